@@ -38,6 +38,9 @@ THE SOFTWARE.
 #include <netinet/in.h>
 #include <net/if.h>
 #include <arpa/inet.h>
+#ifdef __linux
+#include <sys/epoll.h>
+#endif
 
 #include "babeld.h"
 #include "util.h"
@@ -52,6 +55,7 @@ THE SOFTWARE.
 #include "resend.h"
 #include "config.h"
 #include "local.h"
+#include "snapshot.h"
 
 struct timeval now;
 
@@ -69,6 +73,8 @@ int idle_hello_interval = -1;
 int do_daemonise = 0;
 char *logfile = NULL, *pidfile = "/var/run/babeld.pid";
 
+/* Room for RECEIVE_BATCH packets of receive_buffer_size bytes each. */
+#define RECEIVE_BATCH 16
 unsigned char *receive_buffer = NULL;
 int receive_buffer_size = 0;
 
@@ -86,24 +92,56 @@ int kernel_socket = -1;
 static int kernel_routes_changed = 0;
 static int kernel_link_changed = 0;
 static int kernel_addr_changed = 0;
+static int track_kernel_routes = 0;
 
 struct timeval check_neighbours_timeout;
 
-static volatile sig_atomic_t exiting = 0, dumping = 0, changed = 0;
+static volatile sig_atomic_t exiting = 0, restarting = 0;
+static volatile sig_atomic_t dumping = 0, changed = 0;
+
+int local_server_socket = -1, local_server_port = -1;
+int local_binary_server_socket = -1, local_binary_server_port = -1;
+
+/* The handful of sockets that the main loop waits on.  With epoll, the
+   kernel is only told about changes to this set. */
+#ifndef NO_LOCAL_INTERFACE
+#define MAX_WATCHED (4 + MAX_LOCAL_CLIENTS)
+#else
+#define MAX_WATCHED 2
+#endif
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
 
-int local_server_socket = -1, local_socket = -1;
-int local_server_port = -1;
+struct watched_socket {
+    int fd;
+    int events;
+};
+
+static struct watched_socket watched[MAX_WATCHED], ready[MAX_WATCHED];
+static int numwatched = 0, numready = 0;
+#ifdef __linux
+static int epoll_fd = -1;
+#endif
 
 static int kernel_routes_callback(int changed, void *closure);
 static void init_signals(void);
 static void dump_tables(FILE *out);
 static int reopen_logfile(void);
+static int setup_events(void);
+static void watch_sockets(const struct watched_socket *fds, int n);
+static void forget_socket(int fd);
+static int wait_for_sockets(struct timeval *tv);
+static int socket_ready(int fd, int events);
+#ifndef NO_LOCAL_INTERFACE
+static void local_accept_client(int s, int binary);
+static void local_close_client(struct local_client *client);
+#endif
 
 int
 main(int argc, char **argv)
 {
-    struct sockaddr_in6 sin6;
-    int rc, fd, i, opt;
+    int rc, fd, i, opt, warm;
     time_t expiry_time, source_expiry_time, kernel_dump_time;
     char *config_file = NULL;
     void *vrc;
@@ -125,7 +163,7 @@ main(int argc, char **argv)
     protocol_port = 6697;
 
     while(1) {
-        opt = getopt(argc, argv, "m:p:h:H:i:k:A:PsS:d:g:lwt:T:c:C:DL:I:");
+        opt = getopt(argc, argv, "m:p:h:H:i:k:A:PsS:d:g:G:lwt:T:c:C:DL:I:K");
         if(opt < 0)
             break;
 
@@ -191,6 +229,13 @@ main(int argc, char **argv)
             fprintf(stderr, "Warning: no local interface in this version.\n");
 #else
             local_server_port = atoi(optarg);
+#endif
+            break;
+        case 'G':
+#ifdef NO_LOCAL_INTERFACE
+            fprintf(stderr, "Warning: no local interface in this version.\n");
+#else
+            local_binary_server_port = atoi(optarg);
 #endif
             break;
         case 'l':
@@ -229,6 +274,9 @@ main(int argc, char **argv)
         case 'I':
             pidfile = optarg;
             break;
+        case 'K':
+            track_kernel_routes = 1;
+            break;
         default:
             goto usage;
         }
@@ -415,11 +463,16 @@ main(int argc, char **argv)
         char buf2[100];
         int s;
         long t;
-        rc = read(fd, buf, 99);
-        if(rc < 0) {
-            perror("read(babel-state)");
+        FILE *state = fdopen(fd, "r");
+        if(state == NULL) {
+            perror("fdopen(babel-state)");
+            close(fd);
+        } else if(fgets(buf, 100, state) == NULL) {
+            if(ferror(state))
+                perror("read(babel-state)");
+            fclose(state);
         } else {
-            buf[rc] = '\0';
+            int loaded = 0;
             rc = sscanf(buf, "%99s %d %ld\n", buf2, &s, &t);
             if(rc == 3 && s >= 0 && s <= 0xFFFF) {
                 unsigned char sid[8];
@@ -438,12 +491,21 @@ main(int argc, char **argv)
                     /* Convert realtime into monotonic time. */
                     if(t >= 1176800000L && t <= realnow.tv_sec)
                         reboot_time = now.tv_sec - (realnow.tv_sec - t);
+                    /* Anything older than this has been forgotten
+                       by our neighbours. */
+                    if(memcmp(sid, myid, 8) == 0 &&
+                       t >= 1176800000L && t <= realnow.tv_sec &&
+                       realnow.tv_sec - t < SOURCE_GC_TIME) {
+                        load_snapshot(state, realnow.tv_sec - t);
+                        loaded = 1;
+                    }
                 }
             } else {
                 fprintf(stderr, "Couldn't parse babel-state.\n");
             }
+            if(!loaded)
+                fclose(state);
         }
-        close(fd);
         fd = -1;
     }
 
@@ -453,6 +515,12 @@ main(int argc, char **argv)
         goto fail;
     }
 
+    rc = setup_events();
+    if(rc < 0) {
+        perror("Couldn't set up event loop");
+        goto fail;
+    }
+
 #ifndef NO_LOCAL_INTERFACE
     if(local_server_port >= 0) {
         local_server_socket = tcp_server_socket(local_server_port, 1);
@@ -461,6 +529,14 @@ main(int argc, char **argv)
             goto fail;
         }
     }
+    if(local_binary_server_port >= 0) {
+        local_binary_server_socket =
+            tcp_server_socket(local_binary_server_port, 1);
+        if(local_binary_server_socket < 0) {
+            perror("local_binary_server_socket");
+            goto fail;
+        }
+    }
 #endif
 
     init_signals();
@@ -471,9 +547,24 @@ main(int argc, char **argv)
     if(receive_buffer == NULL)
         goto fail;
 
-    rc = check_xroutes(0);
+    if(track_kernel_routes) {
+        rc = kernel_track_routes(apply_kernel_change);
+        if(rc < 0) {
+            perror("Warning: couldn't track kernel routes");
+            track_kernel_routes = 0;
+        }
+    }
+
+    /* If the previous instance left its routes in the kernel, our
+       neighbours haven't heard that they're gone; tell them about any
+       exported routes that disappeared in the meantime. */
+    warm = restore_snapshot();
+    rc = check_xroutes(warm);
     if(rc < 0)
         fprintf(stderr, "Warning: couldn't check exported routes.\n");
+    /* After a cold start, this flushes whatever an instance that exited
+       on SIGQUIT left behind, since we have no routes to match it. */
+    adopt_kernel_routes();
     kernel_routes_changed = 0;
     kernel_link_changed = 0;
     kernel_addr_changed = 0;
@@ -483,7 +574,8 @@ main(int argc, char **argv)
     source_expiry_time = now.tv_sec + roughly(300);
 
     /* Make some noise so that others notice us, and send retractions in
-       case we were restarted recently */
+       case we were restarted recently.  After a warm restart, the routes
+       that we announced are still valid, so we just announce them again. */
     FOR_ALL_NETS(net) {
         if(!net_up(net))
             continue;
@@ -491,7 +583,8 @@ main(int argc, char **argv)
         usleep(roughly(10000));
         gettime(&now);
         send_hello(net);
-        send_wildcard_retraction(net);
+        if(!warm)
+            send_wildcard_retraction(net);
     }
 
     FOR_ALL_NETS(net) {
@@ -500,8 +593,12 @@ main(int argc, char **argv)
         usleep(roughly(10000));
         gettime(&now);
         send_hello(net);
-        send_wildcard_retraction(net);
-        send_self_update(net);
+        if(warm) {
+            send_update(net, 0, NULL, 0);
+        } else {
+            send_wildcard_retraction(net);
+            send_self_update(net);
+        }
         send_request(net, NULL, 0);
         flushupdates(net);
         flushbuf(net);
@@ -511,52 +608,61 @@ main(int argc, char **argv)
 
     while(1) {
         struct timeval tv;
-        fd_set readfds;
 
         gettime(&now);
 
+        /* The per-network timeouts are kept in a heap, so this doesn't
+           depend on the number of networks. */
         tv = check_neighbours_timeout;
         timeval_min_sec(&tv, expiry_time);
         timeval_min_sec(&tv, source_expiry_time);
-        timeval_min_sec(&tv, kernel_dump_time);
+        if(!track_kernel_routes || kernel_socket < 0)
+            timeval_min_sec(&tv, kernel_dump_time);
         timeval_min(&tv, &resend_time);
-        FOR_ALL_NETS(net) {
-            if(!net_up(net))
-                continue;
-            timeval_min(&tv, &net->flush_timeout);
-            timeval_min(&tv, &net->hello_timeout);
-            timeval_min(&tv, &net->update_timeout);
-            timeval_min(&tv, &net->update_flush_timeout);
-        }
+        net = first_network_timeout();
+        if(net)
+            timeval_min(&tv, &net->timeout);
         timeval_min(&tv, &unicast_flush_timeout);
-        FD_ZERO(&readfds);
+        numready = 0;
         if(timeval_compare(&tv, &now) > 0) {
-            int maxfd = 0;
+            struct watched_socket fds[MAX_WATCHED];
+            int n = 0;
             timeval_minus(&tv, &tv, &now);
-            FD_SET(protocol_socket, &readfds);
-            maxfd = MAX(maxfd, protocol_socket);
-            if(kernel_socket < 0) kernel_setup_socket(1);
+            fds[n].fd = protocol_socket;
+            fds[n++].events = WATCH_READ;
+            if(kernel_socket < 0) {
+                /* The kernel socket may come back with the same number. */
+                watch_sockets(NULL, 0);
+                kernel_setup_socket(1);
+            }
             if(kernel_socket >= 0) {
-                FD_SET(kernel_socket, &readfds);
-                maxfd = MAX(maxfd, kernel_socket);
+                fds[n].fd = kernel_socket;
+                fds[n++].events = WATCH_READ;
             }
 #ifndef NO_LOCAL_INTERFACE
-            if(local_socket >= 0) {
-                FD_SET(local_socket, &readfds);
-                maxfd = MAX(maxfd, local_socket);
-            } else if(local_server_socket >= 0) {
-                FD_SET(local_server_socket, &readfds);
-                maxfd = MAX(maxfd, local_server_socket);
+            if(local_server_socket >= 0) {
+                fds[n].fd = local_server_socket;
+                fds[n++].events = WATCH_READ;
+            }
+            if(local_binary_server_socket >= 0) {
+                fds[n].fd = local_binary_server_socket;
+                fds[n++].events = WATCH_READ;
+            }
+            for(i = 0; i < num_local_clients; i++) {
+                struct local_client *client = &local_clients[i];
+                fds[n].fd = client->fd;
+                fds[n++].events = WATCH_READ |
+                    (client->start < client->buffered ? WATCH_WRITE : 0);
             }
 #endif
-            rc = select(maxfd + 1, &readfds, NULL, NULL, &tv);
+            watch_sockets(fds, n);
+            rc = wait_for_sockets(&tv);
             if(rc < 0) {
                 if(errno != EINTR) {
-                    perror("select");
+                    perror("wait_for_sockets");
                     sleep(1);
                 }
-                rc = 0;
-                FD_ZERO(&readfds);
+                numready = 0;
             }
         }
 
@@ -565,62 +671,72 @@ main(int argc, char **argv)
         if(exiting)
             break;
 
-        if(kernel_socket >= 0 && FD_ISSET(kernel_socket, &readfds))
+        /* Route changes made during this iteration are sent to the
+           kernel together, and acknowledged, before we sleep again. */
+        kernel_start_batch(route_kernel_failure);
+        babel_start_batch();
+
+        if(kernel_socket >= 0 && socket_ready(kernel_socket, WATCH_READ))
             kernel_callback(kernel_routes_callback, NULL);
 
-        if(FD_ISSET(protocol_socket, &readfds)) {
-            rc = babel_recv(protocol_socket,
-                            receive_buffer, receive_buffer_size,
-                            (struct sockaddr*)&sin6, sizeof(sin6));
+        if(socket_ready(protocol_socket, WATCH_READ)) {
+            struct sockaddr_in6 from[RECEIVE_BATCH];
+            int lens[RECEIVE_BATCH];
+            rc = babel_recv_batch(protocol_socket,
+                                  receive_buffer, receive_buffer_size,
+                                  RECEIVE_BATCH, from, lens);
             if(rc < 0) {
                 if(errno != EAGAIN && errno != EINTR) {
                     perror("recv");
                     sleep(1);
                 }
             } else {
-                FOR_ALL_NETS(net) {
-                    if(!net_up(net))
-                        continue;
-                    if(net->ifindex == sin6.sin6_scope_id) {
-                        parse_packet((unsigned char*)&sin6.sin6_addr, net,
-                                     receive_buffer, rc);
-                        VALGRIND_MAKE_MEM_UNDEFINED(receive_buffer,
-                                                    receive_buffer_size);
-                        break;
+                for(i = 0; i < rc; i++) {
+                    unsigned char *packet =
+                        receive_buffer + i * receive_buffer_size;
+                    FOR_ALL_NETS(net) {
+                        if(!net_up(net))
+                            continue;
+                        if(net->ifindex == from[i].sin6_scope_id) {
+                            parse_packet((unsigned char*)&from[i].sin6_addr,
+                                         net, packet, lens[i]);
+                            VALGRIND_MAKE_MEM_UNDEFINED(packet,
+                                                        receive_buffer_size);
+                            break;
+                        }
                     }
                 }
+                update_changed_neighbours();
             }
         }
 
 #ifndef NO_LOCAL_INTERFACE
         if(local_server_socket >= 0 &&
-           FD_ISSET(local_server_socket, &readfds)) {
-            if(local_socket >= 0) {
-                close(local_socket);
-                local_socket = -1;
-            }
-            local_socket = accept(local_server_socket, NULL, NULL);
-            if(local_socket < 0) {
-                if(errno != EINTR && errno != EAGAIN)
-                    perror("accept(local_server_socket)");
-            } else {
-                local_dump();
-            }
-        }
-
-        if(local_socket >= 0 && FD_ISSET(local_socket, &readfds)) {
-            rc = local_read(local_socket);
-            if(rc <= 0) {
-                if(rc < 0)
-                    perror("read(local_socket)");
-                close(local_socket);
-                local_socket = -1;
+           socket_ready(local_server_socket, WATCH_READ))
+            local_accept_client(local_server_socket, 0);
+
+        if(local_binary_server_socket >= 0 &&
+           socket_ready(local_binary_server_socket, WATCH_READ))
+            local_accept_client(local_binary_server_socket, 1);
+
+        i = 0;
+        while(i < num_local_clients) {
+            struct local_client *client = &local_clients[i];
+            if(socket_ready(client->fd, WATCH_READ)) {
+                rc = local_read(client);
+                if(rc <= 0) {
+                    if(rc < 0)
+                        perror("read(local_socket)");
+                    local_close_client(client);
+                    continue;
+                }
             }
+            i++;
         }
 #endif
 
         if(changed) {
-            kernel_dump_time = now.tv_sec;
+            kernel_routes_changed = 1;
             check_neighbours_timeout = now;
             expiry_time = now.tv_sec;
             rc = reopen_logfile();
@@ -634,10 +750,16 @@ main(int argc, char **argv)
         if(kernel_link_changed || kernel_addr_changed) {
             check_networks();
             kernel_link_changed = 0;
+            if(track_kernel_routes)
+                /* Already applied by apply_kernel_change. */
+                kernel_addr_changed = 0;
         }
 
+        /* When tracking kernel routes, we only need a full dump if we
+           lost track of the kernel's state. */
         if(kernel_routes_changed || kernel_addr_changed ||
-           now.tv_sec >= kernel_dump_time) {
+           ((!track_kernel_routes || kernel_socket < 0) &&
+            now.tv_sec >= kernel_dump_time)) {
             rc = check_xroutes(1);
             if(rc < 0)
                 fprintf(stderr, "Warning: couldn't check exported routes.\n");
@@ -667,15 +789,22 @@ main(int argc, char **argv)
             source_expiry_time = now.tv_sec + roughly(300);
         }
 
-        FOR_ALL_NETS(net) {
-            if(!net_up(net))
-                continue;
+        while((net = first_network_timeout()) != NULL &&
+              timeval_compare(&now, &net->timeout) >= 0) {
             if(timeval_compare(&now, &net->hello_timeout) >= 0)
                 send_hello(net);
             if(timeval_compare(&now, &net->update_timeout) >= 0)
                 send_update(net, 0, NULL, 0);
             if(timeval_compare(&now, &net->update_flush_timeout) >= 0)
                 flushupdates(net);
+            if(net->flush_timeout.tv_sec != 0 &&
+               timeval_compare(&now, &net->flush_timeout) >= 0)
+                flushbuf(net);
+            reschedule_network(net);
+            /* This shouldn't happen, but avoid spinning if it does. */
+            if(net->heap_index >= 0 &&
+               timeval_compare(&now, &net->timeout) >= 0)
+                break;
         }
 
         if(resend_time.tv_sec != 0) {
@@ -688,14 +817,25 @@ main(int argc, char **argv)
                 flush_unicast(1);
         }
 
-        FOR_ALL_NETS(net) {
-            if(!net_up(net))
-                continue;
-            if(net->flush_timeout.tv_sec != 0) {
-                if(timeval_compare(&now, &net->flush_timeout) >= 0)
-                    flushbuf(net);
+        babel_end_batch();
+        kernel_end_batch();
+
+#ifndef NO_LOCAL_INTERFACE
+        /* Send whatever we queued for the local clients, without ever
+           blocking on them. */
+        i = 0;
+        while(i < num_local_clients) {
+            struct local_client *client = &local_clients[i];
+            if(client->closing || client->start < client->buffered) {
+                rc = local_flush(client);
+                if(rc < 0) {
+                    local_close_client(client);
+                    continue;
+                }
             }
+            i++;
         }
+#endif
 
         if(UNLIKELY(debug || dumping)) {
             dump_tables(stdout);
@@ -703,16 +843,33 @@ main(int argc, char **argv)
         }
     }
 
+    /* In case we broke out of the loop with a batch still open. */
+    babel_end_batch();
+    kernel_end_batch();
+
     debugf("Exiting...\n");
     usleep(roughly(10000));
     gettime(&now);
 
+    if(restarting) {
+        /* Leave our routes in the kernel, and ask our neighbours to bear
+           with us while the next instance starts up. */
+        FOR_ALL_NETS(net) {
+            if(!net_up(net))
+                continue;
+            send_hello_noupdate(net, WARM_RESTART_TIME * 100);
+            flushbuf(net);
+        }
+        kernel_setup_socket(0);
+        goto save_state;
+    }
+
     /* Uninstall and flush all routes. */
     while(numroutes > 0) {
-        if(routes[0].installed)
-            uninstall_route(&routes[0]);
+        if(routes[0]->installed)
+            uninstall_route(routes[0]);
         /* We need to flush the route so network_up won't reinstall it */
-        flush_route(&routes[0]);
+        flush_route(routes[0]);
     }
 
     FOR_ALL_NETS(net) {
@@ -740,29 +897,34 @@ main(int argc, char **argv)
     kernel_setup_socket(0);
     kernel_setup(0);
 
+ save_state:
     fd = open(state_file, O_WRONLY | O_TRUNC | O_CREAT, 0644);
     if(fd < 0) {
         perror("creat(babel-state)");
         unlink(state_file);
     } else {
         struct timeval realnow;
-        char buf[100];
+        FILE *state = fdopen(fd, "w");
         gettimeofday(&realnow, NULL);
-        rc = snprintf(buf, 100, "%s %d %ld\n",
-                      format_eui64(myid), (int)myseqno,
-                      (long)realnow.tv_sec);
-        if(rc < 0 || rc >= 100) {
-            fprintf(stderr, "write(babel-state): overflow.\n");
+        if(state == NULL) {
+            perror("fdopen(babel-state)");
+            close(fd);
             unlink(state_file);
         } else {
-            rc = write(fd, buf, rc);
+            rc = fprintf(state, "%s %d %ld\n",
+                         format_eui64(myid), (int)myseqno,
+                         (long)realnow.tv_sec);
+            if(rc >= 0)
+                rc = save_snapshot(state, restarting);
+            if(rc >= 0)
+                rc = fflush(state);
             if(rc < 0) {
                 perror("write(babel-state)");
                 unlink(state_file);
             }
             fsync(fd);
+            fclose(state);
         }
-        close(fd);
     }
     if(pidfile)
         unlink(pidfile);
@@ -776,11 +938,13 @@ main(int argc, char **argv)
             "                "
             "[-h hello] [-H wired_hello] [-i idle_hello]\n"
             "                "
-            "[-k metric] [-A metric] [-s] [-P] [-l] [-w] [-d level] [-g port]\n"
+            "[-k metric] [-A metric] [-s] [-P] [-l] [-w] [-d level]\n"
+            "                "
+            "[-g port] [-G port]\n"
             "                "
             "[-t table] [-T table] [-c file] [-C statement]\n"
             "                "
-            "[-D] [-L logfile] [-I pidfile]\n"
+            "[-D] [-L logfile] [-I pidfile] [-K]\n"
             "                "
             "[id] interface...\n",
             argv[0]);
@@ -820,7 +984,7 @@ resize_receive_buffer(int size)
         return 0;
 
     if(receive_buffer == NULL) {
-        receive_buffer = malloc(size);
+        receive_buffer = malloc(size * RECEIVE_BATCH);
         if(receive_buffer == NULL) {
             perror("malloc(receive_buffer)");
             return -1;
@@ -828,7 +992,7 @@ resize_receive_buffer(int size)
         receive_buffer_size = size;
     } else {
         unsigned char *new;
-        new = realloc(receive_buffer, size);
+        new = realloc(receive_buffer, size * RECEIVE_BATCH);
         if(new == NULL) {
             perror("realloc(receive_buffer)");
             return -1;
@@ -845,6 +1009,13 @@ sigexit(int signo)
     exiting = 1;
 }
 
+static void
+sigrestart(int signo)
+{
+    restarting = 1;
+    exiting = 1;
+}
+
 static void
 sigdump(int signo)
 {
@@ -881,6 +1052,12 @@ init_signals(void)
     sa.sa_flags = 0;
     sigaction(SIGINT, &sa, NULL);
 
+    sigemptyset(&ss);
+    sa.sa_handler = sigrestart;
+    sa.sa_mask = ss;
+    sa.sa_flags = 0;
+    sigaction(SIGQUIT, &sa, NULL);
+
     sigemptyset(&ss);
     sa.sa_handler = SIG_IGN;
     sa.sa_mask = ss;
@@ -929,26 +1106,26 @@ dump_tables(FILE *out)
     }
     for(i = 0; i < numxroutes; i++) {
         fprintf(out, "%s metric %d (exported)\n",
-                format_prefix(xroutes[i].prefix, xroutes[i].plen),
-                xroutes[i].metric);
+                format_prefix(xroutes[i]->prefix, xroutes[i]->plen),
+                xroutes[i]->metric);
     }
     for(i = 0; i < numroutes; i++) {
         const unsigned char *nexthop =
-            memcmp(routes[i].nexthop, routes[i].neigh->address, 16) == 0 ?
-            NULL : routes[i].nexthop;
+            memcmp(routes[i]->nexthop, routes[i]->neigh->address, 16) == 0 ?
+            NULL : routes[i]->nexthop;
         fprintf(out, "%s metric %d refmetric %d id %s seqno %d age %d "
                 "via %s neigh %s%s%s%s\n",
-                format_prefix(routes[i].src->prefix, routes[i].src->plen),
-                route_metric(&routes[i]), routes[i].refmetric,
-                format_eui64(routes[i].src->id),
-                (int)routes[i].seqno,
-                (int)(now.tv_sec - routes[i].time),
-                routes[i].neigh->network->ifname,
-                format_address(routes[i].neigh->address),
+                format_prefix(routes[i]->src->prefix, routes[i]->src->plen),
+                route_metric(routes[i]), routes[i]->refmetric,
+                format_eui64(routes[i]->src->id),
+                (int)routes[i]->seqno,
+                (int)(now.tv_sec - routes[i]->time),
+                routes[i]->neigh->network->ifname,
+                format_address(routes[i]->neigh->address),
                 nexthop ? " nexthop " : "",
                 nexthop ? format_address(nexthop) : "",
-                routes[i].installed ? " (installed)" :
-                route_feasible(&routes[i]) ? " (feasible)" : "");
+                routes[i]->installed ? " (installed)" :
+                route_feasible(routes[i]) ? " (feasible)" : "");
     }
     fflush(out);
 }
@@ -982,6 +1159,186 @@ reopen_logfile()
     return 1;
 }
 
+static int
+setup_events()
+{
+#ifdef __linux
+    epoll_fd = epoll_create(MAX_WATCHED);
+    if(epoll_fd < 0)
+        return -1;
+    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+#endif
+    return 1;
+}
+
+static int
+find_watched(int fd)
+{
+    int i;
+    for(i = 0; i < numwatched; i++)
+        if(watched[i].fd == fd)
+            return i;
+    return -1;
+}
+
+#ifdef __linux
+static int
+watch_epoll(int op, int fd, int events)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = ((events & WATCH_READ) ? EPOLLIN : 0) |
+        ((events & WATCH_WRITE) ? EPOLLOUT : 0);
+    event.data.fd = fd;
+    return epoll_ctl(epoll_fd, op, fd, &event);
+}
+#endif
+
+/* Make the set of watched sockets equal to fds. */
+
+static void
+watch_sockets(const struct watched_socket *fds, int n)
+{
+    int i, j;
+
+    i = 0;
+    while(i < numwatched) {
+        for(j = 0; j < n; j++)
+            if(fds[j].fd == watched[i].fd)
+                break;
+        if(j < n)
+            i++;
+        else
+            forget_socket(watched[i].fd);
+    }
+
+    for(j = 0; j < n; j++) {
+        i = find_watched(fds[j].fd);
+        if(i >= 0) {
+            if(watched[i].events == fds[j].events)
+                continue;
+#ifdef __linux
+            if(watch_epoll(EPOLL_CTL_MOD, fds[j].fd, fds[j].events) < 0) {
+                perror("epoll_ctl(MOD)");
+                continue;
+            }
+#endif
+            watched[i].events = fds[j].events;
+            continue;
+        }
+        if(numwatched >= MAX_WATCHED)
+            break;
+#ifdef __linux
+        if(watch_epoll(EPOLL_CTL_ADD, fds[j].fd, fds[j].events) < 0 &&
+           errno != EEXIST) {
+            perror("epoll_ctl(ADD)");
+            continue;
+        }
+#endif
+        watched[numwatched++] = fds[j];
+    }
+}
+
+/* Must be called before closing a watched socket, since its number
+   may be reused. */
+
+static void
+forget_socket(int fd)
+{
+    int i = find_watched(fd);
+
+    if(i < 0)
+        return;
+
+#ifdef __linux
+    /* This fails harmlessly if fd has already been closed. */
+    watch_epoll(EPOLL_CTL_DEL, fd, 0);
+#endif
+    watched[i] = watched[--numwatched];
+}
+
+static int
+wait_for_sockets(struct timeval *tv)
+{
+    int rc, i;
+#ifdef __linux
+    struct epoll_event events[MAX_WATCHED];
+    int msecs = tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+
+    numready = 0;
+    rc = epoll_wait(epoll_fd, events, MAX_WATCHED, msecs);
+    if(rc < 0)
+        return -1;
+    for(i = 0; i < rc; i++) {
+        ready[numready].fd = events[i].data.fd;
+        /* Report errors and hangups to the readers and the writers. */
+        ready[numready++].events =
+            ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) ?
+             WATCH_READ : 0) |
+            ((events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) ?
+             WATCH_WRITE : 0);
+    }
+#else
+    fd_set readfds, writefds;
+    int maxfd = 0;
+
+    numready = 0;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    for(i = 0; i < numwatched; i++) {
+        if(watched[i].events & WATCH_READ)
+            FD_SET(watched[i].fd, &readfds);
+        if(watched[i].events & WATCH_WRITE)
+            FD_SET(watched[i].fd, &writefds);
+        maxfd = MAX(maxfd, watched[i].fd);
+    }
+    rc = select(maxfd + 1, &readfds, &writefds, NULL, tv);
+    if(rc < 0)
+        return -1;
+    for(i = 0; i < numwatched; i++) {
+        int events =
+            (FD_ISSET(watched[i].fd, &readfds) ? WATCH_READ : 0) |
+            (FD_ISSET(watched[i].fd, &writefds) ? WATCH_WRITE : 0);
+        if(events) {
+            ready[numready].fd = watched[i].fd;
+            ready[numready++].events = events;
+        }
+    }
+#endif
+    return numready;
+}
+
+static int
+socket_ready(int fd, int events)
+{
+    int i;
+    for(i = 0; i < numready; i++)
+        if(ready[i].fd == fd)
+            return !!(ready[i].events & events);
+    return 0;
+}
+
+#ifndef NO_LOCAL_INTERFACE
+static void
+local_accept_client(int s, int binary)
+{
+    struct local_client *client;
+
+    client = local_accept(s, binary);
+    if(client == NULL) {
+        if(errno != EINTR && errno != EAGAIN)
+            perror("accept(local_server_socket)");
+    }
+}
+
+static void
+local_close_client(struct local_client *client)
+{
+    forget_socket(client->fd);
+    local_close(client);
+}
+#endif
+
 static int
 kernel_routes_callback(int changed, void *closure)
 {
@@ -991,5 +1348,11 @@ kernel_routes_callback(int changed, void *closure)
         kernel_addr_changed = 1;
     if (changed & CHANGE_ROUTE)
         kernel_routes_changed = 1;
+    if (changed & CHANGE_OVERRUN) {
+        kernel_routes_changed = kernel_link_changed = 1;
+        /* The kernel socket may have been reopened under the same
+           number, so make sure it gets registered again. */
+        forget_socket(kernel_socket);
+    }
     return 1;
 }
@@ -87,7 +87,6 @@ extern int wireless_hello_interval, wired_hello_interval, idle_hello_interval;
 extern int idle_time;
 extern int link_detect;
 extern int all_wireless;
-extern int local_socket;
 
 extern unsigned char myid[8];
 
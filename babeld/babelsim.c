@@ -0,0 +1,1257 @@
+/*
+Copyright (c) 2026 by the Byzantium Project
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* babelsim runs a mesh of babeld.sim instances over simulated links, in
+   simulated time, and reports how long the mesh takes to converge after
+   each scripted event, how many packets it sends, and how much CPU the
+   instances use.  Every instance is a separate process, since babeld keeps
+   its state in globals, but they only run when babelsim lets them, so that
+   a run is reproducible.  See sim.h for the protocol.
+
+   A scenario is a list of lines:
+
+       seed N                  seed for babeld's jitter and for packet loss
+       hello MSECS             hello interval of every instance
+       prefixes N              extra /64 prefixes redistributed by each node
+       args ARGS...            extra arguments for every instance
+       nodes N                 number of nodes (numbered from 0)
+       link A B [OPTIONS]      a point-to-point link
+       lan A B C... [OPTIONS]  a shared link
+       line N [OPTIONS]        N nodes in a line
+       ring N [OPTIONS]        N nodes in a ring
+       grid W H [OPTIONS]      W by H nodes in a grid
+       at SECS down A B        bring the link between A and B down
+       at SECS up A B          bring it back up
+       at SECS loss A B P      set the loss rate of the link between A and B
+       end SECS                stop the simulation
+
+   where OPTIONS are "loss P" (a probability), "delay MSECS" and
+   "wireless".  A link with a loss rate of 1 is cut without its ends
+   noticing.  Every node redistributes its own address, 10.X.Y.1.  The mesh
+   is converged when following the routes from any node leads to every
+   address and prefix of the nodes it can reach, and when no node has a
+   route to anything else. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "sim.h"
+
+#define MIN(x, y) ((x) <= (y) ? (x) : (y))
+#define MAX(x, y) ((x) >= (y) ? (x) : (y))
+
+#define KERNEL_INFINITY 0xFFFF
+/* Simulated time starts here, since babeld treats 0 as "never". */
+#define START_TIME 1000000
+
+struct member {
+    int node;
+    int ifindex;
+};
+
+struct segment {
+    struct member *members;
+    int nmembers;
+    int up;
+    double loss;
+    int delay;                  /* microseconds */
+    int wireless;
+};
+
+struct fib_entry {
+    int via;                    /* next hop, -1 if none, -2 if unknown */
+    int ifindex;
+};
+
+struct node {
+    pid_t pid;
+    int fd;
+    int running;
+    int woken;
+    struct timeval deadline;    /* 0 if none */
+    long long cpu, phase_cpu;
+    unsigned int seq;
+    int numinterfaces;
+    int segments[SIM_MAX_INTERFACES];
+    struct fib_entry *fib;      /* installed routes, by prefix number */
+};
+
+#define EVENT_ACTION 0
+#define EVENT_LINK 1
+#define EVENT_PACKET 2
+
+struct event {
+    struct timeval time;
+    int kind;
+    int src;                    /* for ordering packets sent at once */
+    unsigned int seq;
+    int node;
+    int ifindex;
+    int up;
+    unsigned char from[16];
+    int len;
+    unsigned char *data;
+};
+
+#define ACTION_DOWN 1
+#define ACTION_UP 2
+#define ACTION_LOSS 3
+
+struct action {
+    struct timeval time;
+    int what;
+    int segment;
+    double loss;
+    char *description;
+};
+
+struct phase {
+    char *description;
+    struct timeval start;
+    struct timeval converged;   /* 0 if not converged */
+    struct timeval last_change;
+    long packets, bytes, deliveries, route_ops;
+    int missing, extra;         /* as of the last check */
+};
+
+static const char *babeld_path = "./babeld.sim";
+static const char *log_directory = NULL;
+static unsigned int seed = 1;
+static int hello_interval = -1;
+static int numprefixes = 0;
+static char *extra_args[64];
+static int num_extra_args = 0;
+static struct timeval end_time = {START_TIME + 60, 0};
+
+static struct node *nodes = NULL;
+static int numnodes = 0;
+static struct segment *segments = NULL;
+static int numsegments = 0;
+static struct action *actions = NULL;
+static int numactions = 0;
+static unsigned char *reach = NULL;
+static int prefixes_per_node;
+
+static struct event *events = NULL;
+static int numevents = 0, maxevents = 0;
+
+static struct timeval now = {START_TIME, 0};
+static struct phase phase;
+
+/* Convergence is only rechecked for the prefixes whose routes changed. */
+static int routes_dirty = 0;
+static unsigned char *prefix_dirty = NULL;
+static int *prefix_bad = NULL, *prefix_stale = NULL;
+static int total_bad = 0, total_stale = 0;
+
+static void
+fatal(const char *fmt, ...)
+{
+    va_list args;
+    int i;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    for(i = 0; i < numnodes; i++)
+        if(nodes[i].pid > 0)
+            kill(nodes[i].pid, SIGKILL);
+    exit(1);
+}
+
+static void *
+xrealloc(void *p, size_t size)
+{
+    p = realloc(p, size);
+    if(p == NULL && size > 0)
+        fatal("Out of memory.");
+    return p;
+}
+
+static void
+timeval_add_usec(struct timeval *d, const struct timeval *s, long long usecs)
+{
+    long long t = s->tv_usec + usecs;
+    d->tv_sec = s->tv_sec + t / 1000000;
+    d->tv_usec = t % 1000000;
+}
+
+static int
+timeval_compare(const struct timeval *s1, const struct timeval *s2)
+{
+    if(s1->tv_sec < s2->tv_sec)
+        return -1;
+    else if(s1->tv_sec > s2->tv_sec)
+        return 1;
+    else if(s1->tv_usec < s2->tv_usec)
+        return -1;
+    else if(s1->tv_usec > s2->tv_usec)
+        return 1;
+    else
+        return 0;
+}
+
+static double
+seconds_since(const struct timeval *t, const struct timeval *base)
+{
+    return (t->tv_sec - base->tv_sec) + (t->tv_usec - base->tv_usec) / 1.0E6;
+}
+
+/* A deterministic coin, so that losses don't depend on the order in which
+   we happen to read packets. */
+static double
+coin(int src, unsigned int seq, int dst)
+{
+    unsigned long long x = ((unsigned long long)seed << 40) ^
+        ((unsigned long long)src << 24) ^ ((unsigned long long)seq << 8) ^
+        (unsigned long long)dst * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return (x >> 11) / 9007199254740992.0;
+}
+
+/* Events */
+
+static int
+event_before(const struct event *e1, const struct event *e2)
+{
+    int c = timeval_compare(&e1->time, &e2->time);
+    if(c != 0)
+        return c < 0;
+    if(e1->kind != e2->kind)
+        return e1->kind < e2->kind;
+    if(e1->src != e2->src)
+        return e1->src < e2->src;
+    if(e1->seq != e2->seq)
+        return e1->seq < e2->seq;
+    return e1->node < e2->node;
+}
+
+static void
+push_event(const struct event *event)
+{
+    int i;
+
+    if(numevents >= maxevents) {
+        maxevents = maxevents < 1 ? 256 : 2 * maxevents;
+        events = xrealloc(events, maxevents * sizeof(struct event));
+    }
+
+    i = numevents++;
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if(!event_before(event, &events[parent]))
+            break;
+        events[i] = events[parent];
+        i = parent;
+    }
+    events[i] = *event;
+}
+
+static void
+pop_event(struct event *event)
+{
+    struct event last;
+    int i = 0;
+
+    *event = events[0];
+    last = events[--numevents];
+    while(1) {
+        int child = 2 * i + 1;
+        if(child >= numevents)
+            break;
+        if(child + 1 < numevents &&
+           event_before(&events[child + 1], &events[child]))
+            child++;
+        if(!event_before(&events[child], &last))
+            break;
+        events[i] = events[child];
+        i = child;
+    }
+    if(numevents > 0)
+        events[i] = last;
+}
+
+/* Topology */
+
+static int
+add_segment(const int *members, int n, double loss, int delay, int wireless)
+{
+    struct segment *segment;
+    int i;
+
+    segments = xrealloc(segments, (numsegments + 1) * sizeof(struct segment));
+    segment = &segments[numsegments];
+    segment->members = xrealloc(NULL, n * sizeof(struct member));
+    segment->nmembers = n;
+    segment->up = 1;
+    segment->loss = loss;
+    segment->delay = delay;
+    segment->wireless = wireless;
+
+    for(i = 0; i < n; i++) {
+        struct node *node;
+        if(members[i] < 0 || members[i] >= numnodes)
+            fatal("No such node %d.", members[i]);
+        node = &nodes[members[i]];
+        if(node->numinterfaces >= SIM_MAX_INTERFACES)
+            fatal("Too many interfaces on node %d.", members[i]);
+        node->segments[node->numinterfaces] = numsegments;
+        segment->members[i].node = members[i];
+        segment->members[i].ifindex = ++node->numinterfaces;
+    }
+    return numsegments++;
+}
+
+static void
+set_nodes(int n)
+{
+    int i;
+
+    if(n <= numnodes)
+        return;
+    if(n > 0xFFFF)
+        fatal("Too many nodes.");
+    nodes = xrealloc(nodes, n * sizeof(struct node));
+    for(i = numnodes; i < n; i++) {
+        memset(&nodes[i], 0, sizeof(struct node));
+        nodes[i].fd = -1;
+    }
+    numnodes = n;
+}
+
+static int
+find_segment(int a, int b)
+{
+    int i, j, k;
+
+    for(i = 0; i < numsegments; i++) {
+        int found = 0;
+        for(j = 0; j < segments[i].nmembers; j++) {
+            k = segments[i].members[j].node;
+            if(k == a || k == b)
+                found |= k == a ? 1 : 2;
+        }
+        if(found == 3)
+            return i;
+    }
+    fatal("No link between %d and %d.", a, b);
+    return -1;
+}
+
+static int
+segment_usable(struct segment *segment)
+{
+    return segment->up && segment->loss < 1.0;
+}
+
+static void
+compute_reachability(void)
+{
+    int *queue = xrealloc(NULL, numnodes * sizeof(int));
+    int i, j, k, m;
+
+    reach = xrealloc(reach, (size_t)numnodes * numnodes);
+    memset(reach, 0, (size_t)numnodes * numnodes);
+
+    for(i = 0; i < numnodes; i++) {
+        unsigned char *r = reach + (size_t)i * numnodes;
+        int head = 0, tail = 0;
+        r[i] = 1;
+        queue[tail++] = i;
+        while(head < tail) {
+            struct node *node = &nodes[queue[head++]];
+            for(j = 0; j < node->numinterfaces; j++) {
+                struct segment *segment = &segments[node->segments[j]];
+                if(!segment_usable(segment))
+                    continue;
+                for(k = 0; k < segment->nmembers; k++) {
+                    m = segment->members[k].node;
+                    if(!r[m]) {
+                        r[m] = 1;
+                        queue[tail++] = m;
+                    }
+                }
+            }
+        }
+    }
+    free(queue);
+    if(prefix_dirty)
+        memset(prefix_dirty, 1, numnodes * prefixes_per_node);
+    routes_dirty = 1;
+}
+
+/* Which prefix, if any, of which node is this? */
+
+static int
+prefix_number(const unsigned char *prefix, int plen)
+{
+    unsigned char p[16];
+    int node, i;
+
+    if(plen == 128 && prefix[12] == 10) {
+        node = (prefix[13] << 8) | prefix[14];
+        if(node >= numnodes)
+            return -1;
+        sim_node_address(p, node);
+        if(memcmp(p, prefix, 16) != 0)
+            return -1;
+        return node * prefixes_per_node;
+    } else if(plen == 64) {
+        node = (prefix[4] << 8) | prefix[5];
+        i = (prefix[6] << 8) | prefix[7];
+        if(node >= numnodes || i >= numprefixes)
+            return -1;
+        sim_node_prefix(p, node, i);
+        if(memcmp(p, prefix, 16) != 0)
+            return -1;
+        return node * prefixes_per_node + 1 + i;
+    }
+    return -1;
+}
+
+/* Phases */
+
+static void
+start_phase(const char *description)
+{
+    int i;
+
+    memset(&phase, 0, sizeof(phase));
+    phase.description = strdup(description);
+    phase.start = now;
+    for(i = 0; i < numnodes; i++)
+        nodes[i].phase_cpu = nodes[i].cpu;
+    routes_dirty = 1;
+}
+
+static void
+end_phase(void)
+{
+    double elapsed = seconds_since(&now, &phase.start);
+    long long cpu = 0;
+    char converged[40];
+    int i;
+
+    for(i = 0; i < numnodes; i++)
+        cpu += nodes[i].cpu - nodes[i].phase_cpu;
+
+    if(phase.converged.tv_sec > 0)
+        snprintf(converged, 40, "converged %.3fs",
+                 seconds_since(&phase.converged, &phase.start));
+    else
+        snprintf(converged, 40, "NOT CONVERGED (%d bad, %d stale)",
+                 phase.missing, phase.extra);
+
+    printf("%-24s %s, last change %.3fs\n"
+           "%24s %ld packets (%.1f/s), %ld bytes, %ld deliveries\n"
+           "%24s %ld route operations, CPU %.3fs (%.1fus per operation)\n",
+           phase.description, converged,
+           phase.last_change.tv_sec > 0 ?
+           seconds_since(&phase.last_change, &phase.start) : 0.0,
+           "", phase.packets, elapsed > 0 ? phase.packets / elapsed : 0.0,
+           phase.bytes, phase.deliveries,
+           "", phase.route_ops, cpu / 1.0E9,
+           phase.route_ops > 0 ? cpu / 1.0E3 / phase.route_ops : 0.0);
+    fflush(stdout);
+    free(phase.description);
+}
+
+#define UNKNOWN 0
+#define VISITING 1
+#define GOOD 2
+#define BAD 3
+
+/* Does following the routes to prefix p from node n lead to its owner? */
+
+static int
+route_good(int p, int n, unsigned char *state, int *path)
+{
+    int len = 0, i, result;
+
+    while(state[n] == UNKNOWN) {
+        struct fib_entry *entry = &nodes[n].fib[p];
+        struct segment *segment;
+        int next = entry->via;
+
+        state[n] = VISITING;
+        path[len++] = n;
+        if(next < 0) {
+            n = -1;
+            break;
+        }
+        segment = &segments[nodes[n].segments[entry->ifindex - 1]];
+        if(!segment_usable(segment)) {
+            n = -1;
+            break;
+        }
+        for(i = 0; i < segment->nmembers; i++)
+            if(segment->members[i].node == next)
+                break;
+        if(i >= segment->nmembers) {
+            n = -1;
+            break;
+        }
+        n = next;
+    }
+
+    /* A route loop ends on a node that is still being visited. */
+    result = n >= 0 && state[n] == GOOD ? GOOD : BAD;
+    for(i = 0; i < len; i++)
+        state[path[i]] = result;
+    return result;
+}
+
+static void
+check_prefix(int p, unsigned char *state, int *path)
+{
+    int owner = p / prefixes_per_node, n;
+
+    total_bad -= prefix_bad[p];
+    total_stale -= prefix_stale[p];
+    prefix_bad[p] = prefix_stale[p] = 0;
+
+    memset(state, UNKNOWN, numnodes);
+    state[owner] = GOOD;
+    for(n = 0; n < numnodes; n++) {
+        if(n == owner)
+            continue;
+        if(reach[(size_t)n * numnodes + owner]) {
+            if(route_good(p, n, state, path) != GOOD)
+                prefix_bad[p]++;
+        } else if(nodes[n].fib[p].via != -1) {
+            prefix_stale[p]++;
+        }
+    }
+
+    total_bad += prefix_bad[p];
+    total_stale += prefix_stale[p];
+    prefix_dirty[p] = 0;
+}
+
+static void
+check_converged(void)
+{
+    unsigned char *state;
+    int *path;
+    int p;
+
+    if(!routes_dirty)
+        return;
+    routes_dirty = 0;
+
+    state = xrealloc(NULL, numnodes);
+    path = xrealloc(NULL, numnodes * sizeof(int));
+    for(p = 0; p < numnodes * prefixes_per_node; p++)
+        if(prefix_dirty[p])
+            check_prefix(p, state, path);
+    free(state);
+    free(path);
+
+    phase.missing = total_bad;
+    phase.extra = total_stale;
+    if(total_bad > 0 || total_stale > 0)
+        phase.converged.tv_sec = phase.converged.tv_usec = 0;
+    else if(phase.converged.tv_sec == 0)
+        phase.converged = now;
+}
+
+/* Talking to the instances */
+
+static void
+start_node(int n)
+{
+    struct node *node = &nodes[n];
+    char *argv[80 + SIM_MAX_INTERFACES];
+    char names[SIM_MAX_INTERFACES][10];
+    char buf[SIM_MAX_INTERFACES + 1], hello[20];
+    int sv[2], argc = 0, i, rc, fd;
+    pid_t pid;
+
+    if(node->numinterfaces == 0)
+        fatal("Node %d has no links.", n);
+
+    rc = socketpair(PF_UNIX, SOCK_SEQPACKET, 0, sv);
+    if(rc < 0)
+        fatal("socketpair: %s", strerror(errno));
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+    pid = fork();
+    if(pid < 0)
+        fatal("fork: %s", strerror(errno));
+
+    if(pid > 0) {
+        close(sv[1]);
+        node->pid = pid;
+        node->fd = sv[0];
+        node->running = 1;
+        return;
+    }
+
+    if(dup2(sv[1], SIM_FD) < 0)
+        _exit(1);
+    if(sv[1] != SIM_FD)
+        close(sv[1]);
+
+    snprintf(buf, sizeof(buf), "%d", n);
+    setenv("BABELSIM_NODE", buf, 1);
+    snprintf(buf, sizeof(buf), "%u", seed);
+    setenv("BABELSIM_SEED", buf, 1);
+    snprintf(buf, sizeof(buf), "%d", numprefixes);
+    setenv("BABELSIM_PREFIXES", buf, 1);
+    for(i = 0; i < node->numinterfaces; i++)
+        buf[i] = segments[node->segments[i]].wireless ? 'w' : '-';
+    buf[i] = '\0';
+    setenv("BABELSIM_INTERFACES", buf, 1);
+
+    if(log_directory) {
+        char filename[1024];
+        snprintf(filename, 1024, "%s/node%d.log", log_directory, n);
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    } else {
+        fd = open("/dev/null", O_WRONLY);
+    }
+    if(fd >= 0) {
+        dup2(fd, 1);
+        dup2(fd, 2);
+        if(fd > 2)
+            close(fd);
+    }
+
+    argv[argc++] = (char*)babeld_path;
+    argv[argc++] = "-I";
+    argv[argc++] = "";
+    argv[argc++] = "-S";
+    argv[argc++] = "";
+    if(hello_interval > 0) {
+        snprintf(hello, 20, "%d.%03d",
+                 hello_interval / 1000, hello_interval % 1000);
+        argv[argc++] = "-h";
+        argv[argc++] = hello;
+        argv[argc++] = "-H";
+        argv[argc++] = hello;
+    }
+    if(numprefixes > 0) {
+        argv[argc++] = "-C";
+        argv[argc++] = "redistribute proto 4";
+    }
+    for(i = 0; i < num_extra_args; i++)
+        argv[argc++] = extra_args[i];
+    for(i = 0; i < node->numinterfaces; i++) {
+        snprintf(names[i], 10, "sim%d", i);
+        argv[argc++] = names[i];
+    }
+    argv[argc] = NULL;
+
+    execv(babeld_path, argv);
+    fprintf(stderr, "exec(%s): %s\n", babeld_path, strerror(errno));
+    _exit(1);
+}
+
+static void
+send_message(struct node *node, struct sim_message *message,
+             const unsigned char *data, int len)
+{
+    unsigned char buf[sizeof(struct sim_message) + 0xFFFF];
+    int rc;
+
+    message->len = len;
+    memcpy(buf, message, sizeof(*message));
+    if(len > 0)
+        memcpy(buf + sizeof(*message), data, len);
+    rc = send(node->fd, buf, sizeof(*message) + len, 0);
+    if(rc < (int)sizeof(*message) + len)
+        fatal("Couldn't talk to node %d.", (int)(node - nodes));
+}
+
+static void
+handle_send(int n, struct sim_message *message, unsigned char *data, int len)
+{
+    struct node *node = &nodes[n];
+    struct segment *segment;
+    struct event event;
+    unsigned char ll[16];
+    int i;
+
+    phase.packets++;
+    phase.bytes += len;
+    node->seq++;
+
+    if(message->ifindex < 1 || message->ifindex > node->numinterfaces)
+        return;
+    segment = &segments[node->segments[message->ifindex - 1]];
+    if(!segment->up)
+        return;
+
+    memset(&event, 0, sizeof(event));
+    event.kind = EVENT_PACKET;
+    event.src = n;
+    event.seq = node->seq;
+    timeval_add_usec(&event.time, &now, segment->delay);
+    sim_ll_address(event.from, n, message->ifindex - 1);
+    event.len = len;
+
+    for(i = 0; i < segment->nmembers; i++) {
+        struct member *member = &segment->members[i];
+        if(member->node == n)
+            continue;
+        if(message->addr[0] != 0xFF) {
+            sim_ll_address(ll, member->node, member->ifindex - 1);
+            if(memcmp(ll, message->addr, 16) != 0)
+                continue;
+        }
+        if(segment->loss > 0 &&
+           coin(n, node->seq, member->node) < segment->loss)
+            continue;
+        event.node = member->node;
+        event.ifindex = member->ifindex;
+        event.data = xrealloc(NULL, len);
+        memcpy(event.data, data, len);
+        push_event(&event);
+    }
+}
+
+/* Which node, if any, owns this next hop? */
+
+static int
+gateway_node(const unsigned char *gate)
+{
+    static const unsigned char v4prefix[12] =
+        {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+
+    if(gate[0] == 0xfe && gate[1] == 0x80)
+        return (gate[12] << 8) | gate[13];
+    if(memcmp(gate, v4prefix, 12) == 0 && gate[12] == 100)
+        return ((gate[13] - 64) << 8) | gate[14];
+    return -2;
+}
+
+static void
+handle_route(int n, struct sim_route *route)
+{
+    struct fib_entry *entry;
+    int p;
+
+    phase.route_ops++;
+    phase.last_change = now;
+
+    p = prefix_number(route->prefix, route->plen);
+    if(p < 0)
+        return;
+
+    entry = &nodes[n].fib[p];
+    if(route->add && route->metric < KERNEL_INFINITY &&
+       route->ifindex >= 1 && route->ifindex <= nodes[n].numinterfaces) {
+        entry->via = gateway_node(route->gate);
+        if(entry->via >= numnodes)
+            entry->via = -2;
+        entry->ifindex = route->ifindex;
+    } else if(route->add) {
+        /* An unreachable route. */
+        entry->via = -1;
+    } else if(entry->ifindex == route->ifindex) {
+        entry->via = -1;
+    }
+    prefix_dirty[p] = 1;
+    routes_dirty = 1;
+}
+
+/* Read from the running instances until they are all waiting. */
+
+static void
+collect(void)
+{
+    struct pollfd *fds = xrealloc(NULL, numnodes * sizeof(struct pollfd));
+    unsigned char buf[sizeof(struct sim_message) + 0xFFFF];
+    int *which = xrealloc(NULL, numnodes * sizeof(int));
+    int i, n, rc;
+
+    while(1) {
+        n = 0;
+        for(i = 0; i < numnodes; i++) {
+            if(nodes[i].running) {
+                fds[n].fd = nodes[i].fd;
+                fds[n].events = POLLIN;
+                which[n++] = i;
+            }
+        }
+        if(n == 0)
+            break;
+
+        rc = poll(fds, n, -1);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            fatal("poll: %s", strerror(errno));
+        }
+
+        for(i = 0; i < n; i++) {
+            struct node *node = &nodes[which[i]];
+            if(!fds[i].revents)
+                continue;
+            /* Drain it, so that we don't poll once per message. */
+            while(node->running) {
+                rc = recv(node->fd, buf, sizeof(buf), MSG_DONTWAIT);
+                if(rc < 0 && (errno == EAGAIN || errno == EINTR))
+                    break;
+                if(rc <= 0)
+                    fatal("Node %d died.", which[i]);
+                if(buf[0] == SIM_ROUTE) {
+                    struct sim_route route;
+                    if(rc < (int)sizeof(route))
+                        fatal("Truncated message from node %d.", which[i]);
+                    memcpy(&route, buf, sizeof(route));
+                    handle_route(which[i], &route);
+                } else {
+                    struct sim_message message;
+                    if(rc < (int)sizeof(message))
+                        fatal("Truncated message from node %d.", which[i]);
+                    memcpy(&message, buf, sizeof(message));
+                    if(message.type == SIM_SEND) {
+                        handle_send(which[i], &message,
+                                    buf + sizeof(message),
+                                    MIN(message.len,
+                                        rc - (int)sizeof(message)));
+                    } else if(message.type == SIM_WAIT) {
+                        node->running = 0;
+                        node->deadline = message.time;
+                        node->cpu = message.cpu;
+                    }
+                }
+            }
+        }
+    }
+    free(fds);
+    free(which);
+}
+
+static void
+apply_action(struct action *action)
+{
+    struct segment *segment = &segments[action->segment];
+    struct event event;
+    int i, up;
+
+    end_phase();
+    start_phase(action->description);
+
+    switch(action->what) {
+    case ACTION_LOSS:
+        segment->loss = action->loss;
+        compute_reachability();
+        return;
+    case ACTION_DOWN:
+    case ACTION_UP:
+        up = action->what == ACTION_UP;
+        if(segment->up == up)
+            return;
+        segment->up = up;
+        compute_reachability();
+        memset(&event, 0, sizeof(event));
+        event.kind = EVENT_LINK;
+        event.time = now;
+        event.up = up;
+        for(i = 0; i < segment->nmembers; i++) {
+            event.node = segment->members[i].node;
+            event.ifindex = segment->members[i].ifindex;
+            push_event(&event);
+        }
+        return;
+    }
+}
+
+static void
+run(void)
+{
+    struct sim_message message;
+    struct event event;
+    int i, j;
+
+    for(i = 0; i < numactions; i++) {
+        memset(&event, 0, sizeof(event));
+        event.kind = EVENT_ACTION;
+        event.time = actions[i].time;
+        event.seq = i;
+        push_event(&event);
+    }
+
+    for(i = 0; i < numnodes; i++) {
+        int p, count = numnodes * prefixes_per_node;
+        nodes[i].fib = xrealloc(NULL, count * sizeof(struct fib_entry));
+        for(p = 0; p < count; p++) {
+            nodes[i].fib[p].via = -1;
+            nodes[i].fib[p].ifindex = 0;
+        }
+    }
+    prefix_dirty = xrealloc(NULL, numnodes * prefixes_per_node);
+    prefix_bad = xrealloc(NULL, numnodes * prefixes_per_node * sizeof(int));
+    prefix_stale = xrealloc(NULL, numnodes * prefixes_per_node * sizeof(int));
+    memset(prefix_bad, 0, numnodes * prefixes_per_node * sizeof(int));
+    memset(prefix_stale, 0, numnodes * prefixes_per_node * sizeof(int));
+    compute_reachability();
+    start_phase("start");
+
+    for(i = 0; i < numnodes; i++)
+        start_node(i);
+
+    while(1) {
+        struct timeval next = end_time;
+
+        collect();
+        check_converged();
+
+        for(i = 0; i < numnodes; i++) {
+            if(nodes[i].deadline.tv_sec > 0 &&
+               timeval_compare(&nodes[i].deadline, &next) < 0)
+                next = nodes[i].deadline;
+        }
+        if(numevents > 0 && timeval_compare(&events[0].time, &next) < 0)
+            next = events[0].time;
+        if(timeval_compare(&next, &now) > 0)
+            now = next;
+        if(timeval_compare(&now, &end_time) >= 0)
+            break;
+
+        while(numevents > 0 && timeval_compare(&events[0].time, &now) <= 0) {
+            pop_event(&event);
+            memset(&message, 0, sizeof(message));
+            switch(event.kind) {
+            case EVENT_ACTION:
+                apply_action(&actions[event.seq]);
+                break;
+            case EVENT_LINK:
+                message.type = SIM_LINK;
+                message.ifindex = event.ifindex;
+                message.up = event.up;
+                send_message(&nodes[event.node], &message, NULL, 0);
+                nodes[event.node].woken = 1;
+                break;
+            case EVENT_PACKET:
+                if(segments[nodes[event.node].segments[event.ifindex - 1]].up) {
+                    message.type = SIM_PACKET;
+                    message.ifindex = event.ifindex;
+                    memcpy(message.addr, event.from, 16);
+                    send_message(&nodes[event.node], &message,
+                                 event.data, event.len);
+                    nodes[event.node].woken = 1;
+                    phase.deliveries++;
+                }
+                free(event.data);
+                break;
+            }
+        }
+
+        for(j = 0; j < numnodes; j++) {
+            struct node *node = &nodes[j];
+            if(node->woken ||
+               (node->deadline.tv_sec > 0 &&
+                timeval_compare(&node->deadline, &now) <= 0)) {
+                memset(&message, 0, sizeof(message));
+                message.type = SIM_GO;
+                message.time = now;
+                send_message(node, &message, NULL, 0);
+                node->woken = 0;
+                node->running = 1;
+            }
+        }
+    }
+
+    end_phase();
+
+    for(i = 0; i < numnodes; i++) {
+        kill(nodes[i].pid, SIGKILL);
+        waitpid(nodes[i].pid, NULL, 0);
+    }
+}
+
+/* Scenarios */
+
+static int
+tokenise(char *line, char **tokens, int max)
+{
+    int n = 0;
+    char *p = line;
+
+    while(n < max) {
+        while(*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+            p++;
+        if(*p == '\0' || *p == '#')
+            break;
+        if(*p == '"') {
+            tokens[n++] = ++p;
+            while(*p && *p != '"')
+                p++;
+        } else {
+            tokens[n++] = p;
+            while(*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+                p++;
+        }
+        if(*p)
+            *p++ = '\0';
+    }
+    return n;
+}
+
+static double
+parse_number(const char *s, int lineno)
+{
+    char *end;
+    double d = strtod(s, &end);
+    if(*s == '\0' || *end != '\0')
+        fatal("Line %d: bad number %s.", lineno, s);
+    return d;
+}
+
+/* Parse link options starting at tokens[i]; returns the first token that
+   isn't one. */
+static int
+parse_link_options(char **tokens, int i, int n, int lineno,
+                   double *loss, int *delay, int *wireless)
+{
+    *loss = 0;
+    *delay = 1000;
+    *wireless = 0;
+    while(i < n) {
+        if(strcmp(tokens[i], "loss") == 0 && i + 1 < n) {
+            *loss = parse_number(tokens[i + 1], lineno);
+            i += 2;
+        } else if(strcmp(tokens[i], "delay") == 0 && i + 1 < n) {
+            *delay = parse_number(tokens[i + 1], lineno) * 1000;
+            i += 2;
+        } else if(strcmp(tokens[i], "wireless") == 0) {
+            *wireless = 1;
+            i++;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+static void
+parse_scenario(FILE *f)
+{
+    char line[4096], *tokens[256];
+    int lineno = 0, n, i, j, m[256];
+    double loss;
+    int delay, wireless;
+
+    while(fgets(line, sizeof(line), f)) {
+        lineno++;
+        n = tokenise(line, tokens, 256);
+        if(n == 0)
+            continue;
+
+        if(strcmp(tokens[0], "seed") == 0 && n == 2) {
+            seed = parse_number(tokens[1], lineno);
+        } else if(strcmp(tokens[0], "hello") == 0 && n == 2) {
+            hello_interval = parse_number(tokens[1], lineno);
+        } else if(strcmp(tokens[0], "prefixes") == 0 && n == 2) {
+            numprefixes = parse_number(tokens[1], lineno);
+            if(numprefixes < 0 || numprefixes > 0xFFFF)
+                fatal("Line %d: too many prefixes.", lineno);
+        } else if(strcmp(tokens[0], "args") == 0) {
+            for(i = 1; i < n && num_extra_args < 64; i++)
+                extra_args[num_extra_args++] = strdup(tokens[i]);
+        } else if(strcmp(tokens[0], "nodes") == 0 && n == 2) {
+            set_nodes(parse_number(tokens[1], lineno));
+        } else if(strcmp(tokens[0], "link") == 0 && n >= 3) {
+            m[0] = parse_number(tokens[1], lineno);
+            m[1] = parse_number(tokens[2], lineno);
+            i = parse_link_options(tokens, 3, n, lineno,
+                                   &loss, &delay, &wireless);
+            if(i < n)
+                fatal("Line %d: unexpected %s.", lineno, tokens[i]);
+            add_segment(m, 2, loss, delay, wireless);
+        } else if(strcmp(tokens[0], "lan") == 0 && n >= 3) {
+            for(i = 1; i < n; i++) {
+                char *end;
+                m[i - 1] = strtol(tokens[i], &end, 10);
+                if(*end != '\0')
+                    break;
+            }
+            j = i - 1;
+            i = parse_link_options(tokens, i, n, lineno,
+                                   &loss, &delay, &wireless);
+            if(i < n)
+                fatal("Line %d: unexpected %s.", lineno, tokens[i]);
+            add_segment(m, j, loss, delay, wireless);
+        } else if((strcmp(tokens[0], "line") == 0 ||
+                   strcmp(tokens[0], "ring") == 0) && n >= 2) {
+            int count = parse_number(tokens[1], lineno);
+            int base = numnodes;
+            i = parse_link_options(tokens, 2, n, lineno,
+                                   &loss, &delay, &wireless);
+            if(i < n)
+                fatal("Line %d: unexpected %s.", lineno, tokens[i]);
+            set_nodes(base + count);
+            for(i = 0; i + 1 < count; i++) {
+                m[0] = base + i;
+                m[1] = base + i + 1;
+                add_segment(m, 2, loss, delay, wireless);
+            }
+            if(tokens[0][0] == 'r' && count > 2) {
+                m[0] = base + count - 1;
+                m[1] = base;
+                add_segment(m, 2, loss, delay, wireless);
+            }
+        } else if(strcmp(tokens[0], "grid") == 0 && n >= 3) {
+            int w = parse_number(tokens[1], lineno);
+            int h = parse_number(tokens[2], lineno);
+            int base = numnodes, x, y;
+            i = parse_link_options(tokens, 3, n, lineno,
+                                   &loss, &delay, &wireless);
+            if(i < n)
+                fatal("Line %d: unexpected %s.", lineno, tokens[i]);
+            set_nodes(base + w * h);
+            for(y = 0; y < h; y++) {
+                for(x = 0; x < w; x++) {
+                    m[0] = base + y * w + x;
+                    if(x + 1 < w) {
+                        m[1] = m[0] + 1;
+                        add_segment(m, 2, loss, delay, wireless);
+                    }
+                    if(y + 1 < h) {
+                        m[1] = m[0] + w;
+                        add_segment(m, 2, loss, delay, wireless);
+                    }
+                }
+            }
+        } else if(strcmp(tokens[0], "at") == 0 && n >= 5) {
+            struct action *action;
+            double t = parse_number(tokens[1], lineno);
+            char description[100];
+            actions = xrealloc(actions,
+                               (numactions + 1) * sizeof(struct action));
+            action = &actions[numactions];
+            timeval_add_usec(&action->time, &now, t * 1.0E6);
+            if(strcmp(tokens[2], "down") == 0 && n == 5) {
+                action->what = ACTION_DOWN;
+            } else if(strcmp(tokens[2], "up") == 0 && n == 5) {
+                action->what = ACTION_UP;
+            } else if(strcmp(tokens[2], "loss") == 0 && n == 6) {
+                action->what = ACTION_LOSS;
+                action->loss = parse_number(tokens[5], lineno);
+            } else {
+                fatal("Line %d: unknown action %s.", lineno, tokens[2]);
+            }
+            action->segment = find_segment(parse_number(tokens[3], lineno),
+                                           parse_number(tokens[4], lineno));
+            snprintf(description, 100, "%gs %s %s %s%s%s", t,
+                     tokens[2], tokens[3], tokens[4],
+                     n == 6 ? " " : "", n == 6 ? tokens[5] : "");
+            action->description = strdup(description);
+            numactions++;
+        } else if(strcmp(tokens[0], "end") == 0 && n == 2) {
+            timeval_add_usec(&end_time, &now,
+                             parse_number(tokens[1], lineno) * 1.0E6);
+        } else {
+            fatal("Line %d: couldn't parse %s.", lineno, tokens[0]);
+        }
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct rusage usage;
+    FILE *f;
+    int opt, i, numlinks = 0;
+    long long cpu = 0;
+
+    while(1) {
+        opt = getopt(argc, argv, "b:l:");
+        if(opt < 0)
+            break;
+        switch(opt) {
+        case 'b':
+            babeld_path = optarg;
+            break;
+        case 'l':
+            log_directory = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if(optind != argc - 1)
+        goto usage;
+
+    if(strcmp(argv[optind], "-") == 0) {
+        f = stdin;
+    } else {
+        f = fopen(argv[optind], "r");
+        if(f == NULL) {
+            perror(argv[optind]);
+            exit(1);
+        }
+    }
+    parse_scenario(f);
+    if(f != stdin)
+        fclose(f);
+
+    if(numnodes == 0)
+        fatal("No nodes.");
+
+    prefixes_per_node = 1 + numprefixes;
+    for(i = 0; i < numsegments; i++)
+        numlinks += segments[i].nmembers > 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d nodes, %d links, %d prefixes, seed %u\n",
+           numnodes, numlinks, numnodes * prefixes_per_node, seed);
+    fflush(stdout);
+
+    run();
+
+    for(i = 0; i < numnodes; i++)
+        cpu += nodes[i].cpu;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Total babeld CPU %.3fs, simulator CPU %.3fs.\n", cpu / 1.0E9,
+           usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1.0E6);
+    return 0;
+
+ usage:
+    fprintf(stderr, "Syntax: %s [-b babeld.sim] [-l logdir] scenario\n",
+            argv[0]);
+    exit(1);
+}
@@ -21,6 +21,7 @@ THE SOFTWARE.
 */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/time.h>
@@ -36,9 +37,52 @@ THE SOFTWARE.
 #include "network.h"
 #include "config.h"
 
-struct filter *input_filters = NULL;
-struct filter *output_filters = NULL;
-struct filter *redistribute_filters = NULL;
+/* Filters are kept on a list in configuration order, and compiled into a
+   binary trie on their prefix the first time they are used.  Each trie
+   node links the filters anchored at that node in list order, so that
+   finding the first match only requires looking at the filters whose
+   prefix contains the one being filtered.  Verdicts are cached in a small
+   direct-mapped table, which must be flushed whenever anything a filter
+   depends on changes. */
+
+#define FILTER_CACHE_SIZE 1024
+/* Below this, walking the list is cheaper than hashing. */
+#define FILTER_CACHE_MIN 8
+
+#define FILTER_USES_ID 1
+#define FILTER_USES_NEIGH 2
+#define FILTER_USES_IFINDEX 4
+
+struct filter_node {
+    int child[2];               /* 0 if none, the root is never a child */
+    int first;                  /* first filter anchored here, or -1 */
+};
+
+struct filter_verdict {
+    unsigned char valid;
+    unsigned char plen;
+    unsigned char has_id, has_neigh;
+    unsigned char prefix[16];
+    unsigned char id[8];
+    unsigned char neigh[16];
+    unsigned int ifindex;
+    int proto;
+    int result;
+};
+
+struct filter_chain {
+    struct filter *filters;
+    int dirty;
+    int numfilters;
+    int uses;
+    struct filter **index;      /* filters in list order */
+    int *next_at_node;          /* next filter at the same node, or -1 */
+    struct filter_node *nodes;
+    int numnodes, maxnodes;
+    struct filter_verdict *cache;
+};
+
+static struct filter_chain input_filters, output_filters, redistribute_filters;
 struct network_conf *network_confs = NULL;
 
 /* get_next_char callback */
@@ -454,19 +498,20 @@ parse_nconf(gnc_t gnc, void *closure)
 }
 
 static void
-add_filter(struct filter *filter, struct filter **filters)
+add_filter(struct filter *filter, struct filter_chain *chain)
 {
-    if(*filters == NULL) {
+    if(chain->filters == NULL) {
         filter->next = NULL;
-        *filters = filter;
+        chain->filters = filter;
     } else {
         struct filter *f;
-        f = *filters;
+        f = chain->filters;
         while(f->next)
             f = f->next;
         filter->next = NULL;
         f->next = filter;
     }
+    chain->dirty = 1;
 }
 
 static void
@@ -587,27 +632,156 @@ parse_config_from_string(char *string)
 }
 
 static void
-renumber_filter(struct filter *filter)
+flush_filter_cache(struct filter_chain *chain)
+{
+    if(chain->cache)
+        memset(chain->cache, 0,
+               FILTER_CACHE_SIZE * sizeof(struct filter_verdict));
+}
+
+static void
+renumber_filter(struct filter_chain *chain)
 {
+    struct filter *filter = chain->filters;
     while(filter) {
         if(filter->ifname)
             filter->ifindex = if_nametoindex(filter->ifname);
         filter = filter->next;
     }
+    flush_filter_cache(chain);
 }
 
 void
 renumber_filters()
 {
-    renumber_filter(input_filters);
-    renumber_filter(output_filters);
-    renumber_filter(redistribute_filters);
+    renumber_filter(&input_filters);
+    renumber_filter(&output_filters);
+    renumber_filter(&redistribute_filters);
+}
+
+static inline int
+prefix_bit(const unsigned char *prefix, int i)
+{
+    return (prefix[i / 8] >> (7 - i % 8)) & 1;
 }
 
 static int
-filter_match(struct filter *f, const unsigned char *id,
-             const unsigned char *prefix, unsigned short plen,
-             const unsigned char *neigh, unsigned int ifindex, int proto)
+filter_node(struct filter_chain *chain, const unsigned char *prefix, int plen)
+{
+    int i, n = 0;
+
+    for(i = 0; i < plen; i++) {
+        int b = prefix_bit(prefix, i);
+        if(chain->nodes[n].child[b] == 0) {
+            if(chain->numnodes >= chain->maxnodes) {
+                struct filter_node *new_nodes;
+                int max = 2 * chain->maxnodes;
+                new_nodes = realloc(chain->nodes,
+                                    max * sizeof(struct filter_node));
+                if(new_nodes == NULL)
+                    return -1;
+                chain->nodes = new_nodes;
+                chain->maxnodes = max;
+            }
+            chain->nodes[chain->numnodes].child[0] = 0;
+            chain->nodes[chain->numnodes].child[1] = 0;
+            chain->nodes[chain->numnodes].first = -1;
+            chain->nodes[n].child[b] = chain->numnodes++;
+        }
+        n = chain->nodes[n].child[b];
+    }
+    return n;
+}
+
+static int
+compile_filters(struct filter_chain *chain)
+{
+    struct filter *f;
+    int i, n;
+
+    free(chain->index);
+    free(chain->next_at_node);
+    free(chain->nodes);
+    chain->index = NULL;
+    chain->next_at_node = NULL;
+    chain->nodes = NULL;
+    chain->numfilters = 0;
+    chain->numnodes = chain->maxnodes = 0;
+    chain->uses = 0;
+
+    for(f = chain->filters; f; f = f->next)
+        chain->numfilters++;
+
+    if(chain->numfilters == 0)
+        goto done;
+
+    chain->index = malloc(chain->numfilters * sizeof(struct filter*));
+    chain->next_at_node = malloc(chain->numfilters * sizeof(int));
+    chain->maxnodes = 64;
+    chain->nodes = malloc(chain->maxnodes * sizeof(struct filter_node));
+    if(chain->index == NULL || chain->next_at_node == NULL ||
+       chain->nodes == NULL)
+        goto fail;
+
+    chain->nodes[0].child[0] = chain->nodes[0].child[1] = 0;
+    chain->nodes[0].first = -1;
+    chain->numnodes = 1;
+
+    for(i = 0, f = chain->filters; f; i++, f = f->next) {
+        chain->index[i] = f;
+        if(f->id)
+            chain->uses |= FILTER_USES_ID;
+        if(f->neigh)
+            chain->uses |= FILTER_USES_NEIGH;
+        if(f->ifname)
+            chain->uses |= FILTER_USES_IFINDEX;
+
+        n = f->prefix ? filter_node(chain, f->prefix, f->plen) : 0;
+        if(n < 0)
+            goto fail;
+        /* Borrowed to remember the node until everything is inserted. */
+        chain->next_at_node[i] = n;
+    }
+
+    /* Link the filters at their nodes, walking backwards so that each
+       list ends up in list order. */
+    for(i = chain->numfilters - 1; i >= 0; i--) {
+        n = chain->next_at_node[i];
+        chain->next_at_node[i] = chain->nodes[n].first;
+        chain->nodes[n].first = i;
+    }
+
+    if(chain->numfilters >= FILTER_CACHE_MIN && chain->cache == NULL) {
+        chain->cache = calloc(FILTER_CACHE_SIZE,
+                              sizeof(struct filter_verdict));
+        /* We can live without a cache. */
+    }
+
+ done:
+    flush_filter_cache(chain);
+    chain->dirty = 0;
+    return 1;
+
+ fail:
+    perror("compile_filters");
+    free(chain->index);
+    free(chain->next_at_node);
+    free(chain->nodes);
+    chain->index = NULL;
+    chain->next_at_node = NULL;
+    chain->nodes = NULL;
+    chain->numfilters = chain->numnodes = chain->maxnodes = 0;
+    /* do_filter will fall back to walking the list. */
+    chain->dirty = 0;
+    return -1;
+}
+
+/* Everything but the prefix, which the trie has already checked. */
+
+static int
+filter_match_rest(struct filter *f, const unsigned char *id,
+                  const unsigned char *prefix, unsigned short plen,
+                  const unsigned char *neigh, unsigned int ifindex, int proto)
 {
     if(f->af) {
         if(plen >= 96 && v4mapped(prefix)) {
@@ -620,10 +794,6 @@ filter_match(struct filter *f, const unsigned char *id,
         if(!id || memcmp(f->id, id, 8) != 0)
             return 0;
     }
-    if(f->prefix) {
-        if(!prefix || plen < f->plen || !in_prefix(prefix, f->prefix, f->plen))
-            return 0;
-    }
     if(f->plen_ge > 0 || f->plen_le < 128) {
         if(!prefix)
             return 0;
@@ -657,16 +827,118 @@ filter_match(struct filter *f, const unsigned char *id,
 }
 
 static int
-do_filter(struct filter *f, const unsigned char *id,
+filter_match(struct filter *f, const unsigned char *id,
+             const unsigned char *prefix, unsigned short plen,
+             const unsigned char *neigh, unsigned int ifindex, int proto)
+{
+    if(f->prefix) {
+        if(!prefix || plen < f->plen || !in_prefix(prefix, f->prefix, f->plen))
+            return 0;
+    }
+    return filter_match_rest(f, id, prefix, plen, neigh, ifindex, proto);
+}
+
+/* Walk down the trie along prefix, and return the first filter in list
+   order that matches. */
+
+static struct filter *
+trie_filter(struct filter_chain *chain, const unsigned char *id,
+            const unsigned char *prefix, unsigned short plen,
+            const unsigned char *neigh, unsigned int ifindex, int proto)
+{
+    int i = 0, n = 0, best = chain->numfilters;
+
+    while(1) {
+        int j;
+        for(j = chain->nodes[n].first; j >= 0 && j < best;
+            j = chain->next_at_node[j]) {
+            if(filter_match_rest(chain->index[j], id, prefix, plen,
+                                 neigh, ifindex, proto)) {
+                best = j;
+                break;
+            }
+        }
+        if(i >= plen)
+            break;
+        n = chain->nodes[n].child[prefix_bit(prefix, i)];
+        if(n == 0)
+            break;
+        i++;
+    }
+
+    return best < chain->numfilters ? chain->index[best] : NULL;
+}
+
+static struct filter_verdict *
+filter_cache_entry(struct filter_chain *chain, struct filter_verdict *key)
+{
+    unsigned h = hash_bytes(hash_prefix(key->prefix, key->plen),
+                            (unsigned char*)&key->proto, sizeof(int));
+    if(chain->uses & FILTER_USES_ID)
+        h = hash_bytes(h, key->id, 8);
+    if(chain->uses & FILTER_USES_NEIGH)
+        h = hash_bytes(h, key->neigh, 16);
+    if(chain->uses & FILTER_USES_IFINDEX)
+        h = hash_bytes(h, (unsigned char*)&key->ifindex,
+                       sizeof(unsigned int));
+    return &chain->cache[h & (FILTER_CACHE_SIZE - 1)];
+}
+
+static int
+do_filter(struct filter_chain *chain, const unsigned char *id,
           const unsigned char *prefix, unsigned short plen,
           const unsigned char *neigh, unsigned int ifindex, int proto)
 {
-    while(f) {
-        if(filter_match(f, id, prefix, plen, neigh, ifindex, proto))
-            return f->result;
-        f = f->next;
+    struct filter_verdict key, *entry = NULL;
+    struct filter *f;
+
+    if(chain->dirty)
+        compile_filters(chain);
+
+    if(chain->filters == NULL)
+        return -1;
+
+    if(prefix == NULL || plen > 128 || chain->numnodes == 0) {
+        /* Not compiled, or nothing to walk the trie with. */
+        for(f = chain->filters; f; f = f->next) {
+            if(filter_match(f, id, prefix, plen, neigh, ifindex, proto))
+                return f->result;
+        }
+        return -1;
     }
-    return -1;
+
+    if(chain->cache) {
+        /* Only the fields that some filter looks at go into the key. */
+        memset(&key, 0, sizeof(key));
+        key.valid = 1;
+        key.plen = plen;
+        memcpy(key.prefix, prefix, 16);
+        key.proto = proto;
+        if((chain->uses & FILTER_USES_ID) && id) {
+            key.has_id = 1;
+            memcpy(key.id, id, 8);
+        }
+        if((chain->uses & FILTER_USES_NEIGH) && neigh) {
+            key.has_neigh = 1;
+            memcpy(key.neigh, neigh, 16);
+        }
+        if(chain->uses & FILTER_USES_IFINDEX)
+            key.ifindex = ifindex;
+
+        entry = filter_cache_entry(chain, &key);
+        if(entry->valid &&
+           memcmp(entry, &key, offsetof(struct filter_verdict, result)) == 0)
+            return entry->result;
+    }
+
+    f = trie_filter(chain, id, prefix, plen, neigh, ifindex, proto);
+
+    if(entry) {
+        key.result = f ? (int)f->result : -1;
+        memcpy(entry, &key, sizeof(key));
+    }
+
+    return f ? (int)f->result : -1;
 }
 
 int
@@ -675,7 +947,7 @@ input_filter(const unsigned char *id,
              const unsigned char *neigh, unsigned int ifindex)
 {
     int res;
-    res = do_filter(input_filters, id, prefix, plen, neigh, ifindex, 0);
+    res = do_filter(&input_filters, id, prefix, plen, neigh, ifindex, 0);
     if(res < 0)
         res = 0;
     return res;
@@ -686,7 +958,7 @@ output_filter(const unsigned char *id, const unsigned char *prefix,
               unsigned short plen, unsigned int ifindex)
 {
     int res;
-    res = do_filter(output_filters, id, prefix, plen, NULL, ifindex, 0);
+    res = do_filter(&output_filters, id, prefix, plen, NULL, ifindex, 0);
     if(res < 0)
         res = 0;
     return res;
@@ -697,7 +969,7 @@ redistribute_filter(const unsigned char *prefix, unsigned short plen,
                     unsigned int ifindex, int proto)
 {
     int res;
-    res = do_filter(redistribute_filters, NULL, prefix, plen, NULL,
+    res = do_filter(&redistribute_filters, NULL, prefix, plen, NULL,
                     ifindex, proto);
     if(res < 0)
         res = INFINITY;
@@ -715,6 +987,10 @@ finalise_config()
     filter->plen_le = 128;
     add_filter(filter, &redistribute_filters);
 
+    compile_filters(&input_filters);
+    compile_filters(&output_filters);
+    compile_filters(&redistribute_filters);
+
     while(network_confs) {
         struct network_conf *n;
         void *vrc;
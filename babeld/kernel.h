@@ -41,6 +41,7 @@ struct kernel_route {
 #define CHANGE_LINK  (1 << 0)
 #define CHANGE_ROUTE (1 << 1)
 #define CHANGE_ADDR  (1 << 2)
+#define CHANGE_OVERRUN (1 << 3)
 
 extern int export_table, import_table;
 
@@ -57,7 +58,12 @@ int kernel_route(int operation, const unsigned char *dest, unsigned short plen,
                  const unsigned char *newgate, int newifindex,
                  unsigned int newmetric);
 int kernel_routes(struct kernel_route *routes, int maxroutes);
+int kernel_own_routes(struct kernel_route *routes, int maxroutes);
+int kernel_start_batch(void (*fn)(int operation, struct kernel_route *route,
+                                  int error));
+int kernel_end_batch(void);
 int kernel_callback(int (*fn)(int, void*), void *closure);
+int kernel_track_routes(void (*fn)(int add, struct kernel_route *route));
 int kernel_addresses(char *ifname, int ifindex, int ll,
                      struct kernel_route *routes, int maxroutes);
 int if_eui64(char *ifname, int ifindex, unsigned char *eui);
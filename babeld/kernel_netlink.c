@@ -60,6 +60,10 @@ static int old_rp_filter = -1;
 
 static int dgram_socket = -1;
 
+/* If set, route and address changes are passed to this function one at a
+   time rather than being merely flagged as CHANGE_ROUTE or CHANGE_ADDR. */
+static void (*route_change_fn)(int add, struct kernel_route *route) = NULL;
+
 #ifndef ARPHRD_ETHER
 #define ARPHRD_ETHER 1
 #define NO_ARPHRD
@@ -286,7 +290,9 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
         }
 
         if(len < 0) {
+            int saved_errno = errno;
             perror("netlink_read: recvmsg()");
+            errno = saved_errno;
             return 2;
         } else if(len == 0) {
             fprintf(stderr, "netlink_read: EOF\n");
@@ -407,6 +413,200 @@ netlink_talk(struct nlmsghdr *nh)
     return rc;
 }
 
+/* Route requests are queued here while batching, and sent to the kernel
+   in a single sendmsg.  The acknowledgements are only collected once the
+   whole batch has been sent. */
+
+#define BATCH_MAX 256
+#define BATCH_BUFSIZE (BATCH_MAX * 128)
+
+struct batched_request {
+    int operation;
+    int acked;
+    struct kernel_route route;
+};
+
+static int batch_depth = 0;
+static void (*batch_failed)(int operation, struct kernel_route *route,
+                            int error) = NULL;
+static char batch_buf[BATCH_BUFSIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+static int batch_len = 0;
+static struct batched_request batch[BATCH_MAX];
+static int batch_count = 0;
+static unsigned short batch_first_seqno = 0;
+
+static int
+netlink_read_batch_acks(void)
+{
+    struct msghdr msg;
+    struct sockaddr_nl nladdr;
+    struct iovec iov;
+    struct nlmsghdr *nh;
+    int len, pending = batch_count;
+    char buf[8192];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &nladdr;
+    msg.msg_namelen = sizeof(nladdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    iov.iov_base = buf;
+
+    while(pending > 0) {
+        iov.iov_len = sizeof(buf);
+        len = recvmsg(nl_command.sock, &msg, 0);
+        if(len < 0 && (errno == EAGAIN || errno == EINTR)) {
+            int rc = wait_for_fd(0, nl_command.sock, 100);
+            if(rc <= 0) {
+                if(rc == 0)
+                    errno = EAGAIN;
+                break;
+            }
+            continue;
+        }
+        if(len <= 0)
+            break;
+        if(nladdr.nl_pid != 0)
+            continue;
+
+        for(nh = (struct nlmsghdr *)buf;
+            NLMSG_OK(nh, len);
+            nh = NLMSG_NEXT(nh, len)) {
+            struct nlmsgerr *err;
+            unsigned short i;
+            if(nh->nlmsg_type != NLMSG_ERROR ||
+               nh->nlmsg_pid != nl_command.sockaddr.nl_pid)
+                continue;
+            i = (unsigned short)(nh->nlmsg_seq - batch_first_seqno);
+            if(i >= batch_count || batch[i].acked)
+                continue;
+            batch[i].acked = 1;
+            pending--;
+            err = (struct nlmsgerr *)NLMSG_DATA(nh);
+            if(err->error != 0 && batch_failed)
+                batch_failed(batch[i].operation, &batch[i].route,
+                             -err->error);
+        }
+    }
+
+    if(pending > 0) {
+        perror("netlink_read_batch_acks");
+        fprintf(stderr, "Lost %d netlink acknowledgements.\n", pending);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+netlink_flush_batch(void)
+{
+    struct sockaddr_nl nladdr;
+    struct msghdr msg;
+    struct iovec iov;
+    int rc;
+
+    if(batch_count == 0)
+        return 0;
+
+    kdebugf("netlink_flush_batch: %d requests, %d bytes.\n",
+            batch_count, batch_len);
+
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &nladdr;
+    msg.msg_namelen = sizeof(nladdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    iov.iov_base = batch_buf;
+    iov.iov_len = batch_len;
+
+    rc = sendmsg(nl_command.sock, &msg, 0);
+    if(rc < 0 && (errno == EAGAIN || errno == EINTR)) {
+        rc = wait_for_fd(1, nl_command.sock, 100);
+        if(rc <= 0) {
+            if(rc == 0)
+                errno = EAGAIN;
+        } else {
+            rc = sendmsg(nl_command.sock, &msg, 0);
+        }
+    }
+
+    if(rc < batch_len) {
+        int i, saved_errno = errno;
+        perror("sendmsg(batch)");
+        for(i = 0; i < batch_count; i++) {
+            if(batch_failed)
+                batch_failed(batch[i].operation, &batch[i].route,
+                             saved_errno);
+        }
+        rc = -1;
+    } else {
+        rc = netlink_read_batch_acks();
+    }
+
+    batch_len = 0;
+    batch_count = 0;
+    return rc;
+}
+
+static int
+netlink_queue(struct nlmsghdr *nh, int operation,
+              const unsigned char *dest, unsigned short plen,
+              const unsigned char *gate, int ifindex, unsigned int metric)
+{
+    struct batched_request *request;
+
+    if(batch_count >= BATCH_MAX ||
+       batch_len + NLMSG_ALIGN(nh->nlmsg_len) > BATCH_BUFSIZE)
+        netlink_flush_batch();
+
+    nh->nlmsg_flags |= NLM_F_ACK;
+    nh->nlmsg_seq = ++nl_command.seqno;
+    if(batch_count == 0)
+        batch_first_seqno = nh->nlmsg_seq;
+
+    memcpy(batch_buf + batch_len, nh, nh->nlmsg_len);
+    batch_len += NLMSG_ALIGN(nh->nlmsg_len);
+
+    request = &batch[batch_count++];
+    request->operation = operation;
+    request->acked = 0;
+    memcpy(request->route.prefix, dest, 16);
+    request->route.plen = plen;
+    request->route.metric = metric;
+    request->route.ifindex = ifindex;
+    request->route.proto = RTPROT_BABEL;
+    memcpy(request->route.gw, gate, 16);
+    return 1;
+}
+
+int
+kernel_start_batch(void (*fn)(int operation, struct kernel_route *route,
+                              int error))
+{
+    if(batch_depth++ == 0)
+        batch_failed = fn;
+    return 1;
+}
+
+int
+kernel_end_batch(void)
+{
+    int rc = 0;
+
+    if(batch_depth <= 0)
+        return 0;
+
+    if(--batch_depth == 0) {
+        rc = netlink_flush_batch();
+        batch_failed = NULL;
+    }
+    return rc;
+}
+
 static int
 netlink_send_dump(int type, void *data, int len) {
 
@@ -893,11 +1093,16 @@ kernel_route(int operation, const unsigned char *dest, unsigned short plen,
     }
     buf.nh.nlmsg_len = (char*)rta + rta->rta_len - buf.raw;
 
+    if(batch_depth > 0)
+        return netlink_queue(&buf.nh, operation, dest, plen,
+                             gate, ifindex, metric);
+
     return netlink_talk(&buf.nh);
 }
 
 static int
-parse_kernel_route_rta(struct rtmsg *rtm, int len, struct kernel_route *route)
+parse_kernel_route_rta(struct rtmsg *rtm, int len, struct kernel_route *route,
+                       int want_table)
 {
     int table = rtm->rtm_table;
     struct rtattr *rta= RTM_RTA(rtm);;
@@ -952,7 +1157,7 @@ parse_kernel_route_rta(struct rtmsg *rtm, int len, struct kernel_route *route)
     }
 #undef COPY_ADDR
 
-    if(table != import_table)
+    if(table != want_table)
         return -1;
 
     return 0;
@@ -992,6 +1197,7 @@ filter_kernel_routes(struct nlmsghdr *nh, void *data)
     int maxroutes = 0;
     struct kernel_route *routes = NULL;
     int *found = NULL;
+    int own = 0;
     int len;
 
     struct rtmsg *rtm;
@@ -1001,6 +1207,7 @@ filter_kernel_routes(struct nlmsghdr *nh, void *data)
         maxroutes = *(int*)args[0];
         routes = (struct kernel_route *)args[1];
         found = (int*)args[2];
+        own = *(int*)args[3];
     }
 
     len = nh->nlmsg_len;
@@ -1015,7 +1222,7 @@ filter_kernel_routes(struct nlmsghdr *nh, void *data)
     rtm = (struct rtmsg*)NLMSG_DATA(nh);
     len -= NLMSG_LENGTH(0);
 
-    if(rtm->rtm_protocol == RTPROT_BABEL)
+    if((rtm->rtm_protocol == RTPROT_BABEL) != own)
         return 0;
 
     if(rtm->rtm_src_len != 0)
@@ -1026,7 +1233,8 @@ filter_kernel_routes(struct nlmsghdr *nh, void *data)
     else
         current_route = &route;
 
-    rc = parse_kernel_route_rta(rtm, len, current_route);
+    rc = parse_kernel_route_rta(rtm, len, current_route,
+                                own ? export_table : import_table);
     if(rc < 0)
         return 0;
 
@@ -1034,7 +1242,8 @@ filter_kernel_routes(struct nlmsghdr *nh, void *data)
         return 0;
 
     /* Ignore default unreachable routes; no idea where they come from. */
-    if(current_route->plen == 0 && current_route->metric >= KERNEL_INFINITY)
+    if(!own &&
+       current_route->plen == 0 && current_route->metric >= KERNEL_INFINITY)
         return 0;
 
     if(debug >= 2) {
@@ -1045,19 +1254,20 @@ filter_kernel_routes(struct nlmsghdr *nh, void *data)
     }
 
     if (data) *found = (*found)+1;
+    else if(route_change_fn)
+        route_change_fn(nh->nlmsg_type == RTM_NEWROUTE, current_route);
 
     return 1;
 
 }
 
-/* This function should not return routes installed by us. */
-int
-kernel_routes(struct kernel_route *routes, int maxroutes)
+static int
+dump_kernel_routes(struct kernel_route *routes, int maxroutes, int own)
 {
     int i, rc;
     int maxr = maxroutes;
     int found = 0;
-    void *data[3] = { &maxr, routes, &found };
+    void *data[4] = { &maxr, routes, &found, &own };
     int families[2] = { AF_INET6, AF_INET };
     struct rtgenmsg g;
 
@@ -1075,6 +1285,9 @@ kernel_routes(struct kernel_route *routes, int maxroutes)
         }
     }
 
+    /* Make sure the dump reflects the requests we have already made. */
+    netlink_flush_batch();
+
     for(i = 0; i < 2; i++) {
         memset(&g, 0, sizeof(g));
         g.rtgen_family = families[i];
@@ -1092,6 +1305,21 @@ kernel_routes(struct kernel_route *routes, int maxroutes)
     return found;
 }
 
+/* This function should not return routes installed by us. */
+int
+kernel_routes(struct kernel_route *routes, int maxroutes)
+{
+    return dump_kernel_routes(routes, maxroutes, 0);
+}
+
+/* The routes in the export table that were installed by us, or by
+   a previous instance of babeld. */
+int
+kernel_own_routes(struct kernel_route *routes, int maxroutes)
+{
+    return dump_kernel_routes(routes, maxroutes, 1);
+}
+
 static char *
 parse_ifname_rta(struct ifinfomsg *info, int len)
 {
@@ -1238,6 +1466,15 @@ filter_addresses(struct nlmsghdr *nh, void *data)
         route->proto = RTPROT_BABEL_LOCAL;
         memset(route->gw, 0, 16);
         *found = (*found)+1;
+    } else if(route_change_fn) {
+        struct kernel_route route;
+        memcpy(route.prefix, addr.s6_addr, 16);
+        route.plen = 128;
+        route.metric = 0;
+        route.ifindex = ifa->ifa_index;
+        route.proto = RTPROT_BABEL_LOCAL;
+        memset(route.gw, 0, 16);
+        route_change_fn(nh->nlmsg_type == RTM_NEWADDR, &route);
     }
 
     return 1;
@@ -1253,7 +1490,7 @@ filter_netlink(struct nlmsghdr *nh, void *data)
         case RTM_NEWROUTE:
         case RTM_DELROUTE:
             rc = filter_kernel_routes(nh, NULL);
-            if (changed && rc > 0)
+            if (changed && rc > 0 && !route_change_fn)
                 *changed |= CHANGE_ROUTE;
             return rc;
         case RTM_NEWLINK:
@@ -1333,6 +1570,11 @@ kernel_callback(int (*fn)(int, void*), void *closure)
     }
     rc = netlink_read(&nl_listen, &nl_command, 0, filter_netlink, &changed);
 
+    /* If the kernel dropped messages, or we had to reopen the socket,
+       incremental updates are no longer enough. */
+    if(rc < 0 || (rc == 2 && errno == ENOBUFS))
+        changed |= CHANGE_OVERRUN;
+
     if(rc < 0 && nl_listen.sock < 0)
       kernel_setup_socket(1);
 
@@ -1343,3 +1585,10 @@ kernel_callback(int (*fn)(int, void*), void *closure)
 
     return 0;
 }
+
+int
+kernel_track_routes(void (*fn)(int add, struct kernel_route *route))
+{
+    route_change_fn = fn;
+    return 1;
+}
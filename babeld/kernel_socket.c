@@ -475,7 +475,8 @@ print_kernel_route(int add, struct kernel_route *route)
 }
 
 static int
-parse_kernel_route(const struct rt_msghdr *rtm, struct kernel_route *route)
+parse_kernel_route(const struct rt_msghdr *rtm, struct kernel_route *route,
+                   int own)
 {
 
     void *rta = (void*)rtm + sizeof(struct rt_msghdr);
@@ -492,7 +493,7 @@ parse_kernel_route(const struct rt_msghdr *rtm, struct kernel_route *route)
     if(IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr) 
        || IN6_IS_ADDR_MC_LINKLOCAL(&sin6->sin6_addr))
         return -1;
-    if((rtm->rtm_flags & RTF_PROTO2) != 0)
+    if(((rtm->rtm_flags & RTF_PROTO2) != 0) != own)
         return -1;
     memcpy(&route->prefix, &sin6->sin6_addr, 16);
     rta += ROUNDUP(sizeof(struct sockaddr_in6));
@@ -532,8 +533,8 @@ parse_kernel_route(const struct rt_msghdr *rtm, struct kernel_route *route)
 
 }
 
-int
-kernel_routes(struct kernel_route *routes, int maxroutes)
+static int
+dump_kernel_routes(struct kernel_route *routes, int maxroutes, int own)
 {
     int mib[6];
     char *buf, *p;
@@ -570,7 +571,7 @@ kernel_routes(struct kernel_route *routes, int maxroutes)
     p = buf;
     while(p < buf + len && i < maxroutes) {
         rtm = (struct rt_msghdr*)p;
-        rc = parse_kernel_route(rtm, &routes[i]);
+        rc = parse_kernel_route(rtm, &routes[i], own);
         if(rc)
             goto cont;
 
@@ -592,6 +593,18 @@ kernel_routes(struct kernel_route *routes, int maxroutes)
 
 }
 
+int
+kernel_routes(struct kernel_route *routes, int maxroutes)
+{
+    return dump_kernel_routes(routes, maxroutes, 0);
+}
+
+int
+kernel_own_routes(struct kernel_route *routes, int maxroutes)
+{
+    return dump_kernel_routes(routes, maxroutes, 1);
+}
+
 static int
 socket_read(int sock) 
 {
@@ -620,7 +633,7 @@ socket_read(int sock)
         if(buf.rtm.rtm_errno)
             return 0;
 
-        rc = parse_kernel_route(&buf.rtm, &route);
+        rc = parse_kernel_route(&buf.rtm, &route, 0);
         if(rc < 0)
             return 0;
         if(debug > 2)
@@ -703,6 +716,28 @@ kernel_callback(int (*fn)(int, void*), void *closure)
 
 }
 
+int
+kernel_start_batch(void (*fn)(int operation, struct kernel_route *route,
+                              int error))
+{
+    /* Routing socket requests are always synchronous. */
+    return 0;
+}
+
+int
+kernel_end_batch(void)
+{
+    return 0;
+}
+
+int
+kernel_track_routes(void (*fn)(int add, struct kernel_route *route))
+{
+    /* Not implemented, the caller will fall back to dumping the tables. */
+    errno = ENOSYS;
+    return -1;
+}
+
 /* Local Variables:      */
 /* c-basic-offset: 4     */
 /* indent-tabs-mode: nil */
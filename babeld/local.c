@@ -25,6 +25,10 @@ THE SOFTWARE.
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "babeld.h"
 #include "network.h"
@@ -41,75 +45,151 @@ int dummy;
 
 #else
 
-int
-local_read(int s)
-{
-    int rc;
-    char buf[500];
+/* We never block on a client: output is queued, and written whenever
+   the socket is writable.  A client that lets more than this much
+   output accumulate is either resynchronised (binary) or dropped (text). */
+#define LOCAL_BUFSIZE_MAX (1024 * 1024)
 
-    /* Ignore anything that comes in, except for EOF */
-    rc = read(s, buf, 500);
+struct local_client local_clients[MAX_LOCAL_CLIENTS];
+int num_local_clients = 0;
 
-    if(rc <= 0)
-        return rc;
+static int
+local_queue(struct local_client *client, const void *data, int len, int force)
+{
+    if(client->closing || (client->resync && !force))
+        return 0;
+
+    if(!force && client->buffered + len > LOCAL_BUFSIZE_MAX) {
+        if(client->binary) {
+            /* Stop queueing changes until the client catches up. */
+            client->resync = 1;
+        } else {
+            fprintf(stderr, "Local client is too slow, dropping it.\n");
+            client->closing = 1;
+        }
+        return -1;
+    }
+
+    if(client->buffered + len > client->size) {
+        unsigned char *new_buf;
+        int n = MAX(client->size, 4096);
+        while(n < client->buffered + len)
+            n *= 2;
+        if(client->start > 0) {
+            memmove(client->buf, client->buf + client->start,
+                    client->buffered - client->start);
+            client->buffered -= client->start;
+            client->start = 0;
+        }
+        new_buf = realloc(client->buf, n);
+        if(new_buf == NULL) {
+            perror("realloc(local_client)");
+            client->closing = 1;
+            return -1;
+        }
+        client->buf = new_buf;
+        client->size = n;
+    }
 
+    memcpy(client->buf + client->buffered, data, len);
+    client->buffered += len;
     return 1;
 }
 
-static int
-write_timeout(int fd, const void *buf, int len)
+/* The functions below either queue a change for all clients (target is
+   NULL), or a part of a snapshot for target only.  A snapshot is always
+   queued whole. */
+
+static void
+local_queue_all(struct local_client *target, int binary,
+                const void *buf, int len)
 {
-    int n = 0, rc = 0;
-    const char *b = buf;
+    int i;
 
-    while(n < len) {
-        rc = write(fd, b + n, len - n);
-        if(rc < 0) {
-            if(errno == EAGAIN || errno == EINTR) {
-                rc = wait_for_fd(1, fd, 100);
-                if(rc > 0) {
-                    rc = write(fd, b + n, len - n);
-                }
-            }
-        }
-        if(rc > 0)
-            n += rc;
-        else
-            break;
+    if(target) {
+        local_queue(target, buf, len, 1);
+        return;
     }
 
-    if(n >= len)
-        return 1;
-    else {
-        if(rc >= 0)
-            errno = EAGAIN;
-        return -1;
+    for(i = 0; i < num_local_clients; i++) {
+        if(!local_clients[i].binary == !binary)
+            local_queue(&local_clients[i], buf, len, 0);
     }
 }
 
-void
-local_notify_self()
+static int
+want_format(struct local_client *target, int binary)
+{
+    int i;
+
+    if(target)
+        return !target->binary == !binary;
+
+    for(i = 0; i < num_local_clients; i++) {
+        if(!local_clients[i].binary == !binary &&
+           !local_clients[i].closing && !local_clients[i].resync)
+            return 1;
+    }
+    return 0;
+}
+
+static unsigned char *
+start_record(unsigned char *buf, int type, int kind)
+{
+    buf[2] = type;
+    buf[3] = kind;
+    return buf + 4;
+}
+
+static int
+end_record(unsigned char *buf, unsigned char *p)
+{
+    DO_HTONS(buf, p - buf);
+    return p - buf;
+}
+
+static unsigned char *
+put_short(unsigned char *p, unsigned short v)
+{
+    DO_HTONS(p, v);
+    return p + 2;
+}
+
+static unsigned char *
+put_long(unsigned char *p, unsigned int v)
+{
+    DO_HTONL(p, v);
+    return p + 4;
+}
+
+static unsigned char *
+put_bytes(unsigned char *p, const unsigned char *data, int len)
+{
+    memcpy(p, data, len);
+    return p + len;
+}
+
+static void
+notify_self(struct local_client *target)
 {
     char buf[512];
     int rc;
-    
-    if(local_socket < 0)
+
+    if(!want_format(target, 0))
         return;
 
     rc = snprintf(buf, 512, "add self alamakota id %s\n",
                   format_eui64(myid));
-
     if(rc < 0 || rc >= 512)
-        goto fail;
+        return;
 
-    rc = write_timeout(local_socket, buf, rc);
-    if(rc < 0)
-        goto fail;
-    return;
+    local_queue_all(target, 0, buf, rc);
+}
 
- fail:
-    shutdown(local_socket, 1);
-    return;
+void
+local_notify_self()
+{
+    notify_self(NULL);
 }
 
 static char *
@@ -123,132 +203,261 @@ local_kind(int kind)
     }
 }
 
+static void
+notify_neighbour(struct neighbour *neigh, int kind,
+                 struct local_client *target)
+{
+    if(want_format(target, 0)) {
+        char buf[512];
+        int rc;
+        rc = snprintf(buf, 512,
+                      "%s neighbour %lx address %s "
+                      "if %s reach %04x rxcost %d txcost %d cost %d\n",
+                      local_kind(kind),
+                      /* Neighbours never move around in memory , so we can
+                         use the address as a unique identifier. */
+                      (unsigned long int)neigh,
+                      format_address(neigh->address),
+                      neigh->network->ifname,
+                      neigh->reach,
+                      neighbour_rxcost(neigh),
+                      neighbour_txcost(neigh),
+                      neighbour_cost(neigh));
+        if(rc >= 0 && rc < 512)
+            local_queue_all(target, 0, buf, rc);
+    }
+
+    if(want_format(target, 1)) {
+        unsigned char buf[40], *p;
+        p = start_record(buf, LOCAL_BINARY_NEIGHBOUR, kind);
+        p = put_bytes(p, neigh->address, 16);
+        p = put_long(p, neigh->network->ifindex);
+        p = put_short(p, neigh->reach);
+        p = put_short(p, neighbour_rxcost(neigh));
+        p = put_short(p, neighbour_txcost(neigh));
+        p = put_short(p, neighbour_cost(neigh));
+        local_queue_all(target, 1, buf, end_record(buf, p));
+    }
+}
+
 void
 local_notify_neighbour(struct neighbour *neigh, int kind)
 {
-    char buf[512];
-    int rc;
-    
-    if(local_socket < 0)
-        return;
+    notify_neighbour(neigh, kind, NULL);
+}
 
-    rc = snprintf(buf, 512,
-                  "%s neighbour %lx address %s "
-                  "if %s reach %04x rxcost %d txcost %d cost %d\n",
-                  local_kind(kind),
-                  /* Neighbours never move around in memory , so we can use the
-                     address as a unique identifier. */
-                  (unsigned long int)neigh,
-                  format_address(neigh->address),
-                  neigh->network->ifname,
-                  neigh->reach,
-                  neighbour_rxcost(neigh),
-                  neighbour_txcost(neigh),
-                  neighbour_cost(neigh));
+static void
+notify_xroute(struct xroute *xroute, int kind, struct local_client *target)
+{
+    if(want_format(target, 0)) {
+        char buf[512];
+        int rc;
+        rc = snprintf(buf, 512, "%s xroute %s prefix %s metric %d\n",
+                      local_kind(kind),
+                      format_prefix(xroute->prefix, xroute->plen),
+                      format_prefix(xroute->prefix, xroute->plen),
+                      xroute->metric);
+        if(rc >= 0 && rc < 512)
+            local_queue_all(target, 0, buf, rc);
+    }
 
-    if(rc < 0 || rc >= 512)
-        goto fail;
+    if(want_format(target, 1)) {
+        unsigned char buf[24], *p;
+        p = start_record(buf, LOCAL_BINARY_XROUTE, kind);
+        p = put_bytes(p, xroute->prefix, 16);
+        *p++ = xroute->plen;
+        *p++ = 0;
+        p = put_short(p, xroute->metric);
+        local_queue_all(target, 1, buf, end_record(buf, p));
+    }
+}
 
-    rc = write_timeout(local_socket, buf, rc);
-    if(rc < 0)
-        goto fail;
-    return;
+void
+local_notify_xroute(struct xroute *xroute, int kind)
+{
+    notify_xroute(xroute, kind, NULL);
+}
 
- fail:
-    shutdown(local_socket, 1);
-    return;
+static void
+notify_route(struct route *route, int kind, struct local_client *target)
+{
+    if(want_format(target, 0)) {
+        char buf[512];
+        int rc;
+        rc = snprintf(buf, 512,
+                      "%s route %s-%lx prefix %s installed %s "
+                      "id %s metric %d refmetric %d via %s if %s\n",
+                      local_kind(kind),
+                      format_prefix(route->src->prefix, route->src->plen),
+                      (unsigned long)route->neigh,
+                      format_prefix(route->src->prefix, route->src->plen),
+                      route->installed ? "yes" : "no",
+                      format_eui64(route->src->id),
+                      route_metric(route), route->refmetric,
+                      format_address(route->neigh->address),
+                      route->neigh->network->ifname);
+        if(rc >= 0 && rc < 512)
+            local_queue_all(target, 0, buf, rc);
+    }
+
+    if(want_format(target, 1)) {
+        unsigned char buf[56], *p;
+        p = start_record(buf, LOCAL_BINARY_ROUTE, kind);
+        p = put_bytes(p, route->src->prefix, 16);
+        *p++ = route->src->plen;
+        *p++ = !!route->installed;
+        p = put_short(p, route_metric(route));
+        p = put_short(p, route->refmetric);
+        p = put_bytes(p, route->src->id, 8);
+        p = put_bytes(p, route->neigh->address, 16);
+        p = put_long(p, route->neigh->network->ifindex);
+        local_queue_all(target, 1, buf, end_record(buf, p));
+    }
 }
 
 void
-local_notify_xroute(struct xroute *xroute, int kind)
+local_notify_route(struct route *route, int kind)
 {
-    char buf[512];
-    int rc;
+    notify_route(route, kind, NULL);
+}
 
-    if(local_socket < 0)
-        return;
+/* Queue a snapshot of our tables for client, and for client only. */
 
-    rc = snprintf(buf, 512, "%s xroute %s prefix %s metric %d\n",
-                  local_kind(kind),
-                  format_prefix(xroute->prefix, xroute->plen),
-                  format_prefix(xroute->prefix, xroute->plen),
-                  xroute->metric);
-    
-    if(rc < 0 || rc >= 512)
-        goto fail;
+static void
+local_snapshot(struct local_client *client)
+{
+    struct neighbour *neigh;
+    int i;
+
+    client->resync = 0;
+
+    if(client->binary) {
+        unsigned char buf[12], *p;
+        p = start_record(buf, LOCAL_BINARY_START, LOCAL_ADD);
+        p = put_bytes(p, myid, 8);
+        local_queue(client, buf, end_record(buf, p), 1);
+    } else {
+        const char *header = "BABEL 0.0\n";
+        local_queue(client, header, strlen(header), 1);
+        notify_self(client);
+    }
 
-    rc = write_timeout(local_socket, buf, rc);
-    if(rc < 0)
-        goto fail;
-    return;
+    FOR_ALL_NEIGHBOURS(neigh)
+        notify_neighbour(neigh, LOCAL_ADD, client);
+    for(i = 0; i < numxroutes; i++)
+        notify_xroute(xroutes[i], LOCAL_ADD, client);
+    for(i = 0; i < numroutes; i++)
+        notify_route(routes[i], LOCAL_ADD, client);
 
- fail:
-    shutdown(local_socket, 1);
-    return;
+    if(client->binary) {
+        unsigned char buf[4];
+        start_record(buf, LOCAL_BINARY_END, LOCAL_ADD);
+        local_queue(client, buf, end_record(buf, buf + 4), 1);
+    }
 }
 
-void
-local_notify_route(struct route *route, int kind)
+struct local_client *
+local_accept(int s, int binary)
+{
+    struct local_client *client;
+    int fd, rc;
+
+    fd = accept(s, NULL, NULL);
+    if(fd < 0)
+        return NULL;
+
+    rc = fcntl(fd, F_GETFL, 0);
+    if(rc >= 0)
+        rc = fcntl(fd, F_SETFL, rc | O_NONBLOCK);
+    if(rc < 0) {
+        perror("fcntl(local_client)");
+        close(fd);
+        return NULL;
+    }
+
+    if(num_local_clients >= MAX_LOCAL_CLIENTS) {
+        fprintf(stderr, "Too many local clients.\n");
+        close(fd);
+        errno = EMFILE;
+        return NULL;
+    }
+
+    client = &local_clients[num_local_clients++];
+    memset(client, 0, sizeof(struct local_client));
+    client->fd = fd;
+    client->binary = !!binary;
+    local_snapshot(client);
+    return client;
+}
+
+int
+local_read(struct local_client *client)
 {
-    char buf[512];
     int rc;
+    char buf[500];
 
-    if(local_socket < 0)
-        return;
+    /* Ignore anything that comes in, except for EOF */
+    rc = read(client->fd, buf, 500);
 
-    rc = snprintf(buf, 512,
-                  "%s route %s-%lx prefix %s installed %s "
-                  "id %s metric %d refmetric %d via %s if %s\n",
-                  local_kind(kind),
-                  format_prefix(route->src->prefix, route->src->plen),
-                  (unsigned long)route->neigh,
-                  format_prefix(route->src->prefix, route->src->plen),
-                  route->installed ? "yes" : "no",
-                  format_eui64(route->src->id),
-                  route_metric(route), route->refmetric,
-                  format_address(route->neigh->address),
-                  route->neigh->network->ifname);
-    
-    if(rc < 0 || rc >= 512)
-        goto fail;
+    if(rc < 0 && (errno == EAGAIN || errno == EINTR))
+        return 1;
 
-    rc = write_timeout(local_socket, buf, rc);
-    if(rc < 0)
-        goto fail;
-    return;
+    if(rc <= 0)
+        return rc;
 
- fail:
-    shutdown(local_socket, 1);
-    return;
+    return 1;
 }
 
-void
-local_dump()
+/* Write as much of the queued output as the socket will take, without
+   blocking.  Returns -1 if the client should be closed. */
+
+int
+local_flush(struct local_client *client)
 {
-    int i, rc;
-    struct neighbour *neigh;
-    const char *header = "BABEL 0.0\n";
+    int rc;
 
-    if(local_socket < 0)
-        return;
+    if(client->closing)
+        return -1;
+
+    while(client->start < client->buffered) {
+        rc = write(client->fd, client->buf + client->start,
+                   client->buffered - client->start);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN)
+                return 0;
+            return -1;
+        }
+        client->start += rc;
+    }
 
-    rc = write_timeout(local_socket, header, strlen(header));
-    if(rc < 0)
-        goto fail;
+    client->start = client->buffered = 0;
 
-    local_notify_self();
-    FOR_ALL_NEIGHBOURS(neigh) {
-        local_notify_neighbour(neigh, LOCAL_ADD);
+    if(client->resync) {
+        local_snapshot(client);
+        return local_flush(client);
     }
-    for(i = 0; i < numxroutes; i++)
-        local_notify_xroute(&xroutes[i], LOCAL_ADD);
-    for(i = 0; i < numroutes; i++)
-        local_notify_route(&routes[i], LOCAL_ADD);
-    return;
 
- fail:
-    shutdown(local_socket, 1);
-    return;
+    /* Don't keep a large buffer around once a burst is over. */
+    if(client->size > 64 * 1024) {
+        free(client->buf);
+        client->buf = NULL;
+        client->size = 0;
+    }
+    return 1;
+}
+
+void
+local_close(struct local_client *client)
+{
+    int i = client - local_clients;
+
+    close(client->fd);
+    free(client->buf);
+    num_local_clients--;
+    if(i < num_local_clients)
+        local_clients[i] = local_clients[num_local_clients];
 }
 
 #endif
@@ -28,14 +28,47 @@ struct xroute;
 #define LOCAL_ADD 1
 #define LOCAL_CHANGE 2
 
+/* The binary protocol is a stream of records, each of which starts with
+   its total length (2 octets, network byte order), its type and its kind
+   (one of the above).  A connection starts with a snapshot of our tables
+   between a START and an END record, and is followed by changes.  If a
+   client falls too far behind, we stop queueing changes for it, and send
+   it a new snapshot once it has caught up. */
+
+#define LOCAL_BINARY_START 1    /* id (8) */
+#define LOCAL_BINARY_END 2
+#define LOCAL_BINARY_NEIGHBOUR 3
+/* address (16), ifindex (4), reach, rxcost, txcost, cost (2 each) */
+#define LOCAL_BINARY_XROUTE 4
+/* prefix (16), plen (1), pad (1), metric (2) */
+#define LOCAL_BINARY_ROUTE 5
+/* prefix (16), plen (1), installed (1), metric (2), refmetric (2),
+   id (8), neighbour address (16), ifindex (4) */
+
 #ifndef NO_LOCAL_INTERFACE
 
-int local_read(int s);
+#define MAX_LOCAL_CLIENTS 8
+
+struct local_client {
+    int fd;
+    char binary;
+    char closing;               /* waiting for the main loop to close us */
+    char resync;                /* dropped changes, send a new snapshot */
+    unsigned char *buf;
+    int start, buffered, size;
+};
+
+extern struct local_client local_clients[MAX_LOCAL_CLIENTS];
+extern int num_local_clients;
+
+struct local_client *local_accept(int s, int binary);
+int local_read(struct local_client *client);
+int local_flush(struct local_client *client);
+void local_close(struct local_client *client);
 void local_notify_self(void);
 void local_notify_neighbour(struct neighbour *neigh, int kind);
 void local_notify_xroute(struct xroute *xroute, int kind);
 void local_notify_route(struct route *route, int kind);
-void local_dump(void);
 
 #else
 
@@ -43,5 +76,4 @@ void local_dump(void);
 #define local_notify_neighbour(n, k) do {} while(0)
 #define local_notify_xroute(x, k) do {} while(0)
 #define local_notify_route(r, k) do {} while(0)
-#define local_dump() do {} while 0
 #endif
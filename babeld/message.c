@@ -217,7 +217,7 @@ parse_packet(const unsigned char *from, struct network *net,
             update_hello_interval(net);
             changed = update_neighbour(neigh, seqno, interval);
             if(changed)
-                update_neighbour_metric(neigh);
+                neighbour_changed(neigh);
             if(interval > 0)
                 schedule_neighbours_check(interval * 10, 0);
         } else if(type == MESSAGE_IHU) {
@@ -237,7 +237,7 @@ parse_packet(const unsigned char *from, struct network *net,
                 neigh->txcost = txcost;
                 neigh->ihu_time = now;
                 neigh->ihu_interval = interval;
-                update_neighbour_metric(neigh);
+                neighbour_changed(neigh);
                 if(interval > 0)
                     schedule_neighbours_check(interval * 10 * 3, 0);
             }
@@ -473,6 +473,7 @@ flushbuf(struct network *net)
     net->have_buffered_prefix = 0;
     net->flush_timeout.tv_sec = 0;
     net->flush_timeout.tv_usec = 0;
+    reschedule_network(net);
 }
 
 static void
@@ -483,6 +484,7 @@ schedule_flush(struct network *net)
        timeval_minus_msec(&net->flush_timeout, &now) < msecs)
         return;
     delay_jitter(&net->flush_timeout, msecs);
+    reschedule_network(net);
 }
 
 static void
@@ -494,6 +496,7 @@ schedule_flush_now(struct network *net)
        timeval_minus_msec(&net->flush_timeout, &now) < msecs)
         return;
     delay_jitter(&net->flush_timeout, msecs);
+    reschedule_network(net);
 }
 
 static void
@@ -631,6 +634,7 @@ send_hello_noupdate(struct network *net, unsigned interval)
 
     net->hello_seqno = seqno_plus(net->hello_seqno, 1);
     delay_jitter(&net->hello_timeout, net->hello_interval);
+    reschedule_network(net);
 
     if(!net_up(net))
         return;
@@ -788,26 +792,19 @@ really_send_update(struct network *net,
     }
 }
 
+/* The order of the updates within a group, which all have the same
+   router-id and address family: the ones that can carry the router-id
+   implicitly first, then longer prefixes, so that updates sharing a
+   prefix are adjacent. */
+
 static int
-compare_buffered_updates(const void *av, const void *bv)
+compare_buffered_updates(const struct buffered_update *a,
+                         const struct buffered_update *b)
 {
-    const struct buffered_update *a = av, *b = bv;
-    int rc, v4a, v4b, ma, mb;
-
-    rc = memcmp(a->id, b->id, 8);
-    if(rc != 0)
-        return rc;
-
-    v4a = (a->plen >= 96 && v4mapped(a->prefix));
-    v4b = (b->plen >= 96 && v4mapped(b->prefix));
-
-    if(v4a > v4b)
-        return 1;
-    else if(v4a < v4b)
-        return -1;
+    int ma, mb;
 
-    ma = (!v4a && a->plen == 128 && memcmp(a->prefix + 8, a->id, 8) == 0);
-    mb = (!v4b && b->plen == 128 && memcmp(b->prefix + 8, b->id, 8) == 0);
+    ma = (a->plen == 128 && memcmp(a->prefix + 8, a->id, 8) == 0);
+    mb = (b->plen == 128 && memcmp(b->prefix + 8, b->id, 8) == 0);
 
     if(ma > mb)
         return -1;
@@ -822,15 +819,52 @@ compare_buffered_updates(const void *av, const void *bv)
     return memcmp(a->prefix, b->prefix, 16);
 }
 
-void
-flushupdates(struct network *net)
+static void
+send_update_group(struct network *net, struct buffered_update *b, int first)
 {
     struct xroute *xroute;
     struct route *route;
-    const unsigned char *last_prefix = NULL;
-    unsigned char last_plen = 0xFF;
     int i;
 
+    for(i = first; i >= 0; i = b[i].next) {
+        unsigned short seqno;
+        unsigned short metric;
+
+        xroute = find_xroute(b[i].prefix, b[i].plen);
+        route = find_installed_route(b[i].prefix, b[i].plen);
+
+        if(xroute && (!route || xroute->metric <= kernel_metric)) {
+            really_send_update(net, myid,
+                               xroute->prefix, xroute->plen,
+                               myseqno, xroute->metric);
+        } else if(route) {
+            seqno = route->seqno;
+            metric = route_metric(route);
+            if(metric < INFINITY)
+                satisfy_request(route->src->prefix, route->src->plen,
+                                seqno, route->src->id, net);
+            if((net->flags & NET_SPLIT_HORIZON) &&
+               route->neigh->network == net)
+                continue;
+            really_send_update(net, route->src->id,
+                               route->src->prefix,
+                               route->src->plen,
+                               seqno, metric);
+            update_source(route->src, seqno, metric);
+        } else {
+        /* There's no route for this prefix.  This can happen shortly
+           after an xroute has been retracted, so send a retraction. */
+            really_send_update(net, myid, b[i].prefix, b[i].plen,
+                               myseqno, INFINITY);
+        }
+    }
+}
+
+void
+flushupdates(struct network *net)
+{
+    int j, v4;
+
     if(net == NULL) {
         struct network *n;
         FOR_ALL_NETS(n)
@@ -840,11 +874,17 @@ flushupdates(struct network *net)
 
     if(net->num_buffered_updates > 0) {
         struct buffered_update *b = net->buffered_updates;
+        struct update_group *groups = net->update_groups;
         int n = net->num_buffered_updates;
+        int ngroups = net->num_update_groups;
 
         net->buffered_updates = NULL;
+        net->update_groups = NULL;
+        net->update_hash = NULL;
+        net->group_hash = NULL;
         net->update_bufsize = 0;
         net->num_buffered_updates = 0;
+        net->num_update_groups = 0;
 
         if(!net_up(net))
             goto done;
@@ -852,63 +892,15 @@ flushupdates(struct network *net)
         debugf("  (flushing %d buffered updates on %s (%d))\n",
                n, net->ifname, net->ifindex);
 
-        /* In order to send fewer update messages, we want to send updates
-           with the same router-id together, with IPv6 going out before IPv4. */
-
-        for(i = 0; i < n; i++) {
-            route = find_installed_route(b[i].prefix, b[i].plen);
-            if(route)
-                memcpy(b[i].id, route->src->id, 8);
-            else
-                memcpy(b[i].id, myid, 8);
-        }
-
-        qsort(b, n, sizeof(struct buffered_update), compare_buffered_updates);
+        /* In order to send fewer update messages, buffer_update has
+           grouped updates by router-id, and we send IPv6 before IPv4.
+           Duplicates have been dropped already, and each group is
+           kept sorted. */
 
-        for(i = 0; i < n; i++) {
-            unsigned short seqno;
-            unsigned short metric;
-
-            /* The same update may be scheduled multiple times before it is
-               sent out.  Since our buffer is now sorted, it is enough to
-               compare with the previous update. */
-
-            if(last_prefix) {
-                if(b[i].plen == last_plen &&
-                   memcmp(b[i].prefix, last_prefix, 16) == 0)
-                    continue;
-            }
-
-            xroute = find_xroute(b[i].prefix, b[i].plen);
-            route = find_installed_route(b[i].prefix, b[i].plen);
-
-            if(xroute && (!route || xroute->metric <= kernel_metric)) {
-                really_send_update(net, myid,
-                                   xroute->prefix, xroute->plen,
-                                   myseqno, xroute->metric);
-                last_prefix = xroute->prefix;
-                last_plen = xroute->plen;
-            } else if(route) {
-                seqno = route->seqno;
-                metric = route_metric(route);
-                if(metric < INFINITY)
-                    satisfy_request(route->src->prefix, route->src->plen,
-                                    seqno, route->src->id, net);
-                if((net->flags & NET_SPLIT_HORIZON) &&
-                   route->neigh->network == net)
-                    continue;
-                really_send_update(net, route->src->id,
-                                   route->src->prefix,
-                                   route->src->plen,
-                                   seqno, metric);
-                update_source(route->src, seqno, metric);
-                last_prefix = route->src->prefix;
-                last_plen = route->src->plen;
-            } else {
-            /* There's no route for this prefix.  This can happen shortly
-               after an xroute has been retracted, so send a retraction. */
-                really_send_update(net, myid, b[i].prefix, b[i].plen,
-                                   myseqno, INFINITY);
+        for(v4 = 0; v4 <= 1; v4++) {
+            for(j = 0; j < ngroups; j++) {
+                if(groups[j].v4 == v4)
+                    send_update_group(net, b, groups[j].first);
             }
         }
         schedule_flush_now(net);
@@ -917,6 +909,7 @@ flushupdates(struct network *net)
     }
     net->update_flush_timeout.tv_sec = 0;
     net->update_flush_timeout.tv_usec = 0;
+    reschedule_network(net);
 }
 
 static void
@@ -928,38 +921,136 @@ schedule_update_flush(struct network *net, int urgent)
        timeval_minus_msec(&net->update_flush_timeout, &now) < msecs)
         return;
     delay_jitter(&net->update_flush_timeout, msecs);
+    reschedule_network(net);
+}
+
+/* Buffered updates live in a single block: the updates themselves, the
+   groups, and the hash tables used to find an update or a group. */
+
+static int
+alloc_buffered_updates(struct network *net, int n)
+{
+    int hsize = 4;
+    char *block;
+
+    while(hsize < n)
+        hsize *= 2;
+
+    block = malloc(n * sizeof(struct buffered_update) +
+                   n * sizeof(struct update_group) +
+                   2 * hsize * sizeof(int));
+    if(block == NULL)
+        return -1;
+
+    net->buffered_updates = (struct buffered_update*)block;
+    block += n * sizeof(struct buffered_update);
+    net->update_groups = (struct update_group*)block;
+    block += n * sizeof(struct update_group);
+    net->update_hash = (int*)block;
+    net->group_hash = net->update_hash + hsize;
+    memset(net->update_hash, -1, 2 * hsize * sizeof(int));
+    net->update_hash_size = hsize;
+    net->update_bufsize = n;
+    net->num_buffered_updates = 0;
+    net->num_update_groups = 0;
+    return 1;
 }
 
 static void
 buffer_update(struct network *net,
               const unsigned char *prefix, unsigned char plen)
 {
+    struct buffered_update *b;
+    struct update_group *g;
+    struct xroute *xroute;
+    struct route *route;
+    const unsigned char *id;
+    unsigned h;
+    int i, j, prev, v4;
+
     if(net->num_buffered_updates > 0 &&
        net->num_buffered_updates >= net->update_bufsize)
         flushupdates(net);
 
     if(net->update_bufsize == 0) {
-        int n;
+        int n, rc;
         assert(net->buffered_updates == NULL);
         n = MAX(net->bufsize / 16, 4);
-    again:
-        net->buffered_updates = malloc(n * sizeof(struct buffered_update));
-        if(net->buffered_updates == NULL) {
+        rc = alloc_buffered_updates(net, n);
+        if(rc < 0) {
             perror("malloc(buffered_updates)");
-            if(n > 4) {
-                n = 4;
-                goto again;
-            }
+            if(n <= 4)
+                return;
+            rc = alloc_buffered_updates(net, 4);
+            if(rc < 0)
+                return;
+        }
+    }
+
+    /* The same update may be scheduled multiple times before it is
+       sent out. */
+    h = hash_prefix(prefix, plen) & (net->update_hash_size - 1);
+    for(i = net->update_hash[h]; i >= 0; i = net->buffered_updates[i].hash_next)
+        if(net->buffered_updates[i].plen == plen &&
+           memcmp(net->buffered_updates[i].prefix, prefix, 16) == 0)
             return;
+
+    /* This is the router-id that we will most probably announce; if it
+       changes before we flush, we merely lose some compression. */
+    xroute = find_xroute(prefix, plen);
+    route = find_installed_route(prefix, plen);
+    if(xroute && (!route || xroute->metric <= kernel_metric))
+        id = myid;
+    else if(route)
+        id = route->src->id;
+    else
+        id = myid;
+
+    i = net->num_buffered_updates++;
+    b = &net->buffered_updates[i];
+    memcpy(b->id, id, 8);
+    memcpy(b->prefix, prefix, 16);
+    b->plen = plen;
+    b->next = -1;
+    b->hash_next = net->update_hash[h];
+    net->update_hash[h] = i;
+
+    v4 = plen >= 96 && v4mapped(prefix);
+    h = hash_bytes(v4 + 1, id, 8) & (net->update_hash_size - 1);
+    for(g = NULL, i = net->group_hash[h]; i >= 0;
+        i = net->update_groups[i].hash_next) {
+        if(net->update_groups[i].v4 == v4 &&
+           memcmp(net->update_groups[i].id, id, 8) == 0) {
+            g = &net->update_groups[i];
+            break;
         }
-        net->update_bufsize = n;
-        net->num_buffered_updates = 0;
     }
 
-    memcpy(net->buffered_updates[net->num_buffered_updates].prefix,
-           prefix, 16);
-    net->buffered_updates[net->num_buffered_updates].plen = plen;
-    net->num_buffered_updates++;
+    i = b - net->buffered_updates;
+    if(g == NULL) {
+        g = &net->update_groups[net->num_update_groups];
+        memcpy(g->id, id, 8);
+        g->v4 = v4;
+        g->first = g->last = i;
+        g->hash_next = net->group_hash[h];
+        net->group_hash[h] = net->num_update_groups++;
+    } else if(compare_buffered_updates(&net->buffered_updates[g->last],
+                                       b) <= 0) {
+        net->buffered_updates[g->last].next = i;
+        g->last = i;
+    } else {
+        /* Keep the group sorted; it never goes past the last one. */
+        prev = -1;
+        for(j = g->first;
+            compare_buffered_updates(&net->buffered_updates[j], b) <= 0;
+            j = net->buffered_updates[j].next)
+            prev = j;
+        b->next = j;
+        if(prev < 0)
+            g->first = i;
+        else
+            net->buffered_updates[prev].next = i;
+    }
 }
 
 void
@@ -999,13 +1090,14 @@ send_update(struct network *net, int urgent,
             if(!parasitic) {
                 debugf("Sending update to %s for any.\n", net->ifname);
                 for(i = 0; i < numroutes; i++)
-                    if(routes[i].installed)
+                    if(routes[i]->installed)
                         buffer_update(net,
-                                      routes[i].src->prefix,
-                                      routes[i].src->plen);
+                                      routes[i]->src->prefix,
+                                      routes[i]->src->plen);
             }
         }
         delay_jitter(&net->update_timeout, net->update_interval);
+        reschedule_network(net);
     }
     schedule_update_flush(net, urgent);
 }
@@ -1078,7 +1170,7 @@ send_self_update(struct network *net)
     if(!network_idle(net)) {
         debugf("Sending self update to %s.\n", net->ifname);
         for(i = 0; i < numxroutes; i++)
-            send_update(net, 0, xroutes[i].prefix, xroutes[i].plen);
+            send_update(net, 0, xroutes[i]->prefix, xroutes[i]->plen);
     }
 }
 
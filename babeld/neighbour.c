@@ -38,6 +38,10 @@ THE SOFTWARE.
 
 struct neighbour *neighs = NULL;
 
+/* Neighbours whose cost may have changed since we last updated the
+   routes through them. */
+static struct neighbour *changed_neighbours = NULL;
+
 static struct neighbour *
 find_neighbour_nocreate(const unsigned char *address, struct network *net)
 {
@@ -58,6 +62,17 @@ flush_neighbour(struct neighbour *neigh)
         flush_unicast(1);
     flush_resends(neigh);
 
+    if(neigh->dirty) {
+        if(changed_neighbours == neigh) {
+            changed_neighbours = neigh->dirty_next;
+        } else {
+            struct neighbour *previous = changed_neighbours;
+            while(previous->dirty_next != neigh)
+                previous = previous->dirty_next;
+            previous->dirty_next = neigh->dirty_next;
+        }
+    }
+
     if(neighs == neigh) {
         neighs = neigh->next;
     } else {
@@ -70,8 +85,11 @@ flush_neighbour(struct neighbour *neigh)
     free(neigh);
 }
 
+/* Like find_neighbour, but doesn't send a hello to a new neighbour.  This
+   is used when restoring neighbours saved by a previous instance, which
+   shouldn't be told about us until we've restored them properly. */
 struct neighbour *
-find_neighbour(const unsigned char *address, struct network *net)
+add_neighbour(const unsigned char *address, struct network *net)
 {
     struct neighbour *neigh;
     const struct timeval zero = {0, 0};
@@ -98,10 +116,28 @@ find_neighbour(const unsigned char *address, struct network *net)
     neigh->hello_interval = 0;
     neigh->ihu_interval = 0;
     neigh->network = net;
+    neigh->routes = NULL;
+    neigh->cost = INFINITY;
+    neigh->dirty = 0;
+    neigh->dirty_next = NULL;
     neigh->next = neighs;
     neighs = neigh;
     local_notify_neighbour(neigh, LOCAL_ADD);
-    send_hello(net);
+    return neigh;
+}
+
+struct neighbour *
+find_neighbour(const unsigned char *address, struct network *net)
+{
+    struct neighbour *neigh;
+
+    neigh = find_neighbour_nocreate(address, net);
+    if(neigh)
+        return neigh;
+
+    neigh = add_neighbour(address, net);
+    if(neigh)
+        send_hello(net);
     return neigh;
 }
 
@@ -248,10 +284,11 @@ check_neighbours()
         rc = reset_txcost(neigh);
         changed = changed || rc;
 
-        if(changed) {
-            update_neighbour_metric(neigh);
+        /* This only touches the routes if the cost has actually
+           changed, so it's cheap enough to do every time. */
+        update_neighbour_metric(neigh);
+        if(changed)
             local_notify_neighbour(neigh, LOCAL_CHANGE);
-        }
 
         if(neigh->hello_interval > 0)
             msecs = MIN(msecs, neigh->hello_interval * 10);
@@ -263,6 +300,31 @@ check_neighbours()
     return msecs;
 }
 
+/* Remember that the cost of neigh may have changed.  Receiving a burst
+   of packets from a neighbour will then only update its routes once. */
+
+void
+neighbour_changed(struct neighbour *neigh)
+{
+    if(neigh->dirty)
+        return;
+    neigh->dirty = 1;
+    neigh->dirty_next = changed_neighbours;
+    changed_neighbours = neigh;
+}
+
+void
+update_changed_neighbours()
+{
+    while(changed_neighbours) {
+        struct neighbour *neigh = changed_neighbours;
+        changed_neighbours = neigh->dirty_next;
+        neigh->dirty = 0;
+        neigh->dirty_next = NULL;
+        update_neighbour_metric(neigh);
+    }
+}
+
 unsigned
 neighbour_rxcost(struct neighbour *neigh)
 {
@@ -32,6 +32,10 @@ struct neighbour {
     unsigned short hello_interval; /* in centiseconds */
     unsigned short ihu_interval;   /* in centiseconds */
     struct network *network;
+    struct route *routes;        /* routes through this neighbour */
+    unsigned short cost;         /* as last applied to the routes */
+    char dirty;                  /* in the set of changed neighbours */
+    struct neighbour *dirty_next;
 };
 
 extern struct neighbour *neighs;
@@ -43,8 +47,12 @@ int neighbour_valid(struct neighbour *neigh);
 void flush_neighbour(struct neighbour *neigh);
 struct neighbour *find_neighbour(const unsigned char *address,
                                  struct network *net);
+struct neighbour *add_neighbour(const unsigned char *address,
+                                struct network *net);
 int update_neighbour(struct neighbour *neigh, int hello, int hello_interval);
 unsigned check_neighbours(void);
+void neighbour_changed(struct neighbour *neigh);
+void update_changed_neighbours(void);
 unsigned neighbour_txcost(struct neighbour *neigh);
 unsigned neighbour_rxcost(struct neighbour *neigh);
 unsigned neighbour_cost(struct neighbour *neigh);
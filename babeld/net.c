@@ -20,8 +20,14 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#ifdef __linux
+/* For recvmmsg and sendmmsg. */
+#define _GNU_SOURCE
+#endif
+
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -35,6 +41,25 @@ THE SOFTWARE.
 #include "util.h"
 #include "net.h"
 
+/* While batching, outgoing packets are copied here, and sent together
+   when the batch ends. */
+
+#define SEND_BATCH 32
+#define SEND_BATCH_BUFSIZE (64 * 1024)
+
+struct queued_packet {
+    int s;
+    int len;
+    int slen;
+    struct sockaddr_in6 sin6;
+};
+
+static int send_batching = 0;
+static unsigned char send_buf[SEND_BATCH_BUFSIZE];
+static int send_buf_len = 0;
+static struct queued_packet send_queue[SEND_BATCH];
+static int send_queue_len = 0;
+
 int
 babel_socket(int port)
 {
@@ -121,10 +146,56 @@ babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen)
     return rc;
 }
 
+/* Receive up to n packets into consecutive slots of buflen bytes each.
+   Returns the number of packets received, with their lengths in lens. */
+
 int
-babel_send(int s,
-           const void *buf1, int buflen1, const void *buf2, int buflen2,
-           const struct sockaddr *sin, int slen)
+babel_recv_batch(int s, unsigned char *buf, int buflen, int n,
+                 struct sockaddr_in6 *sin6, int *lens)
+{
+#ifdef __linux
+    struct mmsghdr msgs[n];
+    struct iovec iovecs[n];
+    int i, rc;
+
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for(i = 0; i < n; i++) {
+        iovecs[i].iov_base = buf + i * buflen;
+        iovecs[i].iov_len = buflen;
+        msgs[i].msg_hdr.msg_name = &sin6[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    rc = recvmmsg(s, msgs, n, MSG_DONTWAIT, NULL);
+    if(rc < 0)
+        return -1;
+
+    for(i = 0; i < rc; i++)
+        lens[i] = msgs[i].msg_len;
+    return rc;
+#else
+    int i, rc;
+
+    for(i = 0; i < n; i++) {
+        rc = babel_recv(s, buf + i * buflen, buflen,
+                        (struct sockaddr*)&sin6[i], sizeof(struct sockaddr_in6));
+        if(rc < 0) {
+            if(i > 0 && (errno == EAGAIN || errno == EINTR))
+                break;
+            return -1;
+        }
+        lens[i] = rc;
+    }
+    return i;
+#endif
+}
+
+static int
+babel_send_now(int s,
+               const void *buf1, int buflen1, const void *buf2, int buflen2,
+               const struct sockaddr *sin, int slen)
 {
     struct iovec iovec[2];
     struct msghdr msg;
@@ -156,6 +227,126 @@ babel_send(int s,
     return rc;
 }
 
+#ifdef __linux
+static int
+send_queued(int start, int count)
+{
+    struct mmsghdr msgs[SEND_BATCH];
+    struct iovec iovecs[SEND_BATCH];
+    unsigned char *p = send_buf;
+    int i, rc;
+
+    for(i = 0; i < start; i++)
+        p += send_queue[i].len;
+
+    memset(msgs, 0, count * sizeof(struct mmsghdr));
+    for(i = 0; i < count; i++) {
+        struct queued_packet *q = &send_queue[start + i];
+        iovecs[i].iov_base = p;
+        iovecs[i].iov_len = q->len;
+        msgs[i].msg_hdr.msg_name = &q->sin6;
+        msgs[i].msg_hdr.msg_namelen = q->slen;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        p += q->len;
+    }
+
+ again:
+    rc = sendmmsg(send_queue[start].s, msgs, count, 0);
+    if(rc < 0) {
+        if(errno == EINTR)
+            goto again;
+        else if(errno == EAGAIN) {
+            int rc2;
+            rc2 = wait_for_fd(1, send_queue[start].s, 5);
+            if(rc2 > 0)
+                goto again;
+            errno = EAGAIN;
+        }
+    }
+    return rc;
+}
+#endif
+
+/* Send all queued packets.  Consecutive packets on the same socket go
+   out in a single system call where possible. */
+
+static void
+flush_send_queue(void)
+{
+    int i = 0;
+
+    while(i < send_queue_len) {
+        int rc;
+#ifdef __linux
+        int n = 1;
+        while(i + n < send_queue_len && send_queue[i + n].s == send_queue[i].s)
+            n++;
+        rc = send_queued(i, n);
+        if(rc > 0) {
+            i += rc;
+            continue;
+        }
+#else
+        unsigned char *p = send_buf;
+        int j;
+        for(j = 0; j < i; j++)
+            p += send_queue[j].len;
+        rc = babel_send_now(send_queue[i].s, p, send_queue[i].len, NULL, 0,
+                            (struct sockaddr*)&send_queue[i].sin6,
+                            send_queue[i].slen);
+#endif
+        if(rc < 0)
+            /* Drop this packet, as babel_send would have. */
+            perror("send");
+        i++;
+    }
+
+    send_buf_len = 0;
+    send_queue_len = 0;
+}
+
+int
+babel_send(int s,
+           const void *buf1, int buflen1, const void *buf2, int buflen2,
+           const struct sockaddr *sin, int slen)
+{
+    struct queued_packet *q;
+
+    if(!send_batching || buflen1 + buflen2 > SEND_BATCH_BUFSIZE ||
+       slen > sizeof(struct sockaddr_in6))
+        return babel_send_now(s, buf1, buflen1, buf2, buflen2, sin, slen);
+
+    if(send_queue_len >= SEND_BATCH ||
+       send_buf_len + buflen1 + buflen2 > SEND_BATCH_BUFSIZE)
+        flush_send_queue();
+
+    q = &send_queue[send_queue_len++];
+    q->s = s;
+    q->len = buflen1 + buflen2;
+    q->slen = slen;
+    memcpy(&q->sin6, sin, slen);
+    memcpy(send_buf + send_buf_len, buf1, buflen1);
+    memcpy(send_buf + send_buf_len + buflen1, buf2, buflen2);
+    send_buf_len += q->len;
+    return q->len;
+}
+
+/* Between these two calls, babel_send only queues packets. */
+
+void
+babel_start_batch()
+{
+    send_batching = 1;
+}
+
+void
+babel_end_batch()
+{
+    flush_send_queue();
+    send_batching = 0;
+}
+
 int
 tcp_server_socket(int port, int local)
 {
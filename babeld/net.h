@@ -22,7 +22,11 @@ THE SOFTWARE.
 
 int babel_socket(int port);
 int babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen);
+int babel_recv_batch(int s, unsigned char *buf, int buflen, int n,
+                     struct sockaddr_in6 *sin6, int *lens);
 int babel_send(int s,
                const void *buf1, int buflen1, const void *buf2, int buflen2,
                const struct sockaddr *sin, int slen);
+void babel_start_batch(void);
+void babel_end_batch(void);
 int tcp_server_socket(int port, int local);
@@ -41,6 +41,11 @@ THE SOFTWARE.
 
 struct network *networks = NULL;
 
+/* Networks that are up, in a binary heap ordered by their earliest
+   timeout, so that the main loop never needs to walk all of them. */
+static struct network **net_heap = NULL;
+static int net_heap_size = 0, net_heap_max = 0;
+
 static struct network *
 last_network(void)
 {
@@ -81,6 +86,7 @@ add_network(char *ifname, struct network_conf *conf)
     net->bucket_time = now.tv_sec;
     net->bucket = BUCKET_TOKENS_MAX;
     net->hello_seqno = (random() & 0xFFFF);
+    net->heap_index = -1;
 
     if(networks == NULL)
         networks = net;
@@ -150,6 +156,111 @@ delay_jitter(struct timeval *timeout, int msecs)
     timeval_plus_msec(timeout, &now, roughly(msecs));
 }
 
+static void
+heap_set(int i, struct network *net)
+{
+    net_heap[i] = net;
+    net->heap_index = i;
+}
+
+static void
+heap_up(int i)
+{
+    struct network *net = net_heap[i];
+
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if(timeval_compare(&net_heap[parent]->timeout, &net->timeout) <= 0)
+            break;
+        heap_set(i, net_heap[parent]);
+        i = parent;
+    }
+    heap_set(i, net);
+}
+
+static void
+heap_down(int i)
+{
+    struct network *net = net_heap[i];
+
+    while(1) {
+        int child = 2 * i + 1;
+        if(child >= net_heap_size)
+            break;
+        if(child + 1 < net_heap_size &&
+           timeval_compare(&net_heap[child + 1]->timeout,
+                           &net_heap[child]->timeout) < 0)
+            child++;
+        if(timeval_compare(&net->timeout, &net_heap[child]->timeout) <= 0)
+            break;
+        heap_set(i, net_heap[child]);
+        i = child;
+    }
+    heap_set(i, net);
+}
+
+/* Must be called whenever one of the timeouts of net changes, or when
+   net goes up or down. */
+
+void
+reschedule_network(struct network *net)
+{
+    struct timeval timeout = {0, 0};
+    int i = net->heap_index;
+
+    if(net_up(net)) {
+        timeval_min(&timeout, &net->hello_timeout);
+        timeval_min(&timeout, &net->update_timeout);
+        timeval_min(&timeout, &net->update_flush_timeout);
+        timeval_min(&timeout, &net->flush_timeout);
+    }
+
+    if(timeout.tv_sec == 0) {
+        if(i >= 0) {
+            net_heap_size--;
+            if(i < net_heap_size) {
+                heap_set(i, net_heap[net_heap_size]);
+                heap_up(i);
+                heap_down(net_heap[i]->heap_index);
+            }
+            net->heap_index = -1;
+        }
+        net->timeout = timeout;
+        return;
+    }
+
+    if(i < 0) {
+        if(net_heap_size >= net_heap_max) {
+            struct network **new_heap;
+            int n = net_heap_max < 1 ? 8 : 2 * net_heap_max;
+            new_heap = realloc(net_heap, n * sizeof(struct network*));
+            if(new_heap == NULL) {
+                /* Keep running; we'll try again at the next change. */
+                perror("realloc(net_heap)");
+                return;
+            }
+            net_heap = new_heap;
+            net_heap_max = n;
+        }
+        net->timeout = timeout;
+        heap_set(net_heap_size++, net);
+        heap_up(net->heap_index);
+    } else {
+        int earlier = timeval_compare(&timeout, &net->timeout) < 0;
+        net->timeout = timeout;
+        if(earlier)
+            heap_up(i);
+        else
+            heap_down(i);
+    }
+}
+
+struct network *
+first_network_timeout()
+{
+    return net_heap_size > 0 ? net_heap[0] : NULL;
+}
+
 static int
 check_network_ipv4(struct network *net)
 {
@@ -196,6 +307,7 @@ network_up(struct network *net, int up)
         net->flags |= NET_UP;
     else
         net->flags &= ~NET_UP;
+    reschedule_network(net);
 
     if(up) {
         struct kernel_route ll[32];
@@ -344,10 +456,13 @@ network_up(struct network *net, int up)
         net->bufsize = 0;
         free(net->sendbuf);
         net->num_buffered_updates = 0;
+        net->num_update_groups = 0;
         net->update_bufsize = 0;
         if(net->buffered_updates)
             free(net->buffered_updates);
         net->buffered_updates = NULL;
+        net->update_groups = NULL;
+        net->update_hash = net->group_hash = NULL;
         net->sendbuf = NULL;
         if(net->ifindex > 0) {
             memset(&mreq, 0, sizeof(mreq));
@@ -377,6 +492,7 @@ network_up(struct network *net, int up)
     if(up && rc > 0)
         send_update(net, 0, NULL, 0);
 
+    reschedule_network(net);
     return 1;
 }
 
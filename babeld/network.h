@@ -25,6 +25,17 @@ struct buffered_update {
     unsigned char prefix[16];
     unsigned char plen;
     unsigned char pad[3];
+    int next;                   /* next update in the same group, or -1 */
+    int hash_next;              /* next update in the same bucket, or -1 */
+};
+
+/* Buffered updates with the same router-id and address family. */
+struct update_group {
+    unsigned char id[8];
+    unsigned char v4;
+    unsigned char pad[3];
+    int first, last;
+    int hash_next;
 };
 
 struct network_conf {
@@ -57,6 +68,8 @@ struct network {
     struct timeval update_timeout;
     struct timeval flush_timeout;
     struct timeval update_flush_timeout;
+    struct timeval timeout;     /* earliest of the above */
+    int heap_index;             /* in the timeout heap, or -1 */
     char ifname[IF_NAMESIZE];
     unsigned char *ipv4;
     int numll;
@@ -74,6 +87,10 @@ struct network {
     struct buffered_update *buffered_updates;
     int num_buffered_updates;
     int update_bufsize;
+    struct update_group *update_groups;
+    int num_update_groups;
+    int *update_hash, *group_hash;
+    int update_hash_size;
     time_t bucket_time;
     unsigned int bucket;
     time_t activity_time;
@@ -102,6 +119,8 @@ int update_hello_interval(struct network *net);
 unsigned jitter(struct network *net, int urgent);
 unsigned update_jitter(struct network *net, int urgent);
 void delay_jitter(struct timeval *timeout, int msecs);
+void reschedule_network(struct network *net);
+struct network *first_network_timeout(void);
 int network_up(struct network *net, int up);
 int network_ll_address(struct network *net, const unsigned char *address);
 void check_networks(void);
@@ -22,6 +22,7 @@ THE SOFTWARE.
 
 #include <sys/time.h>
 #include <time.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -34,7 +35,17 @@ THE SOFTWARE.
 #include "config.h"
 
 struct timeval resend_time = {0, 0};
-struct resend *to_resend = NULL;
+
+/* Resends are hashed on (kind, prefix, plen).  Those that are waiting to
+   be sent again are also kept in a binary heap ordered by deadline, so that
+   do_resend only looks at the ones that are due. */
+
+static struct resend **resend_hash = NULL;
+static int resend_hash_size = 0, numresends = 0;
+static struct resend **resend_heap = NULL;
+static int resend_heap_size = 0, resend_heap_max = 0;
+
+static int resend_expired(struct resend *resend);
 
 static int
 resend_match(struct resend *resend,
@@ -44,6 +55,163 @@ resend_match(struct resend *resend,
             resend->plen == plen && memcmp(resend->prefix, prefix, 16) == 0);
 }
 
+static inline struct resend **
+resend_bucket(int kind, const unsigned char *prefix, unsigned char plen)
+{
+    unsigned char k = kind;
+    unsigned h = hash_bytes(hash_prefix(prefix, plen), &k, 1);
+    return &resend_hash[h & (resend_hash_size - 1)];
+}
+
+static int
+resize_resend_hash(int n)
+{
+    struct resend **new_hash;
+    struct resend **old_hash = resend_hash;
+    int i, old_size = resend_hash_size;
+
+    new_hash = calloc(n, sizeof(struct resend*));
+    if(new_hash == NULL)
+        return -1;
+
+    resend_hash = new_hash;
+    resend_hash_size = n;
+
+    for(i = 0; i < old_size; i++) {
+        struct resend *resend = old_hash[i];
+        while(resend) {
+            struct resend *next = resend->hash_next;
+            struct resend **bucket =
+                resend_bucket(resend->kind, resend->prefix, resend->plen);
+            resend->hash_next = *bucket;
+            *bucket = resend;
+            resend = next;
+        }
+    }
+    free(old_hash);
+    return 1;
+}
+
+static void
+heap_set(int i, struct resend *resend)
+{
+    resend_heap[i] = resend;
+    resend->heap_index = i;
+}
+
+static void
+heap_up(int i)
+{
+    struct resend *resend = resend_heap[i];
+
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if(timeval_compare(&resend_heap[parent]->deadline,
+                           &resend->deadline) <= 0)
+            break;
+        heap_set(i, resend_heap[parent]);
+        i = parent;
+    }
+    heap_set(i, resend);
+}
+
+static void
+heap_down(int i)
+{
+    struct resend *resend = resend_heap[i];
+
+    while(1) {
+        int child = 2 * i + 1;
+        if(child >= resend_heap_size)
+            break;
+        if(child + 1 < resend_heap_size &&
+           timeval_compare(&resend_heap[child + 1]->deadline,
+                           &resend_heap[child]->deadline) < 0)
+            child++;
+        if(timeval_compare(&resend->deadline,
+                           &resend_heap[child]->deadline) <= 0)
+            break;
+        heap_set(i, resend_heap[child]);
+        i = child;
+    }
+    heap_set(i, resend);
+}
+
+static void
+heap_remove(struct resend *resend)
+{
+    int i = resend->heap_index;
+
+    if(i < 0)
+        return;
+
+    resend_heap_size--;
+    if(i < resend_heap_size) {
+        heap_set(i, resend_heap[resend_heap_size]);
+        heap_up(i);
+        heap_down(resend_heap[i]->heap_index);
+    }
+    resend->heap_index = -1;
+}
+
+/* Must be called whenever the time, delay or max of a resend changes.
+   Doesn't update resend_time, the caller should call
+   recompute_resend_time when it's done. */
+
+static void
+reschedule_resend(struct resend *resend)
+{
+    struct timeval deadline;
+    int i = resend->heap_index;
+
+    if(resend_expired(resend) || resend->delay == 0 || resend->max <= 0) {
+        heap_remove(resend);
+        return;
+    }
+
+    timeval_plus_msec(&deadline, &resend->time, resend->delay);
+
+    if(i < 0) {
+        if(resend_heap_size >= resend_heap_max) {
+            struct resend **new_heap;
+            int n = resend_heap_max < 1 ? 16 : 2 * resend_heap_max;
+            new_heap = realloc(resend_heap, n * sizeof(struct resend*));
+            if(new_heap == NULL) {
+                perror("realloc(resend_heap)");
+                return;
+            }
+            resend_heap = new_heap;
+            resend_heap_max = n;
+        }
+        resend->deadline = deadline;
+        heap_set(resend_heap_size++, resend);
+        heap_up(resend->heap_index);
+    } else {
+        int earlier = timeval_compare(&deadline, &resend->deadline) < 0;
+        resend->deadline = deadline;
+        if(earlier)
+            heap_up(i);
+        else
+            heap_down(i);
+    }
+}
+
+static void
+flush_resend(struct resend *resend)
+{
+    struct resend **p;
+
+    heap_remove(resend);
+
+    p = resend_bucket(resend->kind, resend->prefix, resend->plen);
+    while(*p != resend)
+        p = &(*p)->hash_next;
+    *p = resend->hash_next;
+
+    free(resend);
+    numresends--;
+}
+
 /* This is called by neigh.c when a neighbour is flushed */
 
 void
@@ -53,31 +221,26 @@ flush_resends(struct neighbour *neigh)
 }
 
 static struct resend *
-find_resend(int kind, const unsigned char *prefix, unsigned char plen,
-             struct resend **previous_return)
+find_resend(int kind, const unsigned char *prefix, unsigned char plen)
 {
-    struct resend *current, *previous;
-
-    previous = NULL;
-    current = to_resend;
-    while(current) {
-        if(resend_match(current, kind, prefix, plen)) {
-            if(previous_return)
-                *previous_return = previous;
-            return current;
-        }
-        previous = current;
-        current = current->next;
+    struct resend *resend;
+
+    if(resend_hash_size == 0)
+        return NULL;
+
+    for(resend = *resend_bucket(kind, prefix, plen); resend;
+        resend = resend->hash_next) {
+        if(resend_match(resend, kind, prefix, plen))
+            return resend;
     }
 
     return NULL;
 }
 
 struct resend *
-find_request(const unsigned char *prefix, unsigned char plen,
-             struct resend **previous_return)
+find_request(const unsigned char *prefix, unsigned char plen)
 {
-    return find_resend(RESEND_REQUEST, prefix, plen, previous_return);
+    return find_resend(RESEND_REQUEST, prefix, plen);
 }
 
 int
@@ -97,7 +260,7 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
     if(delay >= 0xFFFF)
         delay = 0xFFFF;
 
-    resend = find_resend(kind, prefix, plen, NULL);
+    resend = find_resend(kind, prefix, plen);
     if(resend) {
         if(resend->delay && delay)
             resend->delay = MIN(resend->delay, delay);
@@ -107,6 +270,8 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
         resend->max = kind == RESEND_REQUEST ? 128 : UPDATE_MAX;
         if(id && memcmp(resend->id, id, 8) == 0 &&
            seqno_compare(resend->seqno, seqno) > 0) {
+            reschedule_resend(resend);
+            recompute_resend_time();
             return 0;
         }
         if(id)
@@ -117,6 +282,17 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
         if(resend->network != network)
             resend->network = NULL;
     } else {
+        struct resend **bucket;
+
+        if(numresends >= resend_hash_size) {
+            int rc = resize_resend_hash(resend_hash_size < 1 ?
+                                        16 : 2 * resend_hash_size);
+            if(rc < 0 && resend_hash_size < 1) {
+                perror("malloc(resend_hash)");
+                return -1;
+            }
+        }
+
         resend = malloc(sizeof(struct resend));
         if(resend == NULL)
             return -1;
@@ -132,15 +308,15 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
             memset(resend->id, 0, 8);
         resend->network = network;
         resend->time = now;
-        resend->next = to_resend;
-        to_resend = resend;
+        resend->heap_index = -1;
+        bucket = resend_bucket(kind, prefix, plen);
+        resend->hash_next = *bucket;
+        *bucket = resend;
+        numresends++;
     }
 
-    if(resend->delay) {
-        struct timeval timeout;
-        timeval_plus_msec(&timeout, &resend->time, resend->delay);
-        timeval_min(&resend_time, &timeout);
-    }
+    reschedule_resend(resend);
+    recompute_resend_time();
     return 1;
 }
 
@@ -161,7 +337,7 @@ unsatisfied_request(const unsigned char *prefix, unsigned char plen,
 {
     struct resend *request;
 
-    request = find_request(prefix, plen, NULL);
+    request = find_request(prefix, plen);
     if(request == NULL || resend_expired(request))
         return 0;
 
@@ -180,7 +356,7 @@ request_redundant(struct network *net,
 {
     struct resend *request;
 
-    request = find_request(prefix, plen, NULL);
+    request = find_request(prefix, plen);
     if(request == NULL || resend_expired(request))
         return 0;
 
@@ -208,9 +384,9 @@ satisfy_request(const unsigned char *prefix, unsigned char plen,
                 unsigned short seqno, const unsigned char *id,
                 struct network *network)
 {
-    struct resend *request, *previous;
+    struct resend *request;
 
-    request = find_request(prefix, plen, &previous);
+    request = find_request(prefix, plen);
     if(request == NULL)
         return 0;
 
@@ -219,10 +395,7 @@ satisfy_request(const unsigned char *prefix, unsigned char plen,
 
     if(memcmp(request->id, id, 8) != 0 ||
        seqno_compare(request->seqno, seqno) <= 0) {
-        /* We cannot remove the request, as we may be walking the list right
-           now.  Mark it as expired, so that expire_resend will remove it. */
-        request->max = 0;
-        request->time.tv_sec = 0;
+        flush_resend(request);
         recompute_resend_time();
         return 1;
     }
@@ -233,48 +406,27 @@ satisfy_request(const unsigned char *prefix, unsigned char plen,
 void
 expire_resend()
 {
-    struct resend *current, *previous;
-    int recompute = 0;
-
-    previous = NULL;
-    current = to_resend;
-    while(current) {
-        if(resend_expired(current)) {
-            if(previous == NULL) {
-                to_resend = current->next;
-                free(current);
-                current = to_resend;
-            } else {
-                previous->next = current->next;
-                free(current);
-                current = previous->next;
-            }
-            recompute = 1;
-        } else {
-            current = current->next;
+    int i;
+
+    for(i = 0; i < resend_hash_size; i++) {
+        struct resend *resend = resend_hash[i];
+        while(resend) {
+            struct resend *next = resend->hash_next;
+            if(resend_expired(resend))
+                flush_resend(resend);
+            resend = next;
         }
     }
-    if(recompute)
-        recompute_resend_time();
+    recompute_resend_time();
 }
 
 void
 recompute_resend_time()
 {
-    struct resend *request;
-    struct timeval resend = {0, 0};
-
-    request = to_resend;
-    while(request) {
-        if(!resend_expired(request) && request->delay > 0 && request->max > 0) {
-            struct timeval timeout;
-            timeval_plus_msec(&timeout, &request->time, request->delay);
-            timeval_min(&resend, &timeout);
-        }
-        request = request->next;
-    }
-
-    resend_time = resend;
+    if(resend_heap_size > 0)
+        resend_time = resend_heap[0]->deadline;
+    else
+        resend_time.tv_sec = resend_time.tv_usec = 0;
 }
 
 void
@@ -282,29 +434,32 @@ do_resend()
 {
     struct resend *resend;
 
-    resend = to_resend;
-    while(resend) {
-        if(!resend_expired(resend) && resend->delay > 0 && resend->max > 0) {
-            struct timeval timeout;
-            timeval_plus_msec(&timeout, &resend->time, resend->delay);
-            if(timeval_compare(&now, &timeout) >= 0) {
-                switch(resend->kind) {
-                case RESEND_REQUEST:
-                    send_multihop_request(resend->network,
-                                          resend->prefix, resend->plen,
-                                          resend->seqno, resend->id, 127);
-                    break;
-                case RESEND_UPDATE:
-                    send_update(resend->network, 1,
-                                resend->prefix, resend->plen);
-                    break;
-                default: abort();
-                }
-                resend->delay = MIN(0xFFFF, resend->delay * 2);
-                resend->max--;
+    while(resend_heap_size > 0) {
+        resend = resend_heap[0];
+        if(timeval_compare(&now, &resend->deadline) < 0)
+            break;
+        if(!resend_expired(resend)) {
+            switch(resend->kind) {
+            case RESEND_REQUEST:
+                send_multihop_request(resend->network,
+                                      resend->prefix, resend->plen,
+                                      resend->seqno, resend->id, 127);
+                break;
+            case RESEND_UPDATE:
+                send_update(resend->network, 1,
+                            resend->prefix, resend->plen);
+                break;
+            default: abort();
             }
+            resend->delay = MIN(0xFFFF, resend->delay * 2);
+            resend->max--;
         }
-        resend = resend->next;
+        reschedule_resend(resend);
+        /* If we're late, leave the rest for the next time around rather
+           than sending the same thing twice in a row. */
+        if(resend->heap_index >= 0 &&
+           timeval_compare(&now, &resend->deadline) >= 0)
+            break;
     }
     recompute_resend_time();
 }
@@ -40,21 +40,149 @@ THE SOFTWARE.
 #include "config.h"
 #include "local.h"
 
-struct route *routes = NULL;
+struct route **routes = NULL;
 int numroutes = 0, maxroutes = 0;
 int kernel_metric = 0;
 int allow_duplicates = -1;
 
+/* Routes are indexed by destination in a hash table with chaining.  All
+   the routes to a given prefix live in the same bucket, so that looking up
+   the installed or best route only touches that prefix's routes. */
+
+static struct route **route_hash = NULL;
+static int route_hash_size = 0;
+
+static inline struct route **
+route_bucket(const unsigned char *prefix, unsigned char plen)
+{
+    return &route_hash[hash_prefix(prefix, plen) & (route_hash_size - 1)];
+}
+
+static int
+resize_route_hash(int n)
+{
+    struct route **new_hash;
+    struct route **old_hash = route_hash;
+    int i, old_size = route_hash_size;
+
+    new_hash = calloc(n, sizeof(struct route*));
+    if(new_hash == NULL)
+        return -1;
+
+    route_hash = new_hash;
+    route_hash_size = n;
+
+    for(i = 0; i < old_size; i++) {
+        struct route *route = old_hash[i];
+        while(route) {
+            struct route *next = route->hash_next;
+            struct route **bucket =
+                route_bucket(route->src->prefix, route->src->plen);
+            route->hash_next = *bucket;
+            *bucket = route;
+            route = next;
+        }
+    }
+    free(old_hash);
+    return 1;
+}
+
+static int
+link_route(struct route *route)
+{
+    struct route **bucket;
+
+    if(numroutes >= maxroutes) {
+        struct route **new_routes;
+        int n = maxroutes < 1 ? 8 : 2 * maxroutes;
+        new_routes = realloc(routes, n * sizeof(struct route*));
+        if(new_routes == NULL)
+            return -1;
+        maxroutes = n;
+        routes = new_routes;
+    }
+
+    if(numroutes >= route_hash_size) {
+        int rc = resize_route_hash(route_hash_size < 1 ?
+                                   16 : 2 * route_hash_size);
+        if(rc < 0 && route_hash_size < 1)
+            return -1;
+        /* Otherwise, just live with longer chains. */
+    }
+
+    route->index = numroutes;
+    routes[numroutes++] = route;
+
+    bucket = route_bucket(route->src->prefix, route->src->plen);
+    route->hash_next = *bucket;
+    *bucket = route;
+
+    route->neigh_prev = NULL;
+    route->neigh_next = route->neigh->routes;
+    if(route->neigh_next)
+        route->neigh_next->neigh_prev = route;
+    route->neigh->routes = route;
+    return 1;
+}
+
+static void
+unlink_route(struct route *route)
+{
+    struct route **p;
+    int i = route->index;
+
+    assert(i >= 0 && i < numroutes && routes[i] == route);
+
+    p = route_bucket(route->src->prefix, route->src->plen);
+    while(*p != route)
+        p = &(*p)->hash_next;
+    *p = route->hash_next;
+
+    if(route->neigh_prev)
+        route->neigh_prev->neigh_next = route->neigh_next;
+    else
+        route->neigh->routes = route->neigh_next;
+    if(route->neigh_next)
+        route->neigh_next->neigh_prev = route->neigh_prev;
+
+    if(i != numroutes - 1) {
+        routes[i] = routes[numroutes - 1];
+        routes[i]->index = i;
+    }
+    numroutes--;
+
+    if(numroutes == 0) {
+        free(routes);
+        routes = NULL;
+        maxroutes = 0;
+        free(route_hash);
+        route_hash = NULL;
+        route_hash_size = 0;
+    } else if(maxroutes > 8 && numroutes < maxroutes / 4) {
+        struct route **new_routes;
+        int n = maxroutes / 2;
+        new_routes = realloc(routes, n * sizeof(struct route*));
+        if(new_routes != NULL) {
+            routes = new_routes;
+            maxroutes = n;
+        }
+    }
+}
+
 struct route *
 find_route(const unsigned char *prefix, unsigned char plen,
            struct neighbour *neigh, const unsigned char *nexthop)
 {
-    int i;
-    for(i = 0; i < numroutes; i++) {
-        if(routes[i].neigh == neigh &&
-           memcmp(routes[i].nexthop, nexthop, 16) == 0 &&
-           source_match(routes[i].src, prefix, plen))
-            return &routes[i];
+    struct route *route;
+
+    if(route_hash_size == 0)
+        return NULL;
+
+    for(route = *route_bucket(prefix, plen); route; route = route->hash_next) {
+        if(route->neigh == neigh &&
+           memcmp(route->nexthop, nexthop, 16) == 0 &&
+           source_match(route->src, prefix, plen))
+            return route;
     }
     return NULL;
 }
@@ -62,25 +190,48 @@ find_route(const unsigned char *prefix, unsigned char plen,
 struct route *
 find_installed_route(const unsigned char *prefix, unsigned char plen)
 {
-    int i;
-    for(i = 0; i < numroutes; i++) {
-        if(routes[i].installed && source_match(routes[i].src, prefix, plen))
-            return &routes[i];
+    struct route *route;
+
+    if(route_hash_size == 0)
+        return NULL;
+
+    for(route = *route_bucket(prefix, plen); route; route = route->hash_next) {
+        if(route->installed && source_match(route->src, prefix, plen))
+            return route;
     }
     return NULL;
 }
 
+/* The time from which src needs to be kept for another SOURCE_GC_TIME:
+   the last update of a route using it, or later if such a route is held
+   for longer than that. */
+time_t
+source_routes_time(struct source *src)
+{
+    struct route *route;
+    time_t t = 0;
+
+    if(route_hash_size == 0)
+        return t;
+
+    for(route = *route_bucket(src->prefix, src->plen); route;
+        route = route->hash_next) {
+        if(route->src != src)
+            continue;
+        t = MAX(t, route->time);
+        if(route->hold_time > SOURCE_GC_TIME)
+            t = MAX(t, route->time + route->hold_time - SOURCE_GC_TIME);
+    }
+    return t;
+}
+
 void
 flush_route(struct route *route)
 {
-    int i;
     struct source *src;
     unsigned oldmetric;
     int lost = 0;
 
-    i = route - routes;
-    assert(i >= 0 && i < numroutes);
-
     oldmetric = route_metric(route);
 
     if(route->installed) {
@@ -91,25 +242,10 @@ flush_route(struct route *route)
     local_notify_route(route, LOCAL_FLUSH);
 
     src = route->src;
+    src->route_count--;
 
-    if(i != numroutes - 1)
-        memcpy(routes + i, routes + numroutes - 1, sizeof(struct route));
-    numroutes--;
-    VALGRIND_MAKE_MEM_UNDEFINED(routes + numroutes, sizeof(struct route));
-
-    if(numroutes == 0) {
-        free(routes);
-        routes = NULL;
-        maxroutes = 0;
-    } else if(maxroutes > 8 && numroutes < maxroutes / 4) {
-        struct route *new_routes;
-        int n = maxroutes / 2;
-        new_routes = realloc(routes, n * sizeof(struct route));
-        if(new_routes != NULL) {
-            routes = new_routes;
-            maxroutes = n;
-        }
-    }
+    unlink_route(route);
+    free(route);
 
     if(lost)
         route_lost(src, oldmetric);
@@ -118,16 +254,8 @@ flush_route(struct route *route)
 void
 flush_neighbour_routes(struct neighbour *neigh)
 {
-    int i;
-
-    i = 0;
-    while(i < numroutes) {
-        if(routes[i].neigh == neigh) {
-            flush_route(&routes[i]);
-            continue;
-        }
-        i++;
-    }
+    while(neigh->routes)
+        flush_route(neigh->routes);
 }
 
 void
@@ -137,9 +265,9 @@ flush_network_routes(struct network *net, int v4only)
 
     i = 0;
     while(i < numroutes) {
-        if(routes[i].neigh->network == net &&
-           (!v4only || v4mapped(routes[i].nexthop))) {
-           flush_route(&routes[i]);
+        if(routes[i]->neigh->network == net &&
+           (!v4only || v4mapped(routes[i]->nexthop))) {
+           flush_route(routes[i]);
            continue;
         }
         i++;
@@ -235,6 +363,47 @@ switch_routes(struct route *old, struct route *new)
     local_notify_route(new, LOCAL_CHANGE);
 }
 
+static void lose_route(struct source *src, unsigned oldmetric,
+                       struct neighbour *exclude);
+
+/* Called when a batched kernel request fails.  Since the route may have
+   been flushed in the meantime, we look it up again by its parameters.
+   A route that couldn't be added is treated as lost, so that we switch
+   to another neighbour or tell ours that we no longer have it. */
+
+void
+route_kernel_failure(int operation, struct kernel_route *kroute, int error)
+{
+    struct route *route, *failed = NULL;
+
+    errno = error;
+    if(operation == ROUTE_FLUSH) {
+        perror("kernel_route(FLUSH)");
+        return;
+    }
+
+    perror("kernel_route(ADD)");
+    if(error == EEXIST || route_hash_size == 0)
+        return;
+
+    route = *route_bucket(kroute->prefix, kroute->plen);
+    while(route) {
+        if(route->installed &&
+           source_match(route->src, kroute->prefix, kroute->plen) &&
+           memcmp(route->nexthop, kroute->gw, 16) == 0 &&
+           route->neigh->network->ifindex == kroute->ifindex) {
+            route->installed = 0;
+            local_notify_route(route, LOCAL_CHANGE);
+            failed = route;
+        }
+        route = route->hash_next;
+    }
+
+    /* Don't try the same neighbour again straight away. */
+    if(failed)
+        lose_route(failed->src, route_metric(failed), failed->neigh);
+}
+
 static void
 change_route_metric(struct route *route, unsigned newmetric)
 {
@@ -312,21 +481,23 @@ struct route *
 find_best_route(const unsigned char *prefix, unsigned char plen, int feasible,
                 struct neighbour *exclude)
 {
-    struct route *route = NULL;
-    int i;
+    struct route *route = NULL, *r;
 
-    for(i = 0; i < numroutes; i++) {
-        if(!source_match(routes[i].src, prefix, plen))
+    if(route_hash_size == 0)
+        return NULL;
+
+    for(r = *route_bucket(prefix, plen); r; r = r->hash_next) {
+        if(!source_match(r->src, prefix, plen))
             continue;
-        if(route_expired(&routes[i]))
+        if(route_expired(r))
             continue;
-        if(feasible && !route_feasible(&routes[i]))
+        if(feasible && !route_feasible(r))
             continue;
-        if(exclude && routes[i].neigh == exclude)
+        if(exclude && r->neigh == exclude)
             continue;
-        if(route && route_metric(route) <= route_metric(&routes[i]))
+        if(route && route_metric(route) <= route_metric(r))
             continue;
-        route = &routes[i];
+        route = r;
     }
     return route;
 }
@@ -351,7 +522,7 @@ update_route_metric(struct route *route)
                                       neigh->network->ifindex);
         int newmetric = MIN(route->refmetric +
                             add_metric +
-                            neighbour_cost(route->neigh),
+                            neigh->cost,
                             INFINITY);
 
         if(newmetric != oldmetric) {
@@ -361,29 +532,33 @@ update_route_metric(struct route *route)
     }
 }
 
+/* Route metrics use the neighbour's cost as of the last call to this
+   function, so that routes only need updating when the cost changes. */
+
 void
 update_neighbour_metric(struct neighbour *neigh)
 {
-    int i;
+    struct route *route, *next;
+    unsigned cost = neighbour_cost(neigh);
 
-    i = 0;
-    while(i < numroutes) {
-        if(routes[i].neigh == neigh)
-            update_route_metric(&routes[i]);
-        i++;
+    if(cost == neigh->cost)
+        return;
+
+    neigh->cost = cost;
+    for(route = neigh->routes; route; route = next) {
+        next = route->neigh_next;
+        update_route_metric(route);
     }
 }
 
 void
 update_network_metric(struct network *net)
 {
-    int i;
+    struct neighbour *neigh;
 
-    i = 0;
-    while(i < numroutes) {
-        if(routes[i].neigh->network == net)
-            update_route_metric(&routes[i]);
-        i++;
+    FOR_ALL_NEIGHBOURS(neigh) {
+        if(neigh->network == net)
+            update_neighbour_metric(neigh);
     }
 }
 
@@ -418,9 +593,14 @@ update_route(const unsigned char *a, const unsigned char *p, unsigned char plen,
     if(src == NULL)
         return NULL;
 
+    /* A hello or IHU earlier in this packet may have changed the cost,
+       typically that of a neighbour that we have only just heard from. */
+    if(neigh->dirty)
+        update_neighbour_metric(neigh);
+
     feasible = update_feasible(src, seqno, refmetric);
     route = find_route(p, plen, neigh, nexthop);
-    metric = MIN((int)refmetric + neighbour_cost(neigh) + add_metric, INFINITY);
+    metric = MIN((int)refmetric + neigh->cost + add_metric, INFINITY);
 
     if(route) {
         struct source *oldsrc;
@@ -447,7 +627,11 @@ update_route(const unsigned char *a, const unsigned char *p, unsigned char plen,
             }
         }
 
-        route->src = src;
+        if(src != route->src) {
+            route->src->route_count--;
+            src->route_count++;
+            route->src = src;
+        }
         if(feasible && refmetric < INFINITY)
             route->time = now.tv_sec;
         route->seqno = seqno;
@@ -470,18 +654,11 @@ update_route(const unsigned char *a, const unsigned char *p, unsigned char plen,
             send_unfeasible_request(neigh, 0, seqno, metric, src);
             return NULL;
         }
-        if(numroutes >= maxroutes) {
-            struct route *new_routes;
-            int n = maxroutes < 1 ? 8 : 2 * maxroutes;
-            new_routes = routes == NULL ?
-                malloc(n * sizeof(struct route)) :
-                realloc(routes, n * sizeof(struct route));
-            if(new_routes == NULL)
-                return NULL;
-            maxroutes = n;
-            routes = new_routes;
+        route = malloc(sizeof(struct route));
+        if(route == NULL) {
+            perror("malloc(route)");
+            return NULL;
         }
-        route = &routes[numroutes];
         route->src = src;
         route->refmetric = refmetric;
         route->seqno = seqno;
@@ -491,13 +668,151 @@ update_route(const unsigned char *a, const unsigned char *p, unsigned char plen,
         route->time = now.tv_sec;
         route->hold_time = hold_time;
         route->installed = 0;
-        numroutes++;
+        if(link_route(route) < 0) {
+            perror("malloc(routes)");
+            free(route);
+            return NULL;
+        }
+        src->route_count++;
         local_notify_route(route, LOCAL_ADD);
         consider_route(route);
     }
     return route;
 }
 
+/* Whether we export a route to this prefix ourselves, so that we should
+   not install one learnt from our neighbours. */
+static int
+shadowed_by_xroute(const unsigned char *prefix, unsigned char plen)
+{
+    struct xroute *xroute = find_xroute(prefix, plen);
+    return xroute &&
+        (allow_duplicates < 0 || xroute->metric >= allow_duplicates);
+}
+
+/* Recreate a route saved by a previous instance of babeld.  The route is
+   not installed: adopt_kernel_routes will find it in the kernel. */
+struct route *
+restore_route(struct source *src, unsigned short seqno,
+              unsigned short refmetric, time_t time, unsigned short hold_time,
+              struct neighbour *neigh, const unsigned char *nexthop)
+{
+    struct route *route;
+    int add_metric;
+
+    if(find_route(src->prefix, src->plen, neigh, nexthop))
+        return NULL;
+
+    add_metric = input_filter(src->id, src->prefix, src->plen,
+                              neigh->address, neigh->network->ifindex);
+    if(add_metric >= INFINITY)
+        return NULL;
+
+    route = malloc(sizeof(struct route));
+    if(route == NULL) {
+        perror("malloc(route)");
+        return NULL;
+    }
+    route->src = src;
+    route->refmetric = refmetric;
+    route->seqno = seqno;
+    route->metric = MIN((int)refmetric + neigh->cost + add_metric, INFINITY);
+    route->neigh = neigh;
+    memcpy(route->nexthop, nexthop, 16);
+    route->time = time;
+    route->hold_time = hold_time;
+    route->installed = 0;
+    if(link_route(route) < 0) {
+        perror("malloc(routes)");
+        free(route);
+        return NULL;
+    }
+    src->route_count++;
+    local_notify_route(route, LOCAL_ADD);
+    return route;
+}
+
+/* Take over the routes that a previous instance left in the kernel.
+   A kernel route is kept if it is a route that we might have installed
+   ourselves, and removed otherwise, which is all of them if we weren't
+   restored from a snapshot; once this is done, we install the best route
+   to any destination that is still lacking one. */
+void
+adopt_kernel_routes(void)
+{
+    struct kernel_route *kroutes;
+    struct route *route;
+    int i, n, rc, maxkroutes = 64;
+
+ again:
+    kroutes = malloc(maxkroutes * sizeof(struct kernel_route));
+    if(kroutes == NULL) {
+        perror("malloc(kroutes)");
+        return;
+    }
+    n = kernel_own_routes(kroutes, maxkroutes);
+    if(n < 0) {
+        perror("kernel_own_routes");
+        n = 0;
+    } else if(n >= maxkroutes) {
+        if(maxkroutes < 64 * 1024) {
+            free(kroutes);
+            maxkroutes *= 2;
+            goto again;
+        }
+        fprintf(stderr,
+                "Warning: only considering the first %d kernel routes.\n", n);
+    }
+
+    for(i = 0; i < n; i++) {
+        struct kernel_route *kroute = &kroutes[i];
+        route = NULL;
+        if(route_hash_size > 0 &&
+           !find_installed_route(kroute->prefix, kroute->plen) &&
+           !shadowed_by_xroute(kroute->prefix, kroute->plen)) {
+            route = *route_bucket(kroute->prefix, kroute->plen);
+            while(route) {
+                if(source_match(route->src, kroute->prefix, kroute->plen) &&
+                   memcmp(route->nexthop, kroute->gw, 16) == 0 &&
+                   route->neigh->network->ifindex == kroute->ifindex &&
+                   route_feasible(route) && !route_expired(route))
+                    break;
+                route = route->hash_next;
+            }
+        }
+
+        if(route == NULL) {
+            debugf("Flushing stale kernel route to %s.\n",
+                   format_prefix(kroute->prefix, kroute->plen));
+            rc = kernel_route(ROUTE_FLUSH, kroute->prefix, kroute->plen,
+                              kroute->gw, kroute->ifindex, kroute->metric,
+                              NULL, 0, 0);
+            if(rc < 0)
+                perror("kernel_route(FLUSH)");
+            continue;
+        }
+
+        debugf("Adopting kernel route to %s.\n",
+               format_prefix(kroute->prefix, kroute->plen));
+        if(kroute->metric != metric_to_kernel(route_metric(route))) {
+            rc = kernel_route(ROUTE_MODIFY, kroute->prefix, kroute->plen,
+                              kroute->gw, kroute->ifindex, kroute->metric,
+                              kroute->gw, kroute->ifindex,
+                              metric_to_kernel(route_metric(route)));
+            if(rc < 0) {
+                perror("kernel_route(MODIFY metric)");
+                continue;
+            }
+        }
+        route->installed = 1;
+        local_notify_route(route, LOCAL_CHANGE);
+    }
+    free(kroutes);
+
+    for(i = 0; i < numroutes; i++)
+        consider_route(routes[i]);
+}
+
 /* We just received an unfeasible update.  If it's any good, send
    a request for a new seqno. */
 void
@@ -527,7 +842,6 @@ void
 consider_route(struct route *route)
 {
     struct route *installed;
-    struct xroute *xroute;
 
     if(route->installed)
         return;
@@ -535,8 +849,7 @@ consider_route(struct route *route)
     if(!route_feasible(route))
         return;
 
-    xroute = find_xroute(route->src->prefix, route->src->plen);
-    if(xroute && (allow_duplicates < 0 || xroute->metric >= allow_duplicates))
+    if(shadowed_by_xroute(route->src->prefix, route->src->plen))
         return;
 
     installed = find_installed_route(route->src->prefix, route->src->plen);
@@ -574,19 +887,15 @@ consider_route(struct route *route)
 void
 retract_neighbour_routes(struct neighbour *neigh)
 {
-    int i;
+    struct route *route;
 
-    i = 0;
-    while(i < numroutes) {
-        if(routes[i].neigh == neigh) {
-            if(routes[i].refmetric != INFINITY) {
-                unsigned short oldmetric = route_metric(&routes[i]);
-                    retract_route(&routes[i]);
-                    if(oldmetric != INFINITY)
-                        route_changed(&routes[i], routes[i].src, oldmetric);
-            }
+    for(route = neigh->routes; route; route = route->neigh_next) {
+        if(route->refmetric != INFINITY) {
+            unsigned short oldmetric = route_metric(route);
+            retract_route(route);
+            if(oldmetric != INFINITY)
+                route_changed(route, route->src, oldmetric);
         }
-        i++;
     }
 }
 
@@ -676,9 +985,15 @@ route_changed(struct route *route,
 /* We just lost the installed route to a given destination. */
 void
 route_lost(struct source *src, unsigned oldmetric)
+{
+    lose_route(src, oldmetric, NULL);
+}
+
+static void
+lose_route(struct source *src, unsigned oldmetric, struct neighbour *exclude)
 {
     struct route *new_route;
-    new_route = find_best_route(src->prefix, src->plen, 1, NULL);
+    new_route = find_best_route(src->prefix, src->plen, 1, exclude);
     if(new_route) {
         consider_route(new_route);
     } else if(oldmetric < INFINITY) {
@@ -700,7 +1015,7 @@ expire_routes(void)
 
     i = 0;
     while(i < numroutes) {
-        struct route *route = &routes[i];
+        struct route *route = routes[i];
 
         if(route->time > now.tv_sec || /* clock stepped */
            route_old(route)) {
@@ -20,6 +20,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+struct kernel_route;
+
 struct route {
     struct source *src;
     unsigned short metric;
@@ -30,6 +32,9 @@ struct route {
     time_t time;
     unsigned short hold_time;    /* in seconds */
     short installed;
+    int index;                   /* position in routes[] */
+    struct route *hash_next;     /* next route in the same prefix bucket */
+    struct route *neigh_next, *neigh_prev; /* routes through neigh */
 };
 
 static inline int
@@ -38,7 +43,7 @@ route_metric(const struct route *route)
     return route->metric;
 }
 
-extern struct route *routes;
+extern struct route **routes;
 extern int numroutes, maxroutes;
 extern int kernel_metric, allow_duplicates;
 
@@ -46,10 +51,13 @@ struct route *find_route(const unsigned char *prefix, unsigned char plen,
                          struct neighbour *neigh, const unsigned char *nexthop);
 struct route *find_installed_route(const unsigned char *prefix,
                                    unsigned char plen);
+time_t source_routes_time(struct source *src);
 void flush_route(struct route *route);
 void flush_neighbour_routes(struct neighbour *neigh);
 void flush_network_routes(struct network *net, int v4only);
 void install_route(struct route *route);
+void route_kernel_failure(int operation, struct kernel_route *kroute,
+                          int error);
 void uninstall_route(struct route *route);
 void switch_route(struct route *old, struct route *new);
 int route_feasible(struct route *route);
@@ -69,6 +77,12 @@ struct route *update_route(const unsigned char *a,
                            unsigned short seqno, unsigned short refmetric,
                            unsigned short interval, struct neighbour *neigh,
                            const unsigned char *nexthop);
+struct route *restore_route(struct source *src, unsigned short seqno,
+                            unsigned short refmetric, time_t time,
+                            unsigned short hold_time,
+                            struct neighbour *neigh,
+                            const unsigned char *nexthop);
+void adopt_kernel_routes(void);
 void retract_neighbour_routes(struct neighbour *neigh);
 void send_unfeasible_request(struct neighbour *neigh, int force,
                              unsigned short seqno, unsigned short metric,
@@ -0,0 +1,582 @@
+/*
+Copyright (c) 2026 by the Byzantium Project
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Replaces net.c and kernel.c in babeld.sim.  Instead of talking to the
+   network and the kernel, an instance talks to babelsim over SIM_FD, and
+   its clock is the simulated one.  The few system calls that babeld makes
+   directly are intercepted with the linker's --wrap. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <net/if.h>
+
+#include "babeld.h"
+#include "kernel.h"
+#include "net.h"
+#include "util.h"
+#include "sim.h"
+
+int export_table = -1, import_table = -1;
+
+struct sim_packet {
+    int ifindex;
+    unsigned char from[16];
+    int len;
+    struct sim_packet *next;
+    unsigned char data[];
+};
+
+static int sim_node = -1;
+static int sim_interfaces = 0;
+static char sim_wireless[SIM_MAX_INTERFACES];
+static char sim_link_up[SIM_MAX_INTERFACES];
+static int sim_prefixes = 0;
+static unsigned int sim_random;
+static int sim_protocol_socket = -1;
+static int link_changed = 0;
+static struct timeval sim_now = {0, 0};
+static struct sim_packet *received = NULL, *received_last = NULL;
+
+int __real_setsockopt(int s, int level, int name,
+                      const void *value, socklen_t len);
+
+static void
+sim_init(void)
+{
+    char *s;
+    int i;
+
+    if(sim_node >= 0)
+        return;
+
+    s = getenv("BABELSIM_NODE");
+    if(s == NULL) {
+        fprintf(stderr, "babeld.sim must be run by babelsim.\n");
+        exit(1);
+    }
+    sim_node = atoi(s);
+
+    s = getenv("BABELSIM_SEED");
+    sim_random = (s ? strtoul(s, NULL, 0) : 1) * 2654435761u + sim_node;
+
+    s = getenv("BABELSIM_PREFIXES");
+    sim_prefixes = s ? atoi(s) : 0;
+
+    /* One character per interface, 'w' for wireless. */
+    s = getenv("BABELSIM_INTERFACES");
+    sim_interfaces = s ? MIN(strlen(s), SIM_MAX_INTERFACES) : 0;
+    for(i = 0; i < sim_interfaces; i++) {
+        sim_wireless[i] = s[i] == 'w';
+        sim_link_up[i] = 1;
+    }
+}
+
+static void
+sim_write(const void *buf, int len)
+{
+    int rc;
+    rc = send(SIM_FD, buf, len, 0);
+    if(rc < len) {
+        /* babelsim is gone, nothing left to do. */
+        exit(1);
+    }
+}
+
+static int
+sim_interface(int ifindex)
+{
+    sim_init();
+    if(ifindex < 1 || ifindex > sim_interfaces)
+        return -1;
+    return ifindex - 1;
+}
+
+/* Block until babelsim tells us to run again. */
+
+static void
+sim_wait(int msecs)
+{
+    struct sim_message message;
+    struct timespec ts;
+    unsigned char buf[sizeof(message) + 0xFFFF];
+    int rc;
+
+    memset(&message, 0, sizeof(message));
+    message.type = SIM_WAIT;
+    if(msecs >= 0)
+        timeval_plus_msec(&message.time, &sim_now, msecs);
+    if(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) >= 0)
+        message.cpu = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    sim_write(&message, sizeof(message));
+
+    while(1) {
+        rc = recv(SIM_FD, buf, sizeof(buf), 0);
+        if(rc < (int)sizeof(message))
+            exit(1);
+        memcpy(&message, buf, sizeof(message));
+        switch(message.type) {
+        case SIM_PACKET: {
+            struct sim_packet *packet;
+            packet = malloc(sizeof(struct sim_packet) + message.len);
+            if(packet == NULL) {
+                perror("malloc(packet)");
+                break;
+            }
+            packet->ifindex = message.ifindex;
+            memcpy(packet->from, message.addr, 16);
+            packet->len = MIN(message.len, rc - (int)sizeof(message));
+            memcpy(packet->data, buf + sizeof(message), packet->len);
+            packet->next = NULL;
+            if(received_last)
+                received_last->next = packet;
+            else
+                received = packet;
+            received_last = packet;
+            break;
+        }
+        case SIM_LINK: {
+            int i = sim_interface(message.ifindex);
+            if(i >= 0) {
+                sim_link_up[i] = message.up;
+                link_changed = 1;
+            }
+            break;
+        }
+        case SIM_GO:
+            if(timeval_compare(&message.time, &sim_now) > 0)
+                sim_now = message.time;
+            return;
+        default:
+            break;
+        }
+    }
+}
+
+/* Time only moves when babelsim says so, plus a microsecond per call so
+   that babeld never sees a timeout that cannot expire. */
+
+int
+gettime(struct timeval *tv)
+{
+    *tv = sim_now;
+    sim_now.tv_usec++;
+    if(sim_now.tv_usec >= 1000000) {
+        sim_now.tv_sec++;
+        sim_now.tv_usec -= 1000000;
+    }
+    return 0;
+}
+
+int
+read_random_bytes(void *buf, size_t len)
+{
+    unsigned char *p = buf;
+    size_t i;
+
+    sim_init();
+    for(i = 0; i < len; i++) {
+        sim_random = sim_random * 1103515245 + 12345;
+        p[i] = sim_random >> 16;
+    }
+    return len;
+}
+
+int
+babel_socket(int port)
+{
+    sim_init();
+    /* Any descriptor will do, it is only used as a handle. */
+    sim_protocol_socket = dup(SIM_FD);
+    return sim_protocol_socket;
+}
+
+int
+babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen)
+{
+    struct sockaddr_in6 sin6;
+    int len, rc;
+
+    rc = babel_recv_batch(s, buf, buflen, 1, &sin6, &len);
+    if(rc <= 0)
+        return -1;
+    memcpy(sin, &sin6, MIN(slen, sizeof(sin6)));
+    return len;
+}
+
+int
+babel_recv_batch(int s, unsigned char *buf, int buflen, int n,
+                 struct sockaddr_in6 *sin6, int *lens)
+{
+    int i = 0;
+
+    while(i < n && received) {
+        struct sim_packet *packet = received;
+        received = packet->next;
+        if(received == NULL)
+            received_last = NULL;
+        memset(&sin6[i], 0, sizeof(sin6[i]));
+        sin6[i].sin6_family = AF_INET6;
+        memcpy(&sin6[i].sin6_addr, packet->from, 16);
+        sin6[i].sin6_scope_id = packet->ifindex;
+        lens[i] = MIN(packet->len, buflen);
+        memcpy(buf + i * buflen, packet->data, lens[i]);
+        free(packet);
+        i++;
+    }
+
+    if(i == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return i;
+}
+
+int
+babel_send(int s,
+           const void *buf1, int buflen1, const void *buf2, int buflen2,
+           const struct sockaddr *sin, int slen)
+{
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)sin;
+    struct sim_message message;
+    unsigned char buf[sizeof(message) + 0xFFFF];
+    int len = buflen1 + buflen2;
+
+    if(len > 0xFFFF || slen < sizeof(struct sockaddr_in6)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&message, 0, sizeof(message));
+    message.type = SIM_SEND;
+    message.len = len;
+    message.ifindex = sin6->sin6_scope_id;
+    memcpy(message.addr, &sin6->sin6_addr, 16);
+    memcpy(buf, &message, sizeof(message));
+    memcpy(buf + sizeof(message), buf1, buflen1);
+    memcpy(buf + sizeof(message) + buflen1, buf2, buflen2);
+    sim_write(buf, sizeof(message) + len);
+    return len;
+}
+
+void
+babel_start_batch()
+{
+    return;
+}
+
+void
+babel_end_batch()
+{
+    return;
+}
+
+int
+tcp_server_socket(int port, int local)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+kernel_setup(int setup)
+{
+    sim_init();
+    return 1;
+}
+
+int
+kernel_setup_socket(int setup)
+{
+    if(setup) {
+        if(kernel_socket < 0)
+            kernel_socket = dup(SIM_FD);
+    } else if(kernel_socket >= 0) {
+        close(kernel_socket);
+        kernel_socket = -1;
+    }
+    return 1;
+}
+
+int
+kernel_setup_interface(int setup, const char *ifname, int ifindex)
+{
+    return 1;
+}
+
+int
+kernel_interface_operational(const char *ifname, int ifindex)
+{
+    int i = sim_interface(ifindex);
+    if(i < 0)
+        return -1;
+    return sim_link_up[i];
+}
+
+int
+kernel_interface_ipv4(const char *ifname, int ifindex, unsigned char *addr_r)
+{
+    int i = sim_interface(ifindex);
+    if(i < 0)
+        return -1;
+    addr_r[0] = 100;
+    addr_r[1] = 64 + ((sim_node >> 8) & 0x3F);
+    addr_r[2] = sim_node & 0xFF;
+    addr_r[3] = i + 1;
+    return 1;
+}
+
+int
+kernel_interface_mtu(const char *ifname, int ifindex)
+{
+    return 1500;
+}
+
+int
+kernel_interface_wireless(const char *ifname, int ifindex)
+{
+    int i = sim_interface(ifindex);
+    if(i < 0)
+        return -1;
+    return sim_wireless[i];
+}
+
+static void
+send_route(int add, const unsigned char *dest, unsigned short plen,
+           const unsigned char *gate, int ifindex, unsigned int metric)
+{
+    struct sim_route route;
+
+    memset(&route, 0, sizeof(route));
+    route.type = SIM_ROUTE;
+    route.add = add;
+    route.plen = plen;
+    route.metric = metric;
+    route.ifindex = ifindex;
+    memcpy(route.prefix, dest, 16);
+    memcpy(route.gate, gate, 16);
+    sim_write(&route, sizeof(route));
+}
+
+int
+kernel_route(int operation, const unsigned char *dest, unsigned short plen,
+             const unsigned char *gate, int ifindex, unsigned int metric,
+             const unsigned char *newgate, int newifindex,
+             unsigned int newmetric)
+{
+    switch(operation) {
+    case ROUTE_ADD:
+        send_route(1, dest, plen, gate, ifindex, metric);
+        break;
+    case ROUTE_FLUSH:
+        send_route(0, dest, plen, gate, ifindex, metric);
+        break;
+    case ROUTE_MODIFY:
+        if(newmetric == metric && memcmp(newgate, gate, 16) == 0 &&
+           newifindex == ifindex)
+            return 0;
+        send_route(0, dest, plen, gate, ifindex, metric);
+        send_route(1, dest, plen, newgate, newifindex, newmetric);
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    return 1;
+}
+
+int
+kernel_routes(struct kernel_route *routes, int maxroutes)
+{
+    int i;
+
+    sim_init();
+    for(i = 0; i < sim_prefixes && i < maxroutes; i++) {
+        memset(&routes[i], 0, sizeof(struct kernel_route));
+        sim_node_prefix(routes[i].prefix, sim_node, i);
+        routes[i].plen = 64;
+        routes[i].ifindex = 1;
+        routes[i].proto = 4;    /* RTPROT_STATIC */
+    }
+    return i;
+}
+
+/* Instances are never restarted, so there is nothing left over. */
+int
+kernel_own_routes(struct kernel_route *routes, int maxroutes)
+{
+    return 0;
+}
+
+int
+kernel_start_batch(void (*fn)(int operation, struct kernel_route *route,
+                              int error))
+{
+    return 0;
+}
+
+int
+kernel_end_batch()
+{
+    return 0;
+}
+
+int
+kernel_callback(int (*fn)(int, void*), void *closure)
+{
+    if(link_changed) {
+        link_changed = 0;
+        fn(CHANGE_LINK, closure);
+    }
+    return 0;
+}
+
+int
+kernel_track_routes(void (*fn)(int add, struct kernel_route *route))
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+kernel_addresses(char *ifname, int ifindex, int ll,
+                 struct kernel_route *routes, int maxroutes)
+{
+    int i, n = 0;
+
+    sim_init();
+    for(i = 0; i < sim_interfaces && n < maxroutes; i++) {
+        if(ifindex && ifindex != i + 1)
+            continue;
+        memset(&routes[n], 0, sizeof(struct kernel_route));
+        if(ll)
+            sim_ll_address(routes[n].prefix, sim_node, i);
+        else if(i == 0)
+            sim_node_address(routes[n].prefix, sim_node);
+        else
+            continue;
+        routes[n].plen = 128;
+        routes[n].ifindex = i + 1;
+        routes[n].proto = RTPROT_BABEL_LOCAL;
+        n++;
+    }
+    return n;
+}
+
+int
+if_eui64(char *ifname, int ifindex, unsigned char *eui)
+{
+    sim_init();
+    eui[0] = 0x02;
+    eui[1] = 0;
+    eui[2] = 0x5e;
+    eui[3] = 0xff;
+    eui[4] = 0xfe;
+    eui[5] = 0;
+    eui[6] = (sim_node >> 8) & 0xFF;
+    eui[7] = sim_node & 0xFF;
+    return 1;
+}
+
+/* Wrapped system calls. */
+
+unsigned int
+__wrap_if_nametoindex(const char *ifname)
+{
+    int i;
+    sim_init();
+    if(strncmp(ifname, "sim", 3) != 0)
+        return 0;
+    i = atoi(ifname + 3);
+    if(i < 0 || i >= sim_interfaces)
+        return 0;
+    return i + 1;
+}
+
+char *
+__wrap_if_indextoname(unsigned int ifindex, char *ifname)
+{
+    if(sim_interface(ifindex) < 0) {
+        errno = ENXIO;
+        return NULL;
+    }
+    snprintf(ifname, IF_NAMESIZE, "sim%d", ifindex - 1);
+    return ifname;
+}
+
+int
+__wrap_setsockopt(int s, int level, int name, const void *value, socklen_t len)
+{
+    if(s == sim_protocol_socket)
+        return 0;
+    return __real_setsockopt(s, level, name, value, len);
+}
+
+int
+__wrap_usleep(useconds_t usecs)
+{
+    timeval_plus_msec(&sim_now, &sim_now, usecs / 1000);
+    return 0;
+}
+
+int
+__wrap_epoll_create(int size)
+{
+    return dup(SIM_FD);
+}
+
+int
+__wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+    return 0;
+}
+
+int
+__wrap_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+                  int timeout)
+{
+    int n = 0;
+
+    if(!received && !link_changed)
+        sim_wait(timeout);
+
+    if(received && n < maxevents) {
+        memset(&events[n], 0, sizeof(events[n]));
+        events[n].events = EPOLLIN;
+        events[n].data.fd = sim_protocol_socket;
+        n++;
+    }
+    if(link_changed && kernel_socket >= 0 && n < maxevents) {
+        memset(&events[n], 0, sizeof(events[n]));
+        events[n].events = EPOLLIN;
+        events[n].data.fd = kernel_socket;
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2026 by the Byzantium Project
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* The protocol spoken between babelsim and the instances of babeld.sim
+   that it runs.  Each instance gets one end of a SOCK_SEQPACKET socket
+   as file descriptor SIM_FD, and every message is one packet.
+
+   An instance runs until it would block, sending SIM_SEND for every packet
+   it sends and SIM_ROUTE for every change to its routing table, and then
+   sends SIM_WAIT with the time at which it wants to be woken up.  It then
+   waits for SIM_PACKET and SIM_LINK messages, until a SIM_GO tells it the
+   current (simulated) time and lets it run again.  Since only one side is
+   ever sending at a time, and time only moves forward when babelsim says
+   so, a run is entirely determined by the scenario and its seed. */
+
+#define SIM_FD 3
+
+#define SIM_SEND 1
+#define SIM_ROUTE 2
+#define SIM_WAIT 3
+#define SIM_PACKET 4
+#define SIM_LINK 5
+#define SIM_GO 6
+
+/* Interfaces are called sim0, sim1, ... and have ifindex 1, 2, ... */
+#define SIM_MAX_INTERFACES 64
+
+struct sim_message {
+    unsigned char type;
+    unsigned char up;           /* SIM_LINK */
+    unsigned short len;         /* length of the packet that follows */
+    int ifindex;
+    unsigned char addr[16];     /* destination or source of a packet */
+    struct timeval time;        /* deadline (SIM_WAIT) or now (SIM_GO) */
+    long long cpu;              /* nanoseconds of CPU used (SIM_WAIT) */
+};
+
+/* SIM_ROUTE.  Modifications are sent as a flush followed by an add. */
+struct sim_route {
+    unsigned char type;
+    unsigned char add;
+    unsigned char plen;
+    unsigned char pad;
+    unsigned int metric;
+    int ifindex;
+    unsigned char prefix[16];
+    unsigned char gate[16];
+};
+
+/* The addresses that babelsim gives to node n. */
+
+static inline void
+sim_ll_address(unsigned char *addr, int node, int interface)
+{
+    memset(addr, 0, 16);
+    addr[0] = 0xfe;
+    addr[1] = 0x80;
+    addr[11] = 1;
+    addr[12] = (node >> 8) & 0xFF;
+    addr[13] = node & 0xFF;
+    addr[14] = (interface >> 8) & 0xFF;
+    addr[15] = interface & 0xFF;
+}
+
+static inline void
+sim_node_address(unsigned char *addr, int node)
+{
+    memset(addr, 0, 16);
+    addr[10] = addr[11] = 0xFF;
+    addr[12] = 10;
+    addr[13] = (node >> 8) & 0xFF;
+    addr[14] = node & 0xFF;
+    addr[15] = 1;
+}
+
+/* The i-th extra prefix redistributed by node n, a /64. */
+static inline void
+sim_node_prefix(unsigned char *addr, int node, int i)
+{
+    memset(addr, 0, 16);
+    addr[0] = 0x20;
+    addr[1] = 0x01;
+    addr[2] = 0x0d;
+    addr[3] = 0xb8;
+    addr[4] = (node >> 8) & 0xFF;
+    addr[5] = node & 0xFF;
+    addr[6] = (i >> 8) & 0xFF;
+    addr[7] = i & 0xFF;
+}
@@ -0,0 +1,369 @@
+/*
+Copyright (c) 2026 by the Byzantium Project
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "babeld.h"
+#include "util.h"
+#include "network.h"
+#include "source.h"
+#include "neighbour.h"
+#include "route.h"
+#include "xroute.h"
+#include "local.h"
+#include "snapshot.h"
+
+/* When we exit, a snapshot of our tables is appended to the state file,
+   one entry per line, and the next instance picks it up at startup.
+
+   The feasibility distances of our sources are always saved.  When we
+   exit because of SIGQUIT, our routes are left in the kernel and our
+   neighbours are not told that we're going away, so we also save
+   everything that we need to carry on where we left off: the networks'
+   hello seqnos, our neighbours, the installed routes and the routes that
+   we export.  If the next instance starts within WARM_RESTART_TIME, it
+   takes over the routes in the kernel (adopt_kernel_routes) rather than
+   starting from scratch. */
+
+static FILE *snapshot = NULL;
+static time_t snapshot_age;     /* seconds since the snapshot was taken */
+static int snapshot_restart;
+
+int
+save_snapshot(FILE *out, int restart)
+{
+    struct network *net;
+    struct neighbour *neigh;
+    struct source *src;
+    int i;
+
+    if(restart) {
+        fprintf(out, "restart\n");
+        FOR_ALL_NETS(net) {
+            if(!net_up(net))
+                continue;
+            fprintf(out, "network %s %u\n", net->ifname, net->hello_seqno);
+        }
+    }
+
+    /* Oldest first, so that restoring them keeps the gc list ordered. */
+    for(src = oldest_source(); src; src = src->gc_next) {
+        if(src->time < now.tv_sec - SOURCE_GC_TIME)
+            continue;
+        fprintf(out, "source %s %s %u %u %ld\n",
+                format_eui64(src->id), format_prefix(src->prefix, src->plen),
+                src->seqno, src->metric, (long)(now.tv_sec - src->time));
+    }
+
+    if(!restart)
+        goto done;
+
+    FOR_ALL_NEIGHBOURS(neigh) {
+        if(!net_up(neigh->network))
+            continue;
+        fprintf(out, "neighbour %s %s %x %u %d %u %u %u %u\n",
+                format_address(neigh->address), neigh->network->ifname,
+                neigh->reach, neigh->txcost, neigh->hello_seqno,
+                neigh->hello_interval, neigh->ihu_interval,
+                timeval_minus_msec(&now, &neigh->hello_time),
+                timeval_minus_msec(&now, &neigh->ihu_time));
+    }
+
+    for(i = 0; i < numroutes; i++) {
+        struct route *route = routes[i];
+        if(!route->installed)
+            continue;
+        fprintf(out, "route %s %s %u %u %s %s %s %ld %u\n",
+                format_prefix(route->src->prefix, route->src->plen),
+                format_eui64(route->src->id),
+                route->seqno, route->refmetric,
+                format_address(route->neigh->address),
+                route->neigh->network->ifname,
+                format_address(route->nexthop),
+                (long)(now.tv_sec - route->time), route->hold_time);
+    }
+
+    for(i = 0; i < numxroutes; i++) {
+        struct xroute *xroute = xroutes[i];
+        fprintf(out, "xroute %s %u %u %d\n",
+                format_prefix(xroute->prefix, xroute->plen),
+                xroute->metric, xroute->ifindex, xroute->proto);
+    }
+
+ done:
+    return ferror(out) ? -1 : 1;
+}
+
+static struct network *
+find_network(const char *ifname)
+{
+    struct network *net;
+    FOR_ALL_NETS(net) {
+        if(strcmp(net->ifname, ifname) == 0)
+            return net;
+    }
+    return NULL;
+}
+
+/* Called with the state file positioned after its first line, before the
+   networks are brought up; we keep the file until restore_snapshot. */
+void
+load_snapshot(FILE *in, time_t age)
+{
+    char buf[256], ifname[IF_NAMESIZE];
+    unsigned int seqno;
+    struct network *net;
+
+    snapshot = in;
+    snapshot_age = age;
+    snapshot_restart = 0;
+
+    while(fgets(buf, sizeof(buf), in)) {
+        if(strcmp(buf, "restart\n") == 0) {
+            /* Past this, our neighbours have given up on us and flushed
+               our routes, so we had better start from scratch. */
+            snapshot_restart = age < WARM_RESTART_TIME;
+        } else if(snapshot_restart &&
+                  sscanf(buf, "network %15s %u", ifname, &seqno) == 2) {
+            /* Our last hello told our neighbours not to expect another
+               one for a while, so just carry on from there. */
+            net = find_network(ifname);
+            if(net != NULL)
+                net->hello_seqno = seqno & 0xFFFF;
+        }
+    }
+}
+
+/* A time in the past, given as the number of milliseconds before the
+   snapshot was taken. */
+static void
+snapshot_time(struct timeval *tv, unsigned int msecs)
+{
+    long long ago = msecs + (long long)snapshot_age * 1000;
+    tv->tv_sec = now.tv_sec - ago / 1000;
+    tv->tv_usec = now.tv_usec - (ago % 1000) * 1000;
+    if(tv->tv_usec < 0) {
+        tv->tv_usec += 1000000;
+        tv->tv_sec--;
+    }
+}
+
+static int
+restore_source(const char *line)
+{
+    char id[40], prefix[60];
+    unsigned char sid[8], p[16], plen;
+    unsigned int seqno, metric;
+    long age;
+    struct source *src;
+    int rc;
+
+    rc = sscanf(line, "source %39s %59s %u %u %ld",
+                id, prefix, &seqno, &metric, &age);
+    if(rc != 5 || seqno > 0xFFFF || metric > INFINITY || age < 0)
+        return -1;
+    if(parse_eui64(id, sid) < 0 || parse_net(prefix, p, &plen, NULL) < 0)
+        return -1;
+
+    age += snapshot_age;
+    if(age >= SOURCE_GC_TIME)
+        return 0;
+
+    src = find_source(sid, p, plen, 1, seqno);
+    if(src == NULL)
+        return 0;
+    src->seqno = seqno;
+    src->metric = metric;
+    src->time = now.tv_sec - age;
+    return 1;
+}
+
+static int
+restore_neighbour(const char *line)
+{
+    char address[40], ifname[IF_NAMESIZE];
+    unsigned char a[16];
+    unsigned int reach, txcost, hello_interval, ihu_interval;
+    unsigned int hello_age, ihu_age;
+    int hello_seqno, rc;
+    struct network *net;
+    struct neighbour *neigh;
+
+    rc = sscanf(line, "neighbour %39s %15s %x %u %d %u %u %u %u",
+                address, ifname, &reach, &txcost, &hello_seqno,
+                &hello_interval, &ihu_interval, &hello_age, &ihu_age);
+    if(rc != 9 || reach > 0xFFFF || txcost > INFINITY ||
+       hello_seqno < -1 || hello_seqno > 0xFFFF ||
+       hello_interval > 0xFFFF || ihu_interval > 0xFFFF)
+        return -1;
+    if(parse_address(address, a, NULL) < 0)
+        return -1;
+
+    net = find_network(ifname);
+    if(net == NULL || !net_up(net))
+        return 0;
+
+    neigh = add_neighbour(a, net);
+    if(neigh == NULL)
+        return 0;
+    neigh->reach = reach;
+    neigh->txcost = txcost;
+    neigh->hello_seqno = hello_seqno;
+    neigh->hello_interval = hello_interval;
+    neigh->ihu_interval = ihu_interval;
+    snapshot_time(&neigh->hello_time, hello_age);
+    snapshot_time(&neigh->ihu_time, ihu_age);
+    /* Not hearing the hellos sent while we were away says nothing about
+       the link, so pretend that we did. */
+    if(hello_seqno >= 0 && hello_interval > 0) {
+        int missed = timeval_minus_msec(&now, &neigh->hello_time) /
+            (hello_interval * 10);
+        if(missed > 0 && missed < 0x8000) {
+            neigh->hello_seqno = seqno_plus(hello_seqno, missed);
+            timeval_plus_msec(&neigh->hello_time, &neigh->hello_time,
+                              missed * hello_interval * 10);
+        }
+    }
+    update_neighbour_metric(neigh);
+    local_notify_neighbour(neigh, LOCAL_CHANGE);
+    return 1;
+}
+
+static int
+restore_one_route(const char *line)
+{
+    char prefix[60], id[40], address[40], ifname[IF_NAMESIZE], nexthop[40];
+    unsigned char p[16], plen, sid[8], a[16], nh[16];
+    unsigned int seqno, refmetric, hold_time;
+    long age;
+    struct network *net;
+    struct neighbour *neigh;
+    struct source *src;
+    int rc;
+
+    rc = sscanf(line, "route %59s %39s %u %u %39s %15s %39s %ld %u",
+                prefix, id, &seqno, &refmetric, address, ifname, nexthop,
+                &age, &hold_time);
+    if(rc != 9 || seqno > 0xFFFF || refmetric > INFINITY ||
+       age < 0 || hold_time > 0xFFFF)
+        return -1;
+    if(parse_net(prefix, p, &plen, NULL) < 0 ||
+       parse_eui64(id, sid) < 0 ||
+       parse_address(address, a, NULL) < 0 ||
+       parse_address(nexthop, nh, NULL) < 0)
+        return -1;
+
+    age += snapshot_age;
+    if(age >= hold_time)
+        return 0;
+
+    net = find_network(ifname);
+    if(net == NULL || !net_up(net))
+        return 0;
+
+    FOR_ALL_NEIGHBOURS(neigh) {
+        if(neigh->network == net && memcmp(neigh->address, a, 16) == 0)
+            break;
+    }
+    if(neigh == NULL)
+        return 0;
+
+    src = find_source(sid, p, plen, 1, seqno);
+    if(src == NULL)
+        return 0;
+
+    return restore_route(src, seqno, refmetric, now.tv_sec - age, hold_time,
+                         neigh, nh) ? 1 : 0;
+}
+
+static int
+restore_xroute(const char *line)
+{
+    char prefix[60];
+    unsigned char p[16], plen;
+    unsigned int metric, ifindex;
+    int proto, rc;
+
+    rc = sscanf(line, "xroute %59s %u %u %d", prefix, &metric, &ifindex, &proto);
+    if(rc != 4 || metric >= INFINITY)
+        return -1;
+    if(parse_net(prefix, p, &plen, NULL) < 0)
+        return -1;
+
+    return add_xroute(p, plen, metric, ifindex, proto) > 0 ? 1 : 0;
+}
+
+/* Called once the networks are up.  Returns 1 if the previous instance
+   left its routes in the kernel, in which case our neighbours still
+   believe what we told them, and check_xroutes should retract any
+   exported routes that have gone away in the meantime. */
+int
+restore_snapshot(void)
+{
+    char buf[256];
+    int rc, restart;
+    int numsrc = 0, numneigh = 0, numroute = 0, numxroute = 0;
+
+    if(snapshot == NULL)
+        return 0;
+
+    rewind(snapshot);
+    /* Skip our id and seqno. */
+    if(fgets(buf, sizeof(buf), snapshot) == NULL)
+        goto done;
+
+    while(fgets(buf, sizeof(buf), snapshot)) {
+        if(strncmp(buf, "source ", 7) == 0) {
+            rc = restore_source(buf);
+            numsrc += rc > 0;
+        } else if(!snapshot_restart) {
+            rc = 0;
+        } else if(strncmp(buf, "neighbour ", 10) == 0) {
+            rc = restore_neighbour(buf);
+            numneigh += rc > 0;
+        } else if(strncmp(buf, "route ", 6) == 0) {
+            rc = restore_one_route(buf);
+            numroute += rc > 0;
+        } else if(strncmp(buf, "xroute ", 7) == 0) {
+            rc = restore_xroute(buf);
+            numxroute += rc > 0;
+        } else {
+            rc = 0;
+        }
+        if(rc < 0)
+            fprintf(stderr, "Couldn't parse babel-state: %s", buf);
+    }
+
+    debugf("Restored %d sources, %d neighbours, %d routes "
+           "and %d xroutes from babel-state.\n",
+           numsrc, numneigh, numroute, numxroute);
+
+ done:
+    restart = snapshot_restart;
+    fclose(snapshot);
+    snapshot = NULL;
+    return restart;
+}
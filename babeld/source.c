@@ -31,28 +31,130 @@ THE SOFTWARE.
 #include "network.h"
 #include "route.h"
 
-struct source *srcs = NULL;
+int numsources = 0;
+
+/* Sources are hashed on (id, prefix, plen).  They are also kept on a list
+   sorted by time, so that expire_sources only needs to look at the head
+   of the list.  A source that is still in use when it expires gets the
+   time of its routes' last update, and is put back in order. */
+
+static struct source **source_hash = NULL;
+static int source_hash_size = 0;
+static struct source *gc_head = NULL, *gc_tail = NULL;
+
+static inline struct source **
+source_bucket(const unsigned char *id, const unsigned char *p,
+              unsigned char plen)
+{
+    unsigned h = hash_bytes(hash_prefix(p, plen), id, 8);
+    return &source_hash[h & (source_hash_size - 1)];
+}
+
+static int
+resize_source_hash(int n)
+{
+    struct source **new_hash;
+    struct source **old_hash = source_hash;
+    int i, old_size = source_hash_size;
+
+    new_hash = calloc(n, sizeof(struct source*));
+    if(new_hash == NULL)
+        return -1;
+
+    source_hash = new_hash;
+    source_hash_size = n;
+
+    for(i = 0; i < old_size; i++) {
+        struct source *src = old_hash[i];
+        while(src) {
+            struct source *next = src->hash_next;
+            struct source **bucket =
+                source_bucket(src->id, src->prefix, src->plen);
+            src->hash_next = *bucket;
+            *bucket = src;
+            src = next;
+        }
+    }
+    free(old_hash);
+    return 1;
+}
+
+static void
+gc_unlink(struct source *src)
+{
+    if(src->gc_prev)
+        src->gc_prev->gc_next = src->gc_next;
+    else
+        gc_head = src->gc_next;
+    if(src->gc_next)
+        src->gc_next->gc_prev = src->gc_prev;
+    else
+        gc_tail = src->gc_prev;
+}
+
+static void
+gc_append(struct source *src)
+{
+    src->gc_next = NULL;
+    src->gc_prev = gc_tail;
+    if(gc_tail)
+        gc_tail->gc_next = src;
+    else
+        gc_head = src;
+    gc_tail = src;
+}
+
+/* Insert src according to its time.  This is mostly recent, so search from
+   the back. */
+static void
+gc_insert(struct source *src)
+{
+    struct source *prev = gc_tail;
+
+    while(prev && prev->time > src->time)
+        prev = prev->gc_prev;
+
+    src->gc_prev = prev;
+    src->gc_next = prev ? prev->gc_next : gc_head;
+    if(src->gc_next)
+        src->gc_next->gc_prev = src;
+    else
+        gc_tail = src;
+    if(prev)
+        prev->gc_next = src;
+    else
+        gc_head = src;
+}
 
 struct source*
 find_source(const unsigned char *id, const unsigned char *p, unsigned char plen,
             int create, unsigned short seqno)
 {
-    struct source *src;
+    struct source *src, **bucket;
 
-    for(src = srcs; src; src = src->next) {
-        /* This should really be a hash table.  For now, check the
-           last byte first. */
-        if(src->id[7] != id[7])
-            continue;
-        if(memcmp(src->id, id, 8) != 0)
-            continue;
-        if(source_match(src, p, plen))
-           return src;
+    if(source_hash_size > 0) {
+        for(src = *source_bucket(id, p, plen); src; src = src->hash_next) {
+            if(src->id[7] != id[7])
+                continue;
+            if(memcmp(src->id, id, 8) != 0)
+                continue;
+            if(source_match(src, p, plen))
+                return src;
+        }
     }
 
     if(!create)
         return NULL;
 
+    if(numsources >= source_hash_size) {
+        int rc = resize_source_hash(source_hash_size < 1 ?
+                                    16 : 2 * source_hash_size);
+        if(rc < 0 && source_hash_size < 1) {
+            perror("malloc(source_hash)");
+            return NULL;
+        }
+    }
+
     src = malloc(sizeof(struct source));
     if(src == NULL) {
         perror("malloc(source)");
@@ -65,31 +167,34 @@ find_source(const unsigned char *id, const unsigned char *p, unsigned char plen,
     src->seqno = seqno;
     src->metric = INFINITY;
     src->time = now.tv_sec;
-    src->next = srcs;
-    srcs = src;
+    src->route_count = 0;
+    bucket = source_bucket(id, p, plen);
+    src->hash_next = *bucket;
+    *bucket = src;
+    gc_append(src);
+    numsources++;
     return src;
 }
 
 int
 flush_source(struct source *src)
 {
-    int i;
+    struct source **p;
 
-    /* This is absolutely horrible -- it makes expire_sources quadratic.
-       But it's not called very often. */
+    if(src->route_count > 0)
+        return 0;
 
-    for(i = 0; i < numroutes; i++) {
-        if(routes[i].src == src)
-            return 0;
-    }
+    p = source_bucket(src->id, src->prefix, src->plen);
+    while(*p != src)
+        p = &(*p)->hash_next;
+    *p = src->hash_next;
+    gc_unlink(src);
+    numsources--;
 
-    if(srcs == src) {
-        srcs = src->next;
-    } else {
-        struct source *previous = srcs;
-        while(previous->next != src)
-            previous = previous->next;
-        previous->next = src->next;
+    if(numsources == 0) {
+        free(source_hash);
+        source_hash = NULL;
+        source_hash_size = 0;
     }
 
     free(src);
@@ -122,7 +227,20 @@ update_source(struct source *src,
         src->seqno = seqno;
         src->metric = metric;
     }
-    src->time = now.tv_sec;
+    if(src->time != now.tv_sec) {
+        src->time = now.tv_sec;
+        if(src != gc_tail) {
+            gc_unlink(src);
+            gc_append(src);
+        }
+    }
+}
+
+/* The oldest source; the others follow through gc_next. */
+struct source *
+oldest_source(void)
+{
+    return gc_head;
 }
 
 void
@@ -130,17 +248,20 @@ expire_sources()
 {
     struct source *src;
 
-    src = srcs;
-    while(src) {
+    while(gc_head) {
+        src = gc_head;
         if(src->time > now.tv_sec)
             /* clock stepped */
             src->time = now.tv_sec;
-        if(src->time < now.tv_sec - SOURCE_GC_TIME) {
-            struct source *old = src;
-            src = src->next;
-            flush_source(old);
-            continue;
+        if(src->time >= now.tv_sec - SOURCE_GC_TIME)
+            break;
+        if(!flush_source(src)) {
+            /* Still in use.  A route that is overdue will be expired
+               before we look at it again. */
+            gc_unlink(src);
+            src->time = MAX(source_routes_time(src),
+                            now.tv_sec - SOURCE_GC_TIME + 1);
+            gc_insert(src);
         }
-        src = src->next;
     }
 }
@@ -23,15 +23,19 @@ THE SOFTWARE.
 #define SOURCE_GC_TIME 200
 
 struct source {
-    struct source *next;
+    struct source *hash_next;
+    struct source *gc_next, *gc_prev; /* roughly by time, oldest first */
     unsigned char id[8];
     unsigned char prefix[16];
     unsigned char plen;
     unsigned short seqno;
     unsigned short metric;
     time_t time;
+    int route_count;                  /* number of routes using it */
 };
 
+extern int numsources;
+
 int source_match(struct source *src,
                  const unsigned char *p, unsigned char plen);
 struct source *find_source(const unsigned char *id,
@@ -41,4 +45,5 @@ struct source *find_source(const unsigned char *id,
 int flush_source(struct source *src);
 void update_source(struct source *src,
                    unsigned short seqno, unsigned short metric);
+struct source *oldest_source(void);
 void expire_sources(void);
@@ -217,6 +217,27 @@ mask_prefix(unsigned char *restrict ret,
     return ret;
 }
 
+/* FNV-1a.  Start with h = 0 and chain calls to hash several fields. */
+unsigned
+hash_bytes(unsigned h, const unsigned char *data, int len)
+{
+    int i;
+
+    if(h == 0)
+        h = 2166136261u;
+    for(i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+unsigned
+hash_prefix(const unsigned char *prefix, unsigned char plen)
+{
+    return hash_bytes(hash_bytes(0, prefix, 16), &plen, 1);
+}
+
 static const unsigned char v4prefix[16] =
     {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF, 0, 0, 0, 0 };
 
@@ -86,6 +86,10 @@ int in_prefix(const unsigned char *restrict address,
 unsigned char *mask_prefix(unsigned char *restrict ret,
                            const unsigned char *restrict prefix,
                            unsigned char plen);
+unsigned hash_bytes(unsigned h, const unsigned char *data, int len)
+    ATTRIBUTE ((pure));
+unsigned hash_prefix(const unsigned char *prefix, unsigned char plen)
+    ATTRIBUTE ((pure));
 const char *format_address(const unsigned char *address);
 const char *format_prefix(const unsigned char *address, unsigned char prefix);
 const char *format_eui64(const unsigned char *eui);
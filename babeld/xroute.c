@@ -39,18 +39,208 @@ THE SOFTWARE.
 #include "network.h"
 #include "local.h"
 
-struct xroute *xroutes;
+struct xroute **xroutes = NULL;
 int numxroutes = 0;
 int maxxroutes = 0;
 
-struct xroute *
-find_xroute(const unsigned char *prefix, unsigned char plen)
+/* Exported routes are hashed on (prefix, plen), just like routes. */
+
+static struct xroute **xroute_hash = NULL;
+static int xroute_hash_size = 0;
+
+static inline struct xroute **
+xroute_bucket(const unsigned char *prefix, unsigned char plen)
 {
+    return &xroute_hash[hash_prefix(prefix, plen) & (xroute_hash_size - 1)];
+}
+
+static int
+resize_xroute_hash(int n)
+{
+    struct xroute **new_hash;
     int i;
+
+    new_hash = calloc(n, sizeof(struct xroute*));
+    if(new_hash == NULL)
+        return -1;
+
+    free(xroute_hash);
+    xroute_hash = new_hash;
+    xroute_hash_size = n;
+
     for(i = 0; i < numxroutes; i++) {
-        if(xroutes[i].plen == plen &&
-           memcmp(xroutes[i].prefix, prefix, 16) == 0)
-            return &xroutes[i];
+        struct xroute **bucket =
+            xroute_bucket(xroutes[i]->prefix, xroutes[i]->plen);
+        xroutes[i]->hash_next = *bucket;
+        *bucket = xroutes[i];
+    }
+    return 1;
+}
+
+/* The kernel routes that the redistribute filters let us export, hashed
+   the same way.  This is rebuilt by check_xroutes and kept up to date by
+   apply_kernel_change, so that when the route that we export goes away,
+   its replacement can be found without dumping the kernel tables. */
+
+struct kroute_entry {
+    struct kernel_route kroute;
+    unsigned short metric;      /* as given by redistribute_filter */
+    struct kroute_entry *hash_next;
+};
+
+static struct kroute_entry **kroute_hash = NULL;
+static int kroute_hash_size = 0, numkroutes = 0;
+
+static inline struct kroute_entry **
+kroute_bucket(const unsigned char *prefix, unsigned char plen)
+{
+    return &kroute_hash[hash_prefix(prefix, plen) & (kroute_hash_size - 1)];
+}
+
+static int
+resize_kroute_hash(int n)
+{
+    struct kroute_entry **new_hash;
+    struct kroute_entry **old_hash = kroute_hash;
+    int i, old_size = kroute_hash_size;
+
+    new_hash = calloc(n, sizeof(struct kroute_entry*));
+    if(new_hash == NULL)
+        return -1;
+
+    kroute_hash = new_hash;
+    kroute_hash_size = n;
+
+    for(i = 0; i < old_size; i++) {
+        struct kroute_entry *entry = old_hash[i];
+        while(entry) {
+            struct kroute_entry *next = entry->hash_next;
+            struct kroute_entry **bucket =
+                kroute_bucket(entry->kroute.prefix, entry->kroute.plen);
+            entry->hash_next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+    free(old_hash);
+    return 1;
+}
+
+static int
+same_kroute(const struct kernel_route *a, const struct kernel_route *b)
+{
+    return a->plen == b->plen && a->metric == b->metric &&
+        a->ifindex == b->ifindex && a->proto == b->proto &&
+        memcmp(a->prefix, b->prefix, 16) == 0 &&
+        memcmp(a->gw, b->gw, 16) == 0;
+}
+
+static struct kroute_entry **
+find_kroute(const struct kernel_route *kroute)
+{
+    struct kroute_entry **p;
+
+    if(kroute_hash_size == 0)
+        return NULL;
+
+    for(p = kroute_bucket(kroute->prefix, kroute->plen); *p;
+        p = &(*p)->hash_next) {
+        if(same_kroute(&(*p)->kroute, kroute))
+            return p;
+    }
+    return NULL;
+}
+
+static void
+add_kroute(const struct kernel_route *kroute, unsigned short metric)
+{
+    struct kroute_entry **p = find_kroute(kroute), *entry;
+
+    if(p) {
+        (*p)->metric = metric;
+        return;
+    }
+
+    if(numkroutes >= kroute_hash_size) {
+        int rc = resize_kroute_hash(kroute_hash_size < 1 ?
+                                    16 : 2 * kroute_hash_size);
+        if(rc < 0 && kroute_hash_size < 1)
+            return;
+    }
+
+    entry = malloc(sizeof(struct kroute_entry));
+    if(entry == NULL)
+        return;
+
+    entry->kroute = *kroute;
+    entry->metric = metric;
+    p = kroute_bucket(kroute->prefix, kroute->plen);
+    entry->hash_next = *p;
+    *p = entry;
+    numkroutes++;
+}
+
+static void
+del_kroute(const struct kernel_route *kroute)
+{
+    struct kroute_entry **p = find_kroute(kroute), *entry;
+
+    if(p == NULL)
+        return;
+
+    entry = *p;
+    *p = entry->hash_next;
+    free(entry);
+    numkroutes--;
+}
+
+static void
+flush_kroutes(void)
+{
+    int i;
+
+    for(i = 0; i < kroute_hash_size; i++) {
+        while(kroute_hash[i]) {
+            struct kroute_entry *entry = kroute_hash[i];
+            kroute_hash[i] = entry->hash_next;
+            free(entry);
+        }
+    }
+    numkroutes = 0;
+}
+
+/* The kernel route to prefix that we would rather export. */
+static struct kroute_entry *
+best_kroute(const unsigned char *prefix, unsigned char plen)
+{
+    struct kroute_entry *entry, *best = NULL;
+
+    if(kroute_hash_size == 0)
+        return NULL;
+
+    for(entry = *kroute_bucket(prefix, plen); entry;
+        entry = entry->hash_next) {
+        if(entry->kroute.plen != plen ||
+           memcmp(entry->kroute.prefix, prefix, 16) != 0)
+            continue;
+        if(best == NULL || entry->metric < best->metric)
+            best = entry;
+    }
+    return best;
+}
+
+struct xroute *
+find_xroute(const unsigned char *prefix, unsigned char plen)
+{
+    struct xroute *xroute;
+
+    if(xroute_hash_size == 0)
+        return NULL;
+
+    for(xroute = *xroute_bucket(prefix, plen); xroute;
+        xroute = xroute->hash_next) {
+        if(xroute->plen == plen && memcmp(xroute->prefix, prefix, 16) == 0)
+            return xroute;
     }
     return NULL;
 }
@@ -58,26 +248,37 @@ find_xroute(const unsigned char *prefix, unsigned char plen)
 void
 flush_xroute(struct xroute *xroute)
 {
+    struct xroute **p;
     int i;
 
-    i = xroute - xroutes;
-    assert(i >= 0 && i < numxroutes);
+    i = xroute->index;
+    assert(i >= 0 && i < numxroutes && xroutes[i] == xroute);
 
     local_notify_xroute(xroute, LOCAL_FLUSH);
 
-    if(i != numxroutes - 1)
-        memcpy(xroutes + i, xroutes + numxroutes - 1, sizeof(struct xroute));
+    p = xroute_bucket(xroute->prefix, xroute->plen);
+    while(*p != xroute)
+        p = &(*p)->hash_next;
+    *p = xroute->hash_next;
+
+    if(i != numxroutes - 1) {
+        xroutes[i] = xroutes[numxroutes - 1];
+        xroutes[i]->index = i;
+    }
     numxroutes--;
-    VALGRIND_MAKE_MEM_UNDEFINED(xroutes + numxroutes, sizeof(struct xroute));
+    free(xroute);
 
     if(numxroutes == 0) {
         free(xroutes);
         xroutes = NULL;
         maxxroutes = 0;
+        free(xroute_hash);
+        xroute_hash = NULL;
+        xroute_hash_size = 0;
     } else if(maxxroutes > 8 && numxroutes < maxxroutes / 4) {
-        struct xroute *new_xroutes;
+        struct xroute **new_xroutes;
         int n = maxxroutes / 2;
-        new_xroutes = realloc(xroutes, n * sizeof(struct xroute));
+        new_xroutes = realloc(xroutes, n * sizeof(struct xroute*));
         if(new_xroutes == NULL)
             return;
         xroutes = new_xroutes;
@@ -89,9 +290,15 @@ int
 add_xroute(unsigned char prefix[16], unsigned char plen,
            unsigned short metric, unsigned int ifindex, int proto)
 {
-    struct xroute *xroute = find_xroute(prefix, plen);
+    struct xroute *xroute = find_xroute(prefix, plen), **bucket;
     if(xroute) {
-        if(xroute->metric <= metric)
+        if(xroute->metric < metric)
+            return 0;
+        /* Remember which kernel route we are exporting, so that we notice
+           when it goes away. */
+        xroute->ifindex = ifindex;
+        xroute->proto = proto;
+        if(xroute->metric == metric)
             return 0;
         xroute->metric = metric;
         local_notify_xroute(xroute, LOCAL_CHANGE);
@@ -99,32 +306,103 @@ add_xroute(unsigned char prefix[16], unsigned char plen,
     }
 
     if(numxroutes >= maxxroutes) {
-        struct xroute *new_xroutes;
+        struct xroute **new_xroutes;
         int n = maxxroutes < 1 ? 8 : 2 * maxxroutes;
-        new_xroutes = xroutes == NULL ?
-            malloc(n * sizeof(struct xroute)) :
-            realloc(xroutes, n * sizeof(struct xroute));
+        new_xroutes = realloc(xroutes, n * sizeof(struct xroute*));
         if(new_xroutes == NULL)
             return -1;
         maxxroutes = n;
         xroutes = new_xroutes;
     }
 
-    memcpy(xroutes[numxroutes].prefix, prefix, 16);
-    xroutes[numxroutes].plen = plen;
-    xroutes[numxroutes].metric = metric;
-    xroutes[numxroutes].ifindex = ifindex;
-    xroutes[numxroutes].proto = proto;
-    numxroutes++;
-    local_notify_xroute(&xroutes[numxroutes - 1], LOCAL_ADD);
+    if(numxroutes >= xroute_hash_size) {
+        int rc = resize_xroute_hash(xroute_hash_size < 1 ?
+                                    16 : 2 * xroute_hash_size);
+        if(rc < 0 && xroute_hash_size < 1)
+            return -1;
+    }
+
+    xroute = malloc(sizeof(struct xroute));
+    if(xroute == NULL)
+        return -1;
+
+    memcpy(xroute->prefix, prefix, 16);
+    xroute->plen = plen;
+    xroute->metric = metric;
+    xroute->ifindex = ifindex;
+    xroute->proto = proto;
+    xroute->mark = 0;
+    xroute->index = numxroutes;
+    xroutes[numxroutes++] = xroute;
+
+    bucket = xroute_bucket(prefix, plen);
+    xroute->hash_next = *bucket;
+    *bucket = xroute;
+
+    local_notify_xroute(xroute, LOCAL_ADD);
+    return 1;
+}
+
+/* We stopped exporting a prefix; fall back to a route learnt from
+   our neighbours, if any. */
+static void
+retract_xroute(struct xroute *xroute, int send_updates)
+{
+    unsigned char prefix[16], plen;
+    struct route *route;
+
+    memcpy(prefix, xroute->prefix, 16);
+    plen = xroute->plen;
+    flush_xroute(xroute);
+    route = find_best_route(prefix, plen, 1, NULL);
+    if(route)
+        install_route(route);
+    /* send_update_resend only records the prefix, so the update
+       will only be sent after we perform all of the changes. */
+    if(send_updates)
+        send_update_resend(NULL, prefix, plen);
+}
+
+/* Start exporting a kernel route, if the redistribute filters allow it,
+   and remember it in the kernel route cache.  Returns true if our exported
+   routes changed. */
+static int
+export_kernel_route(struct kernel_route *kroute, int send_updates)
+{
+    int metric, rc;
+    struct route *route;
+
+    if(martian_prefix(kroute->prefix, kroute->plen))
+        return 0;
+
+    metric = redistribute_filter(kroute->prefix, kroute->plen,
+                                 kroute->ifindex, kroute->proto);
+    if(metric >= INFINITY)
+        return 0;
+
+    add_kroute(kroute, metric);
+
+    rc = add_xroute(kroute->prefix, kroute->plen,
+                    metric, kroute->ifindex, kroute->proto);
+    if(rc <= 0)
+        return 0;
+
+    route = find_installed_route(kroute->prefix, kroute->plen);
+    if(route) {
+        if(allow_duplicates < 0 || kroute->metric < allow_duplicates)
+            uninstall_route(route);
+    }
+    if(send_updates)
+        send_update(NULL, 0, kroute->prefix, kroute->plen);
     return 1;
 }
 
 int
 check_xroutes(int send_updates)
 {
-    int i, j, metric, export, change = 0, rc;
+    int i, metric, change = 0, rc;
     struct kernel_route *routes;
+    struct xroute *xroute;
     int numroutes;
     static int maxroutes = 8;
     const int maxmaxroutes = 16 * 1024;
@@ -156,69 +434,40 @@ check_xroutes(int send_updates)
     if(numroutes >= maxroutes)
         goto resize;
 
+    /* Mark the exported routes that are still in the kernel */
+
+    for(i = 0; i < numxroutes; i++)
+        xroutes[i]->mark = 0;
+
+    for(i = 0; i < numroutes; i++) {
+        xroute = find_xroute(routes[i].prefix, routes[i].plen);
+        if(xroute && xroute->ifindex == routes[i].ifindex &&
+           xroute->proto == routes[i].proto)
+            xroute->mark = 1;
+    }
+
     /* Check for any routes that need to be flushed */
 
     i = 0;
     while(i < numxroutes) {
-        export = 0;
-        metric = redistribute_filter(xroutes[i].prefix, xroutes[i].plen,
-                                     xroutes[i].ifindex, xroutes[i].proto);
-        if(metric < INFINITY && metric == xroutes[i].metric) {
-            for(j = 0; j < numroutes; j++) {
-                if(xroutes[i].plen == routes[j].plen &&
-                   memcmp(xroutes[i].prefix, routes[j].prefix, 16) == 0 &&
-                   xroutes[i].ifindex == routes[j].ifindex &&
-                   xroutes[i].proto == routes[j].proto) {
-                    if(metric < INFINITY) {
-                        export = 1;
-                        break;
-                    }
-                }
-            }
-        }
-
-        if(!export) {
-            unsigned char prefix[16], plen;
-            struct route *route;
-            memcpy(prefix, xroutes[i].prefix, 16);
-            plen = xroutes[i].plen;
-            flush_xroute(&xroutes[i]);
-            route = find_best_route(prefix, plen, 1, NULL);
-            if(route)
-                install_route(route);
-            /* send_update_resend only records the prefix, so the update
-               will only be sent after we perform all of the changes. */
-            if(send_updates)
-                send_update_resend(NULL, prefix, plen);
+        xroute = xroutes[i];
+        metric = redistribute_filter(xroute->prefix, xroute->plen,
+                                     xroute->ifindex, xroute->proto);
+        if(!xroute->mark || metric >= INFINITY || metric != xroute->metric) {
+            retract_xroute(xroute, send_updates);
             change = 1;
         } else {
             i++;
         }
     }
 
-    /* Add any new routes */
+    /* Add any new routes, and start the kernel route cache afresh */
 
+    flush_kroutes();
     for(i = 0; i < numroutes; i++) {
-        if(martian_prefix(routes[i].prefix, routes[i].plen))
-            continue;
-        metric = redistribute_filter(routes[i].prefix, routes[i].plen,
-                                     routes[i].ifindex, routes[i].proto);
-        if(metric < INFINITY) {
-            rc = add_xroute(routes[i].prefix, routes[i].plen,
-                            metric, routes[i].ifindex, routes[i].proto);
-            if(rc) {
-                struct route *route;
-                route = find_installed_route(routes[i].prefix, routes[i].plen);
-                if(route) {
-                    if(allow_duplicates < 0 ||
-                       routes[i].metric < allow_duplicates)
-                        uninstall_route(route);
-                }
-                change = 1;
-                if(send_updates)
-                    send_update(NULL, 0, routes[i].prefix, routes[i].plen);
-            }
-        }
+        rc = export_kernel_route(&routes[i], send_updates);
+        if(rc)
+            change = 1;
     }
 
     free(routes);
@@ -233,3 +482,39 @@ check_xroutes(int send_updates)
     maxroutes = MIN(maxmaxroutes, 2 * maxroutes);
     goto again;
 }
+
+/* Apply a single route or address change reported by the kernel, without
+   dumping the kernel tables.  If the route that we export goes away, we
+   switch to the next best kernel route to the same prefix, if any. */
+void
+apply_kernel_change(int add, struct kernel_route *kroute)
+{
+    struct xroute *xroute;
+    struct kroute_entry *best;
+
+    if(add) {
+        export_kernel_route(kroute, 1);
+        return;
+    }
+
+    del_kroute(kroute);
+
+    xroute = find_xroute(kroute->prefix, kroute->plen);
+    if(xroute == NULL || xroute->ifindex != kroute->ifindex ||
+       xroute->proto != kroute->proto)
+        return;
+
+    best = best_kroute(kroute->prefix, kroute->plen);
+    if(best == NULL) {
+        retract_xroute(xroute, 1);
+        return;
+    }
+
+    xroute->ifindex = best->kroute.ifindex;
+    xroute->proto = best->kroute.proto;
+    if(xroute->metric != best->metric) {
+        xroute->metric = best->metric;
+        local_notify_xroute(xroute, LOCAL_CHANGE);
+        send_update(NULL, 0, xroute->prefix, xroute->plen);
+    }
+}
@@ -26,9 +26,14 @@ struct xroute {
     unsigned short metric;
     unsigned int ifindex;
     int proto;
+    int index;                  /* position in xroutes[] */
+    int mark;                   /* used by check_xroutes */
+    struct xroute *hash_next;
 };
 
-extern struct xroute *xroutes;
+struct kernel_route;
+
+extern struct xroute **xroutes;
 extern int numxroutes;
 
 struct xroute *find_xroute(const unsigned char *prefix, unsigned char plen);
@@ -36,3 +41,4 @@ void flush_xroute(struct xroute *xroute);
 int add_xroute(unsigned char prefix[16], unsigned char plen,
                unsigned short metric, unsigned int ifindex, int proto);
 int check_xroutes(int send_updates);
+void apply_kernel_change(int add, struct kernel_route *kroute);
@@ -115,7 +115,7 @@ static void new_aggregated_packet(unsigned char *packet_buff, int packet_len,
 		}
 	}
 
-	forw_packet_aggr = kmalloc(sizeof(struct forw_packet), GFP_ATOMIC);
+	forw_packet_aggr = kmem_cache_alloc(forw_packet_cache, GFP_ATOMIC);
 	if (!forw_packet_aggr) {
 		if (!own_packet)
 			atomic_inc(&bat_priv->batman_queue_left);
@@ -133,7 +133,7 @@ static void new_aggregated_packet(unsigned char *packet_buff, int packet_len,
 	if (!forw_packet_aggr->skb) {
 		if (!own_packet)
 			atomic_inc(&bat_priv->batman_queue_left);
-		kfree(forw_packet_aggr);
+		kmem_cache_free(forw_packet_cache, forw_packet_aggr);
 		return;
 	}
 	skb_reserve(forw_packet_aggr->skb, sizeof(struct ethhdr));
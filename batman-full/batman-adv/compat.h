@@ -68,6 +68,9 @@ static inline int skb_cow_head(struct sk_buff *skb, unsigned int headroom)
 
 #define cancel_delayed_work_sync(wq) cancel_delayed_work(wq)
 
+#define kmem_cache_create(name, size, align, flags, ctor) \
+	kmem_cache_create(name, size, align, flags, ctor, NULL)
+
 #endif /* < KERNEL_VERSION(2, 6, 23) */
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 24)
@@ -268,6 +271,10 @@ int bat_seq_printf(struct seq_file *m, const char *f, ...);
 
 #define __always_unused			__attribute__((unused))
 
+#define __percpu
+
+#define this_cpu_ptr(ptr) per_cpu_ptr(ptr, smp_processor_id())
+
 #endif /* < KERNEL_VERSION(2, 6, 33) */
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 34)
@@ -280,12 +287,35 @@ int bat_seq_printf(struct seq_file *m, const char *f, ...);
 	pos && ({ prefetch(pos->next); 1; }); \
 	pos = rcu_dereference(hlist_next_rcu(pos)))
 
+#define rcu_dereference_check(p, c) rcu_dereference(p)
+#define rcu_dereference_protected(p, c) (p)
+
 #endif /* < KERNEL_VERSION(2, 6, 34) */
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
 
 #define __rcu
 
+struct u64_stats_sync {
+	seqcount_t seq;
+};
+
+#define u64_stats_update_begin(syncp) write_seqcount_begin(&(syncp)->seq)
+#define u64_stats_update_end(syncp) write_seqcount_end(&(syncp)->seq)
+#define u64_stats_fetch_begin(syncp) read_seqcount_begin(&(syncp)->seq)
+#define u64_stats_fetch_retry(syncp, start) \
+	read_seqcount_retry(&(syncp)->seq, start)
+
+#else
+
+#include <linux/u64_stats_sync.h>
+
 #endif /* < KERNEL_VERSION(2, 6, 36) */
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 37)
+
+#define skb_has_frag_list(skb) (skb_shinfo(skb)->frag_list != NULL)
+
+#endif /* < KERNEL_VERSION(2, 6, 37) */
+
 #endif /* _NET_BATMAN_ADV_COMPAT_H_ */
@@ -600,6 +600,12 @@ static int batman_skb_recv(struct sk_buff *skb, struct net_device *dev,
 		goto err_free;
 	}
 
+	if ((batman_packet->packet_type >= BAT_PACKET) &&
+	    (batman_packet->packet_type <= BAT_UNICAST_FRAG))
+		bat_count_packet(bat_priv,
+				 BAT_CNT_TYPE_RX(batman_packet->packet_type),
+				 skb->len);
+
 	/* all receive handlers return whether they received or reused
 	 * the supplied skb. if not, we have to free the skb. */
 
@@ -22,22 +22,57 @@
 #include "main.h"
 #include "hash.h"
 
-/* clears the hash */
-static void hash_init(struct hashtable_t *hash)
+static struct hash_buckets *hash_buckets_new(int size, gfp_t gfp)
 {
+	struct hash_buckets *buckets;
 	int i;
 
-	for (i = 0 ; i < hash->size; i++) {
-		INIT_HLIST_HEAD(&hash->table[i]);
-		spin_lock_init(&hash->list_locks[i]);
-	}
+	buckets = kmalloc(sizeof(struct hash_buckets), gfp);
+	if (!buckets)
+		return NULL;
+
+	buckets->table = kmalloc(sizeof(struct hlist_head) * size,
+				 gfp | __GFP_NOWARN);
+	if (!buckets->table)
+		goto free_buckets;
+
+	for (i = 0; i < size; i++)
+		INIT_HLIST_HEAD(&buckets->table[i]);
+
+	buckets->size = size;
+	return buckets;
+
+free_buckets:
+	kfree(buckets);
+	return NULL;
+}
+
+static void hash_buckets_free(struct hash_buckets *buckets)
+{
+	kfree(buckets->table);
+	kfree(buckets);
+}
+
+static void hash_buckets_free_rcu(struct rcu_head *rcu)
+{
+	struct hash_buckets *buckets;
+
+	buckets = container_of(rcu, struct hash_buckets, rcu);
+	hash_buckets_free(buckets);
 }
 
 /* free only the hashtable and the hash itself. */
 void hash_destroy(struct hashtable_t *hash)
 {
+	struct hash_buckets *buckets;
+
+	/* nobody else uses the hash anymore */
+	buckets = rcu_dereference_protected(hash->new_buckets, 1);
+	if (buckets)
+		hash_buckets_free(buckets);
+
+	hash_buckets_free(rcu_dereference_protected(hash->buckets, 1));
 	kfree(hash->list_locks);
-	kfree(hash->table);
 	kfree(hash);
 }
 
@@ -45,26 +80,132 @@ void hash_destroy(struct hashtable_t *hash)
 struct hashtable_t *hash_new(int size)
 {
 	struct hashtable_t *hash;
+	struct hash_buckets *buckets;
+	int i;
 
 	hash = kmalloc(sizeof(struct hashtable_t), GFP_ATOMIC);
 	if (!hash)
 		return NULL;
 
-	hash->table = kmalloc(sizeof(struct element_t *) * size, GFP_ATOMIC);
-	if (!hash->table)
+	buckets = hash_buckets_new(size, GFP_ATOMIC);
+	if (!buckets)
 		goto free_hash;
 
 	hash->list_locks = kmalloc(sizeof(spinlock_t) * size, GFP_ATOMIC);
 	if (!hash->list_locks)
-		goto free_table;
+		goto free_buckets;
 
-	hash->size = size;
-	hash_init(hash);
+	for (i = 0; i < size; i++)
+		spin_lock_init(&hash->list_locks[i]);
+
+	rcu_assign_pointer(hash->buckets, buckets);
+	rcu_assign_pointer(hash->new_buckets, NULL);
+	hash->min_size = size;
+	hash->moved = 0;
+	atomic_set(&hash->count, 0);
+	seqcount_init(&hash->seqcount);
+	hash->resize_failed = 0;
 	return hash;
 
-free_table:
-	kfree(hash->table);
+free_buckets:
+	hash_buckets_free(buckets);
 free_hash:
 	kfree(hash);
 	return NULL;
 }
+
+/* moves all entries of a lock stripe into the new buckets - the old and the
+ * new bucket of an entry share the list lock */
+static void hash_move_stripe(struct hashtable_t *hash,
+			     struct hash_buckets *buckets,
+			     struct hash_buckets *new_buckets, int stripe,
+			     hashdata_choose_cb choose, size_t node_offset)
+{
+	struct hlist_node *node, *node_tmp;
+	int i, index;
+
+	spin_lock_bh(&hash->list_locks[stripe]);
+	write_seqcount_begin(&hash->seqcount);
+
+	for (i = stripe; i < buckets->size; i += hash->min_size) {
+		hlist_for_each_safe(node, node_tmp, &buckets->table[i]) {
+			index = choose((char *)node - node_offset,
+				       new_buckets->size);
+
+			hlist_del_rcu(node);
+			hlist_add_head_rcu(node, &new_buckets->table[index]);
+		}
+	}
+
+	hash->moved = stripe + 1;
+
+	write_seqcount_end(&hash->seqcount);
+	spin_unlock_bh(&hash->list_locks[stripe]);
+}
+
+struct hash_buckets *hash_resize_prepare(struct hashtable_t *hash)
+{
+	struct hash_buckets *buckets, *new_buckets;
+	int count, size;
+
+	if (!hash)
+		return NULL;
+
+	/* only hash_resize() replaces the buckets and the caller keeps other
+	 * resizes away */
+	buckets = rcu_dereference_protected(hash->buckets, 1);
+	count = atomic_read(&hash->count);
+	size = buckets->size;
+
+	/* keep between 1/4 and 1 entry per bucket on average */
+	while (size < count)
+		size <<= 1;
+
+	while ((size > hash->min_size) && (count < size / 4))
+		size >>= 1;
+
+	if (size == buckets->size)
+		return NULL;
+
+	/* the next call tries again */
+	new_buckets = hash_buckets_new(size, GFP_KERNEL);
+	if (!new_buckets) {
+		if (!hash->resize_failed++)
+			pr_err("Can't resize hash to %i buckets: "
+			       "out of memory\n", size);
+		return NULL;
+	}
+
+	return new_buckets;
+}
+
+void hash_resize(struct hashtable_t *hash, struct hash_buckets *new_buckets,
+		 hashdata_choose_cb choose, size_t node_offset)
+{
+	struct hash_buckets *buckets;
+	int stripe;
+
+	if (!new_buckets)
+		return;
+
+	buckets = rcu_dereference_protected(hash->buckets, 1);
+	hash->moved = 0;
+	rcu_assign_pointer(hash->new_buckets, new_buckets);
+
+	/* writers only block for the stripe being moved */
+	for (stripe = 0; stripe < hash->min_size; stripe++)
+		hash_move_stripe(hash, buckets, new_buckets, stripe,
+				 choose, node_offset);
+
+	local_bh_disable();
+	write_seqcount_begin(&hash->seqcount);
+
+	rcu_assign_pointer(hash->buckets, new_buckets);
+	smp_wmb();
+	rcu_assign_pointer(hash->new_buckets, NULL);
+
+	write_seqcount_end(&hash->seqcount);
+	local_bh_enable();
+
+	call_rcu(&buckets->rcu, hash_buckets_free_rcu);
+}
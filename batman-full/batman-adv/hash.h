@@ -23,6 +23,7 @@
 #define _NET_BATMAN_ADV_HASH_H_
 
 #include <linux/list.h>
+#include <linux/seqlock.h>
 
 /* callback to a compare function.  should
  * compare 2 element datas for their keys,
@@ -36,41 +37,127 @@ typedef int (*hashdata_compare_cb)(struct hlist_node *, void *);
 typedef int (*hashdata_choose_cb)(void *, int);
 typedef void (*hashdata_free_cb)(struct hlist_node *, void *);
 
+/* the buckets of a hash - replaced as a whole when the hash is resized */
+struct hash_buckets {
+	struct hlist_head *table;   /* the buckets themselves */
+	int size;		    /* number of buckets - a power of 2 */
+	struct rcu_head rcu;
+};
+
+/* The bucket count follows the number of entries (see hash_resize()). Entries
+ * are moved one lock stripe at a time: the bucket index of an entry modulo the
+ * initial size never changes, so neither does the list lock protecting it.
+ * While a resize is running the stripes below 'moved' live in new_buckets
+ * and the remaining ones still in buckets. Lookups retry on a miss if entries
+ * moved underneath them (seqcount). */
 struct hashtable_t {
-	struct hlist_head *table;   /* the hashtable itself with the buckets */
-	spinlock_t *list_locks;     /* spinlock for each hash list entry */
-	int size;		    /* size of hashtable */
+	struct hash_buckets __rcu *buckets;	/* the hashtable */
+	struct hash_buckets __rcu *new_buckets; /* resize target or NULL */
+	spinlock_t *list_locks;	/* spinlock for each lock stripe */
+	int min_size;		/* initial size = number of lock stripes */
+	int moved;		/* lock stripes already in new_buckets */
+	atomic_t count;		/* number of entries */
+	seqcount_t seqcount;	/* changes while entries are moved */
+	int resize_failed;	/* bucket allocations that failed */
 };
 
-/* allocates and clears the hash */
+/* allocates and clears the hash - size has to be a power of 2 and the choose
+ * callbacks used with the hash have to return (hash value % size) */
 struct hashtable_t *hash_new(int size);
 
 /* free only the hashtable and the hash itself. */
 void hash_destroy(struct hashtable_t *hash);
 
+/* allocates the buckets to resize the hash to if the number of entries left
+ * the bounds of the current size, NULL otherwise. It may sleep, so it has to
+ * be called before taking the locks hash_resize() is called with. */
+struct hash_buckets *hash_resize_prepare(struct hashtable_t *hash);
+
+/* moves the entries into new_buckets from hash_resize_prepare() (nothing
+ * happens if they are NULL). The caller must keep other resizes of the same
+ * hash away and node_offset is the offset of the hlist_node inside the
+ * hashed structure. */
+void hash_resize(struct hashtable_t *hash, struct hash_buckets *new_buckets,
+		 hashdata_choose_cb choose, size_t node_offset);
+
+/* the lock stripe of data - the same for every size of the hash */
+static inline int hash_stripe(struct hashtable_t *hash,
+			      hashdata_choose_cb choose, void *data)
+{
+	return choose(data, hash->min_size);
+}
+
+/* the list lock of a bucket - valid for every hash_buckets of the hash */
+static inline spinlock_t *hash_list_lock(struct hashtable_t *hash, int index)
+{
+	return &hash->list_locks[index & (hash->min_size - 1)];
+}
+
+/* the buckets holding the lock stripe. The caller has to hold the list lock
+ * of the stripe: hash_resize() may swap the pointers meanwhile but can neither
+ * move the stripe nor free the buckets holding it */
+static inline struct hash_buckets *hash_stripe_buckets(struct hashtable_t *hash,
+						       int stripe)
+{
+	struct hash_buckets *buckets;
+	spinlock_t *list_lock = &hash->list_locks[stripe];
+
+	buckets = rcu_dereference_check(hash->new_buckets,
+					lockdep_is_held(list_lock));
+	smp_rmb();
+
+	if ((buckets) && (stripe < ACCESS_ONCE(hash->moved)))
+		return buckets;
+
+	return rcu_dereference_check(hash->buckets, lockdep_is_held(list_lock));
+}
+
+/* the current buckets for walking the whole hash. The caller has to hold
+ * rcu_read_lock() or keep hash_resize() away. While a resize is running,
+ * entries may be missed or seen twice. */
+static inline struct hash_buckets *hash_buckets(struct hashtable_t *hash)
+{
+	return rcu_dereference(hash->buckets);
+}
+
+/* the current buckets for walking the whole hash without rcu_read_lock().
+ * c tells lockdep why no hash_resize() can run meanwhile. */
+#define hash_buckets_protected(hash, c) \
+	rcu_dereference_protected((hash)->buckets, c)
+
 /* remove the hash structure. if hashdata_free_cb != NULL, this function will be
  * called to remove the elements inside of the hash.  if you don't remove the
  * elements, memory might be leaked. */
 static inline void hash_delete(struct hashtable_t *hash,
 			       hashdata_free_cb free_cb, void *arg)
 {
+	struct hash_buckets *buckets[2];
 	struct hlist_head *head;
 	struct hlist_node *node, *node_tmp;
 	spinlock_t *list_lock; /* spinlock to protect write access */
-	int i;
+	int i, j;
+
+	/* nobody else uses the hash anymore */
+	buckets[0] = rcu_dereference_protected(hash->buckets, 1);
+	buckets[1] = rcu_dereference_protected(hash->new_buckets, 1);
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
-		list_lock = &hash->list_locks[i];
+	for (j = 0; j < 2; j++) {
+		if (!buckets[j])
+			continue;
+
+		for (i = 0; i < buckets[j]->size; i++) {
+			head = &buckets[j]->table[i];
+			list_lock = hash_list_lock(hash, i);
 
-		spin_lock_bh(list_lock);
-		hlist_for_each_safe(node, node_tmp, head) {
-			hlist_del_rcu(node);
+			spin_lock_bh(list_lock);
+			hlist_for_each_safe(node, node_tmp, head) {
+				hlist_del_rcu(node);
 
-			if (free_cb)
-				free_cb(node, arg);
+				if (free_cb)
+					free_cb(node, arg);
+			}
+			spin_unlock_bh(list_lock);
 		}
-		spin_unlock_bh(list_lock);
 	}
 
 	hash_destroy(hash);
@@ -82,7 +169,8 @@ static inline int hash_add(struct hashtable_t *hash,
 			   hashdata_choose_cb choose,
 			   void *data, struct hlist_node *data_node)
 {
-	int index;
+	int index, stripe;
+	struct hash_buckets *buckets;
 	struct hlist_head *head;
 	struct hlist_node *node;
 	spinlock_t *list_lock; /* spinlock to protect write access */
@@ -90,28 +178,32 @@ static inline int hash_add(struct hashtable_t *hash,
 	if (!hash)
 		goto err;
 
-	index = choose(data, hash->size);
-	head = &hash->table[index];
-	list_lock = &hash->list_locks[index];
+	stripe = hash_stripe(hash, choose, data);
+	list_lock = &hash->list_locks[stripe];
 
-	rcu_read_lock();
-	__hlist_for_each_rcu(node, head) {
+	spin_lock_bh(list_lock);
+
+	buckets = hash_stripe_buckets(hash, stripe);
+	index = choose(data, buckets->size);
+	head = &buckets->table[index];
+
+	hlist_for_each(node, head) {
 		if (!compare(node, data))
 			continue;
 
 		goto err_unlock;
 	}
-	rcu_read_unlock();
 
 	/* no duplicate found in list, add new element */
-	spin_lock_bh(list_lock);
 	hlist_add_head_rcu(data_node, head);
+	atomic_inc(&hash->count);
+
 	spin_unlock_bh(list_lock);
 
 	return 0;
 
 err_unlock:
-	rcu_read_unlock();
+	spin_unlock_bh(list_lock);
 err:
 	return -1;
 }
@@ -125,25 +217,91 @@ static inline void *hash_remove(struct hashtable_t *hash,
 				hashdata_choose_cb choose, void *data)
 {
 	size_t index;
+	int stripe;
+	struct hash_buckets *buckets;
 	struct hlist_node *node;
 	struct hlist_head *head;
 	void *data_save = NULL;
 
-	index = choose(data, hash->size);
-	head = &hash->table[index];
+	stripe = hash_stripe(hash, choose, data);
+
+	spin_lock_bh(&hash->list_locks[stripe]);
+
+	buckets = hash_stripe_buckets(hash, stripe);
+	index = choose(data, buckets->size);
+	head = &buckets->table[index];
 
-	spin_lock_bh(&hash->list_locks[index]);
 	hlist_for_each(node, head) {
 		if (!compare(node, data))
 			continue;
 
 		data_save = node;
 		hlist_del_rcu(node);
+		atomic_dec(&hash->count);
 		break;
 	}
-	spin_unlock_bh(&hash->list_locks[index]);
+	spin_unlock_bh(&hash->list_locks[stripe]);
 
 	return data_save;
 }
 
+/* removes an entry found while walking its bucket with the list lock held */
+static inline void hash_del_node(struct hashtable_t *hash,
+				 struct hlist_node *node)
+{
+	hlist_del_rcu(node);
+	atomic_dec(&hash->count);
+}
+
+static inline struct hlist_node *__hash_find(struct hash_buckets *buckets,
+					     hashdata_compare_cb compare,
+					     hashdata_choose_cb choose,
+					     void *data)
+{
+	struct hlist_head *head;
+	struct hlist_node *node;
+
+	head = &buckets->table[choose(data, buckets->size)];
+
+	__hlist_for_each_rcu(node, head) {
+		if (compare(node, data))
+			return node;
+	}
+
+	return NULL;
+}
+
+/* returns the hash entry matching data or NULL. The caller has to hold
+ * rcu_read_lock() - the entry is only guaranteed to exist until
+ * rcu_read_unlock() unless the caller takes a reference. */
+static inline struct hlist_node *hash_find(struct hashtable_t *hash,
+					   hashdata_compare_cb compare,
+					   hashdata_choose_cb choose,
+					   void *data)
+{
+	struct hash_buckets *buckets;
+	struct hlist_node *node;
+	unsigned int seq;
+
+	if (!hash)
+		return NULL;
+
+	/* an entry moved by hash_resize() might have taken the walk into
+	 * another bucket - a miss only counts if nothing was moved */
+	do {
+		seq = read_seqcount_begin(&hash->seqcount);
+
+		buckets = rcu_dereference(hash->buckets);
+		node = __hash_find(buckets, compare, choose, data);
+		if (node)
+			break;
+
+		buckets = rcu_dereference(hash->new_buckets);
+		if (buckets)
+			node = __hash_find(buckets, compare, choose, data);
+	} while ((!node) && (read_seqcount_retry(&hash->seqcount, seq)));
+
+	return node;
+}
+
 #endif /* _NET_BATMAN_ADV_HASH_H_ */
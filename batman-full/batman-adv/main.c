@@ -31,6 +31,7 @@
 #include "hard-interface.h"
 #include "gateway_client.h"
 #include "vis.h"
+#include "unicast.h"
 #include "hash.h"
 
 struct list_head hardif_list;
@@ -39,6 +40,8 @@ unsigned char broadcast_addr[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 
 struct workqueue_struct *bat_event_workqueue;
 
+struct kmem_cache *forw_packet_cache;
+
 static int __init batman_init(void)
 {
 	INIT_LIST_HEAD(&hardif_list);
@@ -50,6 +53,15 @@ static int __init batman_init(void)
 	if (!bat_event_workqueue)
 		return -ENOMEM;
 
+	forw_packet_cache = kmem_cache_create("bat_forw_packet",
+					      sizeof(struct forw_packet), 0,
+					      0, NULL);
+	if (!forw_packet_cache) {
+		destroy_workqueue(bat_event_workqueue);
+		bat_event_workqueue = NULL;
+		return -ENOMEM;
+	}
+
 	bat_socket_init();
 	debugfs_init();
 
@@ -73,6 +85,9 @@ static void __exit batman_exit(void)
 	bat_event_workqueue = NULL;
 
 	rcu_barrier();
+
+	kmem_cache_destroy(forw_packet_cache);
+	forw_packet_cache = NULL;
 }
 
 int mesh_init(struct net_device *soft_iface)
@@ -87,11 +102,16 @@ int mesh_init(struct net_device *soft_iface)
 	spin_lock_init(&bat_priv->vis_hash_lock);
 	spin_lock_init(&bat_priv->vis_list_lock);
 	spin_lock_init(&bat_priv->softif_neigh_lock);
+	spin_lock_init(&bat_priv->frag_list_lock);
 
 	INIT_HLIST_HEAD(&bat_priv->forw_bat_list);
 	INIT_HLIST_HEAD(&bat_priv->forw_bcast_list);
 	INIT_HLIST_HEAD(&bat_priv->gw_list);
 	INIT_HLIST_HEAD(&bat_priv->softif_neigh_list);
+	INIT_LIST_HEAD(&bat_priv->frag_list);
+
+	INIT_DELAYED_WORK(&bat_priv->bcast_work,
+			  send_outstanding_bcast_packets);
 
 	if (originator_init(bat_priv) < 1)
 		goto err;
@@ -102,6 +122,9 @@ int mesh_init(struct net_device *soft_iface)
 	if (hna_global_init(bat_priv) < 1)
 		goto err;
 
+	if (frag_init(bat_priv) < 1)
+		goto err;
+
 	hna_local_add(soft_iface, soft_iface->dev_addr);
 
 	if (vis_init(bat_priv) < 1)
@@ -132,6 +155,7 @@ void mesh_free(struct net_device *soft_iface)
 
 	gw_node_purge(bat_priv);
 	originator_free(bat_priv);
+	frag_free(bat_priv);
 
 	hna_local_free(bat_priv);
 	hna_global_free(bat_priv);
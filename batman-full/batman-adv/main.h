@@ -128,6 +128,7 @@ extern struct list_head hardif_list;
 
 extern unsigned char broadcast_addr[];
 extern struct workqueue_struct *bat_event_workqueue;
+extern struct kmem_cache *forw_packet_cache;
 
 int mesh_init(struct net_device *soft_iface);
 void mesh_free(struct net_device *soft_iface);
@@ -177,4 +178,35 @@ static inline int compare_eth(void *data1, void *data2)
 	return (memcmp(data1, data2, ETH_ALEN) == 0 ? 1 : 0);
 }
 
+/* the counters of a cpu are updated from process and softirq context,
+ * bottom halves have to stay off while the update is in progress */
+static inline void bat_add_counter(struct bat_priv *bat_priv, size_t idx,
+				   size_t count)
+{
+	struct bat_stats *stats;
+
+	local_bh_disable();
+	stats = this_cpu_ptr(bat_priv->bat_stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->counters[idx] += count;
+	u64_stats_update_end(&stats->syncp);
+	local_bh_enable();
+}
+
+/* counts one packet of len bytes: idx is the packet counter, the byte
+ * counter follows it */
+static inline void bat_count_packet(struct bat_priv *bat_priv, size_t idx,
+				    size_t len)
+{
+	struct bat_stats *stats;
+
+	local_bh_disable();
+	stats = this_cpu_ptr(bat_priv->bat_stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->counters[idx]++;
+	stats->counters[idx + 1] += len;
+	u64_stats_update_end(&stats->syncp);
+	local_bh_enable();
+}
+
 #endif /* _NET_BATMAN_ADV_MAIN_H_ */
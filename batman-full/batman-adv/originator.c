@@ -127,10 +127,6 @@ static void orig_node_free_rcu(struct rcu_head *rcu)
 
 	spin_unlock_bh(&orig_node->neigh_list_lock);
 
-	frag_list_free(&orig_node->frag_list);
-	hna_global_del_orig(orig_node->bat_priv, orig_node,
-			    "originator timed out");
-
 	kfree(orig_node->bcast_own);
 	kfree(orig_node->bcast_own_sum);
 	kfree(orig_node);
@@ -138,13 +134,20 @@ static void orig_node_free_rcu(struct rcu_head *rcu)
 
 void orig_node_free_ref(struct orig_node *orig_node)
 {
-	if (atomic_dec_and_test(&orig_node->refcount))
-		call_rcu(&orig_node->rcu, orig_node_free_rcu);
+	if (!atomic_dec_and_test(&orig_node->refcount))
+		return;
+
+	/* transtable_search() reads the hna entries without lock - they have
+	 * to be unlinked before the grace period starts, not after it */
+	hna_global_del_orig(orig_node->bat_priv, orig_node,
+			    "originator timed out");
+	call_rcu(&orig_node->rcu, orig_node_free_rcu);
 }
 
 void originator_free(struct bat_priv *bat_priv)
 {
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node, *node_tmp;
 	struct hlist_head *head;
 	spinlock_t *list_lock; /* spinlock to protect write access */
@@ -158,15 +161,18 @@ void originator_free(struct bat_priv *bat_priv)
 
 	bat_priv->orig_hash = NULL;
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
-		list_lock = &hash->list_locks[i];
+	/* no resize can be running without the purge worker */
+	buckets = hash_buckets_protected(hash, 1);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
+		list_lock = hash_list_lock(hash, i);
 
 		spin_lock_bh(list_lock);
 		hlist_for_each_entry_safe(orig_node, node, node_tmp,
 					  head, hash_entry) {
 
-			hlist_del_rcu(node);
+			hash_del_node(hash, node);
 			orig_node_free_ref(orig_node);
 		}
 		spin_unlock_bh(list_lock);
@@ -223,9 +229,6 @@ struct orig_node *get_orig_node(struct bat_priv *bat_priv, uint8_t *addr)
 	size = bat_priv->num_ifaces * sizeof(uint8_t);
 	orig_node->bcast_own_sum = kzalloc(size, GFP_ATOMIC);
 
-	INIT_LIST_HEAD(&orig_node->frag_list);
-	orig_node->last_frag_packet = 0;
-
 	if (!orig_node->bcast_own_sum)
 		goto free_bcast_own;
 
@@ -328,6 +331,7 @@ static bool purge_orig_node(struct bat_priv *bat_priv,
 static void _purge_orig(struct bat_priv *bat_priv)
 {
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node, *node_tmp;
 	struct hlist_head *head;
 	spinlock_t *list_lock; /* spinlock to protect write access */
@@ -337,10 +341,15 @@ static void _purge_orig(struct bat_priv *bat_priv)
 	if (!hash)
 		return;
 
+	/* purge_orig_ref() might race with the resize done by the purge
+	 * worker - originators moved meanwhile are purged next time */
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
 	/* for all origins... */
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
-		list_lock = &hash->list_locks[i];
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
+		list_lock = hash_list_lock(hash, i);
 
 		spin_lock_bh(list_lock);
 		hlist_for_each_entry_safe(orig_node, node, node_tmp,
@@ -348,16 +357,12 @@ static void _purge_orig(struct bat_priv *bat_priv)
 			if (purge_orig_node(bat_priv, orig_node)) {
 				if (orig_node->gw_flags)
 					gw_node_delete(bat_priv, orig_node);
-				hlist_del_rcu(node);
-				continue;
+				hash_del_node(hash, node);
 			}
-
-			if (time_after(jiffies, orig_node->last_frag_packet +
-						msecs_to_jiffies(FRAG_TIMEOUT)))
-				frag_list_free(&orig_node->frag_list);
 		}
 		spin_unlock_bh(list_lock);
 	}
+	rcu_read_unlock();
 
 	gw_node_purge(bat_priv);
 	gw_election(bat_priv);
@@ -371,8 +376,22 @@ static void purge_orig(struct work_struct *work)
 		container_of(work, struct delayed_work, work);
 	struct bat_priv *bat_priv =
 		container_of(delayed_work, struct bat_priv, orig_work);
+	struct hash_buckets *new_buckets;
 
 	_purge_orig(bat_priv);
+
+	new_buckets = hash_resize_prepare(bat_priv->orig_hash);
+	hash_resize(bat_priv->orig_hash, new_buckets, choose_orig,
+		    offsetof(struct orig_node, hash_entry));
+
+	new_buckets = hash_resize_prepare(bat_priv->hna_global_hash);
+	spin_lock_bh(&bat_priv->hna_ghash_lock);
+	hash_resize(bat_priv->hna_global_hash, new_buckets, choose_orig,
+		    offsetof(struct hna_global_entry, hash_entry));
+	spin_unlock_bh(&bat_priv->hna_ghash_lock);
+
+	frag_purge(bat_priv);
+
 	start_purge_timer(bat_priv);
 }
 
@@ -386,6 +405,7 @@ int orig_seq_print_text(struct seq_file *seq, void *offset)
 	struct net_device *net_dev = (struct net_device *)seq->private;
 	struct bat_priv *bat_priv = netdev_priv(net_dev);
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node, *node_tmp;
 	struct hlist_head *head;
 	struct orig_node *orig_node;
@@ -415,10 +435,12 @@ int orig_seq_print_text(struct seq_file *seq, void *offset)
 		   "Originator", "last-seen", "#", TQ_MAX_VALUE, "Nexthop",
 		   "outgoingIF", "Potential nexthops");
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(orig_node, node, head, hash_entry) {
 			if (!orig_node->router)
 				continue;
@@ -447,8 +469,8 @@ int orig_seq_print_text(struct seq_file *seq, void *offset)
 			seq_printf(seq, "\n");
 			batman_count++;
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	if ((batman_count == 0))
 		seq_printf(seq, "No batman nodes in range ...\n");
@@ -490,32 +512,43 @@ int orig_hash_add_if(struct hard_iface *hard_iface, int max_if_num)
 {
 	struct bat_priv *bat_priv = netdev_priv(hard_iface->soft_iface);
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node;
 	struct hlist_head *head;
+	spinlock_t *list_lock; /* spinlock to protect write access */
 	struct orig_node *orig_node;
-	int i, ret;
+	int i, stripe, ret;
 
 	/* resize all orig nodes because orig_node->bcast_own(_sum) depend on
-	 * if_num */
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	 * if_num - walking stripe by stripe under the list lock does not
+	 * miss the originators a running hash_resize() moves */
+	for (stripe = 0; stripe < hash->min_size; stripe++) {
+		list_lock = &hash->list_locks[stripe];
 
-		rcu_read_lock();
-		hlist_for_each_entry_rcu(orig_node, node, head, hash_entry) {
-			spin_lock_bh(&orig_node->ogm_cnt_lock);
-			ret = orig_node_add_if(orig_node, max_if_num);
-			spin_unlock_bh(&orig_node->ogm_cnt_lock);
+		spin_lock_bh(list_lock);
+		buckets = hash_stripe_buckets(hash, stripe);
+
+		for (i = stripe; i < buckets->size; i += hash->min_size) {
+			head = &buckets->table[i];
 
-			if (ret == -1)
-				goto err;
+			hlist_for_each_entry(orig_node, node,
+					     head, hash_entry) {
+				spin_lock_bh(&orig_node->ogm_cnt_lock);
+				ret = orig_node_add_if(orig_node, max_if_num);
+				spin_unlock_bh(&orig_node->ogm_cnt_lock);
+
+				if (ret == -1)
+					goto err;
+			}
 		}
-		rcu_read_unlock();
+
+		spin_unlock_bh(list_lock);
 	}
 
 	return 0;
 
 err:
-	rcu_read_unlock();
+	spin_unlock_bh(list_lock);
 	return -ENOMEM;
 }
 
@@ -575,28 +608,39 @@ int orig_hash_del_if(struct hard_iface *hard_iface, int max_if_num)
 {
 	struct bat_priv *bat_priv = netdev_priv(hard_iface->soft_iface);
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node;
 	struct hlist_head *head;
+	spinlock_t *list_lock; /* spinlock to protect write access */
 	struct hard_iface *hard_iface_tmp;
 	struct orig_node *orig_node;
-	int i, ret;
+	int i, stripe, ret;
 
 	/* resize all orig nodes because orig_node->bcast_own(_sum) depend on
-	 * if_num */
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	 * if_num - walking stripe by stripe under the list lock does not
+	 * miss the originators a running hash_resize() moves */
+	for (stripe = 0; stripe < hash->min_size; stripe++) {
+		list_lock = &hash->list_locks[stripe];
 
-		rcu_read_lock();
-		hlist_for_each_entry_rcu(orig_node, node, head, hash_entry) {
-			spin_lock_bh(&orig_node->ogm_cnt_lock);
-			ret = orig_node_del_if(orig_node, max_if_num,
-					hard_iface->if_num);
-			spin_unlock_bh(&orig_node->ogm_cnt_lock);
+		spin_lock_bh(list_lock);
+		buckets = hash_stripe_buckets(hash, stripe);
+
+		for (i = stripe; i < buckets->size; i += hash->min_size) {
+			head = &buckets->table[i];
+
+			hlist_for_each_entry(orig_node, node,
+					     head, hash_entry) {
+				spin_lock_bh(&orig_node->ogm_cnt_lock);
+				ret = orig_node_del_if(orig_node, max_if_num,
+						       hard_iface->if_num);
+				spin_unlock_bh(&orig_node->ogm_cnt_lock);
 
-			if (ret == -1)
-				goto err;
+				if (ret == -1)
+					goto err;
+			}
 		}
-		rcu_read_unlock();
+
+		spin_unlock_bh(list_lock);
 	}
 
 	/* renumber remaining batman interfaces _inside_ of orig_hash_lock */
@@ -620,6 +664,6 @@ int orig_hash_del_if(struct hard_iface *hard_iface, int max_if_num)
 	return 0;
 
 err:
-	rcu_read_unlock();
+	spin_unlock_bh(list_lock);
 	return -ENOMEM;
 }
@@ -71,32 +71,22 @@ static inline int choose_orig(void *data, int32_t size)
 static inline struct orig_node *orig_hash_find(struct bat_priv *bat_priv,
 					       void *data)
 {
-	struct hashtable_t *hash = bat_priv->orig_hash;
-	struct hlist_head *head;
 	struct hlist_node *node;
-	struct orig_node *orig_node, *orig_node_tmp = NULL;
-	int index;
-
-	if (!hash)
-		return NULL;
-
-	index = choose_orig(data, hash->size);
-	head = &hash->table[index];
+	struct orig_node *orig_node = NULL;
 
 	rcu_read_lock();
-	hlist_for_each_entry_rcu(orig_node, node, head, hash_entry) {
-		if (!compare_eth(orig_node, data))
-			continue;
+	node = hash_find(bat_priv->orig_hash, compare_orig, choose_orig, data);
+	if (!node)
+		goto out;
 
-		if (!atomic_inc_not_zero(&orig_node->refcount))
-			continue;
+	orig_node = container_of(node, struct orig_node, hash_entry);
 
-		orig_node_tmp = orig_node;
-		break;
-	}
-	rcu_read_unlock();
+	if (!atomic_inc_not_zero(&orig_node->refcount))
+		orig_node = NULL;
 
-	return orig_node_tmp;
+out:
+	rcu_read_unlock();
+	return orig_node;
 }
 
 #endif /* _NET_BATMAN_ADV_ORIGINATOR_H_ */
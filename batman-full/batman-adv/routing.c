@@ -39,6 +39,7 @@ void slide_own_bcast_window(struct hard_iface *hard_iface)
 {
 	struct bat_priv *bat_priv = netdev_priv(hard_iface->soft_iface);
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node;
 	struct hlist_head *head;
 	struct orig_node *orig_node;
@@ -46,10 +47,12 @@ void slide_own_bcast_window(struct hard_iface *hard_iface)
 	int i;
 	size_t word_index;
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(orig_node, node, head, hash_entry) {
 			spin_lock_bh(&orig_node->ogm_cnt_lock);
 			word_index = hard_iface->if_num * NUM_WORDS;
@@ -60,8 +63,8 @@ void slide_own_bcast_window(struct hard_iface *hard_iface)
 				bit_packet_count(word);
 			spin_unlock_bh(&orig_node->ogm_cnt_lock);
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 }
 
 static void update_HNA(struct bat_priv *bat_priv, struct orig_node *orig_node,
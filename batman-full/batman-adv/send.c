@@ -30,8 +30,6 @@
 #include "gateway_common.h"
 #include "originator.h"
 
-static void send_outstanding_bcast_packet(struct work_struct *work);
-
 /* apply hop penalty for a normal link */
 static uint8_t hop_penalty(const uint8_t tq, struct bat_priv *bat_priv)
 {
@@ -59,7 +57,9 @@ int send_skb_packet(struct sk_buff *skb,
 				struct hard_iface *hard_iface,
 				uint8_t *dst_addr)
 {
+	struct bat_priv *bat_priv;
 	struct ethhdr *ethhdr;
+	uint8_t packet_type;
 
 	if (hard_iface->if_status != IF_ACTIVE)
 		goto send_skb_err;
@@ -73,6 +73,14 @@ int send_skb_packet(struct sk_buff *skb,
 		goto send_skb_err;
 	}
 
+	/* all batman packets start with the packet type */
+	packet_type = skb->data[0];
+	if ((packet_type >= BAT_PACKET) && (packet_type <= BAT_UNICAST_FRAG)) {
+		bat_priv = netdev_priv(hard_iface->soft_iface);
+		bat_count_packet(bat_priv, BAT_CNT_TYPE_TX(packet_type),
+				 skb->len);
+	}
+
 	/* push to the ethernet header. */
 	if (my_skb_head_push(skb, sizeof(struct ethhdr)) < 0)
 		goto send_skb_err;
@@ -367,7 +375,52 @@ static void forw_packet_free(struct forw_packet *forw_packet)
 {
 	if (forw_packet->skb)
 		kfree_skb(forw_packet->skb);
-	kfree(forw_packet);
+	kmem_cache_free(forw_packet_cache, forw_packet);
+}
+
+/* arms the bcast work for send_time unless it is going to run earlier
+ * anyway - must be called with forw_bcast_list_lock held */
+static void bcast_work_schedule(struct bat_priv *bat_priv,
+				unsigned long send_time)
+{
+	unsigned long delay = 0;
+
+	if ((bat_priv->bcast_work_armed) &&
+	    (!time_before(send_time, bat_priv->bcast_work_time)))
+		return;
+
+	/* a work which already left the timer looks at the list again */
+	cancel_delayed_work(&bat_priv->bcast_work);
+
+	if (time_after(send_time, jiffies))
+		delay = send_time - jiffies;
+
+	bat_priv->bcast_work_armed = 1;
+	bat_priv->bcast_work_time = send_time;
+	queue_delayed_work(bat_event_workqueue, &bat_priv->bcast_work, delay);
+}
+
+/* arms the bcast work for the earliest packet in the list - must be
+ * called with forw_bcast_list_lock held */
+static void bcast_work_rearm(struct bat_priv *bat_priv)
+{
+	struct forw_packet *forw_packet;
+	struct hlist_node *tmp_node;
+	unsigned long send_time = 0;
+	int found = 0;
+
+	hlist_for_each_entry(forw_packet, tmp_node,
+			     &bat_priv->forw_bcast_list, list) {
+		if ((found) && (!time_before(forw_packet->send_time,
+					     send_time)))
+			continue;
+
+		send_time = forw_packet->send_time;
+		found = 1;
+	}
+
+	if (found)
+		bcast_work_schedule(bat_priv, send_time);
 }
 
 static void _add_bcast_packet_to_list(struct bat_priv *bat_priv,
@@ -375,17 +428,13 @@ static void _add_bcast_packet_to_list(struct bat_priv *bat_priv,
 				      unsigned long send_time)
 {
 	INIT_HLIST_NODE(&forw_packet->list);
+	forw_packet->send_time = send_time;
 
-	/* add new packet to packet list */
+	/* add new packet to packet list and start the timer for it */
 	spin_lock_bh(&bat_priv->forw_bcast_list_lock);
 	hlist_add_head(&forw_packet->list, &bat_priv->forw_bcast_list);
+	bcast_work_schedule(bat_priv, send_time);
 	spin_unlock_bh(&bat_priv->forw_bcast_list_lock);
-
-	/* start timer for this packet */
-	INIT_DELAYED_WORK(&forw_packet->delayed_work,
-			  send_outstanding_bcast_packet);
-	queue_delayed_work(bat_event_workqueue, &forw_packet->delayed_work,
-			   send_time);
 }
 
 #define atomic_dec_not_zero(v)          atomic_add_unless((v), -1, 0)
@@ -401,6 +450,7 @@ int add_bcast_packet_to_list(struct bat_priv *bat_priv, struct sk_buff *skb)
 {
 	struct forw_packet *forw_packet;
 	struct bcast_packet *bcast_packet;
+	struct sk_buff *newskb;
 
 	if (!atomic_dec_not_zero(&bat_priv->bcast_queue_left)) {
 		bat_dbg(DBG_BATMAN, bat_priv, "bcast packet queue full\n");
@@ -408,83 +458,127 @@ int add_bcast_packet_to_list(struct bat_priv *bat_priv, struct sk_buff *skb)
 	}
 
 	if (!bat_priv->primary_if)
-		goto out;
+		goto out_and_inc;
 
-	forw_packet = kmalloc(sizeof(struct forw_packet), GFP_ATOMIC);
+	forw_packet = kmem_cache_alloc(forw_packet_cache, GFP_ATOMIC);
 
 	if (!forw_packet)
 		goto out_and_inc;
 
-	skb = skb_copy(skb, GFP_ATOMIC);
-	if (!skb)
+	/* the payload stays shared with the caller, only the linear part
+	 * holding the bcast header is copied as the TTL gets changed */
+	newskb = skb_clone(skb, GFP_ATOMIC);
+	if (!newskb)
 		goto packet_free;
 
-	/* as we have a copy now, it is safe to decrease the TTL */
-	bcast_packet = (struct bcast_packet *)skb->data;
+	if (skb_cow_head(newskb, sizeof(struct ethhdr)) < 0)
+		goto skb_free;
+
+	bcast_packet = (struct bcast_packet *)newskb->data;
 	bcast_packet->ttl--;
 
-	skb_reset_mac_header(skb);
+	skb_reset_mac_header(newskb);
+
+	/* the queued skb itself is never sent, only its clones are. They
+	 * may push their ethernet header without copying the data again */
+	skb_header_release(newskb);
 
-	forw_packet->skb = skb;
+	forw_packet->skb = newskb;
 	forw_packet->if_incoming = bat_priv->primary_if;
 
 	/* how often did we send the bcast packet ? */
 	forw_packet->num_packets = 0;
 
-	_add_bcast_packet_to_list(bat_priv, forw_packet, 1);
+	_add_bcast_packet_to_list(bat_priv, forw_packet, jiffies + 1);
 	return NETDEV_TX_OK;
 
+skb_free:
+	kfree_skb(newskb);
 packet_free:
-	kfree(forw_packet);
+	kmem_cache_free(forw_packet_cache, forw_packet);
 out_and_inc:
 	atomic_inc(&bat_priv->bcast_queue_left);
 out:
 	return NETDEV_TX_BUSY;
 }
 
-static void send_outstanding_bcast_packet(struct work_struct *work)
+/* sends all bcast packets which are due in one go and requeues them until
+ * they have been sent 3 times */
+void send_outstanding_bcast_packets(struct work_struct *work)
 {
-	struct hard_iface *hard_iface;
 	struct delayed_work *delayed_work =
 		container_of(work, struct delayed_work, work);
-	struct forw_packet *forw_packet =
-		container_of(delayed_work, struct forw_packet, delayed_work);
+	struct bat_priv *bat_priv =
+		container_of(delayed_work, struct bat_priv, bcast_work);
+	struct forw_packet *forw_packet;
+	struct hlist_node *tmp_node, *safe_tmp_node;
+	struct hlist_head due_list;
+	struct hard_iface *hard_iface;
 	struct sk_buff *skb1;
-	struct net_device *soft_iface = forw_packet->if_incoming->soft_iface;
-	struct bat_priv *bat_priv = netdev_priv(soft_iface);
+	unsigned long send_time;
+	int deactivating;
+
+	INIT_HLIST_HEAD(&due_list);
 
 	spin_lock_bh(&bat_priv->forw_bcast_list_lock);
-	hlist_del(&forw_packet->list);
+	bat_priv->bcast_work_armed = 0;
+
+	hlist_for_each_entry_safe(forw_packet, tmp_node, safe_tmp_node,
+				  &bat_priv->forw_bcast_list, list) {
+		if (time_after(forw_packet->send_time, jiffies))
+			continue;
+
+		hlist_del(&forw_packet->list);
+		hlist_add_head(&forw_packet->list, &due_list);
+	}
 	spin_unlock_bh(&bat_priv->forw_bcast_list_lock);
 
-	if (atomic_read(&bat_priv->mesh_state) == MESH_DEACTIVATING)
-		goto out;
+	deactivating = (atomic_read(&bat_priv->mesh_state) ==
+			MESH_DEACTIVATING);
+	if (deactivating)
+		goto requeue;
 
-	/* rebroadcast packet */
+	/* rebroadcast packets */
 	rcu_read_lock();
 	list_for_each_entry_rcu(hard_iface, &hardif_list, list) {
-		if (hard_iface->soft_iface != soft_iface)
+		if ((!hard_iface->soft_iface) ||
+		    (netdev_priv(hard_iface->soft_iface) != bat_priv))
 			continue;
 
-		/* send a copy of the saved skb */
-		skb1 = skb_clone(forw_packet->skb, GFP_ATOMIC);
-		if (skb1)
-			send_skb_packet(skb1, hard_iface, broadcast_addr);
+		hlist_for_each_entry(forw_packet, tmp_node, &due_list, list) {
+			/* send a copy of the saved skb */
+			skb1 = skb_clone(forw_packet->skb, GFP_ATOMIC);
+			if (skb1)
+				send_skb_packet(skb1, hard_iface,
+						broadcast_addr);
+		}
 	}
 	rcu_read_unlock();
 
-	forw_packet->num_packets++;
+requeue:
+	send_time = jiffies + ((5 * HZ) / 1000);
 
-	/* if we still have some more bcasts to send */
-	if (forw_packet->num_packets < 3) {
-		_add_bcast_packet_to_list(bat_priv, forw_packet,
-					  ((5 * HZ) / 1000));
-		return;
+	spin_lock_bh(&bat_priv->forw_bcast_list_lock);
+	hlist_for_each_entry_safe(forw_packet, tmp_node, safe_tmp_node,
+				  &due_list, list) {
+		hlist_del(&forw_packet->list);
+		forw_packet->num_packets++;
+
+		/* if we still have some more bcasts to send */
+		if ((!deactivating) && (forw_packet->num_packets < 3)) {
+			forw_packet->send_time = send_time;
+			hlist_add_head(&forw_packet->list,
+				       &bat_priv->forw_bcast_list);
+			continue;
+		}
+
+		forw_packet_free(forw_packet);
+		atomic_inc(&bat_priv->bcast_queue_left);
 	}
 
-out:
-	forw_packet_free(forw_packet);
-	atomic_inc(&bat_priv->bcast_queue_left);
+	if (!deactivating)
+		bcast_work_rearm(bat_priv);
+	spin_unlock_bh(&bat_priv->forw_bcast_list_lock);
 }
 
 void send_outstanding_bat_packet(struct work_struct *work)
@@ -521,6 +615,30 @@ out:
 	forw_packet_free(forw_packet);
 }
 
+/* must be called with forw_bcast_list_lock held */
+static void bcast_list_purge(struct bat_priv *bat_priv,
+			     struct hard_iface *hard_iface)
+{
+	struct forw_packet *forw_packet;
+	struct hlist_node *tmp_node, *safe_tmp_node;
+
+	hlist_for_each_entry_safe(forw_packet, tmp_node, safe_tmp_node,
+				  &bat_priv->forw_bcast_list, list) {
+
+		/**
+		 * if purge_outstanding_packets() was called with an argmument
+		 * we delete only packets belonging to the given interface
+		 */
+		if ((hard_iface) &&
+		    (forw_packet->if_incoming != hard_iface))
+			continue;
+
+		hlist_del(&forw_packet->list);
+		forw_packet_free(forw_packet);
+		atomic_inc(&bat_priv->bcast_queue_left);
+	}
+}
+
 void purge_outstanding_packets(struct bat_priv *bat_priv,
 			       struct hard_iface *hard_iface)
 {
@@ -537,27 +655,22 @@ void purge_outstanding_packets(struct bat_priv *bat_priv,
 
 	/* free bcast list */
 	spin_lock_bh(&bat_priv->forw_bcast_list_lock);
-	hlist_for_each_entry_safe(forw_packet, tmp_node, safe_tmp_node,
-				  &bat_priv->forw_bcast_list, list) {
-
-		/**
-		 * if purge_outstanding_packets() was called with an argmument
-		 * we delete only packets belonging to the given interface
-		 */
-		if ((hard_iface) &&
-		    (forw_packet->if_incoming != hard_iface))
-			continue;
+	bcast_list_purge(bat_priv, hard_iface);
+	spin_unlock_bh(&bat_priv->forw_bcast_list_lock);
 
-		spin_unlock_bh(&bat_priv->forw_bcast_list_lock);
+	/**
+	 * the bcast work never dereferences if_incoming, it only has to be
+	 * waited for on shutdown as it puts the packets it is sending right
+	 * now back to the list
+	 */
+	if (!hard_iface) {
+		cancel_delayed_work_sync(&bat_priv->bcast_work);
 
-		/**
-		 * send_outstanding_bcast_packet() will lock the list to
-		 * delete the item from the list
-		 */
-		cancel_delayed_work_sync(&forw_packet->delayed_work);
 		spin_lock_bh(&bat_priv->forw_bcast_list_lock);
+		bcast_list_purge(bat_priv, NULL);
+		bat_priv->bcast_work_armed = 0;
+		spin_unlock_bh(&bat_priv->forw_bcast_list_lock);
 	}
-	spin_unlock_bh(&bat_priv->forw_bcast_list_lock);
 
 	/* free batman packet list */
 	spin_lock_bh(&bat_priv->forw_bat_list_lock);
@@ -33,6 +33,7 @@ void schedule_forward_packet(struct orig_node *orig_node,
 			     struct hard_iface *if_outgoing);
 int add_bcast_packet_to_list(struct bat_priv *bat_priv, struct sk_buff *skb);
 void send_outstanding_bat_packet(struct work_struct *work);
+void send_outstanding_bcast_packets(struct work_struct *work);
 void purge_outstanding_packets(struct bat_priv *bat_priv,
 			       struct hard_iface *hard_iface);
 
@@ -45,6 +45,14 @@ static void bat_set_msglevel(struct net_device *dev, u32 value);
 static u32 bat_get_link(struct net_device *dev);
 static u32 bat_get_rx_csum(struct net_device *dev);
 static int bat_set_rx_csum(struct net_device *dev, u32 data);
+static void bat_get_strings(struct net_device *dev, u32 stringset, u8 *data);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 23)
+static int bat_get_stats_count(struct net_device *dev);
+#else
+static int bat_get_sset_count(struct net_device *dev, int stringset);
+#endif
+static void bat_get_ethtool_stats(struct net_device *dev,
+				  struct ethtool_stats *stats, u64 *data);
 
 static const struct ethtool_ops bat_ethtool_ops = {
 	.get_settings = bat_get_settings,
@@ -53,7 +61,25 @@ static const struct ethtool_ops bat_ethtool_ops = {
 	.set_msglevel = bat_set_msglevel,
 	.get_link = bat_get_link,
 	.get_rx_csum = bat_get_rx_csum,
-	.set_rx_csum = bat_set_rx_csum
+	.set_rx_csum = bat_set_rx_csum,
+	.get_strings = bat_get_strings,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 23)
+	.get_stats_count = bat_get_stats_count,
+#else
+	.get_sset_count = bat_get_sset_count,
+#endif
+	.get_ethtool_stats = bat_get_ethtool_stats
+};
+
+/* names of the enum bat_counters entries as shown by ethtool -S */
+static const char bat_counters_strings[][ETH_GSTRING_LEN] = {
+	"tx", "tx_bytes", "tx_dropped", "rx", "rx_bytes",
+	"ogm_tx", "ogm_tx_bytes", "ogm_rx", "ogm_rx_bytes",
+	"icmp_tx", "icmp_tx_bytes", "icmp_rx", "icmp_rx_bytes",
+	"unicast_tx", "unicast_tx_bytes", "unicast_rx", "unicast_rx_bytes",
+	"bcast_tx", "bcast_tx_bytes", "bcast_rx", "bcast_rx_bytes",
+	"vis_tx", "vis_tx_bytes", "vis_rx", "vis_rx_bytes",
+	"frag_tx", "frag_tx_bytes", "frag_rx", "frag_rx_bytes",
 };
 
 int my_skb_head_push(struct sk_buff *skb, unsigned int len)
@@ -279,10 +305,47 @@ static int interface_release(struct net_device *dev)
 	return 0;
 }
 
+/* sums up the per cpu counters - the 64 bit values of another cpu are
+ * re-read if they got updated while being copied */
+static void bat_sum_counters(struct bat_priv *bat_priv, uint64_t *counters)
+{
+	struct bat_stats *stats;
+	unsigned int start;
+	uint64_t value;
+	int cpu;
+	size_t i;
+
+	memset(counters, 0, BAT_CNT_NUM * sizeof(uint64_t));
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(bat_priv->bat_stats, cpu);
+
+		for (i = 0; i < BAT_CNT_NUM; i++) {
+			do {
+				start = u64_stats_fetch_begin(&stats->syncp);
+				value = stats->counters[i];
+			} while (u64_stats_fetch_retry(&stats->syncp, start));
+
+			counters[i] += value;
+		}
+	}
+}
+
 static struct net_device_stats *interface_stats(struct net_device *dev)
 {
 	struct bat_priv *bat_priv = netdev_priv(dev);
-	return &bat_priv->stats;
+	struct net_device_stats *stats = &bat_priv->stats;
+	uint64_t counters[BAT_CNT_NUM];
+
+	bat_sum_counters(bat_priv, counters);
+
+	stats->tx_packets = counters[BAT_CNT_TX];
+	stats->tx_bytes = counters[BAT_CNT_TX_BYTES];
+	stats->tx_dropped = counters[BAT_CNT_TX_DROPPED];
+	stats->rx_packets = counters[BAT_CNT_RX];
+	stats->rx_bytes = counters[BAT_CNT_RX_BYTES];
+
+	return stats;
 }
 
 static int interface_set_mac_addr(struct net_device *dev, void *p)
@@ -351,7 +414,6 @@ int interface_tx(struct sk_buff *skb, struct net_device *soft_iface)
 	if ((bat_priv->softif_neigh) && (bat_priv->softif_neigh->vid == vid))
 		goto dropped;
 
-	/* TODO: check this for locks */
 	hna_local_add(soft_iface, ethhdr->h_source);
 
 	if (is_multicast_ether_addr(ethhdr->h_dest)) {
@@ -401,14 +463,13 @@ int interface_tx(struct sk_buff *skb, struct net_device *soft_iface)
 			goto dropped_freed;
 	}
 
-	bat_priv->stats.tx_packets++;
-	bat_priv->stats.tx_bytes += data_len;
+	bat_count_packet(bat_priv, BAT_CNT_TX, data_len);
 	goto end;
 
 dropped:
 	kfree_skb(skb);
 dropped_freed:
-	bat_priv->stats.tx_dropped++;
+	bat_add_counter(bat_priv, BAT_CNT_TX_DROPPED, 1);
 end:
 	return NETDEV_TX_OK;
 }
@@ -480,8 +541,8 @@ void interface_rx(struct net_device *soft_iface,
 
 /*	skb->ip_summed = CHECKSUM_UNNECESSARY;*/
 
-	bat_priv->stats.rx_packets++;
-	bat_priv->stats.rx_bytes += skb->len + sizeof(struct ethhdr);
+	bat_count_packet(bat_priv, BAT_CNT_RX,
+			 skb->len + sizeof(struct ethhdr));
 
 	soft_iface->last_rx = jiffies;
 
@@ -506,6 +567,14 @@ static const struct net_device_ops bat_netdev_ops = {
 };
 #endif
 
+static void interface_free(struct net_device *dev)
+{
+	struct bat_priv *bat_priv = netdev_priv(dev);
+
+	free_percpu(bat_priv->bat_stats);
+	free_netdev(dev);
+}
+
 static void interface_setup(struct net_device *dev)
 {
 	struct bat_priv *priv = netdev_priv(dev);
@@ -523,7 +592,7 @@ static void interface_setup(struct net_device *dev)
 	dev->change_mtu = interface_change_mtu;
 	dev->hard_start_xmit = interface_tx;
 #endif
-	dev->destructor = free_netdev;
+	dev->destructor = interface_free;
 
 	/**
 	 * can't call min_mtu, because the needed variables
@@ -556,15 +625,22 @@ struct net_device *softif_create(char *name)
 		goto out;
 	}
 
+	bat_priv = netdev_priv(soft_iface);
+
+	bat_priv->bat_stats = alloc_percpu(struct bat_stats);
+	if (!bat_priv->bat_stats) {
+		pr_err("Unable to allocate the counters of the batman "
+		       "interface: %s\n", name);
+		goto free_soft_iface;
+	}
+
 	ret = register_netdev(soft_iface);
 	if (ret < 0) {
 		pr_err("Unable to register the batman interface '%s': %i\n",
 		       name, ret);
-		goto free_soft_iface;
+		goto free_stats;
 	}
 
-	bat_priv = netdev_priv(soft_iface);
-
 	atomic_set(&bat_priv->aggregated_ogms, 1);
 	atomic_set(&bat_priv->bonding, 0);
 	atomic_set(&bat_priv->vis_mode, VIS_TYPE_CLIENT_UPDATE);
@@ -608,6 +684,8 @@ unreg_soft_iface:
 	unregister_netdev(soft_iface);
 	return NULL;
 
+free_stats:
+	free_percpu(bat_priv->bat_stats);
 free_soft_iface:
 	free_netdev(soft_iface);
 out:
@@ -671,3 +749,33 @@ static int bat_set_rx_csum(struct net_device *dev, u32 data)
 {
 	return -EOPNOTSUPP;
 }
+
+static void bat_get_strings(struct net_device *dev, u32 stringset, u8 *data)
+{
+	if (stringset == ETH_SS_STATS)
+		memcpy(data, bat_counters_strings,
+		       sizeof(bat_counters_strings));
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 23)
+static int bat_get_stats_count(struct net_device *dev)
+{
+	return BAT_CNT_NUM;
+}
+#else
+static int bat_get_sset_count(struct net_device *dev, int stringset)
+{
+	if (stringset == ETH_SS_STATS)
+		return BAT_CNT_NUM;
+
+	return -EOPNOTSUPP;
+}
+#endif
+
+static void bat_get_ethtool_stats(struct net_device *dev,
+				  struct ethtool_stats *stats, u64 *data)
+{
+	struct bat_priv *bat_priv = netdev_priv(dev);
+
+	bat_sum_counters(bat_priv, data);
+}
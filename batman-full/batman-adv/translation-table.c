@@ -52,61 +52,92 @@ static void hna_local_start_timer(struct bat_priv *bat_priv)
 	queue_delayed_work(bat_event_workqueue, &bat_priv->hna_work, 10 * HZ);
 }
 
-static struct hna_local_entry *hna_local_hash_find(struct bat_priv *bat_priv,
-						   void *data)
+/* the caller has to hold rcu_read_lock() - no reference is taken */
+static struct hna_local_entry *__hna_local_find(struct bat_priv *bat_priv,
+						void *data)
+{
+	struct hlist_node *node;
+
+	node = hash_find(bat_priv->hna_local_hash, compare_lhna, choose_orig,
+			 data);
+	if (!node)
+		return NULL;
+
+	return container_of(node, struct hna_local_entry, hash_entry);
+}
+
+/* the caller has to hold rcu_read_lock() - no reference is taken */
+static struct hna_global_entry *__hna_global_find(struct bat_priv *bat_priv,
+						  void *data)
 {
-	struct hashtable_t *hash = bat_priv->hna_local_hash;
-	struct hlist_head *head;
 	struct hlist_node *node;
-	struct hna_local_entry *hna_local_entry, *hna_local_entry_tmp = NULL;
-	int index;
 
-	if (!hash)
+	node = hash_find(bat_priv->hna_global_hash, compare_ghna, choose_orig,
+			 data);
+	if (!node)
 		return NULL;
 
-	index = choose_orig(data, hash->size);
-	head = &hash->table[index];
+	return container_of(node, struct hna_global_entry, hash_entry);
+}
+
+static struct hna_local_entry *hna_local_hash_find(struct bat_priv *bat_priv,
+						   void *data)
+{
+	struct hna_local_entry *hna_local_entry;
 
 	rcu_read_lock();
-	hlist_for_each_entry_rcu(hna_local_entry, node, head, hash_entry) {
-		if (!compare_eth(hna_local_entry, data))
-			continue;
+	hna_local_entry = __hna_local_find(bat_priv, data);
 
-		hna_local_entry_tmp = hna_local_entry;
-		break;
-	}
+	if ((hna_local_entry) &&
+	    (!atomic_inc_not_zero(&hna_local_entry->refcount)))
+		hna_local_entry = NULL;
 	rcu_read_unlock();
 
-	return hna_local_entry_tmp;
+	return hna_local_entry;
 }
 
 static struct hna_global_entry *hna_global_hash_find(struct bat_priv *bat_priv,
 						     void *data)
 {
-	struct hashtable_t *hash = bat_priv->hna_global_hash;
-	struct hlist_head *head;
-	struct hlist_node *node;
 	struct hna_global_entry *hna_global_entry;
-	struct hna_global_entry *hna_global_entry_tmp = NULL;
-	int index;
-
-	if (!hash)
-		return NULL;
-
-	index = choose_orig(data, hash->size);
-	head = &hash->table[index];
 
 	rcu_read_lock();
-	hlist_for_each_entry_rcu(hna_global_entry, node, head, hash_entry) {
-		if (!compare_eth(hna_global_entry, data))
-			continue;
+	hna_global_entry = __hna_global_find(bat_priv, data);
 
-		hna_global_entry_tmp = hna_global_entry;
-		break;
-	}
+	if ((hna_global_entry) &&
+	    (!atomic_inc_not_zero(&hna_global_entry->refcount)))
+		hna_global_entry = NULL;
 	rcu_read_unlock();
 
-	return hna_global_entry_tmp;
+	return hna_global_entry;
+}
+
+static void hna_local_entry_free_rcu(struct rcu_head *rcu)
+{
+	struct hna_local_entry *hna_local_entry;
+
+	hna_local_entry = container_of(rcu, struct hna_local_entry, rcu);
+	kfree(hna_local_entry);
+}
+
+static void hna_local_entry_free_ref(struct hna_local_entry *hna_local_entry)
+{
+	if (atomic_dec_and_test(&hna_local_entry->refcount))
+		call_rcu(&hna_local_entry->rcu, hna_local_entry_free_rcu);
+}
+
+static void hna_global_entry_free_rcu(struct rcu_head *rcu)
+{
+	struct hna_global_entry *hna_global_entry;
+
+	hna_global_entry = container_of(rcu, struct hna_global_entry, rcu);
+	kfree(hna_global_entry);
+}
+
+static void hna_global_entry_free_ref(struct hna_global_entry *hna_global_entry)
+{
+	if (atomic_dec_and_test(&hna_global_entry->refcount))
+		call_rcu(&hna_global_entry->rcu, hna_global_entry_free_rcu);
 }
 
 int hna_local_init(struct bat_priv *bat_priv)
@@ -132,14 +163,19 @@ void hna_local_add(struct net_device *soft_iface, uint8_t *addr)
 	struct hna_global_entry *hna_global_entry;
 	int required_bytes;
 
-	spin_lock_bh(&bat_priv->hna_lhash_lock);
-	hna_local_entry = hna_local_hash_find(bat_priv, addr);
-	spin_unlock_bh(&bat_priv->hna_lhash_lock);
+	/* this runs for every frame sent into the mesh: known addresses only
+	 * get their timestamp refreshed - without lock or reference */
+	rcu_read_lock();
+	hna_local_entry = __hna_local_find(bat_priv, addr);
 
 	if (hna_local_entry) {
-		hna_local_entry->last_seen = jiffies;
+		if (hna_local_entry->last_seen != jiffies)
+			hna_local_entry->last_seen = jiffies;
+
+		rcu_read_unlock();
 		return;
 	}
+	rcu_read_unlock();
 
 	/* only announce as many hosts as possible in the batman-packet and
 	   space in batman_packet->num_hna That also should give a limit to
@@ -167,6 +203,7 @@ void hna_local_add(struct net_device *soft_iface, uint8_t *addr)
 
 	memcpy(hna_local_entry->addr, addr, ETH_ALEN);
 	hna_local_entry->last_seen = jiffies;
+	atomic_set(&hna_local_entry->refcount, 1);
 
 	/* the batman interface mac address should never be purged */
 	if (compare_eth(addr, soft_iface->dev_addr))
@@ -176,8 +213,14 @@ void hna_local_add(struct net_device *soft_iface, uint8_t *addr)
 
 	spin_lock_bh(&bat_priv->hna_lhash_lock);
 
-	hash_add(bat_priv->hna_local_hash, compare_lhna, choose_orig,
-		 hna_local_entry, &hna_local_entry->hash_entry);
+	/* another cpu might have added the address in the meantime */
+	if (hash_add(bat_priv->hna_local_hash, compare_lhna, choose_orig,
+		     hna_local_entry, &hna_local_entry->hash_entry) < 0) {
+		spin_unlock_bh(&bat_priv->hna_lhash_lock);
+		kfree(hna_local_entry);
+		return;
+	}
+
 	bat_priv->num_local_hna++;
 	atomic_set(&bat_priv->hna_local_changed, 1);
 
@@ -188,9 +231,11 @@ void hna_local_add(struct net_device *soft_iface, uint8_t *addr)
 
 	hna_global_entry = hna_global_hash_find(bat_priv, addr);
 
-	if (hna_global_entry)
+	if (hna_global_entry) {
 		_hna_global_del_orig(bat_priv, hna_global_entry,
 				     "local hna received");
+		hna_global_entry_free_ref(hna_global_entry);
+	}
 
 	spin_unlock_bh(&bat_priv->hna_ghash_lock);
 }
@@ -199,6 +244,7 @@ int hna_local_fill_buffer(struct bat_priv *bat_priv,
 			  unsigned char *buff, int buff_len)
 {
 	struct hashtable_t *hash = bat_priv->hna_local_hash;
+	struct hash_buckets *buckets;
 	struct hna_local_entry *hna_local_entry;
 	struct hlist_node *node;
 	struct hlist_head *head;
@@ -206,10 +252,12 @@ int hna_local_fill_buffer(struct bat_priv *bat_priv,
 
 	spin_lock_bh(&bat_priv->hna_lhash_lock);
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(hna_local_entry, node,
 					 head, hash_entry) {
 			if (buff_len < (count + 1) * ETH_ALEN)
@@ -220,8 +268,8 @@ int hna_local_fill_buffer(struct bat_priv *bat_priv,
 
 			count++;
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	/* if we did not get all new local hnas see you next time  ;-) */
 	if (count == bat_priv->num_local_hna)
@@ -236,6 +284,7 @@ int hna_local_seq_print_text(struct seq_file *seq, void *offset)
 	struct net_device *net_dev = (struct net_device *)seq->private;
 	struct bat_priv *bat_priv = netdev_priv(net_dev);
 	struct hashtable_t *hash = bat_priv->hna_local_hash;
+	struct hash_buckets *buckets;
 	struct hna_local_entry *hna_local_entry;
 	struct hlist_node *node;
 	struct hlist_head *head;
@@ -257,14 +306,16 @@ int hna_local_seq_print_text(struct seq_file *seq, void *offset)
 
 	buf_size = 1;
 	/* Estimate length for: " * xx:xx:xx:xx:xx:xx\n" */
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		__hlist_for_each_rcu(node, head)
 			buf_size += 21;
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	buff = kmalloc(buf_size, GFP_ATOMIC);
 	if (!buff) {
@@ -275,17 +326,19 @@ int hna_local_seq_print_text(struct seq_file *seq, void *offset)
 	buff[0] = '\0';
 	pos = 0;
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(hna_local_entry, node,
 					 head, hash_entry) {
 			pos += snprintf(buff + pos, 22, " * %pM\n",
 					hna_local_entry->addr);
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	spin_unlock_bh(&bat_priv->hna_lhash_lock);
 
@@ -297,9 +350,11 @@ int hna_local_seq_print_text(struct seq_file *seq, void *offset)
 static void _hna_local_del(struct hlist_node *node, void *arg)
 {
 	struct bat_priv *bat_priv = (struct bat_priv *)arg;
-	void *data = container_of(node, struct hna_local_entry, hash_entry);
+	struct hna_local_entry *hna_local_entry;
+
+	hna_local_entry = container_of(node, struct hna_local_entry, hash_entry);
 
-	kfree(data);
+	hna_local_entry_free_ref(hna_local_entry);
 	bat_priv->num_local_hna--;
 	atomic_set(&bat_priv->hna_local_changed, 1);
 }
@@ -325,8 +380,10 @@ void hna_local_remove(struct bat_priv *bat_priv,
 
 	hna_local_entry = hna_local_hash_find(bat_priv, addr);
 
-	if (hna_local_entry)
+	if (hna_local_entry) {
 		hna_local_del(bat_priv, hna_local_entry, message);
+		hna_local_entry_free_ref(hna_local_entry);
+	}
 
 	spin_unlock_bh(&bat_priv->hna_lhash_lock);
 }
@@ -338,16 +395,22 @@ static void hna_local_purge(struct work_struct *work)
 	struct bat_priv *bat_priv =
 		container_of(delayed_work, struct bat_priv, hna_work);
 	struct hashtable_t *hash = bat_priv->hna_local_hash;
+	struct hash_buckets *buckets, *new_buckets;
 	struct hna_local_entry *hna_local_entry;
 	struct hlist_node *node, *node_tmp;
 	struct hlist_head *head;
 	unsigned long timeout;
 	int i;
 
+	/* may sleep, so get the new buckets before taking the lock */
+	new_buckets = hash_resize_prepare(hash);
+
 	spin_lock_bh(&bat_priv->hna_lhash_lock);
+	buckets = hash_buckets_protected(hash,
+			lockdep_is_held(&bat_priv->hna_lhash_lock));
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
 		hlist_for_each_entry_safe(hna_local_entry, node, node_tmp,
 					  head, hash_entry) {
@@ -365,6 +428,9 @@ static void hna_local_purge(struct work_struct *work)
 		}
 	}
 
+	hash_resize(hash, new_buckets, choose_orig,
+		    offsetof(struct hna_local_entry, hash_entry));
+
 	spin_unlock_bh(&bat_priv->hna_lhash_lock);
 	hna_local_start_timer(bat_priv);
 }
@@ -402,47 +468,53 @@ void hna_global_add_orig(struct bat_priv *bat_priv,
 	unsigned char *hna_ptr;
 
 	while ((hna_buff_count + 1) * ETH_ALEN <= hna_buff_len) {
+		hna_ptr = hna_buff + (hna_buff_count * ETH_ALEN);
+
 		spin_lock_bh(&bat_priv->hna_ghash_lock);
 
-		hna_ptr = hna_buff + (hna_buff_count * ETH_ALEN);
 		hna_global_entry = hna_global_hash_find(bat_priv, hna_ptr);
 
 		if (!hna_global_entry) {
-			spin_unlock_bh(&bat_priv->hna_ghash_lock);
-
 			hna_global_entry =
 				kmalloc(sizeof(struct hna_global_entry),
 					GFP_ATOMIC);
 
-			if (!hna_global_entry)
+			if (!hna_global_entry) {
+				spin_unlock_bh(&bat_priv->hna_ghash_lock);
 				break;
+			}
 
 			memcpy(hna_global_entry->addr, hna_ptr, ETH_ALEN);
+			hna_global_entry->orig_node = orig_node;
+
+			/* one reference for the hash, one for the code below */
+			atomic_set(&hna_global_entry->refcount, 2);
 
 			bat_dbg(DBG_ROUTES, bat_priv,
 				"Creating new global hna entry: "
 				"%pM (via %pM)\n",
 				hna_global_entry->addr, orig_node->orig);
 
-			spin_lock_bh(&bat_priv->hna_ghash_lock);
 			hash_add(bat_priv->hna_global_hash, compare_ghna,
 				 choose_orig, hna_global_entry,
 				 &hna_global_entry->hash_entry);
 
 		}
 
-		hna_global_entry->orig_node = orig_node;
+		rcu_assign_pointer(hna_global_entry->orig_node, orig_node);
+		hna_global_entry_free_ref(hna_global_entry);
 		spin_unlock_bh(&bat_priv->hna_ghash_lock);
 
 		/* remove address from local hash if present */
 		spin_lock_bh(&bat_priv->hna_lhash_lock);
 
-		hna_ptr = hna_buff + (hna_buff_count * ETH_ALEN);
 		hna_local_entry = hna_local_hash_find(bat_priv, hna_ptr);
 
-		if (hna_local_entry)
+		if (hna_local_entry) {
 			hna_local_del(bat_priv, hna_local_entry,
 				      "global hna received");
+			hna_local_entry_free_ref(hna_local_entry);
+		}
 
 		spin_unlock_bh(&bat_priv->hna_lhash_lock);
 
@@ -467,6 +539,7 @@ int hna_global_seq_print_text(struct seq_file *seq, void *offset)
 	struct net_device *net_dev = (struct net_device *)seq->private;
 	struct bat_priv *bat_priv = netdev_priv(net_dev);
 	struct hashtable_t *hash = bat_priv->hna_global_hash;
+	struct hash_buckets *buckets;
 	struct hna_global_entry *hna_global_entry;
 	struct hlist_node *node;
 	struct hlist_head *head;
@@ -487,14 +560,16 @@ int hna_global_seq_print_text(struct seq_file *seq, void *offset)
 
 	buf_size = 1;
 	/* Estimate length for: " * xx:xx:xx:xx:xx:xx via xx:xx:xx:xx:xx:xx\n"*/
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		__hlist_for_each_rcu(node, head)
 			buf_size += 43;
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	buff = kmalloc(buf_size, GFP_ATOMIC);
 	if (!buff) {
@@ -504,10 +579,12 @@ int hna_global_seq_print_text(struct seq_file *seq, void *offset)
 	buff[0] = '\0';
 	pos = 0;
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(hna_global_entry, node,
 					 head, hash_entry) {
 			pos += snprintf(buff + pos, 44,
@@ -515,8 +592,8 @@ int hna_global_seq_print_text(struct seq_file *seq, void *offset)
 					hna_global_entry->addr,
 					hna_global_entry->orig_node->orig);
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	spin_unlock_bh(&bat_priv->hna_ghash_lock);
 
@@ -536,7 +613,7 @@ static void _hna_global_del_orig(struct bat_priv *bat_priv,
 
 	hash_remove(bat_priv->hna_global_hash, compare_ghna, choose_orig,
 		    hna_global_entry->addr);
-	kfree(hna_global_entry);
+	hna_global_entry_free_ref(hna_global_entry);
 }
 
 void hna_global_del_orig(struct bat_priv *bat_priv,
@@ -555,11 +632,15 @@ void hna_global_del_orig(struct bat_priv *bat_priv,
 		hna_ptr = orig_node->hna_buff + (hna_buff_count * ETH_ALEN);
 		hna_global_entry = hna_global_hash_find(bat_priv, hna_ptr);
 
-		if ((hna_global_entry) &&
-		    (hna_global_entry->orig_node == orig_node))
+		if (!hna_global_entry)
+			goto next;
+
+		if (hna_global_entry->orig_node == orig_node)
 			_hna_global_del_orig(bat_priv, hna_global_entry,
 					     message);
 
+		hna_global_entry_free_ref(hna_global_entry);
+next:
 		hna_buff_count++;
 	}
 
@@ -572,9 +653,11 @@ void hna_global_del_orig(struct bat_priv *bat_priv,
 
 static void hna_global_del(struct hlist_node *node, void *arg)
 {
-	void *data = container_of(node, struct hna_global_entry, hash_entry);
+	struct hna_global_entry *hna_global_entry;
 
-	kfree(data);
+	hna_global_entry = container_of(node, struct hna_global_entry,
+					hash_entry);
+	hna_global_entry_free_ref(hna_global_entry);
 }
 
 void hna_global_free(struct bat_priv *bat_priv)
@@ -586,23 +669,26 @@ void hna_global_free(struct bat_priv *bat_priv)
 	bat_priv->hna_global_hash = NULL;
 }
 
+/* called for every unicast frame sent into the mesh - takes no lock: the
+ * entry stays valid during the rcu read section and the originator is only
+ * returned if it still is alive */
 struct orig_node *transtable_search(struct bat_priv *bat_priv, uint8_t *addr)
 {
 	struct hna_global_entry *hna_global_entry;
 	struct orig_node *orig_node = NULL;
 
-	spin_lock_bh(&bat_priv->hna_ghash_lock);
-	hna_global_entry = hna_global_hash_find(bat_priv, addr);
+	rcu_read_lock();
+	hna_global_entry = __hna_global_find(bat_priv, addr);
 
 	if (!hna_global_entry)
 		goto out;
 
-	if (!atomic_inc_not_zero(&hna_global_entry->orig_node->refcount))
-		goto out;
+	orig_node = rcu_dereference(hna_global_entry->orig_node);
 
-	orig_node = hna_global_entry->orig_node;
+	if (!atomic_inc_not_zero(&orig_node->refcount))
+		orig_node = NULL;
 
 out:
-	spin_unlock_bh(&bat_priv->hna_ghash_lock);
+	rcu_read_unlock();
 	return orig_node;
 }
@@ -82,13 +82,11 @@ struct orig_node {
 	unsigned long bcast_bits[NUM_WORDS];
 	uint32_t last_bcast_seqno;
 	struct hlist_head neigh_list;
-	struct list_head frag_list;
 	spinlock_t neigh_list_lock; /* protects neighbor list */
 	atomic_t refcount;
 	struct rcu_head rcu;
 	struct hlist_node hash_entry;
 	struct bat_priv *bat_priv;
-	unsigned long last_frag_packet;
 	spinlock_t ogm_cnt_lock; /* protects: bcast_own, bcast_own_sum,
 				  * neigh_node->real_bits,
 				  * neigh_node->real_packet_count */
@@ -127,10 +125,57 @@ struct neigh_node {
 	struct hard_iface *if_incoming;
 };
 
+/* the counters of the soft interface and of the mesh traffic per packet
+ * type - every packet counter is followed by its byte counter */
+enum bat_counters {
+	BAT_CNT_TX,
+	BAT_CNT_TX_BYTES,
+	BAT_CNT_TX_DROPPED,
+	BAT_CNT_RX,
+	BAT_CNT_RX_BYTES,
+	/* in the order of the packet types - see BAT_CNT_TYPE_TX() */
+	BAT_CNT_OGM_TX,
+	BAT_CNT_OGM_TX_BYTES,
+	BAT_CNT_OGM_RX,
+	BAT_CNT_OGM_RX_BYTES,
+	BAT_CNT_ICMP_TX,
+	BAT_CNT_ICMP_TX_BYTES,
+	BAT_CNT_ICMP_RX,
+	BAT_CNT_ICMP_RX_BYTES,
+	BAT_CNT_UNICAST_TX,
+	BAT_CNT_UNICAST_TX_BYTES,
+	BAT_CNT_UNICAST_RX,
+	BAT_CNT_UNICAST_RX_BYTES,
+	BAT_CNT_BCAST_TX,
+	BAT_CNT_BCAST_TX_BYTES,
+	BAT_CNT_BCAST_RX,
+	BAT_CNT_BCAST_RX_BYTES,
+	BAT_CNT_VIS_TX,
+	BAT_CNT_VIS_TX_BYTES,
+	BAT_CNT_VIS_RX,
+	BAT_CNT_VIS_RX_BYTES,
+	BAT_CNT_FRAG_TX,
+	BAT_CNT_FRAG_TX_BYTES,
+	BAT_CNT_FRAG_RX,
+	BAT_CNT_FRAG_RX_BYTES,
+	BAT_CNT_NUM,
+};
+
+/* packet counters of the mesh traffic of a packet type (BAT_PACKET, ...) */
+#define BAT_CNT_TYPE_TX(packet_type) \
+	(BAT_CNT_OGM_TX + ((packet_type) - BAT_PACKET) * 4)
+#define BAT_CNT_TYPE_RX(packet_type) (BAT_CNT_TYPE_TX(packet_type) + 2)
+
+/* per cpu counters - see bat_add_counter() */
+struct bat_stats {
+	uint64_t counters[BAT_CNT_NUM];
+	struct u64_stats_sync syncp;
+};
 
 struct bat_priv {
 	atomic_t mesh_state;
-	struct net_device_stats stats;
+	struct net_device_stats stats;	/* summed up from bat_stats */
+	struct bat_stats __percpu *bat_stats;
 	atomic_t aggregated_ogms;	/* boolean */
 	atomic_t bonding;		/* boolean */
 	atomic_t fragmentation;		/* boolean */
@@ -159,19 +204,27 @@ struct bat_priv {
 	struct hashtable_t *hna_local_hash;
 	struct hashtable_t *hna_global_hash;
 	struct hashtable_t *vis_hash;
+	struct hashtable_t *frag_hash;
+	struct list_head frag_list;	/* buffered fragments, oldest first */
 	spinlock_t forw_bat_list_lock; /* protects forw_bat_list */
-	spinlock_t forw_bcast_list_lock; /* protects  */
-	spinlock_t hna_lhash_lock; /* protects hna_local_hash */
-	spinlock_t hna_ghash_lock; /* protects hna_global_hash */
+	spinlock_t forw_bcast_list_lock; /* protects forw_bcast_list and
+					  * bcast_work_* */
+	spinlock_t hna_lhash_lock; /* serialises hna_local_hash writers */
+	spinlock_t hna_ghash_lock; /* serialises hna_global_hash writers */
 	spinlock_t gw_list_lock; /* protects gw_list and curr_gw */
 	spinlock_t vis_hash_lock; /* protects vis_hash */
 	spinlock_t vis_list_lock; /* protects vis_info::recv_list */
 	spinlock_t softif_neigh_lock; /* protects soft-interface neigh list */
+	spinlock_t frag_list_lock; /* protects frag_list, serialises
+				    * frag_hash adds */
 	int16_t num_local_hna;
 	atomic_t hna_local_changed;
 	struct delayed_work hna_work;
 	struct delayed_work orig_work;
 	struct delayed_work vis_work;
+	struct delayed_work bcast_work;
+	unsigned long bcast_work_time;	/* bcast_work is armed for */
+	uint8_t bcast_work_armed;
 	struct gw_node __rcu *curr_gw;  /* rcu protected pointer */
 	struct vis_info *my_vis_info;
 };
@@ -196,12 +249,16 @@ struct hna_local_entry {
 	unsigned long last_seen;
 	char never_purge;
 	struct hlist_node hash_entry;
+	atomic_t refcount;
+	struct rcu_head rcu;
 };
 
 struct hna_global_entry {
 	uint8_t addr[ETH_ALEN];
 	struct orig_node *orig_node;
 	struct hlist_node hash_entry;
+	atomic_t refcount;
+	struct rcu_head rcu;
 };
 
 /**
@@ -238,9 +295,14 @@ struct debug_log {
 	wait_queue_head_t queue_wait;
 };
 
-struct frag_packet_list_entry {
-	struct list_head list;
+/* a fragment waiting for its other half - both halves are keyed by the
+ * originator and the seqno of the head fragment */
+struct frag_packet {
+	struct hlist_node hash_entry;
+	struct list_head list;	/* in frag_list, owned by who hashed it out */
+	uint8_t orig[ETH_ALEN];
 	uint16_t seqno;
+	unsigned long timestamp;
 	struct sk_buff *skb;
 };
 
@@ -29,142 +29,210 @@
 #include "translation-table.h"
 #include "routing.h"
 #include "hard-interface.h"
+#include <linux/if_vlan.h>
 
 
-static struct sk_buff *frag_merge_packet(struct list_head *head,
-					 struct frag_packet_list_entry *tfp,
-					 struct sk_buff *skb)
+/* compares the originator and the head seqno of two fragments */
+static int frag_packet_cmp(struct hlist_node *node, void *data2)
 {
-	struct unicast_frag_packet *up =
-		(struct unicast_frag_packet *)skb->data;
-	struct sk_buff *tmp_skb;
-	struct unicast_packet *unicast_packet;
-	int hdr_len = sizeof(struct unicast_packet);
-	int uni_diff = sizeof(struct unicast_frag_packet) - hdr_len;
+	struct frag_packet *frag_packet1 =
+		container_of(node, struct frag_packet, hash_entry);
+	struct frag_packet *frag_packet2 = data2;
 
-	/* set skb to the first part and tmp_skb to the second part */
-	if (up->flags & UNI_FRAG_HEAD) {
-		tmp_skb = tfp->skb;
-	} else {
-		tmp_skb = skb;
-		skb = tfp->skb;
+	return (frag_packet1->seqno == frag_packet2->seqno) &&
+		compare_eth(frag_packet1->orig, frag_packet2->orig);
+}
+
+/* hash function to choose an entry in a hash table of given size */
+/* hash algorithm from http://en.wikipedia.org/wiki/Hash_table */
+static int frag_packet_choose(void *data, int size)
+{
+	struct frag_packet *frag_packet = data;
+	unsigned char *key = frag_packet->orig;
+	uint32_t hash = 0;
+	size_t i;
+
+	for (i = 0; i < ETH_ALEN; i++) {
+		hash += key[i];
+		hash += (hash << 10);
+		hash ^= (hash >> 6);
 	}
 
-	if (skb_linearize(skb) < 0 || skb_linearize(tmp_skb) < 0)
-		goto err;
+	hash += frag_packet->seqno & 0xff;
+	hash += (hash << 10);
+	hash ^= (hash >> 6);
+	hash += frag_packet->seqno >> 8;
+	hash += (hash << 10);
+	hash ^= (hash >> 6);
 
-	skb_pull(tmp_skb, sizeof(struct unicast_frag_packet));
-	if (pskb_expand_head(skb, 0, tmp_skb->len, GFP_ATOMIC) < 0)
-		goto err;
+	hash += (hash << 3);
+	hash ^= (hash >> 11);
+	hash += (hash << 15);
 
-	/* move free entry to end */
-	tfp->skb = NULL;
-	tfp->seqno = 0;
-	list_move_tail(&tfp->list, head);
+	return hash % size;
+}
 
-	memcpy(skb_put(skb, tmp_skb->len), tmp_skb->data, tmp_skb->len);
-	kfree_skb(tmp_skb);
+static void frag_packet_free(struct frag_packet *frag_packet)
+{
+	kfree_skb(frag_packet->skb);
+	kfree(frag_packet);
+}
 
-	memmove(skb->data + uni_diff, skb->data, hdr_len);
-	unicast_packet = (struct unicast_packet *) skb_pull(skb, uni_diff);
-	unicast_packet->packet_type = BAT_UNICAST;
+static void frag_packet_free_cb(struct hlist_node *node, void *arg)
+{
+	frag_packet_free(container_of(node, struct frag_packet, hash_entry));
+}
 
-	return skb;
+int frag_init(struct bat_priv *bat_priv)
+{
+	if (bat_priv->frag_hash)
+		return 1;
 
-err:
-	/* free buffered skb, skb will be freed later */
-	kfree_skb(tfp->skb);
-	return NULL;
+	bat_priv->frag_hash = hash_new(64);
+
+	if (!bat_priv->frag_hash)
+		return 0;
+
+	return 1;
 }
 
-static void frag_create_entry(struct list_head *head, struct sk_buff *skb)
+void frag_free(struct bat_priv *bat_priv)
 {
-	struct frag_packet_list_entry *tfp;
-	struct unicast_frag_packet *up =
-		(struct unicast_frag_packet *)skb->data;
+	if (!bat_priv->frag_hash)
+		return;
 
-	/* free and oldest packets stand at the end */
-	tfp = list_entry((head)->prev, typeof(*tfp), list);
-	kfree_skb(tfp->skb);
+	hash_delete(bat_priv->frag_hash, frag_packet_free_cb, NULL);
+	bat_priv->frag_hash = NULL;
+	INIT_LIST_HEAD(&bat_priv->frag_list);
+}
+
+/* Buffered fragments are also kept on frag_list in the order they arrived.
+ * New entries are hashed and queued under frag_list_lock, so whoever takes
+ * an entry out of the hash finds it queued and has to unqueue it before
+ * freeing it. */
+
+static void frag_list_del(struct bat_priv *bat_priv,
+			  struct frag_packet *frag_packet)
+{
+	spin_lock_bh(&bat_priv->frag_list_lock);
+	list_del(&frag_packet->list);
+	spin_unlock_bh(&bat_priv->frag_list_lock);
+}
 
-	tfp->seqno = ntohs(up->seqno);
-	tfp->skb = skb;
-	list_move(&tfp->list, head);
-	return;
+/* drops the fragment which waits longest for its other half. Has to be
+ * called with frag_list_lock held, returns 0 if nothing could be dropped */
+static int frag_drop_oldest(struct bat_priv *bat_priv)
+{
+	struct frag_packet *frag_packet;
+	struct hlist_node *node;
+
+	if (list_empty(&bat_priv->frag_list))
+		return 0;
+
+	frag_packet = list_first_entry(&bat_priv->frag_list,
+				       struct frag_packet, list);
+
+	/* it might be getting merged - then this finds nothing or a newer
+	 * fragment with the same key, which is just as well dropped */
+	node = hash_remove(bat_priv->frag_hash, frag_packet_cmp,
+			   frag_packet_choose, frag_packet);
+	if (!node)
+		return 0;
+
+	frag_packet = container_of(node, struct frag_packet, hash_entry);
+	list_del(&frag_packet->list);
+	frag_packet_free(frag_packet);
+	return 1;
 }
 
-static int frag_create_buffer(struct list_head *head)
+/* drops the fragments whose other half did not arrive in time - must only
+ * be called from the purge worker as it resizes the hash afterwards */
+void frag_purge(struct bat_priv *bat_priv)
 {
-	int i;
-	struct frag_packet_list_entry *tfp;
-
-	for (i = 0; i < FRAG_BUFFER_SIZE; i++) {
-		tfp = kmalloc(sizeof(struct frag_packet_list_entry),
-			GFP_ATOMIC);
-		if (!tfp) {
-			frag_list_free(head);
-			return -ENOMEM;
-		}
-		tfp->skb = NULL;
-		tfp->seqno = 0;
-		INIT_LIST_HEAD(&tfp->list);
-		list_add(&tfp->list, head);
+	struct hashtable_t *hash = bat_priv->frag_hash;
+	struct frag_packet *frag_packet;
+
+	if (!hash)
+		return;
+
+	spin_lock_bh(&bat_priv->frag_list_lock);
+	while (!list_empty(&bat_priv->frag_list)) {
+		frag_packet = list_first_entry(&bat_priv->frag_list,
+					       struct frag_packet, list);
+
+		if (!time_after(jiffies, frag_packet->timestamp +
+				msecs_to_jiffies(FRAG_TIMEOUT)))
+			break;
+
+		if (!frag_drop_oldest(bat_priv))
+			break;
 	}
+	spin_unlock_bh(&bat_priv->frag_list_lock);
 
-	return 0;
+	hash_resize(hash, hash_resize_prepare(hash), frag_packet_choose,
+		    offsetof(struct frag_packet, hash_entry));
 }
 
-static struct frag_packet_list_entry *frag_search_packet(struct list_head *head,
-						 struct unicast_frag_packet *up)
+/* chains the second half to the first one through the frag_list - only
+ * the header of the first half is rewritten, no data gets copied.
+ * The buffered skb is always consumed, skb only on success. */
+static struct sk_buff *frag_merge_packet(struct sk_buff *buffered_skb,
+					 struct sk_buff *skb)
 {
-	struct frag_packet_list_entry *tfp;
-	struct unicast_frag_packet *tmp_up = NULL;
-	uint16_t search_seqno;
+	struct unicast_frag_packet *up =
+		(struct unicast_frag_packet *)skb->data;
+	struct sk_buff *tmp_skb, **frag_tail;
+	struct unicast_packet *unicast_packet;
+	int hdr_len = sizeof(struct unicast_packet);
+	int uni_diff = sizeof(struct unicast_frag_packet) - hdr_len;
 
-	if (up->flags & UNI_FRAG_HEAD)
-		search_seqno = ntohs(up->seqno)+1;
-	else
-		search_seqno = ntohs(up->seqno)-1;
+	/* set skb to the first part and tmp_skb to the second part */
+	if (up->flags & UNI_FRAG_HEAD) {
+		tmp_skb = buffered_skb;
+	} else {
+		tmp_skb = skb;
+		skb = buffered_skb;
+	}
 
-	list_for_each_entry(tfp, head, list) {
+	/* interface_rx() reads the ethernet header from the linear part */
+	if (!pskb_may_pull(skb, sizeof(struct unicast_frag_packet) +
+			   VLAN_ETH_HLEN))
+		goto err;
 
-		if (!tfp->skb)
-			continue;
+	/* the header is rewritten in place */
+	if (skb_cow(skb, 0) < 0)
+		goto err;
 
-		if (tfp->seqno == ntohs(up->seqno))
-			goto mov_tail;
+	/* frag_lists can't be nested */
+	if (skb_has_frag_list(tmp_skb) && skb_linearize(tmp_skb) < 0)
+		goto err;
 
-		tmp_up = (struct unicast_frag_packet *)tfp->skb->data;
+	skb_pull(tmp_skb, sizeof(struct unicast_frag_packet));
 
-		if (tfp->seqno == search_seqno) {
+	memmove(skb->data + uni_diff, skb->data, hdr_len);
+	unicast_packet = (struct unicast_packet *) skb_pull(skb, uni_diff);
+	unicast_packet->packet_type = BAT_UNICAST;
 
-			if ((tmp_up->flags & UNI_FRAG_HEAD) !=
-			    (up->flags & UNI_FRAG_HEAD))
-				return tfp;
-			else
-				goto mov_tail;
-		}
-	}
-	return NULL;
+	frag_tail = &skb_shinfo(skb)->frag_list;
+	while (*frag_tail)
+		frag_tail = &(*frag_tail)->next;
 
-mov_tail:
-	list_move_tail(&tfp->list, head);
-	return NULL;
-}
+	tmp_skb->next = NULL;
+	*frag_tail = tmp_skb;
 
-void frag_list_free(struct list_head *head)
-{
-	struct frag_packet_list_entry *pf, *tmp_pf;
+	skb->len += tmp_skb->len;
+	skb->data_len += tmp_skb->len;
+	skb->truesize += tmp_skb->truesize;
 
-	if (!list_empty(head)) {
+	/* a checksum of the hardware covers the first half only */
+	skb->ip_summed = CHECKSUM_NONE;
 
-		list_for_each_entry_safe(pf, tmp_pf, head, list) {
-			kfree_skb(pf->skb);
-			list_del(&pf->list);
-			kfree(pf);
-		}
-	}
-	return;
+	return skb;
+
+err:
+	/* free buffered skb, skb will be freed later */
+	kfree_skb(buffered_skb);
+	return NULL;
 }
 
 /* frag_reassemble_skb():
@@ -176,47 +244,107 @@ void frag_list_free(struct list_head *head)
 int frag_reassemble_skb(struct sk_buff *skb, struct bat_priv *bat_priv,
 			struct sk_buff **new_skb)
 {
-	struct orig_node *orig_node;
-	struct frag_packet_list_entry *tmp_frag_entry;
+	struct frag_packet *frag_packet, *tmp_frag_packet;
+	struct unicast_frag_packet *tmp_up;
+	struct hlist_node *node;
 	int ret = NET_RX_DROP;
 	struct unicast_frag_packet *unicast_packet =
 		(struct unicast_frag_packet *)skb->data;
 
 	*new_skb = NULL;
 
-	orig_node = orig_hash_find(bat_priv, unicast_packet->orig);
-	if (!orig_node)
+	frag_packet = kmalloc(sizeof(struct frag_packet), GFP_ATOMIC);
+	if (!frag_packet)
 		goto out;
 
-	orig_node->last_frag_packet = jiffies;
+	memcpy(frag_packet->orig, unicast_packet->orig, ETH_ALEN);
+	frag_packet->seqno = ntohs(unicast_packet->seqno);
+	if (!(unicast_packet->flags & UNI_FRAG_HEAD))
+		frag_packet->seqno--;
 
-	if (list_empty(&orig_node->frag_list) &&
-	    frag_create_buffer(&orig_node->frag_list)) {
-		pr_debug("couldn't create frag buffer\n");
-		goto out;
-	}
+	frag_packet->timestamp = jiffies;
+	frag_packet->skb = skb;
 
-	tmp_frag_entry = frag_search_packet(&orig_node->frag_list,
-					    unicast_packet);
+search:
+	node = hash_remove(bat_priv->frag_hash, frag_packet_cmp,
+			   frag_packet_choose, frag_packet);
 
-	if (!tmp_frag_entry) {
-		frag_create_entry(&orig_node->frag_list, skb);
-		ret = NET_RX_SUCCESS;
-		goto out;
+	if (!node)
+		goto add;
+
+	tmp_frag_packet = container_of(node, struct frag_packet, hash_entry);
+	frag_list_del(bat_priv, tmp_frag_packet);
+	tmp_up = (struct unicast_frag_packet *)tmp_frag_packet->skb->data;
+
+	/* the same half again replaces the buffered one */
+	if ((tmp_up->flags & UNI_FRAG_HEAD) ==
+	    (unicast_packet->flags & UNI_FRAG_HEAD)) {
+		frag_packet_free(tmp_frag_packet);
+		goto add;
 	}
 
-	*new_skb = frag_merge_packet(&orig_node->frag_list, tmp_frag_entry,
-				     skb);
+	*new_skb = frag_merge_packet(tmp_frag_packet->skb, skb);
+	kfree(tmp_frag_packet);
 	/* if not, merge failed */
 	if (*new_skb)
 		ret = NET_RX_SUCCESS;
 
+	goto free_frag;
+
+add:
+	spin_lock_bh(&bat_priv->frag_list_lock);
+
+	if (atomic_read(&bat_priv->frag_hash->count) >= FRAG_BUFFER_MAX)
+		frag_drop_oldest(bat_priv);
+
+	/* the other half might have been buffered meanwhile */
+	if (hash_add(bat_priv->frag_hash, frag_packet_cmp, frag_packet_choose,
+		     frag_packet, &frag_packet->hash_entry) < 0) {
+		spin_unlock_bh(&bat_priv->frag_list_lock);
+		goto search;
+	}
+
+	list_add_tail(&frag_packet->list, &bat_priv->frag_list);
+	spin_unlock_bh(&bat_priv->frag_list_lock);
+
+	return NET_RX_SUCCESS;
+
+free_frag:
+	kfree(frag_packet);
 out:
-	if (orig_node)
-		orig_node_free_ref(orig_node);
 	return ret;
 }
 
+/* splits skb after len bytes and returns the second part. A packet which
+ * got merged by frag_merge_packet() is split along its frag_list, the
+ * way GSO segments a frag_list skb, without copying any data. Otherwise
+ * skb_split() copies the linear data behind len. */
+static struct sk_buff *frag_split_skb(struct sk_buff *skb, int len)
+{
+	struct sk_buff *frag_skb = skb_shinfo(skb)->frag_list;
+
+	if (frag_skb && !frag_skb->next && !skb_shared(frag_skb) &&
+	    !skb_cloned(skb) && skb->len - frag_skb->len == len) {
+		skb_shinfo(skb)->frag_list = NULL;
+		skb->len -= frag_skb->len;
+		skb->data_len -= frag_skb->len;
+		skb->truesize -= frag_skb->truesize;
+		return frag_skb;
+	}
+
+	if (skb_has_frag_list(skb) && skb_linearize(skb) < 0)
+		return NULL;
+
+	frag_skb = dev_alloc_skb(skb->len - len +
+				 sizeof(struct unicast_frag_packet));
+	if (!frag_skb)
+		return NULL;
+
+	skb_reserve(frag_skb, sizeof(struct unicast_frag_packet));
+	skb_split(skb, frag_skb, len);
+	return frag_skb;
+}
+
 int frag_send_skb(struct sk_buff *skb, struct bat_priv *bat_priv,
 		  struct hard_iface *hard_iface, uint8_t dstaddr[])
 {
@@ -232,14 +360,12 @@ int frag_send_skb(struct sk_buff *skb, struct bat_priv *bat_priv,
 	if (!bat_priv->primary_if)
 		goto dropped;
 
-	frag_skb = dev_alloc_skb(data_len - (data_len / 2) + ucf_hdr_len);
-	if (!frag_skb)
-		goto dropped;
-	skb_reserve(frag_skb, ucf_hdr_len);
-
 	unicast_packet = (struct unicast_packet *) skb->data;
 	memcpy(&tmp_uc, unicast_packet, uc_hdr_len);
-	skb_split(skb, frag_skb, data_len / 2 + uc_hdr_len);
+
+	frag_skb = frag_split_skb(skb, data_len / 2 + uc_hdr_len);
+	if (!frag_skb)
+		goto dropped;
 
 	if (my_skb_head_push(skb, ucf_hdr_len - uc_hdr_len) < 0 ||
 	    my_skb_head_push(frag_skb, ucf_hdr_len) < 0)
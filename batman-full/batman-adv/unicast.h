@@ -24,12 +24,14 @@
 
 #include "packet.h"
 
-#define FRAG_TIMEOUT 10000	/* purge frag list entrys after time in ms */
-#define FRAG_BUFFER_SIZE 6	/* number of list elements in buffer */
+#define FRAG_TIMEOUT 10000	/* purge frag hash entrys after time in ms */
+#define FRAG_BUFFER_MAX 256	/* fragments buffered per mesh interface */
 
+int frag_init(struct bat_priv *bat_priv);
+void frag_free(struct bat_priv *bat_priv);
+void frag_purge(struct bat_priv *bat_priv);
 int frag_reassemble_skb(struct sk_buff *skb, struct bat_priv *bat_priv,
 			struct sk_buff **new_skb);
-void frag_list_free(struct list_head *head);
 int unicast_send_skb(struct sk_buff *skb, struct bat_priv *bat_priv);
 int frag_send_skb(struct sk_buff *skb, struct bat_priv *bat_priv,
 		  struct hard_iface *hard_iface, uint8_t dstaddr[]);
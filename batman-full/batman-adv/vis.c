@@ -108,29 +108,17 @@ static int vis_info_choose(void *data, int size)
 static struct vis_info *vis_hash_find(struct bat_priv *bat_priv,
 				      void *data)
 {
-	struct hashtable_t *hash = bat_priv->vis_hash;
-	struct hlist_head *head;
 	struct hlist_node *node;
-	struct vis_info *vis_info, *vis_info_tmp = NULL;
-	int index;
-
-	if (!hash)
-		return NULL;
-
-	index = vis_info_choose(data, hash->size);
-	head = &hash->table[index];
+	struct vis_info *vis_info = NULL;
 
 	rcu_read_lock();
-	hlist_for_each_entry_rcu(vis_info, node, head, hash_entry) {
-		if (!vis_info_cmp(node, data))
-			continue;
-
-		vis_info_tmp = vis_info;
-		break;
-	}
+	node = hash_find(bat_priv->vis_hash, vis_info_cmp, vis_info_choose,
+			 data);
+	if (node)
+		vis_info = container_of(node, struct vis_info, hash_entry);
 	rcu_read_unlock();
 
-	return vis_info_tmp;
+	return vis_info;
 }
 
 /* insert interface to the list of interfaces of one originator, if it
@@ -212,6 +200,7 @@ int vis_seq_print_text(struct seq_file *seq, void *offset)
 	struct net_device *net_dev = (struct net_device *)seq->private;
 	struct bat_priv *bat_priv = netdev_priv(net_dev);
 	struct hashtable_t *hash = bat_priv->vis_hash;
+	struct hash_buckets *buckets;
 	HLIST_HEAD(vis_if_list);
 	struct if_list_entry *entry;
 	struct hlist_node *pos, *n;
@@ -228,10 +217,12 @@ int vis_seq_print_text(struct seq_file *seq, void *offset)
 	buf_size = 1;
 	/* Estimate length */
 	spin_lock_bh(&bat_priv->vis_hash_lock);
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(info, node, head, hash_entry) {
 			packet = (struct vis_packet *)info->skb_packet->data;
 			entries = (struct vis_info_entry *)
@@ -264,8 +255,8 @@ int vis_seq_print_text(struct seq_file *seq, void *offset)
 				kfree(entry);
 			}
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	buff = kmalloc(buf_size, GFP_ATOMIC);
 	if (!buff) {
@@ -275,10 +266,12 @@ int vis_seq_print_text(struct seq_file *seq, void *offset)
 	buff[0] = '\0';
 	buff_pos = 0;
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(info, node, head, hash_entry) {
 			packet = (struct vis_packet *)info->skb_packet->data;
 			entries = (struct vis_info_entry *)
@@ -320,8 +313,8 @@ int vis_seq_print_text(struct seq_file *seq, void *offset)
 				kfree(entry);
 			}
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	spin_unlock_bh(&bat_priv->vis_hash_lock);
 
@@ -558,6 +551,7 @@ static int find_best_vis_server(struct bat_priv *bat_priv,
 				struct vis_info *info)
 {
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node;
 	struct hlist_head *head;
 	struct orig_node *orig_node;
@@ -566,10 +560,12 @@ static int find_best_vis_server(struct bat_priv *bat_priv,
 
 	packet = (struct vis_packet *)info->skb_packet->data;
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(orig_node, node, head, hash_entry) {
 			if ((orig_node) && (orig_node->router) &&
 			    (orig_node->flags & VIS_SERVER) &&
@@ -579,8 +575,8 @@ static int find_best_vis_server(struct bat_priv *bat_priv,
 				       ETH_ALEN);
 			}
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	return best_tq;
 }
@@ -602,6 +598,7 @@ static bool vis_packet_full(struct vis_info *info)
 static int generate_vis_packet(struct bat_priv *bat_priv)
 {
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node;
 	struct hlist_head *head;
 	struct orig_node *orig_node;
@@ -628,10 +625,12 @@ static int generate_vis_packet(struct bat_priv *bat_priv)
 			return -1;
 	}
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(orig_node, node, head, hash_entry) {
 			neigh_node = orig_node->router;
 
@@ -660,14 +659,17 @@ static int generate_vis_packet(struct bat_priv *bat_priv)
 			if (vis_packet_full(info))
 				goto unlock;
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 
 	hash = bat_priv->hna_local_hash;
 
 	spin_lock_bh(&bat_priv->hna_lhash_lock);
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	buckets = hash_buckets_protected(hash,
+			lockdep_is_held(&bat_priv->hna_lhash_lock));
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
 		hlist_for_each_entry(hna_local_entry, node, head, hash_entry) {
 			entry = (struct vis_info_entry *)
@@ -699,12 +701,16 @@ static void purge_vis_packets(struct bat_priv *bat_priv)
 {
 	int i;
 	struct hashtable_t *hash = bat_priv->vis_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node, *node_tmp;
 	struct hlist_head *head;
 	struct vis_info *info;
 
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	buckets = hash_buckets_protected(hash,
+			lockdep_is_held(&bat_priv->vis_hash_lock));
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
 		hlist_for_each_entry_safe(info, node, node_tmp,
 					  head, hash_entry) {
@@ -714,7 +720,7 @@ static void purge_vis_packets(struct bat_priv *bat_priv)
 
 			if (time_after(jiffies,
 				       info->first_seen + VIS_TIMEOUT * HZ)) {
-				hlist_del(node);
+				hash_del_node(hash, node);
 				send_list_del(info);
 				kref_put(&info->refcount, free_info);
 			}
@@ -726,6 +732,7 @@ static void broadcast_vis_packet(struct bat_priv *bat_priv,
 				 struct vis_info *info)
 {
 	struct hashtable_t *hash = bat_priv->orig_hash;
+	struct hash_buckets *buckets;
 	struct hlist_node *node;
 	struct hlist_head *head;
 	struct orig_node *orig_node;
@@ -739,10 +746,12 @@ static void broadcast_vis_packet(struct bat_priv *bat_priv,
 	packet = (struct vis_packet *)info->skb_packet->data;
 
 	/* send to all routers in range. */
-	for (i = 0; i < hash->size; i++) {
-		head = &hash->table[i];
+	rcu_read_lock();
+	buckets = hash_buckets(hash);
+
+	for (i = 0; i < buckets->size; i++) {
+		head = &buckets->table[i];
 
-		rcu_read_lock();
 		hlist_for_each_entry_rcu(orig_node, node, head, hash_entry) {
 			/* if it's a vis server and reachable, send it. */
 			if ((!orig_node) || (!orig_node->router))
@@ -764,8 +773,8 @@ static void broadcast_vis_packet(struct bat_priv *bat_priv,
 				send_skb_packet(skb, hard_iface, dstaddr);
 
 		}
-		rcu_read_unlock();
 	}
+	rcu_read_unlock();
 }
 
 static void unicast_vis_packet(struct bat_priv *bat_priv,
@@ -842,10 +851,16 @@ static void send_vis_packets(struct work_struct *work)
 		container_of(work, struct delayed_work, work);
 	struct bat_priv *bat_priv =
 		container_of(delayed_work, struct bat_priv, vis_work);
+	struct hash_buckets *new_buckets;
 	struct vis_info *info;
 
+	/* may sleep, so get the new buckets before taking the lock */
+	new_buckets = hash_resize_prepare(bat_priv->vis_hash);
+
 	spin_lock_bh(&bat_priv->vis_hash_lock);
 	purge_vis_packets(bat_priv);
+	hash_resize(bat_priv->vis_hash, new_buckets, vis_info_choose,
+		    offsetof(struct vis_info, hash_entry));
 
 	if (generate_vis_packet(bat_priv) == 0) {
 		/* schedule if generation was successful */
@@ -32,6 +32,7 @@
 #include "originator.h"
 #include "schedule.h"
 #include "hna.h"
+#include "pipeline.h"
 #include "types.h"
 
 
@@ -88,13 +89,13 @@ uint8_t found_ifs = 0;
 uint8_t active_ifs = 0;
 int32_t receive_max_sock = 0;
 fd_set receive_wait_set;
+int32_t receive_epoll_fd = -1;
 
 uint8_t unix_client = 0;
 uint8_t log_facility_active = 0;
 
 struct hashtable_t *orig_hash;
 
-struct list_head_first forw_list;
 struct list_head_first gw_list;
 struct list_head_first if_list;
 
@@ -113,8 +114,8 @@ uint8_t minimum_send = TQ_LOCAL_BIDRECT_SEND_MINIMUM;
 uint8_t minimum_recv = TQ_LOCAL_BIDRECT_RECV_MINIMUM;
 uint8_t global_win_size = TQ_GLOBAL_WINDOW_SIZE;
 uint8_t local_win_size = TQ_LOCAL_WINDOW_SIZE;
-uint8_t num_words = (TQ_LOCAL_WINDOW_SIZE / WORD_BIT_SIZE);
 uint8_t aggregation_enabled = 1;
+int16_t num_workers = -1;   /* ogm workers, -1: one per cpu */
 
 int nat_tool_avail = -1;
 int8_t disable_client_nat = 0;
@@ -140,6 +141,8 @@ void usage(void)
 	fprintf( stderr, "       -v print version\n" );
 	fprintf( stderr, "       --policy-routing-script\n" );
 	fprintf( stderr, "       --disable-client-nat\n" );
+	fprintf( stderr, "       --workers\n" );
+	fprintf( stderr, "       --profile\n" );
 }
 
 
@@ -192,6 +195,9 @@ void verbose_usage(void)
 	fprintf( stderr, "       -v print version\n" );
 	fprintf( stderr, "       --policy-routing-script send all routing table changes to the script\n" );
 	fprintf(stderr, "       --disable-client-nat deactivates the 'set tunnel NAT rules' feature (useful for half tunneling)\n");
+	fprintf(stderr, "       --workers number of threads processing the originator messages\n");
+	fprintf(stderr, "          default: one per cpu (none on single cpu systems), allowed values: 0 - %i\n\n", PIPELINE_MAX_WORKERS);
+	fprintf(stderr, "       --profile show the time spent and packets handled per processing stage (client mode only)\n");
 }
 
 
@@ -610,8 +616,13 @@ static int isBidirectionalNeigh(struct orig_node *orig_node, struct orig_node *o
 
 	in->tq = ((in->tq * orig_neigh_node->tq_own * orig_neigh_node->tq_asym_penalty) / (TQ_MAX_VALUE *  TQ_MAX_VALUE));
 
-	addr_to_string( orig_node->orig, orig_str, ADDR_STR_LEN );
-	addr_to_string( orig_neigh_node->orig, neigh_str, ADDR_STR_LEN );
+	/* the address strings are only needed for the debug output */
+	orig_str[0] = neigh_str[0] = '\0';
+
+	if (debug_clients.clients_num[3] > 0) {
+		addr_to_string(orig_node->orig, orig_str, ADDR_STR_LEN);
+		addr_to_string(orig_neigh_node->orig, neigh_str, ADDR_STR_LEN);
+	}
 
 	/*debug_output( 3, "bidirectional: orig = %-15s neigh = %-15s => own_bcast = %2i, real recv = %2i, local tq: %3i, asym_penalty: %3i, total tq: %3i \n",
 	orig_str, neigh_str, total_count, neigh_node->real_packet_count, orig_neigh_node->tq_own, orig_neigh_node->tq_asym_penalty, in->tq );*/
@@ -733,21 +744,21 @@ static uint8_t count_real_packets(struct bat_packet *in, uint32_t neigh, struct
 		tmp_neigh_node = list_entry( list_pos, struct neigh_node, list );
 
 		if ( !is_duplicate )
-			is_duplicate = get_bit_status( tmp_neigh_node->real_bits, orig_node->last_real_seqno, in->seqno );
+			is_duplicate = get_bit_status( &tmp_neigh_node->real_bits, orig_node->last_real_seqno, in->seqno );
 
 		if ( ( tmp_neigh_node->addr == neigh ) && ( tmp_neigh_node->if_incoming == if_incoming ) ) {
 
-			bit_get_packet( tmp_neigh_node->real_bits, in->seqno - orig_node->last_real_seqno, 1 );
+			bit_get_packet( &tmp_neigh_node->real_bits, in->seqno - orig_node->last_real_seqno, 1 );
 			/*debug_output( 3, "count_real_packets (yes): neigh = %s, is_new = %s, seq = %i, last seq = %i\n", neigh_str, ( is_new_seqno ? "YES" : "NO" ), in->seqno, orig_node->last_real_seqno );*/
 
 		} else {
 
-			bit_get_packet( tmp_neigh_node->real_bits, in->seqno - orig_node->last_real_seqno, 0 );
+			bit_get_packet( &tmp_neigh_node->real_bits, in->seqno - orig_node->last_real_seqno, 0 );
 			/*debug_output( 3, "count_real_packets (no): neigh = %s, is_new = %s, seq = %i, last seq = %i\n", neigh_str, ( is_new_seqno ? "YES" : "NO" ), in->seqno, orig_node->last_real_seqno );*/
 
 		}
 
-		tmp_neigh_node->real_packet_count = bit_packet_count( tmp_neigh_node->real_bits );
+		tmp_neigh_node->real_packet_count = bit_packet_count( &tmp_neigh_node->real_bits );
 
 	}
 
@@ -761,234 +772,290 @@ static uint8_t count_real_packets(struct bat_packet *in, uint32_t neigh, struct
 	return is_duplicate;
 }
 
-int8_t batman(void)
+/* runs on the worker owning the originator of the packet - see pipeline.h */
+void process_ogm(struct bat_packet *bat_packet, uint32_t neigh, struct batman_if *if_incoming, uint32_t curr_time, uint8_t is_my_orig, uint8_t is_my_oldorig)
 {
-	struct list_head *list_pos, *forw_pos_tmp;
 	struct orig_node *orig_neigh_node, *orig_node;
-	struct batman_if *batman_if, *if_incoming;
-	struct forw_node *forw_node;
-	struct bat_packet *bat_packet;
-	uint32_t neigh, debug_timeout, vis_timeout, select_timeout, curr_time;
-	unsigned char in[2001], *hna_recv_buff;
-	char orig_str[ADDR_STR_LEN], neigh_str[ADDR_STR_LEN], ifaddr_str[ADDR_STR_LEN], prev_sender_str[ADDR_STR_LEN];
-	int16_t hna_buff_len, packet_len, curr_packet_len;
-	uint8_t forward_old, if_rp_filter_all_old, if_rp_filter_default_old, if_send_redirects_all_old, if_send_redirects_default_old;
-	uint8_t is_my_addr, is_my_orig, is_my_oldorig, is_broadcast, is_duplicate, is_bidirectional, has_directlink_flag;
-	int8_t res;
+	unsigned char *hna_recv_buff;
+	char neigh_str[ADDR_STR_LEN];
+	int16_t hna_buff_len;
+	uint8_t is_duplicate, is_bidirectional, has_directlink_flag;
 
 
-	debug_timeout = vis_timeout = get_time_msec();
+	/* the neighbour string is only needed for the debug output */
+	neigh_str[0] = '\0';
 
-	if ( NULL == ( orig_hash = hash_new( 128, compare_orig, choose_orig ) ) )
-		return(-1);
+	if (debug_clients.clients_num[3] > 0)
+		addr_to_string(neigh, neigh_str, sizeof(neigh_str));
 
-	/* for profiling the functions */
-	prof_init(PROF_choose_gw, "choose_gw");
-	prof_init(PROF_update_routes, "update_routes");
-	prof_init(PROF_update_gw_list, "update_gw_list");
-	prof_init(PROF_is_duplicate, "isDuplicate");
-	prof_init(PROF_get_orig_node, "get_orig_node");
-	prof_init(PROF_update_originator, "update_orig");
-	prof_init(PROF_purge_originator, "purge_orig");
-	prof_init(PROF_schedule_forward_packet, "schedule_forward_packet");
-	prof_init(PROF_send_outstanding_packets, "send_outstanding_packets");
+	has_directlink_flag = (bat_packet->flags & DIRECTLINK ? 1 : 0);
 
-	list_for_each(list_pos, &if_list) {
-		batman_if = list_entry(list_pos, struct batman_if, list);
+	hna_buff_len = bat_packet->hna_len * 5;
+	hna_recv_buff = (hna_buff_len > 4 ? (unsigned char *)(bat_packet + 1) : NULL);
 
-		batman_if->out.version = COMPAT_VERSION;
-		batman_if->out.flags = 0x00;
-		batman_if->out.ttl = (batman_if->if_num > 0 ? 2 : TTL);
-		batman_if->out.gwflags = (batman_if->if_num > 0 ? 0 : gateway_class);
-		batman_if->out.seqno = 1;
-		batman_if->out.gwport = htons(GW_PORT);
-		batman_if->out.tq = TQ_MAX_VALUE;
+	if (is_my_orig) {
+		orig_neigh_node = get_orig_node(neigh);
 
-		schedule_own_packet(batman_if);
+		if ((has_directlink_flag) && (if_incoming->addr.sin_addr.s_addr == bat_packet->orig) && (bat_packet->seqno - if_incoming->out.seqno + 2 == 0)) {
+
+			debug_output(4, "count own bcast (is_my_orig): old = %i, ", orig_neigh_node->bcast_own_sum[if_incoming->if_num]);
+
+			bit_mark(&orig_neigh_node->bcast_own[if_incoming->if_num], 0);
+			orig_neigh_node->bcast_own_sum[if_incoming->if_num] = bit_packet_count(&orig_neigh_node->bcast_own[if_incoming->if_num]);
+
+			debug_output(4, "new = %i \n", orig_neigh_node->bcast_own_sum[if_incoming->if_num]);
+
+		}
+
+		debug_output(4, "Drop packet: originator packet from myself (via neighbour) \n");
+		return;
 	}
 
-	if_rp_filter_all_old = get_rp_filter("all");
-	if_rp_filter_default_old = get_rp_filter("default");
+	if (bat_packet->tq == 0) {
+		count_real_packets(bat_packet, neigh, if_incoming);
 
-	if_send_redirects_all_old = get_send_redirects("all");
-	if_send_redirects_default_old = get_send_redirects("default");
+		debug_output(4, "Drop packet: originator packet with tq is 0 \n");
+		return;
+	}
 
-	set_rp_filter(0, "all");
-	set_rp_filter(0, "default");
+	if (is_my_oldorig) {
+		debug_output(4, "Drop packet: ignoring all rebroadcast echos (sender: %s) \n", neigh_str);
+		return;
+	}
 
-	set_send_redirects(0, "all");
-	set_send_redirects(0, "default");
+	is_duplicate = count_real_packets(bat_packet, neigh, if_incoming);
 
-	forward_old = get_forwarding();
-	set_forwarding(1);
+	orig_node = get_orig_node(bat_packet->orig);
 
-	while (!is_aborted()) {
+	/* if sender is a direct neighbor the sender ip equals originator ip */
+	orig_neigh_node = (bat_packet->orig == neigh ? orig_node : get_orig_node(neigh));
 
-		debug_output( 4, " \n" );
+	/* drop packet if sender is not a direct neighbor and if we no route towards it */
+	if ((bat_packet->orig != neigh) && (orig_neigh_node->router == NULL)) {
+		debug_output(4, "Drop packet: OGM via unknown neighbor! \n");
+		return;
+	}
 
-		/* harden select_timeout against sudden time change (e.g. ntpdate) */
-		curr_time = get_time_msec();
-		select_timeout = ((int)(((struct forw_node *)forw_list.next)->send_time - curr_time) > 0 ?
-					((struct forw_node *)forw_list.next)->send_time - curr_time : 10);
+	is_bidirectional = isBidirectionalNeigh(orig_node, orig_neigh_node, bat_packet, curr_time, if_incoming);
 
-		res = receive_packet(in, sizeof(in), &packet_len, &neigh, select_timeout, &if_incoming);
+	/* update ranking if it is not a duplicate or has the same seqno and similar ttl as the non-duplicate */
+	if ((is_bidirectional) && ((!is_duplicate) ||
+	     ((orig_node->last_real_seqno == bat_packet->seqno) &&
+	     (orig_node->last_ttl - 3 <= bat_packet->ttl))))
+		update_orig(orig_node, bat_packet, neigh, if_incoming, hna_recv_buff, hna_buff_len, is_duplicate, curr_time);
 
-		/* on receive error the interface is deactivated in receive_packet() */
-		if (res < 1)
-			goto send_packets;
+	/* is single hop (direct) neighbour */
+	if (bat_packet->orig == neigh) {
 
-		curr_time = get_time_msec();
-		curr_packet_len = 0;
-		bat_packet = (struct bat_packet *)in;
+		/* mark direct link on incoming interface */
+		if (prepare_forward_packet(orig_node, bat_packet, neigh, 1))
+			pipeline_forward(bat_packet, 1, hna_buff_len, if_incoming, curr_time);
+
+		debug_output(4, "Forward packet: rebroadcast neighbour packet with direct link flag \n");
+		return;
+	}
+
+	/* multihop originator */
+	if (!is_bidirectional) {
+		debug_output(4, "Drop packet: not received via bidirectional link\n");
+		return;
+	}
+
+	if (is_duplicate) {
+		debug_output(4, "Drop packet: duplicate packet received\n");
+		return;
+	}
+
+	debug_output(4, "Forward packet: rebroadcast originator packet \n");
+
+	if (prepare_forward_packet(orig_node, bat_packet, neigh, 0))
+		pipeline_forward(bat_packet, 0, hna_buff_len, if_incoming, curr_time);
+}
+
+/* split a received datagram into its OGMs and hand them to the pipeline */
+static void process_packet(struct recv_packet *recv_packet, uint32_t curr_time)
+{
+	struct list_head *list_pos;
+	struct batman_if *batman_if, *if_incoming = recv_packet->if_incoming;
+	struct bat_packet *bat_packet;
+	uint32_t neigh = recv_packet->neigh;
+	char orig_str[ADDR_STR_LEN], neigh_str[ADDR_STR_LEN], ifaddr_str[ADDR_STR_LEN], prev_sender_str[ADDR_STR_LEN];
+	int16_t packet_len = recv_packet->len, curr_packet_len = 0;
+	uint8_t is_my_addr, is_my_orig, is_my_oldorig, is_broadcast, debug_recv;
+
+
+	bat_packet = (struct bat_packet *)recv_packet->buff;
+
+	/* the address strings are only needed for the debug output */
+	debug_recv = (debug_clients.clients_num[3] > 0);
+	orig_str[0] = neigh_str[0] = ifaddr_str[0] = prev_sender_str[0] = '\0';
 
+	if (debug_recv) {
 		addr_to_string(neigh, neigh_str, sizeof(neigh_str));
 		addr_to_string(if_incoming->addr.sin_addr.s_addr, ifaddr_str, sizeof(ifaddr_str));
+	}
 
-		while ((curr_packet_len + (int)sizeof(struct bat_packet) <= packet_len) &&
-			(curr_packet_len + (int)sizeof(struct bat_packet) + bat_packet->hna_len * 5 <= packet_len) &&
-			(curr_packet_len + (int)sizeof(struct bat_packet) + bat_packet->hna_len * 5 <= MAX_AGGREGATION_BYTES)) {
+	while ((curr_packet_len + (int)sizeof(struct bat_packet) <= packet_len) &&
+		(curr_packet_len + (int)sizeof(struct bat_packet) + bat_packet->hna_len * 5 <= packet_len) &&
+		(curr_packet_len + (int)sizeof(struct bat_packet) + bat_packet->hna_len * 5 <= MAX_AGGREGATION_BYTES)) {
 
-			bat_packet = (struct bat_packet *)(in + curr_packet_len);
-			curr_packet_len += sizeof(struct bat_packet) + bat_packet->hna_len * 5;
+		bat_packet = (struct bat_packet *)(recv_packet->buff + curr_packet_len);
+		curr_packet_len += sizeof(struct bat_packet) + bat_packet->hna_len * 5;
 
-			/* network to host order for our 16bit seqno */
-			bat_packet->seqno = ntohs(bat_packet->seqno);
+		/* network to host order for our 16bit seqno */
+		bat_packet->seqno = ntohs(bat_packet->seqno);
 
+		if (debug_recv) {
 			addr_to_string(bat_packet->orig, orig_str, sizeof(orig_str));
 			addr_to_string(bat_packet->prev_sender, prev_sender_str, sizeof(prev_sender_str));
+		}
 
-			is_my_addr = is_my_orig = is_my_oldorig = is_broadcast = 0;
+		is_my_addr = is_my_orig = is_my_oldorig = is_broadcast = 0;
 
-			has_directlink_flag = (bat_packet->flags & DIRECTLINK ? 1 : 0);
+		debug_output(4, "Received BATMAN packet via NB: %s, IF: %s %s (from OG: %s, via old OG: %s, seqno %d, tq %d, TTL %d, V %d, IDF %d) \n", neigh_str, if_incoming->dev, ifaddr_str, orig_str, prev_sender_str, bat_packet->seqno, bat_packet->tq, bat_packet->ttl, bat_packet->version, (bat_packet->flags & DIRECTLINK ? 1 : 0));
 
-			debug_output(4, "Received BATMAN packet via NB: %s, IF: %s %s (from OG: %s, via old OG: %s, seqno %d, tq %d, TTL %d, V %d, IDF %d) \n", neigh_str, if_incoming->dev, ifaddr_str, orig_str, prev_sender_str, bat_packet->seqno, bat_packet->tq, bat_packet->ttl, bat_packet->version, has_directlink_flag);
+		list_for_each(list_pos, &if_list) {
 
-			hna_buff_len = bat_packet->hna_len * 5;
-			hna_recv_buff = (hna_buff_len > 4 ? (unsigned char *)(bat_packet + 1) : NULL);
+			batman_if = list_entry(list_pos, struct batman_if, list);
 
-			list_for_each(list_pos, &if_list) {
+			if (neigh == batman_if->addr.sin_addr.s_addr)
+				is_my_addr = 1;
 
-				batman_if = list_entry(list_pos, struct batman_if, list);
+			if (bat_packet->orig == batman_if->addr.sin_addr.s_addr)
+				is_my_orig = 1;
 
-				if (neigh == batman_if->addr.sin_addr.s_addr)
-					is_my_addr = 1;
+			if (neigh == batman_if->broad.sin_addr.s_addr)
+				is_broadcast = 1;
 
-				if (bat_packet->orig == batman_if->addr.sin_addr.s_addr)
-					is_my_orig = 1;
+			if (bat_packet->prev_sender == batman_if->addr.sin_addr.s_addr)
+				is_my_oldorig = 1;
 
-				if (neigh == batman_if->broad.sin_addr.s_addr)
-					is_broadcast = 1;
+		}
 
-				if (bat_packet->prev_sender == batman_if->addr.sin_addr.s_addr)
-					is_my_oldorig = 1;
 
-			}
+		if (bat_packet->gwflags != 0)
+			debug_output(4, "Is an internet gateway (class %i) \n", bat_packet->gwflags);
 
+		if (bat_packet->version != COMPAT_VERSION) {
+			debug_output(4, "Drop packet: incompatible batman version (%i) \n", bat_packet->version);
+			return;
+		}
 
-			if (bat_packet->gwflags != 0)
-				debug_output(4, "Is an internet gateway (class %i) \n", bat_packet->gwflags);
+		if (is_my_addr) {
+			debug_output(4, "Drop packet: received my own broadcast (sender: %s) \n", neigh_str);
+			return;
+		}
 
-			if (bat_packet->version != COMPAT_VERSION) {
-				debug_output(4, "Drop packet: incompatible batman version (%i) \n", bat_packet->version);
-				goto send_packets;
-			}
+		if (is_broadcast) {
+			debug_output(4, "Drop packet: ignoring all packets with broadcast source IP (sender: %s) \n", neigh_str);
+			return;
+		}
 
-			if (is_my_addr) {
-				debug_output(4, "Drop packet: received my own broadcast (sender: %s) \n", neigh_str);
-				goto send_packets;
-			}
+		pipeline_dispatch(bat_packet, neigh, if_incoming, curr_time, is_my_orig, is_my_oldorig);
 
-			if (is_broadcast) {
-				debug_output(4, "Drop packet: ignoring all packets with broadcast source IP (sender: %s) \n", neigh_str);
-				goto send_packets;
-			}
+	}
+}
 
-			if (is_my_orig) {
-				orig_neigh_node = get_orig_node(neigh);
+int8_t batman(void)
+{
+	struct list_head *list_pos;
+	struct batman_if *batman_if;
+	static struct recv_packet recv_packets[RECV_BATCH];
+	uint32_t debug_timeout, vis_timeout, select_timeout, send_time, curr_time;
+	uint8_t forward_old, if_rp_filter_all_old, if_rp_filter_default_old, if_send_redirects_all_old, if_send_redirects_default_old;
+	int16_t num_packets, i;
 
-				if ((has_directlink_flag) && (if_incoming->addr.sin_addr.s_addr == bat_packet->orig) && (bat_packet->seqno - if_incoming->out.seqno + 2 == 0)) {
 
-					debug_output(4, "count own bcast (is_my_orig): old = %i, ", orig_neigh_node->bcast_own_sum[if_incoming->if_num]);
+	debug_timeout = vis_timeout = get_time_msec();
 
-					bit_mark((TYPE_OF_WORD *)&(orig_neigh_node->bcast_own[if_incoming->if_num * num_words]), 0);
-					orig_neigh_node->bcast_own_sum[if_incoming->if_num] = bit_packet_count((TYPE_OF_WORD *)&(orig_neigh_node->bcast_own[if_incoming->if_num * num_words]));
+	if ( NULL == ( orig_hash = hash_new( 128, compare_orig, choose_orig ) ) )
+		return(-1);
 
-					debug_output(4, "new = %i \n", orig_neigh_node->bcast_own_sum[if_incoming->if_num]);
+	/* for profiling the functions */
+	prof_init(PROF_choose_gw, "choose_gw");
+	prof_init(PROF_update_routes, "update_routes");
+	prof_init(PROF_update_gw_list, "update_gw_list");
+	prof_init(PROF_is_duplicate, "isDuplicate");
+	prof_init(PROF_get_orig_node, "get_orig_node");
+	prof_init(PROF_update_originator, "update_orig");
+	prof_init(PROF_purge_originator, "purge_orig");
+	prof_init(PROF_schedule_forward_packet, "schedule_forward_packet");
+	prof_init(PROF_send_outstanding_packets, "send_outstanding_packets");
+	prof_init(PROF_receive_packets, "receive_packets");
 
-				}
+	if (pipeline_init() < 0)
+		return -1;
 
-				debug_output(4, "Drop packet: originator packet from myself (via neighbour) \n");
-				goto send_packets;
-			}
+	/* wake up the main thread when the workers have packets to forward */
+	interface_listen_sockets();
 
-			if (bat_packet->tq == 0) {
-				count_real_packets(bat_packet, neigh, if_incoming);
+	schedule_init();
 
-				debug_output(4, "Drop packet: originator packet with tq is 0 \n");
-				goto send_packets;
-			}
+	list_for_each(list_pos, &if_list) {
+		batman_if = list_entry(list_pos, struct batman_if, list);
 
-			if (is_my_oldorig) {
-				debug_output(4, "Drop packet: ignoring all rebroadcast echos (sender: %s) \n", neigh_str);
-				goto send_packets;
-			}
+		batman_if->out.version = COMPAT_VERSION;
+		batman_if->out.flags = 0x00;
+		batman_if->out.ttl = (batman_if->if_num > 0 ? 2 : TTL);
+		batman_if->out.gwflags = (batman_if->if_num > 0 ? 0 : gateway_class);
+		batman_if->out.seqno = 1;
+		batman_if->out.gwport = htons(GW_PORT);
+		batman_if->out.tq = TQ_MAX_VALUE;
 
-			is_duplicate = count_real_packets(bat_packet, neigh, if_incoming);
+		schedule_own_packet(batman_if);
+	}
 
-			orig_node = get_orig_node(bat_packet->orig);
+	if_rp_filter_all_old = get_rp_filter("all");
+	if_rp_filter_default_old = get_rp_filter("default");
 
-			/* if sender is a direct neighbor the sender ip equals originator ip */
-			orig_neigh_node = (bat_packet->orig == neigh ? orig_node : get_orig_node(neigh));
+	if_send_redirects_all_old = get_send_redirects("all");
+	if_send_redirects_default_old = get_send_redirects("default");
 
-			/* drop packet if sender is not a direct neighbor and if we no route towards it */
-			if ((bat_packet->orig != neigh) && (orig_neigh_node->router == NULL)) {
-				debug_output(4, "Drop packet: OGM via unknown neighbor! \n");
-				goto send_packets;
-			}
+	set_rp_filter(0, "all");
+	set_rp_filter(0, "default");
 
-			is_bidirectional = isBidirectionalNeigh(orig_node, orig_neigh_node, bat_packet, curr_time, if_incoming);
+	set_send_redirects(0, "all");
+	set_send_redirects(0, "default");
 
-			/* update ranking if it is not a duplicate or has the same seqno and similar ttl as the non-duplicate */
-			if ((is_bidirectional) && ((!is_duplicate) ||
-			     ((orig_node->last_real_seqno == bat_packet->seqno) &&
-			     (orig_node->last_ttl - 3 <= bat_packet->ttl))))
-				update_orig(orig_node, bat_packet, neigh, if_incoming, hna_recv_buff, hna_buff_len, is_duplicate, curr_time);
+	forward_old = get_forwarding();
+	set_forwarding(1);
 
-			/* is single hop (direct) neighbour */
-			if (bat_packet->orig == neigh) {
+	while (!is_aborted()) {
 
-				/* mark direct link on incoming interface */
-				schedule_forward_packet(orig_node, bat_packet, neigh, 1, hna_buff_len, if_incoming, curr_time);
+		debug_output( 4, " \n" );
 
-				debug_output(4, "Forward packet: rebroadcast neighbour packet with direct link flag \n");
-				goto send_packets;
-			}
+		/* harden select_timeout against sudden time change (e.g. ntpdate) */
+		curr_time = get_time_msec();
+		send_time = get_forw_send_time(curr_time);
+		select_timeout = ((int)(send_time - curr_time) > 0 ? send_time - curr_time : 10);
 
-			/* multihop originator */
-			if (!is_bidirectional) {
-				debug_output(4, "Drop packet: not received via bidirectional link\n");
-				goto send_packets;
-			}
+		num_packets = receive_packets(recv_packets, RECV_BATCH, select_timeout);
 
-			if (is_duplicate) {
-				debug_output(4, "Drop packet: duplicate packet received\n");
-				goto send_packets;
-			}
+		curr_time = get_time_msec();
 
-			debug_output(4, "Forward packet: rebroadcast originator packet \n");
+		/* on receive error the interface is deactivated in receive_packets() */
+		if (num_packets > 0) {
 
-			schedule_forward_packet(orig_node, bat_packet, neigh, 0, hna_buff_len, if_incoming, curr_time);
+			prof_start(PROF_receive_packets);
 
-		}
+			for (i = 0; i < num_packets; i++) {
+				process_packet(&recv_packets[i], curr_time);
+				prof_count(PROF_receive_packets, 1, recv_packets[i].len);
+			}
 
+			prof_stop(PROF_receive_packets);
 
-send_packets:
+		}
+
+		pipeline_collect();
 		send_outstanding_packets(curr_time);
 
 		if ((int)(curr_time - (debug_timeout + 1000)) > 0) {
 
 			debug_timeout = curr_time;
 
+			pipeline_lock();
+
 			purge_orig( curr_time );
 
 			debug_orig();
@@ -1013,10 +1080,14 @@ send_packets:
 			}
 
 			hna_local_task_exec();
+
+			pipeline_unlock();
 		}
 
 	}
 
+	pipeline_destroy();
+
 	if (debug_level > 0)
 		printf("Deleting all BATMAN routes\n");
 
@@ -1024,15 +1095,7 @@ send_packets:
 
 	hash_destroy(orig_hash);
 
-	list_for_each_safe(list_pos, forw_pos_tmp, &forw_list) {
-
-		forw_node = list_entry(list_pos, struct forw_node, list);
-
-		list_del((struct list_head *)&forw_list, list_pos, &forw_list);
-
-		debugFree(forw_node->pack_buff, 1105);
-		debugFree(forw_node, 1106);
-	}
+	schedule_free();
 
 	if (vis_packet != NULL)
 		debugFree(vis_packet, 1108);
@@ -54,7 +54,7 @@
  *
  * DEBUG_MALLOC   enables malloc() / free() wrapper functions to detect memory leaks / buffer overflows / etc
  * MEMORY_USAGE   allows you to monitor the internal memory usage (needs DEBUG_MALLOC to work)
- * PROFILE_DATA   allows you to monitor the cpu usage for each function
+ * PROFILE_DATA   adds the profile data to debug level 5 (batmand -c --profile works without it)
  *
  ***/
 
@@ -89,6 +89,8 @@
 #define DEFAULT_ROUTING_CLASS 30
 
 
+#define RECV_BATCH 16          /* datagrams handed to batman() per receive_packets() call */
+#define RECV_PACKET_SIZE 2001
 #define MAX_AGGREGATION_BYTES 512 /* should not be bigger than 512 bytes or change the size of forw_node->direct_link_flags */
 #define MAX_AGGREGATION_MS 100
 
@@ -170,6 +172,7 @@ extern uint8_t found_ifs;
 extern uint8_t active_ifs;
 extern int32_t receive_max_sock;
 extern fd_set receive_wait_set;
+extern int32_t receive_epoll_fd;
 
 extern uint8_t unix_client;
 extern uint8_t log_facility_active;
@@ -178,7 +181,6 @@ extern struct hashtable_t *orig_hash;
 
 extern struct list_head_first if_list;
 extern struct list_head_first gw_list;
-extern struct list_head_first forw_list;
 extern struct vis_if vis_if;
 extern struct unix_if unix_if;
 extern struct debug_clients debug_clients;
@@ -192,8 +194,8 @@ extern uint8_t minimum_send;
 extern uint8_t minimum_recv;
 extern uint8_t global_win_size;
 extern uint8_t local_win_size;
-extern uint8_t num_words;
 extern uint8_t aggregation_enabled;
+extern int16_t num_workers;
 
 #include "types.h" // can be removed as soon as these function have been cleaned up
 int8_t batman(void);
@@ -205,5 +207,6 @@ void update_gw_list(struct orig_node *orig_node, uint8_t new_gwflags, uint16_t g
 void get_gw_speeds(unsigned char gw_class, int *down, int *up);
 unsigned char get_gw_class(int down, int up);
 void choose_gw(void);
+void process_ogm(struct bat_packet *bat_packet, uint32_t neigh, struct batman_if *if_incoming, uint32_t curr_time, uint8_t is_my_orig, uint8_t is_my_oldorig);
 
 #endif
@@ -28,20 +28,77 @@
 
 
 
+/* The window is a ring of local_win_size bits: seq_bits->head is the bit of the
+ * newest sequence number and the older ones follow downwards (wrapping around).
+ * Moving the window forward only clears the bits of the sequence numbers that
+ * fall out and bumps the head. seq_bits->count keeps the number of bits set, so
+ * neither shifting nor counting needs to touch the whole window. */
+
+static inline int bit_popcount( TYPE_OF_WORD word ) {
+
+	return __builtin_popcountll( word );
+
+}
+
+/* ring position of the sequence number n places before the newest one */
+static inline int32_t bit_index( struct seq_window *seq_bits, int32_t n ) {
+
+	int32_t index = seq_bits->head - n;
+
+	return ( index < 0 ? index + local_win_size : index );
+
+}
+
+/* clear n bits of the ring starting at index, returns how many of them were set */
+static int bit_clear( struct seq_window *seq_bits, int32_t index, int32_t n ) {
+
+	int32_t word_offset, len;
+	int cleared = 0;
+	TYPE_OF_WORD mask;
+
+	while ( n > 0 ) {
+
+		if ( index >= local_win_size )
+			index -= local_win_size;
+
+		word_offset = index % WORD_BIT_SIZE;	/* which position in the selected word */
+		len = WORD_BIT_SIZE - word_offset;	/* the window size is a multiple of the word size */
+
+		if ( len > n )
+			len = n;
+
+		mask = ( len == (int32_t)WORD_BIT_SIZE ? ~(TYPE_OF_WORD)0 : ( ( (TYPE_OF_WORD)1 << len ) - 1 ) ) << word_offset;
+
+		cleared += bit_popcount( seq_bits->bits[index / WORD_BIT_SIZE] & mask );
+		seq_bits->bits[index / WORD_BIT_SIZE] &= ~mask;
+
+		index += len;
+		n -= len;
+
+	}
+
+	return cleared;
+
+}
+
 /* clear the bits */
-void bit_init( TYPE_OF_WORD *seq_bits ) {
+void bit_init( struct seq_window *seq_bits ) {
 
 	int i;
 
-	for (i = 0 ; i < (int)num_words; i++)
-		seq_bits[i]= 0;
+	for (i = 0 ; i < (int)(local_win_size / WORD_BIT_SIZE); i++)
+		seq_bits->bits[i]= 0;
+
+	seq_bits->head = 0;
+	seq_bits->count = 0;
 
 }
 
 /* returns true if corresponding bit in given seq_bits indicates so and curr_seqno is within range of last_seqno */
-uint8_t get_bit_status( TYPE_OF_WORD *seq_bits, uint16_t last_seqno, uint16_t curr_seqno ) {
+uint8_t get_bit_status( struct seq_window *seq_bits, uint16_t last_seqno, uint16_t curr_seqno ) {
 
-	int16_t diff, word_offset, word_num;
+	int16_t diff;
+	int32_t index;
 
 	diff= last_seqno- curr_seqno;
 	if (diff < 0 || diff >= local_win_size) {
@@ -49,10 +106,9 @@ uint8_t get_bit_status( TYPE_OF_WORD *seq_bits, uint16_t last_seqno, uint16_t cu
 
 	} else {
 
-		word_offset= ( last_seqno - curr_seqno ) % WORD_BIT_SIZE;	/* which position in the selected word */
-		word_num   = ( last_seqno - curr_seqno ) / WORD_BIT_SIZE;	/* which word */
+		index = bit_index( seq_bits, diff );
 
-		if ( seq_bits[word_num] & 1<<word_offset )   /* get position status */
+		if ( seq_bits->bits[index / WORD_BIT_SIZE] & (TYPE_OF_WORD)1 << ( index % WORD_BIT_SIZE ) )   /* get position status */
 			return 1;
 		else
 			return 0;
@@ -62,8 +118,9 @@ uint8_t get_bit_status( TYPE_OF_WORD *seq_bits, uint16_t last_seqno, uint16_t cu
 }
 
 /* turn corresponding bit on, so we can remember that we got the packet */
-void bit_mark( TYPE_OF_WORD *seq_bits, int32_t n ) {
-	int32_t word_offset,word_num;
+void bit_mark( struct seq_window *seq_bits, int32_t n ) {
+	int32_t index;
+	TYPE_OF_WORD bit;
 
 	if (n<0 || n >= local_win_size) {			/* if too old, just drop it */
 /* 		printf("got old packet, dropping\n");*/
@@ -72,60 +129,33 @@ void bit_mark( TYPE_OF_WORD *seq_bits, int32_t n ) {
 
 /* 	printf("mark bit %d\n", n); */
 
-	word_offset= n%WORD_BIT_SIZE;	/* which position in the selected word */
-	word_num   = n/WORD_BIT_SIZE;	/* which word */
+	index = bit_index( seq_bits, n );
+	bit = (TYPE_OF_WORD)1 << ( index % WORD_BIT_SIZE );
 
-	seq_bits[word_num]|= 1<<word_offset;	/* turn the position on */
+	if ( !( seq_bits->bits[index / WORD_BIT_SIZE] & bit ) ) {
+		seq_bits->bits[index / WORD_BIT_SIZE] |= bit;	/* turn the position on */
+		seq_bits->count++;
+	}
 }
 
 /* shift the packet array p by n places. */
-void bit_shift( TYPE_OF_WORD *seq_bits, int32_t n ) {
-	int32_t word_offset, word_num;
-	int32_t i;
+void bit_shift( struct seq_window *seq_bits, int32_t n ) {
 
-/*	bit_print( seq_bits );*/
 	if( n<=0 ) return;
 
-	word_offset= n%WORD_BIT_SIZE;	/* shift how much inside each word */
-	word_num   = n/WORD_BIT_SIZE;	/* shift over how much (full) words */
-
-	for ( i=num_words-1; i>word_num; i-- ) {
-		/* going from old to new, so we can't overwrite the data we copy from. *
- 		 * left is high, right is low: FEDC BA98 7654 3210
-		 *	                                  ^^ ^^
-		 *                             vvvv
-		 * ^^^^ = from, vvvvv =to, we'd have word_num==1 and
-		 * word_offset==WORD_BIT_SIZE/2 ????? in this example. (=24 bits)
-		 *
-		 * our desired output would be: 9876 5432 1000 0000
-		 * */
-
-		seq_bits[i]=
-			(seq_bits[i - word_num] << word_offset) +
-					/* take the lower port from the left half, shift it left to its final position */
-			(seq_bits[i - word_num - 1] >>	(WORD_BIT_SIZE-word_offset));
-					/* and the upper part of the right half and shift it left to it's position */
-		/* for our example that would be: word[0] = 9800 + 0076 = 9876 */
+	if ( n >= local_win_size ) {
+		bit_init( seq_bits );
+		return;
 	}
-	/* now for our last word, i==word_num, we only have the it's "left" half. that's the 1000 word in
-	 * our example.*/
-
-	seq_bits[i]= (seq_bits[i - word_num] << word_offset);
-
-	/* pad the rest with 0, if there is anything */
-	i--;
 
-	for (; i>=0; i--) {
-		seq_bits[i]= 0;
-	}
-/*	bit_print( seq_bits ); */
+	/* the n oldest sequence numbers drop out - their bits follow the head */
+	seq_bits->count -= bit_clear( seq_bits, seq_bits->head + 1, n );
+	seq_bits->head = ( seq_bits->head + n ) % local_win_size;
 }
 
 
 /* receive and process one packet, returns 1 if received seq_num is considered new, 0 if old  */
-char bit_get_packet( TYPE_OF_WORD *seq_bits, int16_t seq_num_diff, int8_t set_mark ) {
-
-	int i;
+char bit_get_packet( struct seq_window *seq_bits, int16_t seq_num_diff, int8_t set_mark ) {
 
 	/* we already got a sequence number higher than this one, so we just mark it. this should wrap around the integer just fine */
 	if ((seq_num_diff < 0) && (seq_num_diff >= -local_win_size)) {
@@ -145,11 +175,10 @@ char bit_get_packet( TYPE_OF_WORD *seq_bits, int16_t seq_num_diff, int8_t set_ma
 		if (-seq_num_diff > local_win_size)
 			debug_output(4, "Other host probably restarted !\n");
 
-		for (i=0; i<num_words; i++)
-			seq_bits[i]= 0;
+		bit_init( seq_bits );
 
 		if ( set_mark )
-			seq_bits[0] = 1;  /* we only have the latest packet */
+			bit_mark( seq_bits, 0 );  /* we only have the latest packet */
 
 	} else {
 
@@ -164,41 +193,15 @@ char bit_get_packet( TYPE_OF_WORD *seq_bits, int16_t seq_num_diff, int8_t set_ma
 
 }
 
-/* count the hamming weight, how many good packets did we receive? just count the 1's ... */
-int bit_packet_count( TYPE_OF_WORD *seq_bits ) {
-
-	int i, hamming = 0;
-	TYPE_OF_WORD word;
-
-	for (i=0; i<num_words; i++) {
-
-		word = seq_bits[i];
+/* how many good packets did we receive? the count is kept up to date by bit_mark() and bit_shift() */
+int bit_packet_count( struct seq_window *seq_bits ) {
 
-		while (word) {
-
-			word &= word-1;   /* see http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetKernighan */
-			hamming++;
-
-		}
-
-	}
-
-	return(hamming);
+	return seq_bits->count;
 
 }
 
 uint8_t bit_count( int32_t to_count ) {
 
-	uint8_t hamming = 0;
-
-	while ( to_count ) {
-
-		to_count &= to_count-1;   /* see http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetKernighan */
-		hamming++;
-
-	}
-
-	return(hamming);
+	return __builtin_popcount( (uint32_t)to_count );
 
 }
-
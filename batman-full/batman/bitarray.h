@@ -25,12 +25,13 @@
 #define WORD_BIT_SIZE ( sizeof(TYPE_OF_WORD) * 8 )
 
 
-void bit_init( TYPE_OF_WORD *seq_bits );
-uint8_t get_bit_status( TYPE_OF_WORD *seq_bits, uint16_t last_seqno, uint16_t curr_seqno );
-char *bit_print( TYPE_OF_WORD *seq_bits );
-void bit_mark( TYPE_OF_WORD *seq_bits, int32_t n );
-void bit_shift( TYPE_OF_WORD *seq_bits, int32_t n );
-char bit_get_packet( TYPE_OF_WORD *seq_bits, int16_t seq_num_diff, int8_t set_mark );
-int  bit_packet_count( TYPE_OF_WORD *seq_bits );
+struct seq_window;
+
+void bit_init( struct seq_window *seq_bits );
+uint8_t get_bit_status( struct seq_window *seq_bits, uint16_t last_seqno, uint16_t curr_seqno );
+void bit_mark( struct seq_window *seq_bits, int32_t n );
+void bit_shift( struct seq_window *seq_bits, int32_t n );
+char bit_get_packet( struct seq_window *seq_bits, int16_t seq_num_diff, int8_t set_mark );
+int  bit_packet_count( struct seq_window *seq_bits );
 uint8_t bit_count( int32_t to_count );
 
@@ -154,7 +154,8 @@ int8_t set_tun_addr(int32_t BATMANUNUSED(fd), uint32_t tun_addr, char *tun_ifnam
 }
 
 int8_t add_dev_tun(struct batman_if *batman_if, uint32_t tun_addr,
-		char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *BATMANUNUSED(ifi))
+		char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *BATMANUNUSED(ifi),
+		uint8_t BATMANUNUSED(multi_queue))
 {
 	int so;
 	struct ifreq ifr_tun, ifr_if;
@@ -237,3 +238,8 @@ int8_t add_dev_tun(struct batman_if *batman_if, uint32_t tun_addr,
 	return 1;
 }
 
+/* tun devices have a single queue on BSD */
+int32_t add_dev_tun_queue(char *BATMANUNUSED(tun_dev))
+{
+	return -1;
+}
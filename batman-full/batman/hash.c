@@ -25,15 +25,156 @@
 #include "allocate.h"
 
 
+/* removed elements leave this marker behind - the probe sequences continue over it */
+static char hash_deleted_marker;
+#define HASH_DELETED ((void *)&hash_deleted_marker)
+
+#define HASH_MIGRATE_SLOTS 16	/* slots of the old table moved with every hash_add() */
+#define HASH_MIGRATE_ALL -1
+
+
+static int hash_roundup(int size)
+{
+	int real_size = 8;
+
+	while ((real_size < size) && (real_size < (1 << 30)))
+		real_size <<= 1;
+
+	return real_size;
+}
+
+static struct element_t *hash_table_new(int size)
+{
+	struct element_t *table;
+	int i;
+
+	table = debugMalloc(sizeof(struct element_t) * size, 303);
+	if (!table)
+		return NULL;
+
+	for (i = 0; i < size; i++) {
+		table[i].data = NULL;
+		table[i].hash = 0;
+	}
+
+	return table;
+}
+
+static struct element_t *hash_find_slot(struct element_t *table, int size, hashdata_compare_cb compare, void *keydata, unsigned int hash_value)
+{
+	struct element_t *slot;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		slot = &table[(hash_value + i) & (size - 1)];
+
+		if (slot->data == NULL)
+			return NULL;
+
+		if ((slot->data != HASH_DELETED) && (slot->hash == hash_value) && (compare(slot->data, keydata)))
+			return slot;
+	}
+
+	return NULL;
+}
+
+/* the table never gets more than half full - there always is a free slot */
+static struct element_t *hash_free_slot(struct hashtable_t *hash, unsigned int hash_value)
+{
+	struct element_t *slot;
+
+	while (1) {
+		slot = &hash->table[hash_value & (hash->size - 1)];
+
+		if ((slot->data == NULL) || (slot->data == HASH_DELETED))
+			return slot;
+
+		hash_value++;
+	}
+}
+
+static void hash_store(struct hashtable_t *hash, void *data, unsigned int hash_value)
+{
+	struct element_t *slot;
+
+	slot = hash_free_slot(hash, hash_value);
+
+	if (slot->data == HASH_DELETED)
+		hash->deleted--;
+
+	slot->data = data;
+	slot->hash = hash_value;
+}
+
+/* move num_slots slots of the old table into the new one (or all of them with
+ * HASH_MIGRATE_ALL) and drop the old table once it is empty */
+static void hash_migrate(struct hashtable_t *hash, int num_slots)
+{
+	struct element_t *old_slot;
+
+	while (hash->old_table != NULL) {
+
+		if (hash->old_index == hash->old_size) {
+			debugFree(hash->old_table, 1307);
+			hash->old_table = NULL;
+			break;
+		}
+
+		if (num_slots-- == 0)
+			break;
+
+		old_slot = &hash->old_table[hash->old_index++];
+
+		if ((old_slot->data != NULL) && (old_slot->data != HASH_DELETED))
+			hash_store(hash, old_slot->data, old_slot->hash);
+
+		/* the remaining elements of the old table might probe over this slot */
+		old_slot->data = HASH_DELETED;
+	}
+}
+
+/* switch to a new table, the elements get moved over by hash_migrate() */
+static int hash_rehash(struct hashtable_t *hash, int size)
+{
+	struct element_t *table;
+
+	/* finish a resize still in progress first */
+	hash_migrate(hash, HASH_MIGRATE_ALL);
+
+	if (size < (hash->elements + 1) * 2)
+		size = (hash->elements + 1) * 2;
+
+	size = hash_roundup(size);
+	table = hash_table_new(size);
+
+	if (!table)
+		return -1;
+
+	hash->old_table = hash->table;
+	hash->old_size = hash->size;
+	hash->old_index = 0;
+
+	hash->table = table;
+	hash->size = size;
+	hash->deleted = 0;
+	return 0;
+}
+
 /* clears the hash */
 void hash_init(struct hashtable_t *hash)
 {
 	int i;
 
 	hash->elements = 0;
+	hash->deleted = 0;
 
 	for (i = 0; i < hash->size; i++)
-		hash->table[i] = NULL;
+		hash->table[i].data = NULL;
+
+	if (hash->old_table != NULL) {
+		debugFree(hash->old_table, 1307);
+		hash->old_table = NULL;
+	}
 }
 
 /* remove the hash structure. if hashdata_free_cb != NULL,
@@ -41,23 +182,11 @@ void hash_init(struct hashtable_t *hash)
  * if you don't remove the elements, memory might be leaked. */
 void hash_delete(struct hashtable_t *hash, hashdata_free_cb free_cb)
 {
-	struct element_t *bucket, *last_bucket;
-	int i;
-
-	for (i = 0; i < hash->size; i++) {
-
-		bucket = hash->table[i];
-		while (bucket != NULL) {
-
-			if (free_cb != NULL)
-				free_cb(bucket->data);
-
-			last_bucket = bucket;
-			bucket = bucket->next;
-			debugFree(last_bucket, 1301);
-
-		}
+	struct hash_it_t *hashit = NULL;
 
+	if (free_cb != NULL) {
+		while (NULL != (hashit = hash_iterate(hash, hashit)))
+			free_cb(hashit->bucket->data);
 	}
 
 	hash_destroy(hash);
@@ -66,6 +195,9 @@ void hash_delete(struct hashtable_t *hash, hashdata_free_cb free_cb)
 /* free only the hashtable and the hash itself. */
 void hash_destroy(struct hashtable_t *hash)
 {
+	if (hash->old_table != NULL)
+		debugFree(hash->old_table, 1301);
+
 	debugFree(hash->table, 1302);
 	debugFree(hash, 1303);
 }
@@ -75,70 +207,30 @@ void hash_destroy(struct hashtable_t *hash)
 struct hash_it_t *hash_iterate(struct hashtable_t *hash, struct hash_it_t *iter_in)
 {
 	struct hash_it_t *iter;
+	struct element_t *slot;
+	int old_size = (hash->old_table != NULL ? hash->old_size : 0);
 
 	if (iter_in == NULL) {
 		iter = debugMalloc(sizeof(struct hash_it_t), 301);
 		iter->index =  -1;
 		iter->bucket = NULL;
-		iter->prev_bucket = NULL;
 	} else
 		iter= iter_in;
 
-	/* sanity checks first (if our bucket got deleted in the last iteration): */
-	if (iter->bucket != NULL) {
-		if (iter->first_bucket != NULL) {
-
-			/* we're on the first element and it got removed after the last iteration. */
-			if ((*iter->first_bucket) != iter->bucket) {
-
-				/* there are still other elements in the list */
-				if ((*iter->first_bucket) != NULL) {
-					iter->prev_bucket = NULL;
-					iter->bucket = (*iter->first_bucket);
-					iter->first_bucket = &hash->table[iter->index];
-					return iter;
-				} else {
-					iter->bucket = NULL;
-				}
-
-			}
+	/* the elements not yet moved out of the old table come first. removing
+	 * the current element only marks its slot, the index stays valid. */
+	while (++iter->index < old_size + hash->size) {
 
-		} else if (iter->prev_bucket != NULL) {
+		if (iter->index < old_size)
+			slot = &hash->old_table[iter->index];
+		else
+			slot = &hash->table[iter->index - old_size];
 
-			/* we're not on the first element, and the bucket got removed after the last iteration.
-			* the last bucket's next pointer is not pointing to our actual bucket anymore.
-			* select the next. */
-			if (iter->prev_bucket->next != iter->bucket)
-				iter->bucket = iter->prev_bucket;
-
-		}
-
-	}
-
-	/* now as we are sane, select the next one if there is some */
-	if (iter->bucket != NULL) {
-		if (iter->bucket->next != NULL) {
-			iter->prev_bucket = iter->bucket;
-			iter->bucket = iter->bucket->next;
-			iter->first_bucket = NULL;
-			return iter;
-		}
-	}
-	/* if not returned yet, we've reached the last one on the index and have to search forward */
-
-	iter->index++;
-	/* go through the entries of the hash table */
-	while (iter->index < hash->size) {
-
-		if ((hash->table[iter->index]) == NULL) {
-			iter->index++;
+		if ((slot->data == NULL) || (slot->data == HASH_DELETED))
 			continue;
-		}
 
-		iter->prev_bucket = NULL;
-		iter->bucket = hash->table[iter->index];
-		iter->first_bucket = &hash->table[iter->index];
-		return iter;	/* if this table entry is not null, return it */
+		iter->bucket = slot;
+		return iter;
 	}
 
 	/* nothing to iterate over anymore */
@@ -155,14 +247,15 @@ struct hashtable_t *hash_new(int size, hashdata_compare_cb compare, hashdata_cho
 	if (!hash)
 		return NULL;
 
-	hash->size= size;
-	hash->table= debugMalloc(sizeof(struct element_t *) * size, 303);
+	hash->size = hash_roundup(size);
+	hash->table = hash_table_new(hash->size);
 
 	if (!hash->table) {
 		debugFree(hash, 1305);
 		return NULL;
 	}
 
+	hash->old_table = NULL;
 	hash_init(hash);
 	hash->compare = compare;
 	hash->choose = choose;
@@ -172,37 +265,27 @@ struct hashtable_t *hash_new(int size, hashdata_compare_cb compare, hashdata_cho
 /* adds data to the hashtable. returns 0 on success, -1 on error */
 int hash_add(struct hashtable_t *hash, void *data)
 {
-	int index;
-	struct element_t *bucket, *prev_bucket = NULL;
-
-	index = hash->choose(data, hash->size);
-	bucket = hash->table[index];
+	unsigned int hash_value;
 
-	while (bucket != NULL) {
-		if (hash->compare(bucket->data, data))
-			return -1;
-
-		prev_bucket = bucket;
-		bucket= bucket->next;
-	}
+	hash_value = hash->choose(data, HASH_FULL_SIZE);
 
-	/* found the tail of the list, add new element */
-	bucket = debugMalloc(sizeof(struct element_t),304);
+	if (hash_find_slot(hash->table, hash->size, hash->compare, data, hash_value) != NULL)
+		return -1;
 
-	if (!bucket)
+	if ((hash->old_table != NULL) &&
+	    (hash_find_slot(hash->old_table, hash->old_size, hash->compare, data, hash_value) != NULL))
 		return -1;
 
-	/* init the new bucket */
-	bucket->data = data;
-	bucket->next = NULL;
+	hash_migrate(hash, HASH_MIGRATE_SLOTS);
 
-	/* and link it */
-	if (prev_bucket == NULL) {
-		hash->table[index] = bucket;
-	} else {
-		prev_bucket->next = bucket;
+	/* keep at least half of the slots empty - grow the table or, if mostly
+	 * removed elements fill it, rehash it with the same size */
+	if ((hash->elements + hash->deleted + 1) * 2 > hash->size) {
+		if (hash_rehash(hash, ((hash->elements + 1) * 4 > hash->size ? hash->size * 2 : hash->size)) < 0)
+			return -1;
 	}
 
+	hash_store(hash, data, hash_value);
 	hash->elements++;
 	return 0;
 }
@@ -210,20 +293,16 @@ int hash_add(struct hashtable_t *hash, void *data)
 /* finds data, based on the key in keydata. returns the found data on success, or NULL on error */
 void *hash_find(struct hashtable_t *hash, void *keydata)
 {
-	int index;
-	struct element_t *bucket;
+	unsigned int hash_value;
+	struct element_t *slot;
 
-	index = hash->choose(keydata , hash->size);
-	bucket = hash->table[index];
+	hash_value = hash->choose(keydata, HASH_FULL_SIZE);
+	slot = hash_find_slot(hash->table, hash->size, hash->compare, keydata, hash_value);
 
-	while (bucket != NULL) {
-		if (hash->compare(bucket->data, keydata))
-			return bucket->data;
-
-		bucket = bucket->next;
-	}
+	if ((slot == NULL) && (hash->old_table != NULL))
+		slot = hash_find_slot(hash->old_table, hash->old_size, hash->compare, keydata, hash_value);
 
-	return NULL;
+	return (slot != NULL ? slot->data : NULL);
 }
 
 /* remove bucket (this might be used in hash_iterate() if you already found the bucket
@@ -234,14 +313,11 @@ void *hash_remove_bucket(struct hashtable_t *hash, struct hash_it_t *hash_it_t)
 	void *data_save;
 
 	data_save = hash_it_t->bucket->data;	/* save the pointer to the data */
+	hash_it_t->bucket->data = HASH_DELETED;
 
-	if (hash_it_t->prev_bucket != NULL) {
-		hash_it_t->prev_bucket->next = hash_it_t->bucket->next;
-	} else if (hash_it_t->first_bucket != NULL) {
-		(*hash_it_t->first_bucket) = hash_it_t->bucket->next;
-	}
-
-	debugFree(hash_it_t->bucket, 1306);
+	/* marked slots of the old table go away with it */
+	if ((hash_it_t->bucket >= hash->table) && (hash_it_t->bucket < hash->table + hash->size))
+		hash->deleted++;
 
 	hash->elements--;
 	return data_save;
@@ -254,66 +330,44 @@ void *hash_remove_bucket(struct hashtable_t *hash, struct hash_it_t *hash_it_t)
 void *hash_remove(struct hashtable_t *hash, void *data)
 {
 	struct hash_it_t hash_it_t;
+	unsigned int hash_value;
 
-	hash_it_t.index = hash->choose(data, hash->size);
-	hash_it_t.bucket = hash->table[hash_it_t.index];
-	hash_it_t.prev_bucket = NULL;
+	hash_value = hash->choose(data, HASH_FULL_SIZE);
+	hash_it_t.bucket = hash_find_slot(hash->table, hash->size, hash->compare, data, hash_value);
 
-	while (hash_it_t.bucket != NULL) {
-		if (hash->compare(hash_it_t.bucket->data, data)) {
-			hash_it_t.first_bucket = (hash_it_t.bucket == hash->table[hash_it_t.index] ? &hash->table[ hash_it_t.index ] : NULL);
-			return hash_remove_bucket(hash, &hash_it_t);
-		}
+	if ((hash_it_t.bucket == NULL) && (hash->old_table != NULL))
+		hash_it_t.bucket = hash_find_slot(hash->old_table, hash->old_size, hash->compare, data, hash_value);
 
-		hash_it_t.prev_bucket = hash_it_t.bucket;
-		hash_it_t.bucket = hash_it_t.bucket->next;
-	}
+	if (hash_it_t.bucket == NULL)
+		return NULL;
 
-	return NULL;
+	return hash_remove_bucket(hash, &hash_it_t);
 }
 
-/* resize the hash, returns the pointer to the new hash or NULL on error. removes the old hash on success. */
+/* resize the hash, returns the pointer to the hash or NULL on error. the elements
+ * are moved to the new table step by step by the following hash_add() calls */
 struct hashtable_t *hash_resize(struct hashtable_t *hash, int size)
 {
-	struct hashtable_t *new_hash;
-	struct element_t *bucket;
-	int i;
-
-	/* initialize a new hash with the new size */
-	new_hash = hash_new(size, hash->compare, hash->choose);
-	if (!new_hash)
+	if (hash_rehash(hash, size) < 0)
 		return NULL;
 
-	/* copy the elements */
-	for (i = 0; i < hash->size; i++) {
-		bucket = hash->table[i];
-		while (bucket != NULL) {
-			hash_add(new_hash, bucket->data);
-			bucket = bucket->next;
-		}
-	}
-
-	hash_delete(hash, NULL);	/* remove hash and eventual overflow buckets but not the content itself. */
-	return new_hash;
+	return hash;
 }
 
 /* print the hash table for debugging */
 /* void hash_debug(struct hashtable_t *hash) {
 	int i;
-	struct element_t *bucket;
 
 	for (i = 0; i < hash->size; i++) {
 		printf("[%d] ", i);
-		bucket = hash->table[i];
 
-		while (bucket) {
-			printf("-> [%10p] ", (void *)bucket);
-			bucket = bucket->next;
-		}
+		if (hash->table[i].data == HASH_DELETED)
+			printf("deleted");
+		else if (hash->table[i].data != NULL)
+			printf("[%10p] %08x", hash->table[i].data, hash->table[i].hash);
 
 		printf("\n");
 
 	}
 	printf("\n");
 }*/
-
@@ -27,22 +27,31 @@ typedef int (*hashdata_compare_cb)(void *, void *);
 typedef int (*hashdata_choose_cb)(void *, int);
 typedef void (*hashdata_free_cb)(void *);
 
+/* the table uses open addressing with linear probing - the slots keep the
+ * data pointer and the full hash value of its key (the choose callback called
+ * with HASH_FULL_SIZE), so most mismatches are sorted out without touching
+ * the data. the size of the table is always a power of 2. */
+#define HASH_FULL_SIZE 0x7fffffff
+
 struct element_t {
-	void *data;						/* pointer to the data */
-	struct element_t *next;			/* overflow bucket pointer */
+	void *data;						/* pointer to the data, NULL if the slot is empty */
+	unsigned int hash;				/* full hash value of the data's key */
 };
 
 struct hash_it_t {
 	int index;
 	struct element_t *bucket;
-	struct element_t *prev_bucket;
-	struct element_t **first_bucket;
 };
 
 struct hashtable_t {
-	struct element_t **table;					/* the hashtable itself, with the buckets */
+	struct element_t *table;					/* the hashtable itself, with the slots */
 	int elements;								/* number of elements registered */
 	int size;									/* size of hashtable */
+	int deleted;								/* slots of removed elements in table */
+	struct element_t *old_table;				/* table being resized, its elements are moved over
+												 * a few slots with every hash_add() */
+	int old_size;								/* size of old_table */
+	int old_index;								/* next slot of old_table to be moved */
 	hashdata_compare_cb compare;			    /* callback to a compare function.
 												 * should compare 2 element datas for their keys,
 												 * return 0 if same and not 0 if not same */
@@ -70,7 +79,8 @@ void 				 hash_delete(struct hashtable_t *hash, hashdata_free_cb free_cb);
 /* free only the hashtable and the hash itself. */
 void 				 hash_destroy(struct hashtable_t *hash);
 
-/* adds data to the hashtable. returns 0 on success, -1 on error */
+/* adds data to the hashtable. returns 0 on success, -1 on error.
+ * don't add elements while iterating through the hash. */
 int 				 hash_add(struct hashtable_t *hash, void *data);
 
 /* removes data from hash, if found. returns pointer do data on success,
@@ -82,7 +92,8 @@ void 				*hash_remove(struct hashtable_t *hash, void *data);
 /* finds data, based on the key in keydata. returns the found data on success, or NULL on error */
 void 				*hash_find(struct hashtable_t *hash, void *keydata);
 
-/* resize the hash, returns the pointer to the new hash or NULL on error. removes the old hash on success */
+/* resize the hash, returns the pointer to the hash or NULL on error. the elements
+ * are moved to the new table step by step by the following hash_add() calls */
 struct hashtable_t	*hash_resize(struct hashtable_t *hash, int size);
 
 /* print the hash table for debugging */
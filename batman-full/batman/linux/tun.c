@@ -177,7 +177,7 @@ int8_t del_dev_tun( int32_t fd ) {
 
 
 
-int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi ) {
+int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi, uint8_t multi_queue ) {
 
 	int32_t tmp_fd, sock_opts;
 	struct ifreq ifr_tun, ifr_if;
@@ -197,8 +197,19 @@ int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_de
 
 	}
 
+#ifdef IFF_MULTI_QUEUE
+	if ( multi_queue )
+		ifr_tun.ifr_flags |= IFF_MULTI_QUEUE;
+#endif
+
 	if ( ( ioctl( *fd, TUNSETIFF, (void *)&ifr_tun ) ) < 0 ) {
 
+		/* kernel without multiqueue tun support: go on with a single queue */
+		if ( ( multi_queue ) && ( errno == EINVAL ) ) {
+			close(*fd);
+			return add_dev_tun( batman_if, tun_addr, tun_dev, tun_dev_size, fd, ifi, 0 );
+		}
+
 		debug_output( 0, "Error - can't create tun device (TUNSETIFF): %s\n", strerror(errno) );
 		close(*fd);
 		return -1;
@@ -318,6 +329,41 @@ int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_de
 }
 
 
+/* attach another queue to a tun device created with multi_queue set - returns
+ * the fd of the new queue or -1 if the device does not support multiple queues */
+int32_t add_dev_tun_queue( char *tun_dev ) {
+
+#ifdef IFF_MULTI_QUEUE
+	int32_t fd, sock_opts;
+	struct ifreq ifr_tun;
+
+	memset( &ifr_tun, 0, sizeof(ifr_tun) );
+
+	ifr_tun.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+	strncpy( ifr_tun.ifr_name, tun_dev, IFNAMSIZ - 1 );
+
+	if ( ( fd = open( "/dev/net/tun", O_RDWR ) ) < 0 )
+		return -1;
+
+	if ( ioctl( fd, TUNSETIFF, (void *)&ifr_tun ) < 0 ) {
+
+		close( fd );
+		return -1;
+
+	}
+
+	sock_opts = fcntl( fd, F_GETFL, 0 );
+	fcntl( fd, F_SETFL, sock_opts | O_NONBLOCK );
+
+	return fd;
+#else
+	return -1;
+#endif
+
+}
+
+
+
 int8_t set_tun_addr( int32_t fd, uint32_t tun_addr, char *tun_dev ) {
 
 	struct sockaddr_in addr;
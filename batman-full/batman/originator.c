@@ -28,6 +28,8 @@
 #include "batman.h"
 #include "originator.h"
 #include "hna.h"
+#include "schedule.h"
+#include "pipeline.h"
 #include "types.h"
 
 struct neigh_node * create_neighbor(struct orig_node *orig_node, struct orig_node *orig_neigh_node, uint32_t neigh, struct batman_if *if_incoming) {
@@ -47,8 +49,7 @@ struct neigh_node * create_neighbor(struct orig_node *orig_node, struct orig_nod
 	neigh_node->tq_recv = debugMalloc(sizeof(uint16_t) * global_win_size, 406);
 	memset(neigh_node->tq_recv, 0, sizeof(uint16_t) * global_win_size);
 
-	neigh_node->real_bits = debugMalloc(sizeof(TYPE_OF_WORD) * num_words, 407);
-	memset(neigh_node->real_bits, 0, sizeof(TYPE_OF_WORD) * num_words);
+	bit_init(&neigh_node->real_bits);
 
 	list_add_tail(&neigh_node->list, &orig_node->neigh_list);
 
@@ -89,7 +90,11 @@ int choose_orig( void *data, int32_t size ) {
 
 
 
-/* this function finds or creates an originator entry for the given address if it does not exits */
+/* lookups of the ogm workers may run in parallel, adding (and resizing) may not */
+static pthread_rwlock_t orig_hash_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* this function finds or creates an originator entry for the given address if it does not exits
+ * the caller holds the shard lock of addr, so nobody else creates the same entry in the meantime */
 struct orig_node *get_orig_node( uint32_t addr ) {
 
 	struct orig_node *orig_node;
@@ -98,7 +103,9 @@ struct orig_node *get_orig_node( uint32_t addr ) {
 	prof_start( PROF_get_orig_node );
 
 
+	pthread_rwlock_rdlock( &orig_hash_lock );
 	orig_node = ((struct orig_node *)hash_find( orig_hash, &addr ));
+	pthread_rwlock_unlock( &orig_hash_lock );
 
 	if ( orig_node != NULL ) {
 
@@ -119,12 +126,14 @@ struct orig_node *get_orig_node( uint32_t addr ) {
 	orig_node->router = NULL;
 	orig_node->batman_if = NULL;
 
-	orig_node->bcast_own = debugMalloc( found_ifs * sizeof(TYPE_OF_WORD) * num_words, 404 );
-	memset( orig_node->bcast_own, 0, found_ifs * sizeof(TYPE_OF_WORD) * num_words );
+	orig_node->bcast_own = debugMalloc( found_ifs * sizeof(struct seq_window), 404 );
+	memset( orig_node->bcast_own, 0, found_ifs * sizeof(struct seq_window) );
 
 	orig_node->bcast_own_sum = debugMalloc( found_ifs * sizeof(uint8_t), 405 );
 	memset( orig_node->bcast_own_sum, 0, found_ifs * sizeof(uint8_t) );
 
+	pthread_rwlock_wrlock( &orig_hash_lock );
+
 	hash_add( orig_hash, orig_node );
 
 	if ( orig_hash->elements * 4 > orig_hash->size ) {
@@ -142,6 +151,8 @@ struct orig_node *get_orig_node( uint32_t addr ) {
 
 	}
 
+	pthread_rwlock_unlock( &orig_hash_lock );
+
 	prof_stop( PROF_get_orig_node );
 	return orig_node;
 
@@ -188,6 +199,9 @@ void update_orig(struct orig_node *orig_node, struct bat_packet *in, uint32_t ne
 		neigh_node->last_ttl = in->ttl;
 	}
 
+	/* the routing table, hna and gateway lists are shared by all ogm workers */
+	pipeline_route_lock();
+
 	/**
 	 * if we got have a better tq value via this neighbour or
 	 * same tq value but the link is more symetric change the next hop
@@ -244,6 +258,8 @@ void update_orig(struct orig_node *orig_node, struct bat_packet *in, uint32_t ne
 
 	}
 
+	pipeline_route_unlock();
+
 	prof_stop(PROF_update_originator);
 }
 
@@ -281,7 +297,6 @@ void purge_orig(uint32_t curr_time)
 
 				list_del((struct list_head *)&orig_node->neigh_list, neigh_pos, &orig_node->neigh_list);
 				debugFree(neigh_node->tq_recv, 1407);
-				debugFree(neigh_node->real_bits, 1409);
 				debugFree(neigh_node, 1401);
 
 			}
@@ -351,7 +366,6 @@ void purge_orig(uint32_t curr_time)
 					neigh_purged = 1;
 					list_del(prev_list_head, neigh_pos, &orig_node->neigh_list);
 					debugFree(neigh_node->tq_recv, 1408);
-					debugFree(neigh_node->real_bits, 1410);
 					debugFree(neigh_node, 1406);
 
 				} else {
@@ -406,8 +420,7 @@ void purge_orig(uint32_t curr_time)
 void debug_orig(void) {
 
 	struct hash_it_t *hashit = NULL;
-	struct list_head *forw_pos, *orig_pos, *neigh_pos;
-	struct forw_node *forw_node;
+	struct list_head *orig_pos, *neigh_pos;
 	struct orig_node *orig_node;
 	struct neigh_node *neigh_node;
 	struct gw_node *gw_node;
@@ -474,11 +487,7 @@ void debug_orig(void) {
 			debug_output( 4, "------------------ DEBUG ------------------ \n" );
 			debug_output( 4, "Forward list \n" );
 
-			list_for_each( forw_pos, &forw_list ) {
-				forw_node = list_entry( forw_pos, struct forw_node, list );
-				addr_to_string( ((struct bat_packet *)forw_node->pack_buff)->orig, str, sizeof(str) );
-				debug_output( 4, "    %s at %u \n", str, forw_node->send_time );
-			}
+			debug_forw_list();
 
 			debug_output( 4, "Originator list \n" );
 			debug_output( 4, "  %-11s (%s/%i) %''15s [%10s]: %''20s\n", "Originator", "#", TQ_MAX_VALUE, "Nexthop", "outgoingIF", "Potential nexthops" );
@@ -56,7 +56,8 @@ void del_nat_rule(char *dev);
 void hna_local_update_nat(uint32_t hna_ip, uint8_t netmask, int8_t route_action);
 int8_t probe_tun(uint8_t print_to_stderr);
 int8_t del_dev_tun( int32_t fd );
-int8_t add_dev_tun( struct batman_if *batman_if, uint32_t dest_addr, char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi );
+int8_t add_dev_tun( struct batman_if *batman_if, uint32_t dest_addr, char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi, uint8_t multi_queue );
+int32_t add_dev_tun_queue( char *tun_dev );
 int8_t set_tun_addr( int32_t fd, uint32_t tun_addr, char *tun_dev );
 
 /* init.c */
@@ -83,7 +84,7 @@ int is_wifi_interface(char *dev, int fd);
 void print_animation( void );
 void del_default_route(void);
 void add_default_route(void);
-int8_t receive_packet(unsigned char *packet_buff, int32_t packet_buff_len, int16_t *packet_len, uint32_t *neigh, uint32_t timeout, struct batman_if **if_incoming);
+int16_t receive_packets(struct recv_packet *packets, int16_t max_packets, uint32_t timeout);
 int8_t send_udp_packet(unsigned char *packet_buff, int packet_buff_len, struct sockaddr_in *broad, int send_sock, struct batman_if *batman_if);
 void del_gw_interface(void);
 void restore_defaults(void);
@@ -91,6 +92,7 @@ void cleanup(void);
 
 /* tunnel.c */
 void init_bh_ports(void);
+void tunnel_wakeup(void);
 void *gw_listen(void *arg);
 void *client_to_gw_tun( void *arg );
 
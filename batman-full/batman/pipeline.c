@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2026 B.A.T.M.A.N. contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include "os.h"
+#include "batman.h"
+#include "originator.h"
+#include "schedule.h"
+#include "pipeline.h"
+
+
+
+struct ogm_job {
+	struct batman_if *if_incoming;
+	uint32_t neigh;
+	uint32_t recv_time;
+	int16_t hna_buff_len;
+	uint8_t is_my_orig;
+	uint8_t is_my_oldorig;
+	uint8_t directlink;
+	unsigned char packet[MAX_AGGREGATION_BYTES] ALIGN_WORD;
+};
+
+/* single producer / single consumer queue: head is written by the consumer
+ * only and tail by the producer only - therefore no lock is needed */
+struct ogm_ring {
+	uint32_t head;
+	uint32_t tail;
+	struct ogm_job *jobs;
+};
+
+struct ogm_worker {
+	pthread_t thread_id;
+	pthread_mutex_t shard_mutex;	/* protects all originators hashing to this worker */
+	pthread_mutex_t wait_mutex;
+	pthread_cond_t wait_cond;
+	int32_t running;
+	int32_t sleeping;
+	int32_t notified;		/* main thread has been woken up to collect the forwards */
+	struct ogm_ring in;		/* main thread -> worker: received OGMs */
+	struct ogm_ring out;		/* worker -> main thread: OGMs to rebroadcast */
+};
+
+
+static struct ogm_worker *workers = NULL;
+static uint8_t workers_num = 0;
+static int32_t workers_stop = 0;
+static int32_t wake_pipe[2] = {-1, -1};
+static pthread_mutex_t route_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct ogm_worker *curr_worker = NULL;
+
+
+
+static struct ogm_job *ring_slot(struct ogm_ring *ring)
+{
+	if (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= PIPELINE_RING_SIZE)
+		return NULL;
+
+	return &ring->jobs[ring->tail & (PIPELINE_RING_SIZE - 1)];
+}
+
+static void ring_push(struct ogm_ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_SEQ_CST);
+}
+
+static struct ogm_job *ring_peek(struct ogm_ring *ring)
+{
+	if (ring->head == __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST))
+		return NULL;
+
+	return &ring->jobs[ring->head & (PIPELINE_RING_SIZE - 1)];
+}
+
+static void ring_pop(struct ogm_ring *ring)
+{
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+
+
+/* the worker owning the originator - uses the hash function of orig_hash */
+static struct ogm_worker *get_worker(uint32_t addr)
+{
+	return &workers[choose_orig(&addr, workers_num)];
+}
+
+static void ogm_job_run(struct ogm_job *job)
+{
+	struct bat_packet *bat_packet = (struct bat_packet *)job->packet;
+	struct ogm_worker *first, *second, *tmp;
+
+	first = get_worker(bat_packet->orig);
+	second = get_worker(job->neigh);
+
+	/* the shards are always locked in the same order - see pipeline_lock() */
+	if (first > second) {
+		tmp = first;
+		first = second;
+		second = tmp;
+	}
+
+	pthread_mutex_lock(&first->shard_mutex);
+
+	if (second != first)
+		pthread_mutex_lock(&second->shard_mutex);
+
+	process_ogm(bat_packet, job->neigh, job->if_incoming, job->recv_time, job->is_my_orig, job->is_my_oldorig);
+
+	if (second != first)
+		pthread_mutex_unlock(&second->shard_mutex);
+
+	pthread_mutex_unlock(&first->shard_mutex);
+}
+
+static void *ogm_worker_loop(void *arg)
+{
+	struct ogm_worker *worker = arg;
+	struct ogm_job *job;
+
+	curr_worker = worker;
+
+	while (!__atomic_load_n(&workers_stop, __ATOMIC_SEQ_CST)) {
+
+		if ((job = ring_peek(&worker->in)) != NULL) {
+
+			ogm_job_run(job);
+			ring_pop(&worker->in);
+			continue;
+
+		}
+
+		/* the main thread checks sleeping after queueing a job, we check
+		 * the queue after setting sleeping - one of us sees the other */
+		pthread_mutex_lock(&worker->wait_mutex);
+		__atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+
+		while ((!__atomic_load_n(&workers_stop, __ATOMIC_SEQ_CST)) && (ring_peek(&worker->in) == NULL))
+			pthread_cond_wait(&worker->wait_cond, &worker->wait_mutex);
+
+		__atomic_store_n(&worker->sleeping, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&worker->wait_mutex);
+
+	}
+
+	__atomic_store_n(&worker->running, 0, __ATOMIC_SEQ_CST);
+
+	return NULL;
+}
+
+
+
+int8_t pipeline_init(void)
+{
+	struct ogm_worker *worker;
+	long cpus;
+	uint8_t i;
+	int res;
+
+	if (num_workers < 0) {
+
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = (cpus > 1 ? (cpus > PIPELINE_MAX_WORKERS ? PIPELINE_MAX_WORKERS : cpus) : 0);
+
+	}
+
+	if (num_workers == 0)
+		return 0;
+
+	if (pipe(wake_pipe) < 0) {
+
+		debug_output(0, "Error - can't create pipe for the ogm workers: %s \n", strerror(errno));
+		wake_pipe[0] = wake_pipe[1] = -1;
+		return -1;
+
+	}
+
+	fcntl(wake_pipe[0], F_SETFL, fcntl(wake_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(wake_pipe[1], F_SETFL, fcntl(wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+	workers = debugMalloc(num_workers * sizeof(struct ogm_worker), 801);
+	memset(workers, 0, num_workers * sizeof(struct ogm_worker));
+
+	for (i = 0; i < num_workers; i++) {
+
+		worker = &workers[i];
+
+		pthread_mutex_init(&worker->shard_mutex, NULL);
+		pthread_mutex_init(&worker->wait_mutex, NULL);
+		pthread_cond_init(&worker->wait_cond, NULL);
+
+		worker->in.jobs = debugMalloc(PIPELINE_RING_SIZE * sizeof(struct ogm_job), 802);
+		worker->out.jobs = debugMalloc(PIPELINE_RING_SIZE * sizeof(struct ogm_job), 803);
+
+	}
+
+	workers_stop = 0;
+
+	/* workers_num picks the shards - it only counts the running workers */
+	for (i = 0; i < num_workers; i++) {
+
+		workers[i].running = 1;
+
+		if ((res = pthread_create(&workers[i].thread_id, NULL, &ogm_worker_loop, &workers[i])) != 0) {
+
+			debug_output(0, "Error - can't create ogm worker thread: %s \n", strerror(res));
+			workers[i].running = 0;
+			break;
+
+		}
+
+		workers_num++;
+
+	}
+
+	debug_output(3, "Processing originator messages with %i workers \n", workers_num);
+
+	return 0;
+}
+
+
+
+void pipeline_destroy(void)
+{
+	uint8_t i;
+
+	if (workers == NULL)
+		return;
+
+	__atomic_store_n(&workers_stop, 1, __ATOMIC_SEQ_CST);
+
+	for (i = 0; i < workers_num; i++) {
+
+		pthread_mutex_lock(&workers[i].wait_mutex);
+		pthread_cond_signal(&workers[i].wait_cond);
+		pthread_mutex_unlock(&workers[i].wait_mutex);
+
+	}
+
+	/* a worker might wait for room in its forward queue */
+	for (i = 0; i < workers_num; i++) {
+
+		while (__atomic_load_n(&workers[i].running, __ATOMIC_SEQ_CST)) {
+			pipeline_collect();
+			sched_yield();
+		}
+
+		pthread_join(workers[i].thread_id, NULL);
+
+	}
+
+	for (i = 0; i < num_workers; i++) {
+
+		pthread_mutex_destroy(&workers[i].shard_mutex);
+		pthread_mutex_destroy(&workers[i].wait_mutex);
+		pthread_cond_destroy(&workers[i].wait_cond);
+
+		debugFree(workers[i].in.jobs, 1802);
+		debugFree(workers[i].out.jobs, 1803);
+
+	}
+
+	debugFree(workers, 1801);
+	workers = NULL;
+	workers_num = num_workers = 0;
+
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	wake_pipe[0] = wake_pipe[1] = -1;
+}
+
+
+
+/* the main thread selects on this to get woken up when there is something to forward */
+int32_t pipeline_fd(void)
+{
+	return wake_pipe[0];
+}
+
+void pipeline_wakeup_ack(void)
+{
+	char buff[64];
+
+	while (read(wake_pipe[0], buff, sizeof(buff)) > 0)
+		;
+}
+
+
+
+void pipeline_dispatch(struct bat_packet *bat_packet, uint32_t neigh, struct batman_if *if_incoming, uint32_t curr_time, uint8_t is_my_orig, uint8_t is_my_oldorig)
+{
+	struct ogm_worker *worker;
+	struct ogm_job *job;
+
+	if (workers_num == 0) {
+		process_ogm(bat_packet, neigh, if_incoming, curr_time, is_my_orig, is_my_oldorig);
+		return;
+	}
+
+	/* echos of our own packets only update the entry of the neighbour */
+	worker = get_worker(is_my_orig ? neigh : bat_packet->orig);
+
+	/* the worker might be stuck on its full forward queue */
+	while ((job = ring_slot(&worker->in)) == NULL) {
+		pipeline_collect();
+		sched_yield();
+	}
+
+	job->if_incoming = if_incoming;
+	job->neigh = neigh;
+	job->recv_time = curr_time;
+	job->is_my_orig = is_my_orig;
+	job->is_my_oldorig = is_my_oldorig;
+	memcpy(job->packet, bat_packet, sizeof(struct bat_packet) + bat_packet->hna_len * 5);
+
+	ring_push(&worker->in);
+
+	if (__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&worker->wait_mutex);
+		pthread_cond_signal(&worker->wait_cond);
+		pthread_mutex_unlock(&worker->wait_mutex);
+	}
+}
+
+
+
+/* the worker has prepared the packet - only the aggregation and sending is left to the main thread */
+void pipeline_forward(struct bat_packet *bat_packet, uint8_t directlink, int16_t hna_buff_len, struct batman_if *if_incoming, uint32_t curr_time)
+{
+	struct ogm_worker *worker = curr_worker;
+	struct ogm_job *job;
+
+	if (worker == NULL) {
+		schedule_forward_packet(bat_packet, directlink, hna_buff_len, if_incoming, curr_time);
+		return;
+	}
+
+	/* the main thread has been notified already when the queue got filled */
+	while ((job = ring_slot(&worker->out)) == NULL)
+		sched_yield();
+
+	job->if_incoming = if_incoming;
+	job->recv_time = curr_time;
+	job->hna_buff_len = hna_buff_len;
+	job->directlink = directlink;
+	memcpy(job->packet, bat_packet, sizeof(struct bat_packet) + hna_buff_len);
+
+	ring_push(&worker->out);
+
+	if (!__atomic_exchange_n(&worker->notified, 1, __ATOMIC_SEQ_CST)) {
+		if ((write(wake_pipe[1], "", 1) < 0) && (errno != EAGAIN))
+			debug_output(0, "Error - can't wake up main thread: %s \n", strerror(errno));
+	}
+}
+
+void pipeline_collect(void)
+{
+	struct ogm_job *job;
+	uint8_t i;
+
+	for (i = 0; i < workers_num; i++) {
+
+		__atomic_store_n(&workers[i].notified, 0, __ATOMIC_SEQ_CST);
+
+		while ((job = ring_peek(&workers[i].out)) != NULL) {
+
+			schedule_forward_packet((struct bat_packet *)job->packet, job->directlink, job->hna_buff_len, job->if_incoming, job->recv_time);
+			ring_pop(&workers[i].out);
+
+		}
+
+	}
+}
+
+
+
+/* stops the workers at the next OGM boundary - to be called from the main thread only */
+void pipeline_lock(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < workers_num; i++) {
+
+		/* a worker holding the lock might wait for us to drain its forward queue */
+		while (pthread_mutex_trylock(&workers[i].shard_mutex) != 0) {
+			pipeline_collect();
+			sched_yield();
+		}
+
+	}
+}
+
+void pipeline_unlock(void)
+{
+	uint8_t i;
+
+	for (i = workers_num; i > 0; i--)
+		pthread_mutex_unlock(&workers[i - 1].shard_mutex);
+}
+
+
+
+/* routing table, hna and gateway changes made while processing an OGM */
+void pipeline_route_lock(void)
+{
+	pthread_mutex_lock(&route_mutex);
+}
+
+void pipeline_route_unlock(void)
+{
+	pthread_mutex_unlock(&route_mutex);
+}
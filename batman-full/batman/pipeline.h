@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 B.A.T.M.A.N. contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_PIPELINE_H
+#define _BATMAN_PIPELINE_H
+
+#include "batman.h"
+
+
+/***
+ *
+ * OGM processing pipeline
+ *
+ * The main thread receives the packets, splits the aggregates and hands
+ * every OGM to the worker owning its originator (the orig_hash hash
+ * function picks the worker). A worker holds the lock of its shard while
+ * processing the OGM - and the lock of the shard of the sending neighbour
+ * as the neighbour's originator entry gets updated as well. OGMs to be
+ * rebroadcasted are handed back to the main thread which aggregates and
+ * sends them.
+ *
+ * Anything else walking the originator table (purging, own packets, vis,
+ * debug output) has to run between pipeline_lock() and pipeline_unlock().
+ *
+ * Without workers (single cpu or --workers 0) everything stays on the
+ * main thread as before.
+ *
+ ***/
+
+#define PIPELINE_MAX_WORKERS 16
+#define PIPELINE_RING_SIZE 256	/* jobs queued per worker and direction - power of 2 */
+
+
+int8_t pipeline_init(void);
+void pipeline_destroy(void);
+int32_t pipeline_fd(void);
+void pipeline_wakeup_ack(void);
+
+void pipeline_dispatch(struct bat_packet *bat_packet, uint32_t neigh, struct batman_if *if_incoming, uint32_t curr_time, uint8_t is_my_orig, uint8_t is_my_oldorig);
+void pipeline_forward(struct bat_packet *bat_packet, uint8_t directlink, int16_t hna_buff_len, struct batman_if *if_incoming, uint32_t curr_time);
+void pipeline_collect(void);
+
+void pipeline_lock(void);
+void pipeline_unlock(void);
+void pipeline_route_lock(void);
+void pipeline_route_unlock(void);
+
+#endif
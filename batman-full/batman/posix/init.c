@@ -35,11 +35,15 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <getopt.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
 
 
 #include "../os.h"
 #include "../batman.h"
 #include "../hna.h"
+#include "../pipeline.h"
 
 #define IOCSETDEV 1
 
@@ -144,7 +148,7 @@ void apply_init_args( int argc, char *argv[] ) {
 	struct batman_if *batman_if;
 	struct hna_task *hna_task;
 	struct debug_level_info *debug_level_info;
-	uint8_t found_args = 1, batch_mode = 0, info_output = 0, was_hna = 0;
+	uint8_t found_args = 1, batch_mode = 0, info_output = 0, profile_output = 0, was_hna = 0;
 	int8_t res;
 
 	int32_t optchar, option_index, recv_buff_len, bytes_written, download_speed = 0, upload_speed = 0;
@@ -159,6 +163,8 @@ void apply_init_args( int argc, char *argv[] ) {
 		{"purge-timeout",     required_argument,       0, 'q'},
 		{"disable-aggregation",     no_argument,       0, 'x'},
 		{"disable-client-nat",     no_argument,       0, 'z'},
+		{"workers",     required_argument,       0, 'w'},
+		{"profile",     no_argument,       0, 'P'},
 		{0, 0, 0, 0}
 	};
 
@@ -271,6 +277,11 @@ void apply_init_args( int argc, char *argv[] ) {
 				found_args++;
 				break;
 
+			case 'P':
+				profile_output++;
+				found_args++;
+				break;
+
 			case 'n':
 				policy_routing_script = optarg;
 
@@ -381,6 +392,22 @@ void apply_init_args( int argc, char *argv[] ) {
 				found_args++;
 				break;
 
+			case 'w':
+
+				errno = 0;
+
+				num_workers = strtol(optarg, NULL, 10);
+
+				if ((num_workers < 0) || (num_workers > PIPELINE_MAX_WORKERS)) {
+
+					printf("Invalid number of workers specified: %i.\nThe number has to be between 0 and %i.\n", num_workers, PIPELINE_MAX_WORKERS);
+					exit(EXIT_FAILURE);
+
+				}
+
+				found_args += ((*((char*)( optarg - 1)) == optchar) ? 1 : 2);
+				break;
+
 			case 'h':
 			default:
 				usage();
@@ -397,6 +424,13 @@ void apply_init_args( int argc, char *argv[] ) {
 
 	}
 
+	if (!unix_client && profile_output) {
+
+		fprintf(stderr, "Error - the profile data can only be read from a running batmand (use -c)\n");
+		exit(EXIT_FAILURE);
+
+	}
+
 	if ( ( download_speed > 0 ) && ( upload_speed == 0 ) )
 		upload_speed = download_speed / 5;
 
@@ -677,6 +711,11 @@ more_hna:
 			batch_mode = 1;
 			snprintf( unix_buff, 10, "i" );
 
+		} else if (profile_output) {
+
+			batch_mode = 1;
+			snprintf(unix_buff, 10, "P");
+
 		} else if (!list_empty(&hna_chg_list)) {
 
 			batch_mode = was_hna = 1;
@@ -771,6 +810,9 @@ void interface_listen_sockets(void)
 {
 	struct list_head *list_pos;
 	struct batman_if *batman_if;
+#if defined(__linux__)
+	struct epoll_event event;
+#endif
 
 	FD_ZERO(&receive_wait_set);
 	receive_max_sock = 0;
@@ -785,6 +827,58 @@ void interface_listen_sockets(void)
 			FD_SET(batman_if->udp_recv_sock, &receive_wait_set);
 		}
 	}
+
+	if (pipeline_fd() >= 0) {
+		if (pipeline_fd() > receive_max_sock)
+			receive_max_sock = pipeline_fd();
+
+		FD_SET(pipeline_fd(), &receive_wait_set);
+	}
+
+#if defined(__linux__)
+	/* receive_packets() waits on an epoll set of the same sockets - the pipeline
+	 * wakeup is registered without interface */
+	if (receive_epoll_fd >= 0)
+		close(receive_epoll_fd);
+
+	if (stop) {
+		receive_epoll_fd = -1;
+		return;
+	}
+
+	if ((receive_epoll_fd = epoll_create(found_ifs + 1)) < 0) {
+		debug_output(3, "Can't create epoll set - falling back to select(): %s\n", strerror(errno));
+		return;
+	}
+
+	list_for_each(list_pos, &if_list) {
+		batman_if = list_entry(list_pos, struct batman_if, list);
+
+		if (!batman_if->if_active)
+			continue;
+
+		event.events = EPOLLIN;
+		event.data.ptr = batman_if;
+
+		if (epoll_ctl(receive_epoll_fd, EPOLL_CTL_ADD, batman_if->udp_recv_sock, &event) < 0)
+			goto epoll_err;
+	}
+
+	if (pipeline_fd() >= 0) {
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+
+		if (epoll_ctl(receive_epoll_fd, EPOLL_CTL_ADD, pipeline_fd(), &event) < 0)
+			goto epoll_err;
+	}
+
+	return;
+
+epoll_err:
+	debug_output(3, "Can't add socket to epoll set - falling back to select(): %s\n", strerror(errno));
+	close(receive_epoll_fd);
+	receive_epoll_fd = -1;
+#endif
 }
 
 static int is_interface_up(char *dev)
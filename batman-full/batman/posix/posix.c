@@ -21,6 +21,7 @@
 
 
 
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <errno.h>
@@ -34,10 +35,14 @@
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <net/if.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
 
 #include "../os.h"
 #include "../batman.h"
 #include "../hna.h"
+#include "../pipeline.h"
 
 
 #define BAT_LOGO_PRINT(x,y,z) printf( "\x1B[%i;%iH%c", y + 1, x, z )                      /* write char 'z' into column 'x', row 'y' */
@@ -52,6 +57,10 @@ uint8_t tunnel_running = 0;
 static pthread_mutex_t batman_clock_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct tms dummy_tms_struct;
 
+#if defined(__linux__)
+static uint8_t no_mmsg = 0;
+#endif
+
 
  /* Make times(2) behave rationally on Linux */
 static clock_t times_wrapper(void)
@@ -288,6 +297,7 @@ void handler( int32_t BATMANUNUSED(sig) ) {
 void del_default_route(void)
 {
 	curr_gateway = NULL;
+	tunnel_wakeup();
 }
 
 
@@ -325,22 +335,43 @@ void add_default_route(void)
 
 
 
-int8_t receive_packet(unsigned char *packet_buff, int32_t packet_buff_len, int16_t *packet_len, uint32_t *neigh, uint32_t timeout, struct batman_if **if_incoming)
+/* drop what is too short to be a batman packet - returns the number of packets kept */
+static int16_t receive_filter(struct recv_packet *packets, int16_t num_packets)
+{
+	int16_t i, kept = 0;
+
+	for (i = 0; i < num_packets; i++) {
+
+		if (((unsigned int)packets[i].len) < sizeof(struct bat_packet))
+			continue;
+
+		if (kept != i)
+			memcpy(&packets[kept], &packets[i], sizeof(struct recv_packet));
+
+		kept++;
+
+	}
+
+	return kept;
+}
+
+/* select() on all interfaces and read one datagram from each interface having one */
+static int16_t receive_select(struct recv_packet *packets, int16_t max_packets, uint32_t timeout)
 {
 	struct sockaddr_in addr;
 	struct timeval tv;
 	struct list_head *if_pos;
 	struct batman_if *batman_if;
-	uint32_t addr_len;
-	int8_t res;
+	socklen_t addr_len;
+	int16_t num_packets = 0;
+	int32_t res;
 	fd_set tmp_wait_set;
 
 
-	addr_len = sizeof(struct sockaddr_in);
-	memcpy( &tmp_wait_set, &receive_wait_set, sizeof(fd_set) );
-
 	while (1) {
 
+		memcpy( &tmp_wait_set, &receive_wait_set, sizeof(fd_set) );
+
 		tv.tv_sec = timeout / 1000;
 		tv.tv_usec = (timeout % 1000) * 1000;
 
@@ -351,7 +382,7 @@ int8_t receive_packet(unsigned char *packet_buff, int32_t packet_buff_len, int16
 
 		if (errno != EINTR) {
 
-			debug_output(0, "Error - can't select (receive_packet): %s\n", strerror(errno));
+			debug_output(0, "Error - can't select (receive_packets): %s\n", strerror(errno));
 
 			/* we might have a deactivated interface - check all active interfaces for problems */
 			check_active_interfaces();
@@ -366,34 +397,178 @@ int8_t receive_packet(unsigned char *packet_buff, int32_t packet_buff_len, int16
 	if ( res == 0 )
 		return 0;
 
+	/* the ogm workers have packets to forward */
+	if ((pipeline_fd() >= 0) && (FD_ISSET(pipeline_fd(), &tmp_wait_set)))
+		pipeline_wakeup_ack();
+
 	list_for_each(if_pos, &if_list) {
 
 		batman_if = list_entry(if_pos, struct batman_if, list);
 
-		if (FD_ISSET(batman_if->udp_recv_sock, &tmp_wait_set)) {
+		if (num_packets == max_packets)
+			break;
 
-			if ((*packet_len = recvfrom(batman_if->udp_recv_sock, packet_buff, packet_buff_len - 1, 0, (struct sockaddr *)&addr, &addr_len)) < 0) {
+		if ((!batman_if->if_active) || (!FD_ISSET(batman_if->udp_recv_sock, &tmp_wait_set)))
+			continue;
 
-				debug_output(0, "Error - can't receive packet: %s\n", strerror(errno));
-				deactivate_interface(batman_if);
-				return -1;
+		addr_len = sizeof(struct sockaddr_in);
 
-			}
+		if ((res = recvfrom(batman_if->udp_recv_sock, packets[num_packets].buff, RECV_PACKET_SIZE - 1, 0, (struct sockaddr *)&addr, &addr_len)) < 0) {
 
-			if (((unsigned int)*packet_len) < sizeof(struct bat_packet))
-				return 0;
+			debug_output(0, "Error - can't receive packet: %s\n", strerror(errno));
+			deactivate_interface(batman_if);
+			continue;
 
-			(*if_incoming) = batman_if;
-			break;
+		}
+
+		packets[num_packets].len = res;
+		packets[num_packets].neigh = addr.sin_addr.s_addr;
+		packets[num_packets].if_incoming = batman_if;
+		num_packets++;
+
+	}
+
+	return receive_filter(packets, num_packets);
+}
+
+#if defined(__linux__)
+
+/* read up to max_packets queued datagrams of the interface without blocking -
+ * returns the number of packets or -1 with errno set */
+static int32_t receive_burst(struct batman_if *batman_if, struct recv_packet *packets, int16_t max_packets)
+{
+	struct mmsghdr msg[RECV_BATCH];
+	struct iovec iov[RECV_BATCH];
+	struct sockaddr_in addr[RECV_BATCH];
+	socklen_t addr_len;
+	int32_t i, res;
+
+
+	if (max_packets > RECV_BATCH)
+		max_packets = RECV_BATCH;
+
+	if (!no_mmsg) {
+
+		for (i = 0; i < max_packets; i++) {
+			iov[i].iov_base = packets[i].buff;
+			iov[i].iov_len = RECV_PACKET_SIZE - 1;
+
+			memset(&msg[i], 0, sizeof(struct mmsghdr));
+			msg[i].msg_hdr.msg_name = &addr[i];
+			msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msg[i].msg_hdr.msg_iov = &iov[i];
+			msg[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		res = recvmmsg(batman_if->udp_recv_sock, msg, max_packets, MSG_DONTWAIT, NULL);
+
+		if ((res >= 0) || (errno != ENOSYS)) {
+
+			for (i = 0; i < res; i++) {
+				packets[i].len = msg[i].msg_len;
+				packets[i].neigh = addr[i].sin_addr.s_addr;
+				packets[i].if_incoming = batman_if;
+			}
+
+			return res;
 
 		}
 
+		/* kernel without recvmmsg() */
+		no_mmsg = 1;
+
 	}
 
-	*neigh = addr.sin_addr.s_addr;
+	addr_len = sizeof(struct sockaddr_in);
+	res = recvfrom(batman_if->udp_recv_sock, packets[0].buff, RECV_PACKET_SIZE - 1, MSG_DONTWAIT, (struct sockaddr *)&addr[0], &addr_len);
 
+	if (res < 0)
+		return -1;
+
+	packets[0].len = res;
+	packets[0].neigh = addr[0].sin_addr.s_addr;
+	packets[0].if_incoming = batman_if;
 	return 1;
+}
+
+#endif
+
+/* wait up to timeout ms for packets and return up to max_packets of them, each with its
+ * incoming interface. returns the number of packets or -1 on error. a failing interface
+ * gets deactivated. */
+int16_t receive_packets(struct recv_packet *packets, int16_t max_packets, uint32_t timeout)
+{
+#if defined(__linux__)
+	struct epoll_event events[RECV_BATCH];
+	struct batman_if *batman_if;
+	int16_t num_packets = 0, quota;
+	int32_t i, res, num_events;
+
+
+	/* no epoll - the interfaces are polled one by one */
+	if (receive_epoll_fd < 0)
+		return receive_select(packets, max_packets, timeout);
+
+	num_events = epoll_wait(receive_epoll_fd, events, RECV_BATCH, timeout);
+
+	if (num_events < 0) {
+
+		if (errno == EINTR)
+			return 0;
+
+		debug_output(0, "Error - can't wait for packets (receive_packets): %s\n", strerror(errno));
+
+		/* we might have a deactivated interface - check all active interfaces for problems */
+		check_active_interfaces();
+		interface_listen_sockets();
+		return -1;
+
+	}
 
+	for (i = 0; i < num_events; i++) {
+
+		batman_if = events[i].data.ptr;
+
+		/* the ogm workers have packets to forward */
+		if (batman_if == NULL) {
+			pipeline_wakeup_ack();
+			continue;
+		}
+
+		/* deactivated while handling an earlier event */
+		if (!batman_if->if_active)
+			continue;
+
+		if (num_packets == max_packets)
+			break;
+
+		/* share the batch among the interfaces having packets queued */
+		quota = (max_packets - num_packets) / (num_events - i);
+
+		if (quota < 1)
+			quota = 1;
+
+		res = receive_burst(batman_if, packets + num_packets, quota);
+
+		if (res < 0) {
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				continue;
+
+			debug_output(0, "Error - can't receive packet: %s\n", strerror(errno));
+			deactivate_interface(batman_if);
+			continue;
+
+		}
+
+		num_packets += receive_filter(packets + num_packets, res);
+
+	}
+
+	return num_packets;
+#else
+	return receive_select(packets, max_packets, timeout);
+#endif
 }
 
 
@@ -433,6 +608,7 @@ void del_gw_interface(void)
 	if (batman_if->udp_tunnel_sock > 0) {
 
 		if (batman_if->listen_thread_id != 0) {
+			tunnel_wakeup();
 			pthread_join(batman_if->listen_thread_id, NULL);
 		} else {
 
@@ -594,6 +770,8 @@ void cleanup(void) {
 	debugFree( debug_clients.mutex, 1222 );
 	debugFree( debug_clients.clients_num, 1223 );
 
+	prof_destroy();
+
 }
 
 
@@ -609,7 +787,6 @@ int main(int argc, char *argv[])
 	}
 
 
-	INIT_LIST_HEAD_FIRST(forw_list);
 	INIT_LIST_HEAD_FIRST(gw_list);
 	INIT_LIST_HEAD_FIRST(if_list);
 
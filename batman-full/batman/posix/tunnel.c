@@ -21,6 +21,7 @@
 
 
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -37,6 +38,11 @@
 #endif
 #include <net/if.h>
 #include <fcntl.h>        /* open(), O_RDWR */
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 
 
 #include "../os.h"
@@ -58,6 +64,64 @@
 
 #define IP_LEASE_TIMEOUT 4 * GW_STATE_VERIFIED_TIMEOUT
 
+#define TUNNEL_PACKET_SIZE 1501
+#define TUNNEL_BATCH 32		/* packets moved per recvmmsg() / sendmmsg() */
+#define TUNNEL_MAX_QUEUES 4	/* gateway tun queues - one forwarding thread each */
+#define TUNNEL_MAX_POLLS (TUNNEL_MAX_QUEUES + 1)
+
+#define TUNNEL_EV_UDP 0x01
+#define TUNNEL_EV_TUN 0x02
+
+
+/* the packets of one batch - buff[i][0] is the tunnel packet type,
+ * len[i] includes it and addr[i] is the peer */
+struct tunnel_batch {
+	unsigned char buff[TUNNEL_BATCH][TUNNEL_PACKET_SIZE];
+	int32_t len[TUNNEL_BATCH];
+	struct sockaddr_in addr[TUNNEL_BATCH];
+#if defined(__linux__)
+	struct iovec iov[TUNNEL_BATCH];
+	struct mmsghdr msg[TUNNEL_BATCH];
+#endif
+};
+
+/* the tunnel threads sleep until traffic arrives, their next timeout is
+ * due or tunnel_wakeup() tells them to check whether they are still needed */
+struct tunnel_poll {
+	int32_t udp_sock;
+	int32_t tun_fd;
+	int32_t wake_fd[2];
+#if defined(__linux__)
+	int32_t epoll_fd;
+	int32_t timer_fd;
+#endif
+	uint32_t deadline;
+	uint8_t armed;
+};
+
+struct gw_listen_data {
+	struct batman_if *batman_if;
+	struct hashtable_t *wip_hash, *vip_hash;
+	struct list_head_first free_ip_list;
+	uint8_t next_free_ip[4] ALIGN_WORD;
+	pthread_rwlock_t lease_lock;
+	uint8_t failed;
+};
+
+struct gw_queue {
+	struct gw_listen_data *gw_data;
+	pthread_t thread_id;
+	int32_t tun_fd;
+	uint8_t purge_leases;
+};
+
+
+static struct tunnel_poll *tunnel_polls[TUNNEL_MAX_POLLS];
+static pthread_mutex_t tunnel_poll_mutex = PTHREAD_MUTEX_INITIALIZER;
+#if defined(__linux__)
+static uint8_t no_mmsg = 0;
+#endif
+
 
 unsigned short bh_udp_ports[] = BH_UDP_PORTS;
 
@@ -96,6 +160,386 @@ static uint16_t get_tunneled_udpdest(const unsigned char *buff)
 #endif
 }
 
+static int8_t tunnel_poll_init(struct tunnel_poll *tunnel_poll, int32_t udp_sock, int32_t tun_fd)
+{
+#if defined(__linux__)
+	struct epoll_event event;
+	int32_t fds[4];
+	uint32_t flags[4];
+#endif
+	int32_t i;
+
+
+	memset(tunnel_poll, 0, sizeof(struct tunnel_poll));
+	tunnel_poll->udp_sock = udp_sock;
+	tunnel_poll->tun_fd = tun_fd;
+
+	if (pipe(tunnel_poll->wake_fd) < 0) {
+		debug_output(0, "Error - can't create tunnel wake up pipe: %s \n", strerror(errno));
+		return -1;
+	}
+
+	fcntl(tunnel_poll->wake_fd[0], F_SETFL, fcntl(tunnel_poll->wake_fd[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(tunnel_poll->wake_fd[1], F_SETFL, fcntl(tunnel_poll->wake_fd[1], F_GETFL, 0) | O_NONBLOCK);
+
+#if defined(__linux__)
+	tunnel_poll->epoll_fd = epoll_create(4);
+	tunnel_poll->timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+
+	if ((tunnel_poll->epoll_fd < 0) || (tunnel_poll->timer_fd < 0)) {
+		debug_output(0, "Error - can't create tunnel epoll / timer: %s \n", strerror(errno));
+		goto err;
+	}
+
+	fds[0] = udp_sock;
+	fds[1] = tun_fd;
+	fds[2] = tunnel_poll->timer_fd;
+	fds[3] = tunnel_poll->wake_fd[0];
+
+	/* the gateway queues share the udp socket - wake only one of them */
+	flags[0] = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+	flags[0] |= EPOLLEXCLUSIVE;
+#endif
+	flags[1] = flags[2] = flags[3] = EPOLLIN;
+
+	for (i = 0; i < 4; i++) {
+
+		memset(&event, 0, sizeof(event));
+		event.events = flags[i];
+		event.data.fd = fds[i];
+
+		if (epoll_ctl(tunnel_poll->epoll_fd, EPOLL_CTL_ADD, fds[i], &event) < 0) {
+			debug_output(0, "Error - can't add fd to tunnel epoll: %s \n", strerror(errno));
+			goto err;
+		}
+
+	}
+#endif
+
+	pthread_mutex_lock(&tunnel_poll_mutex);
+
+	for (i = 0; i < TUNNEL_MAX_POLLS; i++) {
+
+		if (tunnel_polls[i] == NULL) {
+			tunnel_polls[i] = tunnel_poll;
+			break;
+		}
+
+	}
+
+	pthread_mutex_unlock(&tunnel_poll_mutex);
+
+	if (i < TUNNEL_MAX_POLLS)
+		return 1;
+
+	debug_output(0, "Error - too many tunnel threads \n");
+
+#if defined(__linux__)
+err:
+	if (tunnel_poll->epoll_fd >= 0)
+		close(tunnel_poll->epoll_fd);
+
+	if (tunnel_poll->timer_fd >= 0)
+		close(tunnel_poll->timer_fd);
+#endif
+
+	close(tunnel_poll->wake_fd[0]);
+	close(tunnel_poll->wake_fd[1]);
+	return -1;
+}
+
+static void tunnel_poll_destroy(struct tunnel_poll *tunnel_poll)
+{
+	int32_t i;
+
+	pthread_mutex_lock(&tunnel_poll_mutex);
+
+	for (i = 0; i < TUNNEL_MAX_POLLS; i++) {
+
+		if (tunnel_polls[i] == tunnel_poll)
+			tunnel_polls[i] = NULL;
+
+	}
+
+	pthread_mutex_unlock(&tunnel_poll_mutex);
+
+#if defined(__linux__)
+	close(tunnel_poll->epoll_fd);
+	close(tunnel_poll->timer_fd);
+#endif
+	close(tunnel_poll->wake_fd[0]);
+	close(tunnel_poll->wake_fd[1]);
+}
+
+/* wake all tunnel threads - called whenever the gateway selection or the
+ * gateway class changed or batmand is shutting down */
+void tunnel_wakeup(void)
+{
+	int32_t i;
+
+	pthread_mutex_lock(&tunnel_poll_mutex);
+
+	for (i = 0; i < TUNNEL_MAX_POLLS; i++) {
+
+		if ((tunnel_polls[i] != NULL) && (write(tunnel_polls[i]->wake_fd[1], "w", 1) < 0) && (errno != EAGAIN))
+			debug_output(0, "Error - can't wake up tunnel thread: %s \n", strerror(errno));
+
+	}
+
+	pthread_mutex_unlock(&tunnel_poll_mutex);
+}
+
+/* sleep until traffic arrives, somebody calls tunnel_wakeup() or the deadline
+ * (if use_deadline is set) is reached - returns the TUNNEL_EV_* flags of the
+ * fds that have packets waiting or -1 on error */
+static int32_t tunnel_poll_wait(struct tunnel_poll *tunnel_poll, uint8_t use_deadline, uint32_t deadline)
+{
+	uint32_t current_time;
+	int32_t res, ready = 0, delay;
+	char wake_buff[16];
+#if defined(__linux__)
+	struct epoll_event events[4];
+	struct itimerspec timer;
+	uint64_t expirations;
+	int32_t i;
+#else
+	struct timeval tv;
+	fd_set wait_sockets;
+	int32_t max_sock;
+#endif
+
+
+	current_time = get_time_msec();
+	delay = (int32_t)(deadline - current_time);
+
+	if (delay < 1)
+		delay = 1;
+
+#if defined(__linux__)
+	/* only touch the timer if the deadline moved forward - a timer firing
+	 * too early simply rearms it */
+	if ((use_deadline) && ((!tunnel_poll->armed) || ((int32_t)(deadline - tunnel_poll->deadline) < 0))) {
+
+		memset(&timer, 0, sizeof(timer));
+		timer.it_value.tv_sec = delay / 1000;
+		timer.it_value.tv_nsec = (delay % 1000) * 1000000;
+
+		if (timerfd_settime(tunnel_poll->timer_fd, 0, &timer, NULL) < 0)
+			return -1;
+
+		tunnel_poll->deadline = deadline;
+		tunnel_poll->armed = 1;
+
+	}
+
+	res = epoll_wait(tunnel_poll->epoll_fd, events, 4, -1);
+
+	if (res < 0)
+		return (errno == EINTR ? 0 : -1);
+
+	for (i = 0; i < res; i++) {
+
+		if (events[i].data.fd == tunnel_poll->udp_sock) {
+			ready |= TUNNEL_EV_UDP;
+		} else if (events[i].data.fd == tunnel_poll->tun_fd) {
+			ready |= TUNNEL_EV_TUN;
+		} else if (events[i].data.fd == tunnel_poll->timer_fd) {
+			if (read(tunnel_poll->timer_fd, &expirations, sizeof(expirations)) > 0)
+				tunnel_poll->armed = 0;
+		} else {
+			while (read(tunnel_poll->wake_fd[0], wake_buff, sizeof(wake_buff)) > 0);
+		}
+
+	}
+#else
+	tv.tv_sec = delay / 1000;
+	tv.tv_usec = (delay % 1000) * 1000;
+
+	FD_ZERO(&wait_sockets);
+	FD_SET(tunnel_poll->udp_sock, &wait_sockets);
+	FD_SET(tunnel_poll->tun_fd, &wait_sockets);
+	FD_SET(tunnel_poll->wake_fd[0], &wait_sockets);
+
+	max_sock = (tunnel_poll->udp_sock > tunnel_poll->tun_fd ? tunnel_poll->udp_sock : tunnel_poll->tun_fd);
+
+	if (tunnel_poll->wake_fd[0] > max_sock)
+		max_sock = tunnel_poll->wake_fd[0];
+
+	res = select(max_sock + 1, &wait_sockets, NULL, NULL, (use_deadline ? &tv : NULL));
+
+	if (res < 0)
+		return (errno == EINTR ? 0 : -1);
+
+	if (FD_ISSET(tunnel_poll->udp_sock, &wait_sockets))
+		ready |= TUNNEL_EV_UDP;
+
+	if (FD_ISSET(tunnel_poll->tun_fd, &wait_sockets))
+		ready |= TUNNEL_EV_TUN;
+
+	if (FD_ISSET(tunnel_poll->wake_fd[0], &wait_sockets))
+		while (read(tunnel_poll->wake_fd[0], wake_buff, sizeof(wake_buff)) > 0);
+#endif
+
+	return ready;
+}
+
+/* receive up to TUNNEL_BATCH datagrams - returns the number of packets
+ * (0 if the socket ran dry) or -1 on error */
+static int32_t tunnel_recv_batch(int32_t udp_sock, struct tunnel_batch *batch)
+{
+	uint32_t addr_len;
+	int32_t i, res;
+
+#if defined(__linux__)
+	if (!no_mmsg) {
+
+		for (i = 0; i < TUNNEL_BATCH; i++) {
+
+			batch->iov[i].iov_base = batch->buff[i];
+			batch->iov[i].iov_len = TUNNEL_PACKET_SIZE - 1;
+
+			memset(&batch->msg[i], 0, sizeof(struct mmsghdr));
+			batch->msg[i].msg_hdr.msg_iov = &batch->iov[i];
+			batch->msg[i].msg_hdr.msg_iovlen = 1;
+			batch->msg[i].msg_hdr.msg_name = &batch->addr[i];
+			batch->msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+		}
+
+		res = recvmmsg(udp_sock, batch->msg, TUNNEL_BATCH, 0, NULL);
+
+		if (res >= 0) {
+
+			for (i = 0; i < res; i++)
+				batch->len[i] = batch->msg[i].msg_len;
+
+			return res;
+
+		}
+
+		if (errno != ENOSYS)
+			return ((errno == EWOULDBLOCK) || (errno == EINTR) ? 0 : -1);
+
+		/* kernel older than 2.6.33 */
+		no_mmsg = 1;
+
+	}
+#endif
+
+	for (i = 0; i < TUNNEL_BATCH; i++) {
+
+		addr_len = sizeof(struct sockaddr_in);
+		res = recvfrom(udp_sock, batch->buff[i], TUNNEL_PACKET_SIZE - 1, 0, (struct sockaddr *)&batch->addr[i], &addr_len);
+
+		if (res < 0) {
+
+			if ((errno == EWOULDBLOCK) || (errno == EINTR))
+				break;
+
+			return (i > 0 ? i : -1);
+
+		}
+
+		batch->len[i] = res;
+
+	}
+
+	return i;
+}
+
+/* send every packet of the batch with a len > 0 to its addr */
+static void tunnel_send_batch(int32_t udp_sock, struct tunnel_batch *batch, int32_t num_packets, char *peer)
+{
+	int32_t i, res;
+#if defined(__linux__)
+	int32_t num_msg = 0, sent = 0;
+
+	if (!no_mmsg) {
+
+		for (i = 0; i < num_packets; i++) {
+
+			if (batch->len[i] <= 0)
+				continue;
+
+			batch->iov[num_msg].iov_base = batch->buff[i];
+			batch->iov[num_msg].iov_len = batch->len[i];
+
+			memset(&batch->msg[num_msg], 0, sizeof(struct mmsghdr));
+			batch->msg[num_msg].msg_hdr.msg_iov = &batch->iov[num_msg];
+			batch->msg[num_msg].msg_hdr.msg_iovlen = 1;
+			batch->msg[num_msg].msg_hdr.msg_name = &batch->addr[i];
+			batch->msg[num_msg].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			num_msg++;
+
+		}
+
+		while (sent < num_msg) {
+
+			res = sendmmsg(udp_sock, batch->msg + sent, num_msg - sent, 0);
+
+			if (res > 0) {
+				sent += res;
+				continue;
+			}
+
+			if ((res < 0) && (errno == ENOSYS) && (sent == 0)) {
+				no_mmsg = 1;
+				break;
+			}
+
+			/* skip the packet that could not be sent */
+			debug_output(0, "Error - can't send data to %s: %s\n", peer, strerror(errno));
+			sent++;
+
+		}
+
+		if (!no_mmsg)
+			return;
+
+	}
+#endif
+
+	for (i = 0; i < num_packets; i++) {
+
+		if (batch->len[i] <= 0)
+			continue;
+
+		res = sendto(udp_sock, batch->buff[i], batch->len[i], 0, (struct sockaddr *)&batch->addr[i], sizeof(struct sockaddr_in));
+
+		if (res < 0)
+			debug_output(0, "Error - can't send data to %s: %s\n", peer, strerror(errno));
+
+	}
+}
+
+/* read up to TUNNEL_BATCH packets from the tun device, leaving room for the
+ * tunnel packet type - returns the number of packets or -1 on error */
+static int32_t tunnel_read_batch(int32_t tun_fd, struct tunnel_batch *batch)
+{
+	int32_t i, res;
+
+	for (i = 0; i < TUNNEL_BATCH; i++) {
+
+		res = read(tun_fd, batch->buff[i] + 1, TUNNEL_PACKET_SIZE - 2);
+
+		if (res <= 0) {
+
+			if ((res == 0) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				break;
+
+			return (i > 0 ? i : -1);
+
+		}
+
+		batch->buff[i][0] = TUNNEL_DATA;
+		batch->len[i] = res + 1;
+
+	}
+
+	return i;
+}
+
 static int8_t get_tun_ip(struct sockaddr_in *gw_addr, int32_t udp_sock, uint32_t *tun_addr)
 {
 	struct sockaddr_in sender_addr;
@@ -175,20 +619,16 @@ next_try:
 void *client_to_gw_tun(void *arg)
 {
 	struct curr_gw_data *curr_gw_data = (struct curr_gw_data *)arg;
-	struct sockaddr_in gw_addr, my_addr, sender_addr;
-	struct timeval tv;
-	struct list_head_first packet_list;
-	int32_t res, max_sock, buff_len, udp_sock, tun_fd, tun_ifi, sock_opts, i, num_refresh_lease = 0, last_refresh_attempt = 0;
-	uint32_t addr_len, current_time, ip_lease_time = 0, gw_state_time = 0, my_tun_addr = 0, ignore_packet;
+	struct sockaddr_in gw_addr, my_addr;
+	struct tunnel_poll tunnel_poll;
+	struct tunnel_batch *batch = NULL;
+	int32_t res, buff_len, udp_sock, tun_fd, tun_ifi, sock_opts, i, j, num_packets, num_refresh_lease = 0, last_refresh_attempt = 0;
+	uint32_t current_time, deadline, ip_lease_time = 0, gw_state_time = 0, my_tun_addr = 0, ignore_packet;
 	char tun_if[IFNAMSIZ], my_str[ADDR_STR_LEN], gw_str[ADDR_STR_LEN], gw_state = GW_STATE_UNKNOWN;
-	unsigned char buff[1501];
-	fd_set wait_sockets, tmp_wait_sockets;
-
-
-	addr_len = sizeof(struct sockaddr_in);
+	unsigned char ctrl_buff[100], *buff;
 
-	INIT_LIST_HEAD_FIRST(packet_list);
 
+	memset(ctrl_buff, 0, sizeof(ctrl_buff));
 	memset(&gw_addr, 0, sizeof(struct sockaddr_in));
 	memset(&my_addr, 0, sizeof(struct sockaddr_in));
 
@@ -238,41 +678,54 @@ void *client_to_gw_tun(void *arg)
 	debug_output(3, "Gateway client - got IP (%s) from gateway: %s \n", my_str, gw_str);
 
 
-	if (add_dev_tun(curr_gw_data->batman_if, my_tun_addr, tun_if, sizeof(tun_if), &tun_fd, &tun_ifi) <= 0)
+	if (add_dev_tun(curr_gw_data->batman_if, my_tun_addr, tun_if, sizeof(tun_if), &tun_fd, &tun_ifi, 0) <= 0)
 		goto udp_out;
 
 	add_nat_rule(tun_if);
 	add_del_route(0, 0, 0, my_tun_addr, tun_ifi, tun_if, BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_UNICAST, ROUTE_ADD);
 
-	FD_ZERO(&wait_sockets);
-	FD_SET(udp_sock, &wait_sockets);
-	FD_SET(tun_fd, &wait_sockets);
+	if (tunnel_poll_init(&tunnel_poll, udp_sock, tun_fd) < 0)
+		goto cleanup;
 
-	max_sock = (udp_sock > tun_fd ? udp_sock : tun_fd);
+	batch = debugMalloc(sizeof(struct tunnel_batch), 211);
 
 	while ((!is_aborted()) && (curr_gateway != NULL) && (!curr_gw_data->gw_node->deleted)) {
 
-		tv.tv_sec = 0;
-		tv.tv_usec = 250;
+		/* sleep until the next lease refresh or gateway state timeout is due */
+		deadline = ip_lease_time + IP_LEASE_TIMEOUT + 1;
 
-		memcpy(&tmp_wait_sockets, &wait_sockets, sizeof(fd_set));
+		if ((int)(last_refresh_attempt + 1000 + 1 - deadline) > 0)
+			deadline = last_refresh_attempt + 1000 + 1;
 
-		res = select(max_sock + 1, &tmp_wait_sockets, NULL, NULL, &tv);
+		if ((gw_state == GW_STATE_UNKNOWN) && (gw_state_time != 0) &&
+				   ((int)(gw_state_time + GW_STATE_UNKNOWN_TIMEOUT + 1 - deadline) < 0))
+			deadline = gw_state_time + GW_STATE_UNKNOWN_TIMEOUT + 1;
+
+		if ((gw_state == GW_STATE_VERIFIED) &&
+				   ((int)(gw_state_time + GW_STATE_VERIFIED_TIMEOUT + 1 - deadline) < 0))
+			deadline = gw_state_time + GW_STATE_VERIFIED_TIMEOUT + 1;
+
+		res = tunnel_poll_wait(&tunnel_poll, 1, deadline);
 
 		current_time = get_time_msec();
 
-		if ((res < 0) && (errno != EINTR)) {
-			debug_output(0, "Error - can't select (client_to_gw_tun): %s \n", strerror(errno));
+		if (res < 0) {
+			debug_output(0, "Error - can't wait for tunnel traffic (client_to_gw_tun): %s \n", strerror(errno));
 			break;
 		}
 
-		if (res <= 0)
-			goto after_incoming_packet;
-
 		/* traffic that comes from the gateway via the tunnel */
-		if (FD_ISSET(udp_sock, &tmp_wait_sockets)) {
+		if (res & TUNNEL_EV_UDP) {
+
+			if ((num_packets = tunnel_recv_batch(udp_sock, batch)) < 0) {
+				debug_output(0, "Error - gateway client can't receive packet: %s\n", strerror(errno));
+				break;
+			}
 
-			while ((buff_len = recvfrom(udp_sock, buff, sizeof(buff) - 1, 0, (struct sockaddr *)&sender_addr, &addr_len)) > 0) {
+			for (j = 0; j < num_packets; j++) {
+
+				buff = batch->buff[j];
+				buff_len = batch->len[j];
 
 				if (buff_len < 2) {
 					debug_output(0, "Error - ignoring gateway packet from %s: packet too small (%i)\n", my_str, buff_len);
@@ -280,7 +733,7 @@ void *client_to_gw_tun(void *arg)
 				}
 
 				/* a gateway with multiple interfaces breaks here */
-				/*if (sender_addr.sin_addr.s_addr != gw_addr.sin_addr.s_addr) {
+				/*if (batch->addr[j].sin_addr.s_addr != gw_addr.sin_addr.s_addr) {
 					debug_output(0, "Error - can't receive ip request: sender IP is not gateway IP \n");
 					continue;
 				}*/
@@ -302,7 +755,7 @@ void *client_to_gw_tun(void *arg)
 					debug_output(3, "Gateway client - gateway (%s) says: IP (%s) is invalid (maybe expired) \n", gw_str, my_str);
 
 					curr_gateway = NULL;
-					goto cleanup;
+					goto poll_out;
 				/* keep alive packet was confirmed */
 				case TUNNEL_KEEPALIVE_REPLY:
 					debug_output(3, "Gateway client - successfully refreshed IP lease: %s \n", gw_str);
@@ -313,20 +766,20 @@ void *client_to_gw_tun(void *arg)
 
 			}
 
-			if (errno != EWOULDBLOCK) {
-				debug_output(0, "Error - gateway client can't receive packet: %s\n", strerror(errno));
-				break;
-			}
+		}
 
 		/* traffic that we should send to the gateway via the tunnel */
-		} else if (FD_ISSET(tun_fd, &tmp_wait_sockets)) {
+		if (res & TUNNEL_EV_TUN) {
 
-			while ((buff_len = read(tun_fd, buff + 1, sizeof(buff) - 2)) > 0) {
+			if ((num_packets = tunnel_read_batch(tun_fd, batch)) < 0) {
+				debug_output(0, "Error - gateway client can't read tun data: %s\n", strerror(errno));
+				break;
+			}
 
-				buff[0] = TUNNEL_DATA;
+			for (j = 0; j < num_packets; j++) {
 
-				if (sendto(udp_sock, buff, buff_len + 1, 0, (struct sockaddr *)&gw_addr, sizeof(struct sockaddr_in)) < 0)
-					debug_output(0, "Error - can't send data to gateway: %s\n", strerror(errno));
+				buff = batch->buff[j];
+				memcpy(&batch->addr[j], &gw_addr, sizeof(struct sockaddr_in));
 
 				if ((gw_state == GW_STATE_UNKNOWN) && (gw_state_time == 0)) {
 
@@ -360,24 +813,19 @@ void *client_to_gw_tun(void *arg)
 				}
 			}
 
-			if (errno != EWOULDBLOCK) {
-				debug_output(0, "Error - gateway client can't read tun data: %s\n", strerror(errno));
-				break;
-			}
+			tunnel_send_batch(udp_sock, batch, num_packets, "gateway");
 
 		}
 
-after_incoming_packet:
-
 		/* refresh leased IP */
 		if (((int)(current_time - (ip_lease_time + IP_LEASE_TIMEOUT)) > 0) &&
 			((int)(current_time - (last_refresh_attempt + 1000)) > 0)) {
 
 			if (num_refresh_lease < 12) {
 
-				buff[0] = TUNNEL_KEEPALIVE_REQUEST;
+				ctrl_buff[0] = TUNNEL_KEEPALIVE_REQUEST;
 
-				if (sendto(udp_sock, buff, 100, 0, (struct sockaddr *)&gw_addr, sizeof(struct sockaddr_in)) < 0)
+				if (sendto(udp_sock, ctrl_buff, sizeof(ctrl_buff), 0, (struct sockaddr *)&gw_addr, sizeof(struct sockaddr_in)) < 0)
 					debug_output(0, "Error - can't send keep alive request to gateway: %s \n", strerror(errno));
 
 				num_refresh_lease++;
@@ -417,7 +865,13 @@ after_incoming_packet:
 
 	}
 
+poll_out:
+	tunnel_poll_destroy(&tunnel_poll);
+
 cleanup:
+	if (batch != NULL)
+		debugFree(batch, 1224);
+
 	add_del_route(0, 0, 0, my_tun_addr, tun_ifi, tun_if, BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_UNICAST, ROUTE_DEL);
 	del_nat_rule(tun_if);
 	del_dev_tun(tun_fd);
@@ -557,238 +1011,343 @@ static int choose_vip(void *data, int32_t size)
 
 }
 
-void *gw_listen(void *BATMANUNUSED(arg)) {
-
-	struct batman_if *batman_if = (struct batman_if *)if_list.next;
-	struct timeval tv;
-	struct sockaddr_in addr, client_addr;
+/* traffic coming from the tunnel clients via UDP - returns -1 on error */
+static int8_t gw_handle_clients(struct gw_queue *gw_queue, struct tunnel_batch *batch, uint32_t current_time)
+{
+	struct gw_listen_data *gw_data = gw_queue->gw_data;
+	int32_t udp_sock = gw_data->batman_if->udp_tunnel_sock;
 	struct gw_client *gw_client;
-	char gw_addr[16], str[16], tun_dev[IFNAMSIZ];
-	unsigned char buff[1501];
-	int32_t res, max_sock, buff_len, tun_fd, tun_ifi;
-	uint32_t addr_len, client_timeout, current_time;
-	uint8_t my_tun_ip[4] ALIGN_WORD, next_free_ip[4] ALIGN_WORD;
-	struct hashtable_t *wip_hash, *vip_hash;
-	struct list_head_first free_ip_list;
-	fd_set wait_sockets, tmp_wait_sockets;
-	struct hash_it_t *hashit;
-	struct free_ip *free_ip;
-	struct list_head *list_pos, *list_pos_tmp;
+	struct sockaddr_in *addr;
+	char gw_addr[16], str[16];
+	unsigned char *buff;
+	int32_t buff_len, num_packets, j;
 
 
-	my_tun_ip[0] = next_free_ip[0] = 169;
-	my_tun_ip[1] = next_free_ip[1] = 254;
-	my_tun_ip[2] = next_free_ip[2] = 0;
-	my_tun_ip[3] = 0;
-	next_free_ip[3] = 1;
+	if ((num_packets = tunnel_recv_batch(udp_sock, batch)) < 0) {
+		debug_output(0, "Error - gateway can't receive packet: %s\n", strerror(errno));
+		return -1;
+	}
 
-	addr_len = sizeof (struct sockaddr_in);
-	client_timeout = get_time_msec();
+	for (j = 0; j < num_packets; j++) {
 
-	client_addr.sin_family = AF_INET;
-	client_addr.sin_port = htons(PORT + 1);
+		buff = batch->buff[j];
+		buff_len = batch->len[j];
+		addr = &batch->addr[j];
 
-	INIT_LIST_HEAD_FIRST(free_ip_list);
+		if (buff_len < 2) {
+			addr_to_string(addr->sin_addr.s_addr, str, sizeof(str));
+			debug_output(0, "Error - ignoring client packet from %s: packet too small (%i)\n", str, buff_len);
+			continue;
+		}
 
-	if (add_dev_tun(batman_if, *(uint32_t *)my_tun_ip, tun_dev, sizeof(tun_dev), &tun_fd, &tun_ifi) < 0)
-		return NULL;
+		switch(buff[0]) {
+		/* client sends us data that should to the internet */
+		case TUNNEL_DATA:
+			/* compare_vip() adds 4 bytes, hence buff + 9 */
+			pthread_rwlock_rdlock(&gw_data->lease_lock);
+			gw_client = ((struct gw_client *)hash_find(gw_data->vip_hash, buff + 9));
 
-	if (NULL == ( wip_hash = hash_new(128, compare_wip, choose_wip)))
-		return NULL;
+			if ((gw_client != NULL) && ((gw_client->wip_addr == addr->sin_addr.s_addr) || (gw_client->nat_warn != 0))) {
+				pthread_rwlock_unlock(&gw_data->lease_lock);
+				goto write_tun;
+			}
 
-	if (NULL == (vip_hash = hash_new(128, compare_vip, choose_vip))) {
-		hash_destroy(wip_hash);
-		return NULL;
-	}
+			pthread_rwlock_unlock(&gw_data->lease_lock);
+			pthread_rwlock_wrlock(&gw_data->lease_lock);
 
-	add_del_route(*(uint32_t *)my_tun_ip, 16, 0, 0, tun_ifi, tun_dev, 254, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+			gw_client = ((struct gw_client *)hash_find(gw_data->vip_hash, buff + 9));
 
+			/* check whether client IP is known */
+			if ((gw_client == NULL) || ((gw_client->wip_addr != addr->sin_addr.s_addr) && (gw_client->nat_warn == 0))) {
 
-	FD_ZERO(&wait_sockets);
-	FD_SET(batman_if->udp_tunnel_sock, &wait_sockets);
-	FD_SET(tun_fd, &wait_sockets);
+				addr_to_string(addr->sin_addr.s_addr, str, sizeof(str));
 
-	max_sock = (batman_if->udp_tunnel_sock > tun_fd ? batman_if->udp_tunnel_sock : tun_fd);
+				debug_output(0, "Error - got packet from unknown client: %s (tunnelled sender ip %i.%i.%i.%i) \n", str, (uint8_t)buff[13], (uint8_t)buff[14], (uint8_t)buff[15], (uint8_t)buff[16]);
 
-	while ((!is_aborted()) && (gateway_class > 0)) {
+				if (gw_client == NULL) {
 
-		tv.tv_sec = 0;
-		tv.tv_usec = 250;
-		memcpy(&tmp_wait_sockets, &wait_sockets, sizeof(fd_set));
+					/* TODO: only send refresh if the IP comes from 169.254.x.y ?? */
 
-		res = select(max_sock + 1, &tmp_wait_sockets, NULL, NULL, &tv);
+					/* auto assign a dummy address to output the NAT warning only once */
+					gw_client = get_ip_addr(addr, &gw_data->wip_hash, &gw_data->vip_hash, &gw_data->free_ip_list, gw_data->next_free_ip);
 
-		current_time = get_time_msec();
+					addr_to_string(gw_client->vip_addr, str, sizeof(str));
+					addr_to_string(addr->sin_addr.s_addr, gw_addr, sizeof(gw_addr));
+					debug_output(3, "Gateway - assigned %s to unregistered client: %s \n", str, gw_addr);
+
+				}
+
+				debug_output(0, "Either enable NAT on the client or make sure this host has a route back to the sender address.\n");
+				gw_client->nat_warn++;
+			}
+
+			pthread_rwlock_unlock(&gw_data->lease_lock);
+
+write_tun:
+			if (write(gw_queue->tun_fd, buff + 1, buff_len - 1) < 0)
+				debug_output(0, "Error - can't write packet into tun: %s\n", strerror(errno));
 
-		if ((res < 0) && (errno != EINTR)) {
-			debug_output(0, "Error - can't select (gw_listen): %s \n", strerror(errno));
 			break;
-		}
+		/* client asks us to refresh the IP lease */
+		case TUNNEL_KEEPALIVE_REQUEST:
+			pthread_rwlock_wrlock(&gw_data->lease_lock);
+			gw_client = ((struct gw_client *)hash_find(gw_data->wip_hash, &addr->sin_addr.s_addr));
 
-		if (res <= 0)
-			goto after_incoming_packet;
+			buff[0] = TUNNEL_IP_INVALID;
 
-		/* traffic coming from the tunnel client via UDP */
-		if (FD_ISSET(batman_if->udp_tunnel_sock, &tmp_wait_sockets)) {
+			if (gw_client != NULL) {
+				gw_client->last_keep_alive = current_time;
+				buff[0] = TUNNEL_KEEPALIVE_REPLY;
+			}
 
-			while ((buff_len = recvfrom(batman_if->udp_tunnel_sock, buff, sizeof(buff) - 1, 0, (struct sockaddr *)&addr, &addr_len)) > 0) {
+			pthread_rwlock_unlock(&gw_data->lease_lock);
 
-				if (buff_len < 2) {
-					addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
-					debug_output(0, "Error - ignoring client packet from %s: packet too small (%i)\n", str, buff_len);
-					continue;
-				}
+			addr_to_string(addr->sin_addr.s_addr, str, sizeof(str));
 
-				switch(buff[0]) {
-				/* client sends us data that should to the internet */
-				case TUNNEL_DATA:
-					/* compare_vip() adds 4 bytes, hence buff + 9 */
-					gw_client = ((struct gw_client *)hash_find(vip_hash, buff + 9));
+			if (sendto(udp_sock, buff, 100, 0, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0) {
+				debug_output(0, "Error - can't send %s to client (%s): %s \n", (buff[0] == TUNNEL_KEEPALIVE_REPLY ? "keep alive reply" : "invalid ip information"), str, strerror(errno));
+				continue;
+			}
+
+			debug_output(3, "Gateway - send %s to client: %s \n", (buff[0] == TUNNEL_KEEPALIVE_REPLY ? "keep alive reply" : "invalid ip information"), str);
+			break;
+		/* client requests a fresh IP */
+		case TUNNEL_IP_REQUEST:
+			pthread_rwlock_wrlock(&gw_data->lease_lock);
+			gw_client = get_ip_addr(addr, &gw_data->wip_hash, &gw_data->vip_hash, &gw_data->free_ip_list, gw_data->next_free_ip);
+
+			memcpy(buff + 1, (char *)&gw_client->vip_addr, 4);
+			pthread_rwlock_unlock(&gw_data->lease_lock);
+
+			if (sendto(udp_sock, buff, 100, 0, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0) {
+				addr_to_string(addr->sin_addr.s_addr, str, sizeof (str));
+				debug_output(0, "Error - can't send requested ip to client (%s): %s \n", str, strerror(errno));
+				continue;
+			}
+
+			addr_to_string(*(uint32_t *)(buff + 1), str, sizeof(str));
+			addr_to_string(addr->sin_addr.s_addr, gw_addr, sizeof(gw_addr));
+			debug_output(3, "Gateway - assigned %s to client: %s \n", str, gw_addr);
+			break;
+		}
 
-					/* check whether client IP is known */
-					if ((gw_client == NULL) || ((gw_client->wip_addr != addr.sin_addr.s_addr) && (gw_client->nat_warn == 0))) {
+	}
 
-						buff[0] = TUNNEL_IP_INVALID;
-						addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
+	return 1;
+}
 
-						debug_output(0, "Error - got packet from unknown client: %s (tunnelled sender ip %i.%i.%i.%i) \n", str, (uint8_t)buff[13], (uint8_t)buff[14], (uint8_t)buff[15], (uint8_t)buff[16]);
+/* traffic coming from the internet that needs to be sent back to the clients - returns -1 on error */
+static int8_t gw_handle_tun(struct gw_queue *gw_queue, struct tunnel_batch *batch)
+{
+	struct gw_listen_data *gw_data = gw_queue->gw_data;
+	struct gw_client *gw_client;
+	char gw_addr[16];
+	int32_t num_packets, j;
 
-						if (gw_client == NULL) {
 
-							/* TODO: only send refresh if the IP comes from 169.254.x.y ?? */
-							/*if (sendto(batman_if->udp_tunnel_sock, buff, buff_len, 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0)
-								debug_output(0, "Error - can't send invalid ip information to client (%s): %s \n", str, strerror(errno));*/
+	if ((num_packets = tunnel_read_batch(gw_queue->tun_fd, batch)) < 0) {
+		debug_output(0, "Error - gateway can't read tun data: %s\n", strerror(errno));
+		return -1;
+	}
 
-							/* auto assign a dummy address to output the NAT warning only once */
-							gw_client = get_ip_addr(&addr, &wip_hash, &vip_hash, &free_ip_list, next_free_ip);
+	pthread_rwlock_rdlock(&gw_data->lease_lock);
 
-							addr_to_string(gw_client->vip_addr, str, sizeof(str));
-							addr_to_string(addr.sin_addr.s_addr, gw_addr, sizeof(gw_addr));
-							debug_output(3, "Gateway - assigned %s to unregistered client: %s \n", str, gw_addr);
+	for (j = 0; j < num_packets; j++) {
 
-						}
+		gw_client = ((struct gw_client *)hash_find(gw_data->vip_hash, batch->buff[j] + 13));
 
-						debug_output(0, "Either enable NAT on the client or make sure this host has a route back to the sender address.\n");
-						gw_client->nat_warn++;
-					}
+		if (gw_client != NULL) {
 
-					if (write(tun_fd, buff + 1, buff_len - 1) < 0)
-						debug_output(0, "Error - can't write packet into tun: %s\n", strerror(errno));
+			batch->addr[j].sin_family = AF_INET;
+			batch->addr[j].sin_addr.s_addr = gw_client->wip_addr;
+			batch->addr[j].sin_port = gw_client->client_port;
 
-					break;
-				/* client asks us to refresh the IP lease */
-				case TUNNEL_KEEPALIVE_REQUEST:
-					gw_client = ((struct gw_client *)hash_find(wip_hash, &addr.sin_addr.s_addr));
+		} else {
 
-					buff[0] = TUNNEL_IP_INVALID;
+			addr_to_string(*(uint32_t *)(batch->buff[j] + 17), gw_addr, sizeof(gw_addr));
+			debug_output(3, "Gateway - could not resolve packet: %s \n", gw_addr);
+			batch->len[j] = 0;
 
-					if (gw_client != NULL) {
-						gw_client->last_keep_alive = current_time;
-						buff[0] = TUNNEL_KEEPALIVE_REPLY;
-					}
+		}
 
-					addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
+	}
 
-					if (sendto(batman_if->udp_tunnel_sock, buff, 100, 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
-						debug_output(0, "Error - can't send %s to client (%s): %s \n", (buff[0] == TUNNEL_KEEPALIVE_REPLY ? "keep alive reply" : "invalid ip information"), str, strerror(errno));
-						continue;
-					}
+	pthread_rwlock_unlock(&gw_data->lease_lock);
 
-					debug_output(3, "Gateway - send %s to client: %s \n", (buff[0] == TUNNEL_KEEPALIVE_REPLY ? "keep alive reply" : "invalid ip information"), str);
-					break;
-				/* client requests a fresh IP */
-				case TUNNEL_IP_REQUEST:
-					gw_client = get_ip_addr(&addr, &wip_hash, &vip_hash, &free_ip_list, next_free_ip);
+	tunnel_send_batch(gw_data->batman_if->udp_tunnel_sock, batch, num_packets, "client");
+	return 1;
+}
 
-					memcpy(buff + 1, (char *)&gw_client->vip_addr, 4);
+/* close unresponsive client connections (free unused IPs) */
+static void gw_purge_leases(struct gw_listen_data *gw_data, uint32_t current_time)
+{
+	struct gw_client *gw_client;
+	struct free_ip *free_ip;
+	struct hash_it_t *hashit = NULL;
 
-					if (sendto(batman_if->udp_tunnel_sock, buff, 100, 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
-						addr_to_string(addr.sin_addr.s_addr, str, sizeof (str));
-						debug_output(0, "Error - can't send requested ip to client (%s): %s \n", str, strerror(errno));
-						continue;
-					}
 
-					addr_to_string(gw_client->vip_addr, str, sizeof(str));
-					addr_to_string(addr.sin_addr.s_addr, gw_addr, sizeof(gw_addr));
-					debug_output(3, "Gateway - assigned %s to client: %s \n", str, gw_addr);
-					break;
-				}
+	pthread_rwlock_wrlock(&gw_data->lease_lock);
 
-			}
+	while (NULL != (hashit = hash_iterate(gw_data->wip_hash, hashit))) {
 
-			if (errno != EWOULDBLOCK) {
-				debug_output(0, "Error - gateway can't receive packet: %s\n", strerror(errno));
-				break;
-			}
+		gw_client = hashit->bucket->data;
 
-		/* traffic coming from the internet that needs to be sent back to the client */
-		} else if (FD_ISSET(tun_fd, &tmp_wait_sockets)) {
+		if ((int)(current_time - (gw_client->last_keep_alive + IP_LEASE_TIMEOUT + GW_STATE_UNKNOWN_TIMEOUT)) > 0) {
 
-			while ((buff_len = read(tun_fd, buff + 1, sizeof(buff) - 2 )) > 0) {
+			hash_remove_bucket(gw_data->wip_hash, hashit);
+			hash_remove(gw_data->vip_hash, gw_client);
 
-				gw_client = ((struct gw_client *)hash_find(vip_hash, buff + 13));
+			free_ip = debugMalloc(sizeof(struct neigh_node), 210);
 
-				if (gw_client != NULL) {
+			INIT_LIST_HEAD(&free_ip->list);
+			free_ip->addr = gw_client->vip_addr;
 
-					client_addr.sin_addr.s_addr = gw_client->wip_addr;
-					client_addr.sin_port = gw_client->client_port;
+			list_add_tail( &free_ip->list, &gw_data->free_ip_list );
 
-					buff[0] = TUNNEL_DATA;
+			debugFree(gw_client, 1216);
 
-					if (sendto(batman_if->udp_tunnel_sock, buff, buff_len + 1, 0, (struct sockaddr *)&client_addr, sizeof(struct sockaddr_in)) < 0)
-						debug_output(0, "Error - can't send data to client (%s): %s \n", str, strerror(errno));
+		}
 
-				} else {
+	}
 
-					addr_to_string( *(uint32_t *)(buff + 17), gw_addr, sizeof(gw_addr));
-					debug_output(3, "Gateway - could not resolve packet: %s \n", gw_addr);
+	pthread_rwlock_unlock(&gw_data->lease_lock);
+}
 
-				}
+/* every tun queue of the gateway gets its own thread - they all share the
+ * udp socket and the IP leases */
+static void *gw_forward(void *arg)
+{
+	struct gw_queue *gw_queue = (struct gw_queue *)arg;
+	struct gw_listen_data *gw_data = gw_queue->gw_data;
+	struct tunnel_poll tunnel_poll;
+	struct tunnel_batch *batch;
+	uint32_t client_timeout, current_time;
+	int32_t res;
 
-			}
 
-			if (errno != EWOULDBLOCK) {
-				debug_output(0, "Error - gateway can't read tun data: %s\n", strerror(errno));
-				break;
-			}
+	if (tunnel_poll_init(&tunnel_poll, gw_data->batman_if->udp_tunnel_sock, gw_queue->tun_fd) < 0) {
+		__atomic_store_n(&gw_data->failed, 1, __ATOMIC_RELAXED);
+		tunnel_wakeup();
+		return NULL;
+	}
+
+	batch = debugMalloc(sizeof(struct tunnel_batch), 212);
+	client_timeout = get_time_msec();
+
+	while ((!is_aborted()) && (gateway_class > 0) && (!__atomic_load_n(&gw_data->failed, __ATOMIC_RELAXED))) {
+
+		res = tunnel_poll_wait(&tunnel_poll, gw_queue->purge_leases, client_timeout + 60000 + 1);
+
+		current_time = get_time_msec();
 
+		if (res < 0) {
+			debug_output(0, "Error - can't wait for tunnel traffic (gw_listen): %s \n", strerror(errno));
+			break;
 		}
 
-after_incoming_packet:
+		if ((res & TUNNEL_EV_UDP) && (gw_handle_clients(gw_queue, batch, current_time) < 0))
+			break;
 
-		/* close unresponsive client connections (free unused IPs) */
-		if ((int)(current_time - (client_timeout + 60000)) > 0) {
+		if ((res & TUNNEL_EV_TUN) && (gw_handle_tun(gw_queue, batch) < 0))
+			break;
 
+		if ((gw_queue->purge_leases) && ((int)(current_time - (client_timeout + 60000)) > 0)) {
 			client_timeout = current_time;
+			gw_purge_leases(gw_data, current_time);
+		}
 
-			hashit = NULL;
+	}
 
-			while (NULL != (hashit = hash_iterate(wip_hash, hashit))) {
+	/* one queue failing takes down the whole gateway as it did before */
+	if ((!is_aborted()) && (gateway_class > 0) && (!__atomic_exchange_n(&gw_data->failed, 1, __ATOMIC_RELAXED)))
+		tunnel_wakeup();
 
-				gw_client = hashit->bucket->data;
+	debugFree(batch, 1225);
+	tunnel_poll_destroy(&tunnel_poll);
 
-				if ((int)(current_time - (gw_client->last_keep_alive + IP_LEASE_TIMEOUT + GW_STATE_UNKNOWN_TIMEOUT)) > 0) {
+	return NULL;
+}
 
-					hash_remove_bucket(wip_hash, hashit);
-					hash_remove(vip_hash, gw_client);
+void *gw_listen(void *BATMANUNUSED(arg)) {
+
+	struct batman_if *batman_if = (struct batman_if *)if_list.next;
+	struct gw_listen_data gw_data;
+	struct gw_queue gw_queues[TUNNEL_MAX_QUEUES];
+	struct gw_client *gw_client;
+	char tun_dev[IFNAMSIZ];
+	int32_t tun_fd, tun_ifi, num_queues, i;
+	uint8_t my_tun_ip[4] ALIGN_WORD;
+	struct hash_it_t *hashit;
+	struct free_ip *free_ip;
+	struct list_head *list_pos, *list_pos_tmp;
 
-					free_ip = debugMalloc(sizeof(struct neigh_node), 210);
 
-					INIT_LIST_HEAD(&free_ip->list);
-					free_ip->addr = gw_client->vip_addr;
+	memset(&gw_data, 0, sizeof(gw_data));
+	gw_data.batman_if = batman_if;
 
-					list_add_tail( &free_ip->list, &free_ip_list );
+	my_tun_ip[0] = gw_data.next_free_ip[0] = 169;
+	my_tun_ip[1] = gw_data.next_free_ip[1] = 254;
+	my_tun_ip[2] = gw_data.next_free_ip[2] = 0;
+	my_tun_ip[3] = 0;
+	gw_data.next_free_ip[3] = 1;
 
-					debugFree(gw_client, 1216);
+	INIT_LIST_HEAD_FIRST(gw_data.free_ip_list);
 
-				}
+	if (add_dev_tun(batman_if, *(uint32_t *)my_tun_ip, tun_dev, sizeof(tun_dev), &tun_fd, &tun_ifi, 1) < 0)
+		return NULL;
 
-			}
+	if (NULL == (gw_data.wip_hash = hash_new(128, compare_wip, choose_wip)))
+		return NULL;
 
+	if (NULL == (gw_data.vip_hash = hash_new(128, compare_vip, choose_vip))) {
+		hash_destroy(gw_data.wip_hash);
+		return NULL;
+	}
+
+	pthread_rwlock_init(&gw_data.lease_lock, NULL);
+
+	add_del_route(*(uint32_t *)my_tun_ip, 16, 0, 0, tun_ifi, tun_dev, 254, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+
+
+	/* one tun queue per cpu - the first one is served by this thread */
+	num_queues = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (num_queues > TUNNEL_MAX_QUEUES)
+		num_queues = TUNNEL_MAX_QUEUES;
+
+	memset(gw_queues, 0, sizeof(gw_queues));
+
+	gw_queues[0].gw_data = &gw_data;
+	gw_queues[0].tun_fd = tun_fd;
+	gw_queues[0].purge_leases = 1;
+
+	for (i = 1; i < num_queues; i++) {
+
+		gw_queues[i].gw_data = &gw_data;
+
+		/* no multiqueue support: stay with the queues we have */
+		if ((gw_queues[i].tun_fd = add_dev_tun_queue(tun_dev)) < 0)
+			break;
+
+		if (pthread_create(&gw_queues[i].thread_id, NULL, &gw_forward, &gw_queues[i]) != 0) {
+			close(gw_queues[i].tun_fd);
+			break;
 		}
 
 	}
 
+	num_queues = i;
+
+	if (num_queues > 1)
+		debug_output(3, "Gateway - forwarding tunnel traffic with %i queues \n", num_queues);
+
+	gw_forward(&gw_queues[0]);
+
+	for (i = 1; i < num_queues; i++) {
+		pthread_join(gw_queues[i].thread_id, NULL);
+		close(gw_queues[i].tun_fd);
+	}
+
 	/* delete tun device and routes on exit */
 	my_tun_ip[3] = 0;
 	add_del_route( *(uint32_t *)my_tun_ip, 16, 0, 0, tun_ifi, tun_dev, 254, ROUTE_TYPE_UNICAST, ROUTE_DEL );
@@ -797,31 +1356,32 @@ after_incoming_packet:
 
 	hashit = NULL;
 
-	while (NULL != (hashit = hash_iterate(wip_hash, hashit))) {
+	while (NULL != (hashit = hash_iterate(gw_data.wip_hash, hashit))) {
 
 		gw_client = hashit->bucket->data;
 
-		hash_remove_bucket(wip_hash, hashit);
-		hash_remove(vip_hash, gw_client);
+		hash_remove_bucket(gw_data.wip_hash, hashit);
+		hash_remove(gw_data.vip_hash, gw_client);
 
 		debugFree(gw_client, 1217);
 
 	}
 
-	hash_destroy(wip_hash);
-	hash_destroy(vip_hash);
+	hash_destroy(gw_data.wip_hash);
+	hash_destroy(gw_data.vip_hash);
 
-	list_for_each_safe(list_pos, list_pos_tmp, &free_ip_list) {
+	list_for_each_safe(list_pos, list_pos_tmp, &gw_data.free_ip_list) {
 
 		free_ip = list_entry(list_pos, struct free_ip, list);
 
-		list_del((struct list_head *)&free_ip_list, list_pos, &free_ip_list);
+		list_del((struct list_head *)&gw_data.free_ip_list, list_pos, &gw_data.free_ip_list);
 
 		debugFree(free_ip, 1218);
 
 	}
 
+	pthread_rwlock_destroy(&gw_data.lease_lock);
+
 	return NULL;
 
 }
-
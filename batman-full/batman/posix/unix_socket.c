@@ -85,8 +85,9 @@ void debug_output(int8_t debug_prio, char *format, ...) {
 	if (debug_clients.clients_num[debug_prio_intern] < 1)
 		return;
 
-	if (pthread_mutex_trylock((pthread_mutex_t *)debug_clients.mutex[debug_prio_intern] ) != 0) {
-		debug_output(0, "Warning - could not trylock mutex (debug_output): %s \n", strerror(EBUSY));
+	/* the ogm workers print concurrently */
+	if (pthread_mutex_lock((pthread_mutex_t *)debug_clients.mutex[debug_prio_intern]) != 0) {
+		debug_output(0, "Error - could not lock mutex (debug_output): %s \n", strerror(errno));
 		return;
 	}
 
@@ -305,6 +306,11 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 								internal_output(unix_client->sock);
 								dprintf( unix_client->sock, "EOD\n" );
 
+							} else if (buff[0] == 'P') {
+
+								prof_output(unix_client->sock);
+								dprintf(unix_client->sock, "EOD\n");
+
 							} else if ( buff[0] == 'g' ) {
 
 								if ( status > 2 ) {
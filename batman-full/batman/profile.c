@@ -21,23 +21,121 @@
 
 
 
+#include <string.h>
+#include <time.h>
+
 #include "os.h"
 #include "batman.h"
 
 
 
-#if defined PROFILE_DATA
+static char *prof_name[PROF_COUNT];
+
+static struct prof_thread *prof_threads = NULL;
+static int32_t prof_threads_num = 0;
+static pthread_mutex_t prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct prof_thread *prof_self = NULL;
+
+/* only the owning thread writes its counters - the relaxed accesses keep the
+ * readers from seeing torn values */
+#define PROF_ADD(var, val) __atomic_store_n(&(var), __atomic_load_n(&(var), __ATOMIC_RELAXED) + (val), __ATOMIC_RELAXED)
+#define PROF_GET(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+
+
+static uint64_t prof_time(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+
+}
+
+
+
+/* the counters of the calling thread - registered on first use */
+static struct prof_thread *prof_thread_get(void) {
+
+	struct prof_thread *prof_thread;
+
+	if (prof_self != NULL)
+		return prof_self;
+
+	prof_thread = debugMalloc(sizeof(struct prof_thread), 901);
+	memset(prof_thread, 0, sizeof(struct prof_thread));
+
+	pthread_mutex_lock(&prof_mutex);
+
+	prof_thread->id = prof_threads_num++;
+	prof_thread->next = prof_threads;
+	__atomic_store_n(&prof_threads, prof_thread, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&prof_mutex);
+
+	prof_self = prof_thread;
+	return prof_thread;
+
+}
 
 
-static struct prof_container prof_container[PROF_COUNT];
+
+static int32_t prof_bucket(uint64_t time) {
+
+	uint64_t usec = time / 1000;
+	int32_t bucket;
+
+	if (usec == 0)
+		return 0;
+
+	bucket = 64 - __builtin_clzll(usec);
+	return (bucket < PROF_HIST_BUCKETS ? bucket : PROF_HIST_BUCKETS - 1);
+
+}
+
+
+
+/* sum up the counters of all threads */
+static void prof_sum(struct prof_stage *sum) {
+
+	struct prof_thread *prof_thread;
+	struct prof_stage *stage;
+	int32_t index, i;
+	uint64_t max_time;
+
+	memset(sum, 0, sizeof(struct prof_stage) * PROF_COUNT);
+
+	for (prof_thread = __atomic_load_n(&prof_threads, __ATOMIC_ACQUIRE); prof_thread != NULL; prof_thread = prof_thread->next) {
+
+		for (index = 0; index < PROF_COUNT; index++) {
+
+			stage = &prof_thread->stage[index];
+
+			sum[index].calls += PROF_GET(stage->calls);
+			sum[index].total_time += PROF_GET(stage->total_time);
+			sum[index].packets += PROF_GET(stage->packets);
+			sum[index].bytes += PROF_GET(stage->bytes);
+
+			max_time = PROF_GET(stage->max_time);
+
+			if (max_time > sum[index].max_time)
+				sum[index].max_time = max_time;
+
+			for (i = 0; i < PROF_HIST_BUCKETS; i++)
+				sum[index].hist[i] += PROF_GET(stage->hist[i]);
+
+		}
+
+	}
+
+}
 
 
 
 void prof_init(int32_t index, char *name) {
 
-	prof_container[index].total_time = 0;
-	prof_container[index].calls = 0;
-	prof_container[index].name = name;
+	prof_name[index] = name;
 
 }
 
@@ -45,7 +143,7 @@ void prof_init(int32_t index, char *name) {
 
 void prof_start(int32_t index) {
 
-	prof_container[index].start_time = clock();
+	prof_thread_get()->start_time[index] = prof_time();
 
 }
 
@@ -53,50 +151,147 @@ void prof_start(int32_t index) {
 
 void prof_stop(int32_t index) {
 
-	prof_container[index].calls++;
-	prof_container[index].total_time += clock() - prof_container[index].start_time;
+	struct prof_thread *prof_thread = prof_thread_get();
+	struct prof_stage *stage = &prof_thread->stage[index];
+	uint64_t time = prof_time() - prof_thread->start_time[index];
+
+	PROF_ADD(stage->calls, 1);
+	PROF_ADD(stage->total_time, time);
+	PROF_ADD(stage->hist[prof_bucket(time)], 1);
+
+	if (time > stage->max_time)
+		__atomic_store_n(&stage->max_time, time, __ATOMIC_RELAXED);
+
+}
+
+
+
+void prof_count(int32_t index, uint32_t packets, uint32_t bytes) {
+
+	struct prof_stage *stage = &prof_thread_get()->stage[index];
+
+	PROF_ADD(stage->packets, packets);
+	PROF_ADD(stage->bytes, bytes);
 
 }
 
 
 void prof_print(void) {
 
+	struct prof_stage sum[PROF_COUNT];
 	int32_t index;
 
+	prof_sum(sum);
+
 	debug_output( 5, " \nProfile data:\n" );
 
 	for ( index = 0; index < PROF_COUNT; index++ ) {
 
-		debug_output( 5, "   %''30s: cpu time = %10.3f, calls = %''10i, avg time per call = %4.10f \n", prof_container[index].name, (float)prof_container[index].total_time/CLOCKS_PER_SEC, prof_container[index].calls, ( prof_container[index].calls == 0 ? 0.0 : ( ( (float)prof_container[index].total_time/CLOCKS_PER_SEC ) / (float)prof_container[index].calls ) ) );
+		if (prof_name[index] == NULL)
+			continue;
+
+		debug_output( 5, "   %''30s: time = %10.3f, calls = %''10llu, avg time per call = %4.10f \n", prof_name[index], (float)sum[index].total_time / 1000000000, (unsigned long long)sum[index].calls, ( sum[index].calls == 0 ? 0.0 : ( ( (float)sum[index].total_time / 1000000000 ) / (float)sum[index].calls ) ) );
 
 	}
 
 }
 
 
-#else
 
+/* the profile data for the unix socket: totals and latency histogram per stage,
+ * followed by the time every thread spent in each stage */
+void prof_output(int32_t sock) {
 
-void prof_init( int32_t index, char *name ) {
+	struct prof_stage sum[PROF_COUNT];
+	struct prof_thread *prof_thread;
+	int32_t index, i;
+	uint64_t calls;
 
-}
+	prof_sum(sum);
 
+	dprintf(sock, "%-25s %12s %12s %10s %10s %12s %14s\n", "stage", "calls", "total ms", "avg us", "max us", "packets", "bytes");
 
+	for (index = 0; index < PROF_COUNT; index++) {
 
-void prof_start( int32_t index ) {
+		if (prof_name[index] == NULL)
+			continue;
 
-}
+		dprintf(sock, "%-25s %12llu %12llu %10llu %10llu %12llu %14llu\n", prof_name[index],
+			(unsigned long long)sum[index].calls,
+			(unsigned long long)(sum[index].total_time / 1000000),
+			(unsigned long long)(sum[index].calls == 0 ? 0 : sum[index].total_time / sum[index].calls / 1000),
+			(unsigned long long)(sum[index].max_time / 1000),
+			(unsigned long long)sum[index].packets,
+			(unsigned long long)sum[index].bytes);
 
+	}
 
+	dprintf(sock, "\nlatency histogram (calls taking less than x us):\n");
+	dprintf(sock, "%-25s", "stage");
 
-void prof_stop( int32_t index ) {
+	for (i = 0; i < PROF_HIST_BUCKETS - 1; i++)
+		dprintf(sock, " %7i", 1 << i);
 
-}
+	dprintf(sock, " %7s\n", "more");
 
+	for (index = 0; index < PROF_COUNT; index++) {
 
-void prof_print(void) {
+		if ((prof_name[index] == NULL) || (sum[index].calls == 0))
+			continue;
+
+		dprintf(sock, "%-25s", prof_name[index]);
+
+		for (i = 0; i < PROF_HIST_BUCKETS; i++)
+			dprintf(sock, " %7llu", (unsigned long long)sum[index].hist[i]);
+
+		dprintf(sock, "\n");
+
+	}
+
+	dprintf(sock, "\nper thread (calls / total ms):\n");
+
+	for (prof_thread = __atomic_load_n(&prof_threads, __ATOMIC_ACQUIRE); prof_thread != NULL; prof_thread = prof_thread->next) {
+
+		dprintf(sock, "thread %i:", prof_thread->id);
+
+		for (index = 0; index < PROF_COUNT; index++) {
+
+			calls = PROF_GET(prof_thread->stage[index].calls);
+
+			if ((prof_name[index] == NULL) || (calls == 0))
+				continue;
+
+			dprintf(sock, " %s %llu / %llu", prof_name[index], (unsigned long long)calls,
+				(unsigned long long)(PROF_GET(prof_thread->stage[index].total_time) / 1000000));
+
+		}
+
+		dprintf(sock, "\n");
+
+	}
 
 }
 
 
-#endif
+
+/* the threads are gone - free their counters */
+void prof_destroy(void) {
+
+	struct prof_thread *prof_thread;
+
+	pthread_mutex_lock(&prof_mutex);
+
+	while (prof_threads != NULL) {
+
+		prof_thread = prof_threads;
+		prof_threads = prof_thread->next;
+		debugFree(prof_thread, 1901);
+
+	}
+
+	prof_threads_num = 0;
+	pthread_mutex_unlock(&prof_mutex);
+
+	prof_self = NULL;
+
+}
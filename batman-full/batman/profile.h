@@ -21,6 +21,15 @@
 
 
 
+/***
+ *
+ * The profile counters are always on: every thread keeps its own set (no
+ * locking on the fast path) with the time spent per stage taken from
+ * CLOCK_MONOTONIC, a latency histogram and the packets / bytes handled.
+ * They are summed up when read - see batmand -c --profile.
+ *
+ ***/
+
 enum {
 
 	PROF_choose_gw,
@@ -32,17 +41,31 @@ enum {
 	PROF_purge_originator,
 	PROF_schedule_forward_packet,
 	PROF_send_outstanding_packets,
+	PROF_receive_packets,
 	PROF_COUNT
 
 };
 
+#define PROF_HIST_BUCKETS 16	/* <1us, <2us, <4us ... >=16ms */
+
 
-struct prof_container {
+struct prof_stage {
 
-	clock_t start_time;
-	clock_t total_time;
-	char *name;
 	uint64_t calls;
+	uint64_t total_time;	/* ns */
+	uint64_t max_time;	/* ns */
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t hist[PROF_HIST_BUCKETS];
+
+};
+
+struct prof_thread {
+
+	struct prof_thread *next;
+	int32_t id;
+	uint64_t start_time[PROF_COUNT];
+	struct prof_stage stage[PROF_COUNT];
 
 };
 
@@ -50,4 +73,7 @@ struct prof_container {
 void prof_init(int32_t index, char *name);
 void prof_start(int32_t index);
 void prof_stop(int32_t index);
+void prof_count(int32_t index, uint32_t packets, uint32_t bytes);
 void prof_print(void);
+void prof_output(int32_t sock);
+void prof_destroy(void);
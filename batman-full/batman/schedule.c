@@ -27,22 +27,316 @@
 #include "batman.h"
 #include "schedule.h"
 #include "hna.h"
+#include "pipeline.h"
+
+
+
+#define FORW_SLAB_SIZE 64	/* forward slots allocated at once */
+#define FORW_WHEEL_SLOTS 256	/* power of 2 */
+#define FORW_WHEEL_TICK 8	/* ms covered by one wheel slot */
+
+
+struct forw_slab {
+	struct forw_slab *next;
+	struct forw_node forw_nodes[FORW_SLAB_SIZE];
+};
+
+/* the forward slots are never given back to the allocator - sent packets
+ * go to the free list and get reused by the next packet */
+static struct forw_slab *forw_slabs = NULL;
+static struct list_head *forw_free = NULL;
+
+/***
+ *
+ * The forward queue is a timer wheel: slot i holds the packets due in the
+ * FORW_WHEEL_TICK ms starting at forw_wheel_time + i * FORW_WHEEL_TICK
+ * (counted from forw_wheel_slot). Packets beyond the end of the wheel wait
+ * in forw_overflow until the wheel comes around. forw_wheel_map marks the
+ * slots holding packets.
+ *
+ ***/
+static struct list_head_first forw_wheel[FORW_WHEEL_SLOTS];
+static struct list_head_first forw_overflow;
+static uint32_t forw_wheel_map[FORW_WHEEL_SLOTS / 32];
+static uint32_t forw_wheel_time;
+static uint16_t forw_wheel_slot;
+
+/* last packet which may take flooded packets */
+static struct forw_node *forw_aggr_flood = NULL;
+
+
+
+void schedule_init(void)
+{
+	int i;
+
+	for (i = 0; i < FORW_WHEEL_SLOTS; i++) {
+		INIT_LIST_HEAD_FIRST(forw_wheel[i]);
+	}
+
+	INIT_LIST_HEAD_FIRST(forw_overflow);
+	memset(forw_wheel_map, 0, sizeof(forw_wheel_map));
+
+	forw_wheel_time = get_time_msec();
+	forw_wheel_slot = 0;
+}
+
+void schedule_free(void)
+{
+	struct forw_slab *forw_slab;
+
+	while (forw_slabs != NULL) {
+
+		forw_slab = forw_slabs;
+		forw_slabs = forw_slab->next;
+
+		debugFree(forw_slab, 1501);
+
+	}
+
+	forw_free = NULL;
+	forw_aggr_flood = NULL;
+	schedule_init();
+}
+
+static struct forw_node *forw_node_get(void)
+{
+	struct forw_slab *forw_slab;
+	struct forw_node *forw_node;
+	int i;
+
+	if (forw_free == NULL) {
+
+		forw_slab = debugMalloc(sizeof(struct forw_slab), 501);
+		forw_slab->next = forw_slabs;
+		forw_slabs = forw_slab;
+
+		for (i = 0; i < FORW_SLAB_SIZE; i++) {
+			forw_slab->forw_nodes[i].list.next = forw_free;
+			forw_free = &forw_slab->forw_nodes[i].list;
+		}
+
+	}
+
+	forw_node = list_entry(forw_free, struct forw_node, list);
+	forw_free = forw_free->next;
+
+	INIT_LIST_HEAD(&forw_node->list);
+
+	return forw_node;
+}
+
+static void forw_node_put(struct forw_node *forw_node)
+{
+	if (forw_aggr_flood == forw_node)
+		forw_aggr_flood = NULL;
+
+	if (forw_node->if_incoming != NULL) {
+
+		if (forw_node->if_incoming->forw_aggr == forw_node)
+			forw_node->if_incoming->forw_aggr = NULL;
+
+		if (forw_node->if_incoming->forw_own == forw_node)
+			forw_node->if_incoming->forw_own = NULL;
+
+	}
+
+	forw_node->list.next = forw_free;
+	forw_free = &forw_node->list;
+}
+
+static void forw_wheel_add(struct forw_node *forw_node)
+{
+	int32_t ticks;
+	uint16_t slot;
+
+	ticks = (int32_t)(forw_node->send_time - forw_wheel_time) / FORW_WHEEL_TICK;
+
+	/* overdue packets go to the current slot */
+	if (ticks < 0)
+		ticks = 0;
+
+	if (ticks >= FORW_WHEEL_SLOTS) {
+		list_add_tail(&forw_node->list, &forw_overflow);
+		return;
+	}
+
+	slot = (forw_wheel_slot + ticks) & (FORW_WHEEL_SLOTS - 1);
+
+	list_add_tail(&forw_node->list, &forw_wheel[slot]);
+	forw_wheel_map[slot / 32] |= (1U << (slot % 32));
+}
+
+/* move the packets of the overflow list which fit on the wheel now */
+static void forw_wheel_cascade(void)
+{
+	struct list_head *list_pos, *list_pos_tmp, *prev_list_head = (struct list_head *)&forw_overflow;
+	struct forw_node *forw_node;
+
+	list_for_each_safe(list_pos, list_pos_tmp, &forw_overflow) {
+
+		forw_node = list_entry(list_pos, struct forw_node, list);
+
+		if ((int32_t)(forw_node->send_time - forw_wheel_time) >= FORW_WHEEL_SLOTS * FORW_WHEEL_TICK) {
+			prev_list_head = list_pos;
+			continue;
+		}
+
+		list_del(prev_list_head, list_pos, &forw_overflow);
+		forw_wheel_add(forw_node);
+
+	}
+}
+
+/* the wheel fell behind by more than one revolution (long sleep or clock
+ * jump) - put all packets back on a wheel starting at curr_time */
+static void forw_wheel_rebase(uint32_t curr_time)
+{
+	struct list_head_first forw_list;
+	struct list_head *list_pos, *list_pos_tmp;
+	int i;
+
+	INIT_LIST_HEAD_FIRST(forw_list);
+
+	for (i = 0; i <= FORW_WHEEL_SLOTS; i++) {
+
+		list_for_each_safe(list_pos, list_pos_tmp, (i < FORW_WHEEL_SLOTS ? &forw_wheel[i] : &forw_overflow))
+			list_add_tail(list_pos, &forw_list);
+
+	}
+
+	schedule_init();
+	forw_wheel_time = curr_time;
+
+	list_for_each_safe(list_pos, list_pos_tmp, &forw_list)
+		forw_wheel_add(list_entry(list_pos, struct forw_node, list));
+}
+
+/* turn the wheel up to curr_time and move all packets due to the due list */
+static void forw_wheel_collect(uint32_t curr_time, struct list_head_first *due)
+{
+	struct list_head *list_pos, *list_pos_tmp, *prev_list_head;
+	struct forw_node *forw_node;
+	uint16_t slot;
+
+	if ((int32_t)(curr_time - forw_wheel_time) >= FORW_WHEEL_SLOTS * FORW_WHEEL_TICK)
+		forw_wheel_rebase(curr_time);
+
+	while (1) {
+
+		slot = forw_wheel_slot;
+
+		if (forw_wheel_map[slot / 32] & (1U << (slot % 32))) {
+
+			prev_list_head = (struct list_head *)&forw_wheel[slot];
+
+			list_for_each_safe(list_pos, list_pos_tmp, &forw_wheel[slot]) {
+
+				forw_node = list_entry(list_pos, struct forw_node, list);
+
+				if ((int)(curr_time - forw_node->send_time) < 0) {
+					prev_list_head = list_pos;
+					continue;
+				}
+
+				list_del(prev_list_head, list_pos, &forw_wheel[slot]);
+				list_add_tail(list_pos, due);
+
+			}
+
+			if (list_empty(&forw_wheel[slot]))
+				forw_wheel_map[slot / 32] &= ~(1U << (slot % 32));
+
+		}
+
+		/* the current slot is not over yet */
+		if ((int32_t)(curr_time - (forw_wheel_time + FORW_WHEEL_TICK)) < 0)
+			break;
+
+		forw_wheel_time += FORW_WHEEL_TICK;
+		forw_wheel_slot = (slot + 1) & (FORW_WHEEL_SLOTS - 1);
+
+		if (forw_wheel_slot == 0)
+			forw_wheel_cascade();
+
+	}
+}
+
+static uint32_t forw_list_min_send_time(struct list_head_first *forw_list, uint32_t send_time)
+{
+	struct list_head *list_pos;
+	struct forw_node *forw_node;
+
+	list_for_each(list_pos, forw_list) {
+
+		forw_node = list_entry(list_pos, struct forw_node, list);
+
+		if ((int)(forw_node->send_time - send_time) < 0)
+			send_time = forw_node->send_time;
+
+	}
+
+	return send_time;
+}
+
+/* send time of the next packet in the forward queue */
+uint32_t get_forw_send_time(uint32_t curr_time)
+{
+	uint32_t word, slot, i = 0;
+
+	while (i < FORW_WHEEL_SLOTS) {
+
+		slot = (forw_wheel_slot + i) & (FORW_WHEEL_SLOTS - 1);
+		word = forw_wheel_map[slot / 32] >> (slot % 32);
+
+		if (word == 0) {
+			i += 32 - (slot % 32);
+			continue;
+		}
+
+		i += __builtin_ctz(word);
+		slot = (forw_wheel_slot + i) & (FORW_WHEEL_SLOTS - 1);
+
+		return forw_list_min_send_time(&forw_wheel[slot], forw_wheel_time + (i + 1) * FORW_WHEEL_TICK);
+
+	}
+
+	if (!list_empty(&forw_overflow))
+		return forw_list_min_send_time(&forw_overflow, ((struct forw_node *)forw_overflow.next)->send_time);
+
+	return curr_time + originator_interval;
+}
+
+void debug_forw_list(void)
+{
+	struct list_head *forw_pos;
+	struct forw_node *forw_node;
+	char str[ADDR_STR_LEN];
+	int i;
+
+	for (i = 0; i <= FORW_WHEEL_SLOTS; i++) {
+
+		list_for_each(forw_pos, (i < FORW_WHEEL_SLOTS ? &forw_wheel[(forw_wheel_slot + i) & (FORW_WHEEL_SLOTS - 1)] : &forw_overflow)) {
+			forw_node = list_entry(forw_pos, struct forw_node, list);
+			addr_to_string(((struct bat_packet *)forw_node->pack_buff)->orig, str, sizeof(str));
+			debug_output(4, "    %s at %u \n", str, forw_node->send_time);
+		}
+
+	}
+}
 
 
 
 void schedule_own_packet(struct batman_if *batman_if)
 {
-	struct forw_node *forw_node_new, *forw_packet_tmp = NULL;
-	struct list_head *list_pos, *prev_list_head;
+	struct forw_node *forw_node_new;
 	struct hash_it_t *hashit = NULL;
 	struct orig_node *orig_node;
 
 
 	debug_output(4, "schedule_own_packet(): %s \n", batman_if->dev);
 
-	forw_node_new = debugMalloc(sizeof(struct forw_node), 501);
-
-	INIT_LIST_HEAD(&forw_node_new->list);
+	forw_node_new = forw_node_get();
 
 	forw_node_new->send_time = get_time_msec() + originator_interval - JITTER + rand_num(2 * JITTER);
 	forw_node_new->if_incoming = batman_if;
@@ -53,7 +347,6 @@ void schedule_own_packet(struct batman_if *batman_if)
 	/* non-primary interfaces do not send hna information */
 	if ((num_hna_local > 0) && (batman_if->if_num == 0)) {
 
-		forw_node_new->pack_buff = debugMalloc(MAX_AGGREGATION_BYTES, 502);
 		memcpy(forw_node_new->pack_buff, (unsigned char *)&batman_if->out, sizeof(struct bat_packet));
 		memcpy(forw_node_new->pack_buff + sizeof(struct bat_packet), hna_buff_local, num_hna_local * 5);
 		forw_node_new->pack_buff_len = sizeof(struct bat_packet) + num_hna_local * 5;
@@ -61,7 +354,6 @@ void schedule_own_packet(struct batman_if *batman_if)
 
 	} else {
 
-		forw_node_new->pack_buff = debugMalloc(MAX_AGGREGATION_BYTES, 503);
 		memcpy(forw_node_new->pack_buff, &batman_if->out, sizeof(struct bat_packet));
 		forw_node_new->pack_buff_len = sizeof(struct bat_packet);
 		((struct bat_packet *)forw_node_new->pack_buff)->hna_len = 0;
@@ -71,134 +363,165 @@ void schedule_own_packet(struct batman_if *batman_if)
 	/* change sequence number to network order */
 	((struct bat_packet *)forw_node_new->pack_buff)->seqno = htons(((struct bat_packet *)forw_node_new->pack_buff)->seqno);
 
-	prev_list_head = (struct list_head *)&forw_list;
+	forw_wheel_add(forw_node_new);
+	batman_if->forw_own = forw_node_new;
 
-	list_for_each(list_pos, &forw_list) {
+	/* the ogm workers compare the seqno of our echos and count them */
+	pipeline_lock();
 
-		forw_packet_tmp = list_entry(list_pos, struct forw_node, list);
+	batman_if->out.seqno++;
 
-		if ((int)(forw_packet_tmp->send_time - forw_node_new->send_time) >= 0) {
 
-			list_add_before(prev_list_head, list_pos, &forw_node_new->list);
-			break;
+	while ( NULL != ( hashit = hash_iterate( orig_hash, hashit ) ) ) {
 
-		}
+		orig_node = hashit->bucket->data;
 
-		prev_list_head = &forw_packet_tmp->list;
-		forw_packet_tmp = NULL;
+		debug_output( 4, "count own bcast (schedule_own_packet): old = %i, ", orig_node->bcast_own_sum[batman_if->if_num] );
+		bit_get_packet( &orig_node->bcast_own[batman_if->if_num], 1, 0 );
+		orig_node->bcast_own_sum[batman_if->if_num] = bit_packet_count( &orig_node->bcast_own[batman_if->if_num] );
+		debug_output( 4, "new = %i \n", orig_node->bcast_own_sum[batman_if->if_num] );
 
 	}
 
-	if (forw_packet_tmp == NULL)
-		list_add_tail(&forw_node_new->list, &forw_list);
+	pipeline_unlock();
 
-	batman_if->out.seqno++;
+}
 
 
-	while ( NULL != ( hashit = hash_iterate( orig_hash, hashit ) ) ) {
 
-		orig_node = hashit->bucket->data;
+/* turns the received packet into the one we rebroadcast - this needs the originator
+ * and therefore is done by the ogm worker, the aggregation is left to the main thread */
+uint8_t prepare_forward_packet(struct orig_node *orig_node, struct bat_packet *in, uint32_t neigh, uint8_t directlink)
+{
+	uint8_t tq_avg = 0, tq_orig = in->tq, ttl_orig = in->ttl - 1;
 
-		debug_output( 4, "count own bcast (schedule_own_packet): old = %i, ", orig_node->bcast_own_sum[batman_if->if_num] );
-		bit_get_packet( (TYPE_OF_WORD *)&(orig_node->bcast_own[batman_if->if_num * num_words]), 1, 0 );
-		orig_node->bcast_own_sum[batman_if->if_num] = bit_packet_count( (TYPE_OF_WORD *)&(orig_node->bcast_own[batman_if->if_num * num_words]) );
-		debug_output( 4, "new = %i \n", orig_node->bcast_own_sum[batman_if->if_num] );
+	if (in->ttl <= 1) {
+		debug_output(4, "ttl exceeded \n");
+		return 0;
+	}
+
+	in->ttl--;
+	in->prev_sender = neigh;
+
+	/* rebroadcast tq of our best ranking neighbor to ensure the rebroadcast of our best tq value */
+	if ((orig_node->router != NULL) && (orig_node->router->tq_avg != 0)) {
+
+		/* rebroadcast ogm of best ranking neighbor as is */
+		if (orig_node->router->addr != neigh) {
+			in->tq = orig_node->router->tq_avg;
+
+			if (orig_node->router->last_ttl)
+				in->ttl = orig_node->router->last_ttl - 1;
+		}
+
+		tq_avg = orig_node->router->tq_avg;
 
 	}
 
+	/* apply hop penalty */
+	in->tq = (in->tq * (TQ_MAX_VALUE - hop_penalty)) / (TQ_MAX_VALUE);
+
+	debug_output(4, "forwarding: tq_orig: %i, tq_avg: %i, tq_forw: %i, ttl_orig: %i, ttl_forw: %i \n", tq_orig, tq_avg, in->tq, ttl_orig, in->ttl);
+
+	/* change sequence number to network order */
+	in->seqno = htons(in->seqno);
+
+	if (directlink)
+		in->flags |= DIRECTLINK;
+	else
+		in->flags &= ~DIRECTLINK;
+
+	return 1;
 }
 
 
 
-void schedule_forward_packet(struct orig_node *orig_node, struct bat_packet *in, uint32_t neigh, uint8_t directlink, int16_t hna_buff_len, struct batman_if *if_incoming, uint32_t curr_time)
+static uint8_t forw_node_aggregatable(struct forw_node *forw_node, struct bat_packet *in, uint8_t directlink, int16_t hna_buff_len, struct batman_if *if_incoming, uint32_t send_time)
 {
-	struct forw_node *forw_node_new = NULL, *forw_node_aggregate = NULL, *forw_node_pos = NULL;
-	struct list_head *list_pos = forw_list.next, *prev_list_head = (struct list_head *)&forw_list;
 	struct bat_packet *bat_packet;
-	uint8_t tq_avg = 0;
-	uint32_t send_time;
-	prof_start(PROF_schedule_forward_packet);
 
-	debug_output(4, "schedule_forward_packet():  \n");
+	if (forw_node == NULL)
+		return 0;
 
-	if (in->ttl <= 1) {
-		debug_output(4, "ttl exceeded \n");
-		prof_stop(PROF_schedule_forward_packet);
-		return;
-	}
+	/**
+	 * we can aggregate the current packet to this packet if:
+	 * - the send time is within our MAX_AGGREGATION_MS time
+	 * - the resulting packet wont be bigger than MAX_AGGREGATION_BYTES
+	 */
+	if (((int)(forw_node->send_time - send_time) >= 0) ||
+		(forw_node->pack_buff_len + sizeof(struct bat_packet) + hna_buff_len > MAX_AGGREGATION_BYTES))
+		return 0;
 
-	if (aggregation_enabled)
-		send_time = curr_time + MAX_AGGREGATION_MS - (JITTER/2) + rand_num(JITTER);
-	else
-		send_time = curr_time + rand_num(JITTER/2);
+	bat_packet = (struct bat_packet *)forw_node->pack_buff;
 
+	/**
+	 * check aggregation compatibility
+	 * -> direct link packets are broadcasted on their interface only
+	 * -> aggregate packet if the current packet is a "global" packet
+	 *    as well as the base packet
+	 */
 
-	/* find position for the packet in the forward queue */
-	list_for_each(list_pos, &forw_list) {
+	/* packets without direct link flag and high TTL are flooded through the net  */
+	if ((!directlink) && (!(bat_packet->flags & DIRECTLINK)) && (bat_packet->ttl != 1) &&
 
-		forw_node_pos = list_entry(list_pos, struct forw_node, list);
+	/* own packets originating non-primary interfaces leave only that interface */
+			((!forw_node->own) || (forw_node->if_incoming->if_num == 0)))
+		return 1;
 
-		if (aggregation_enabled) {
+	/* if the incoming packet is sent via this one interface only - we still can aggregate */
+	if ((directlink) && (in->ttl == 1) && (forw_node->if_incoming == if_incoming))
+		return 1;
 
-			/* don't save aggregation position if aggregation is disabled */
-			forw_node_aggregate = forw_node_pos;
+	return 0;
+}
 
-			/**
-			 * we can aggregate the current packet to this packet if:
-			 * - the send time is within our MAX_AGGREGATION_MS time
-			 * - the resulting packet wont be bigger than MAX_AGGREGATION_BYTES
-			 */
-			if (((int)(forw_node_pos->send_time - send_time) < 0) &&
-				(forw_node_pos->pack_buff_len + sizeof(struct bat_packet) + hna_buff_len <= MAX_AGGREGATION_BYTES)) {
 
-				bat_packet = (struct bat_packet *)forw_node_pos->pack_buff;
 
-				/**
-				 * check aggregation compatibility
-				 * -> direct link packets are broadcasted on their interface only
-				 * -> aggregate packet if the current packet is a "global" packet
-				 *    as well as the base packet
-				 */
+void schedule_forward_packet(struct bat_packet *in, uint8_t directlink, int16_t hna_buff_len, struct batman_if *if_incoming, uint32_t curr_time)
+{
+	struct forw_node *forw_node_new = NULL, *forw_node_aggregate = NULL, *forw_node_cand[4];
+	uint32_t send_time;
+	int i;
+	prof_start(PROF_schedule_forward_packet);
+	prof_count(PROF_schedule_forward_packet, 1, sizeof(struct bat_packet) + hna_buff_len);
+
+	debug_output(4, "schedule_forward_packet():  \n");
 
-				/* packets without direct link flag and high TTL are flooded through the net  */
-				if ((!directlink) && (!(bat_packet->flags & DIRECTLINK)) && (bat_packet->ttl != 1) &&
+	if (aggregation_enabled)
+		send_time = curr_time + MAX_AGGREGATION_MS - (JITTER/2) + rand_num(JITTER);
+	else
+		send_time = curr_time + rand_num(JITTER/2);
 
-				/* own packets originating non-primary interfaces leave only that interface */
-						((!forw_node_pos->own) || (forw_node_pos->if_incoming->if_num == 0)))
-					break;
 
-				/* if the incoming packet is sent via this one interface only - we still can aggregate */
-				if ((directlink) && (in->ttl == 2) && (forw_node_pos->if_incoming == if_incoming))
-					break;
+	/* only the packets queued last and our own packets can take more packets -
+	 * the earliest of them wins */
+	if (aggregation_enabled) {
 
-			}
+		forw_node_cand[0] = forw_aggr_flood;
+		forw_node_cand[1] = if_incoming->forw_aggr;
+		forw_node_cand[2] = ((struct batman_if *)if_list.next)->forw_own;
+		forw_node_cand[3] = if_incoming->forw_own;
 
-			/* could not find packet to aggregate with */
-			forw_node_aggregate = NULL;
+		for (i = 0; i < 4; i++) {
 
-		}
+			if (!forw_node_aggregatable(forw_node_cand[i], in, directlink, hna_buff_len, if_incoming, send_time))
+				continue;
 
-		if ((int)(forw_node_pos->send_time - send_time) > 0)
-			break;
+			if ((forw_node_aggregate == NULL) || ((int)(forw_node_cand[i]->send_time - forw_node_aggregate->send_time) < 0))
+				forw_node_aggregate = forw_node_cand[i];
 
-		prev_list_head = &forw_node_pos->list;
-		forw_node_pos = NULL;
+		}
 
 	}
 
 	/* nothing to aggregate with - either aggregation disabled or no suitable aggregation packet found */
 	if (forw_node_aggregate == NULL) {
 
-		forw_node_new = debugMalloc(sizeof(struct forw_node), 504);
-		forw_node_new->pack_buff = debugMalloc(MAX_AGGREGATION_BYTES, 505);
-
-		INIT_LIST_HEAD(&forw_node_new->list);
+		forw_node_new = forw_node_get();
 
 		forw_node_new->pack_buff_len = sizeof(struct bat_packet) + hna_buff_len;
 		memcpy(forw_node_new->pack_buff, in, forw_node_new->pack_buff_len);
 
-		bat_packet = (struct bat_packet *)forw_node_new->pack_buff;
-
 		forw_node_new->own = 0;
 		forw_node_new->if_incoming = if_incoming;
 		forw_node_new->num_packets = 0;
@@ -206,10 +529,16 @@ void schedule_forward_packet(struct orig_node *orig_node, struct bat_packet *in,
 
 		forw_node_new->send_time = send_time;
 
+		forw_wheel_add(forw_node_new);
+
+		if_incoming->forw_aggr = forw_node_new;
+
+		if ((!directlink) && (in->ttl != 1))
+			forw_aggr_flood = forw_node_new;
+
 	} else {
 
 		memcpy(forw_node_aggregate->pack_buff + forw_node_aggregate->pack_buff_len, in, sizeof(struct bat_packet) + hna_buff_len);
-		bat_packet = (struct bat_packet *)(forw_node_aggregate->pack_buff + forw_node_aggregate->pack_buff_len);
 		forw_node_aggregate->pack_buff_len += sizeof(struct bat_packet) + hna_buff_len;
 
 		forw_node_aggregate->num_packets++;
@@ -222,50 +551,6 @@ void schedule_forward_packet(struct orig_node *orig_node, struct bat_packet *in,
 	if (directlink)
 		forw_node_new->direct_link_flags = forw_node_new->direct_link_flags | (1 << forw_node_new->num_packets);
 
-	bat_packet->ttl--;
-	bat_packet->prev_sender = neigh;
-
-	/* rebroadcast tq of our best ranking neighbor to ensure the rebroadcast of our best tq value */
-	if ((orig_node->router != NULL) && (orig_node->router->tq_avg != 0)) {
-
-		/* rebroadcast ogm of best ranking neighbor as is */
-		if (orig_node->router->addr != neigh) {
-			bat_packet->tq = orig_node->router->tq_avg;
-
-			if (orig_node->router->last_ttl)
-				bat_packet->ttl = orig_node->router->last_ttl - 1;
-		}
-
-		tq_avg = orig_node->router->tq_avg;
-
-	}
-
-	/* apply hop penalty */
-	bat_packet->tq = (bat_packet->tq * (TQ_MAX_VALUE - hop_penalty)) / (TQ_MAX_VALUE);
-
-	debug_output(4, "forwarding: tq_orig: %i, tq_avg: %i, tq_forw: %i, ttl_orig: %i, ttl_forw: %i \n", in->tq, tq_avg, bat_packet->tq, in->ttl - 1, bat_packet->ttl);
-
-	/* change sequence number to network order */
-	bat_packet->seqno = htons(bat_packet->seqno);
-
-	if (directlink)
-		bat_packet->flags |= DIRECTLINK;
-	else
-		bat_packet->flags &= ~DIRECTLINK;
-
-
-	/* if the packet was not aggregated */
-	if (forw_node_aggregate == NULL) {
-
-		/* if the packet should go somewhere in the queue */
-		if (forw_node_pos != NULL)
-			list_add_before(prev_list_head, list_pos, &forw_node_new->list);
-		/* if the packet is the last packet in the queue */
-		else
-			list_add_tail(&forw_node_new->list, &forw_list);
-
-	}
-
 	prof_stop(PROF_schedule_forward_packet);
 }
 
@@ -275,25 +560,30 @@ void send_outstanding_packets(uint32_t curr_time)
 {
 	struct forw_node *forw_node;
 	struct list_head *forw_pos, *if_pos, *temp;
+	struct list_head_first due_list;
 	struct batman_if *batman_if;
 	struct bat_packet *bat_packet;
 	char orig_str[ADDR_STR_LEN];
-	uint8_t directlink, curr_packet_num;
+	uint8_t directlink, curr_packet_num, debug_forw;
 	int16_t curr_packet_len;
 
 	prof_start(PROF_send_outstanding_packets);
 
+	INIT_LIST_HEAD_FIRST(due_list);
+	forw_wheel_collect(curr_time, &due_list);
 
-	list_for_each_safe(forw_pos, temp, &forw_list) {
+	/* the originator string is only needed for the debug output */
+	debug_forw = (debug_clients.clients_num[3] > 0);
+	orig_str[0] = '\0';
 
-		forw_node = list_entry(forw_pos, struct forw_node, list);
+	list_for_each_safe(forw_pos, temp, &due_list) {
 
-		if ((int)(curr_time - forw_node->send_time) < 0)
-			break;
+		forw_node = list_entry(forw_pos, struct forw_node, list);
 
 		bat_packet = (struct bat_packet *)forw_node->pack_buff;
 
-		addr_to_string(bat_packet->orig, orig_str, ADDR_STR_LEN);
+		if (debug_forw)
+			addr_to_string(bat_packet->orig, orig_str, ADDR_STR_LEN);
 
 		directlink = (bat_packet->flags & DIRECTLINK ? 1 : 0);
 
@@ -311,6 +601,8 @@ void send_outstanding_packets(uint32_t curr_time)
 
 			if (send_udp_packet(forw_node->pack_buff, forw_node->pack_buff_len, &forw_node->if_incoming->broad, forw_node->if_incoming->udp_send_sock, forw_node->if_incoming) < 0)
 					deactivate_interface(forw_node->if_incoming);
+			else
+				prof_count(PROF_send_outstanding_packets, 1, forw_node->pack_buff_len);
 
 			goto packet_free;
 
@@ -332,10 +624,14 @@ void send_outstanding_packets(uint32_t curr_time)
 				else
 					bat_packet->flags &= ~DIRECTLINK;
 
-				if (curr_packet_num > 0)
-					addr_to_string(bat_packet->orig, orig_str, ADDR_STR_LEN);
+				if (debug_forw) {
 
-				debug_output(4, "%s %spacket (originator %s, seqno %d, TQ %d, TTL %d, IDF %s) on interface %s\n", (curr_packet_num > 0 ? "Forwarding" : (forw_node->own ? "Sending own" : "Forwarding")), (curr_packet_num > 0 ? "aggregated " : ""), orig_str, ntohs(bat_packet->seqno), bat_packet->tq, bat_packet->ttl, (bat_packet->flags & DIRECTLINK ? "on" : "off"), batman_if->dev);
+					if (curr_packet_num > 0)
+						addr_to_string(bat_packet->orig, orig_str, ADDR_STR_LEN);
+
+					debug_output(4, "%s %spacket (originator %s, seqno %d, TQ %d, TTL %d, IDF %s) on interface %s\n", (curr_packet_num > 0 ? "Forwarding" : (forw_node->own ? "Sending own" : "Forwarding")), (curr_packet_num > 0 ? "aggregated " : ""), orig_str, ntohs(bat_packet->seqno), bat_packet->tq, bat_packet->ttl, (bat_packet->flags & DIRECTLINK ? "on" : "off"), batman_if->dev);
+
+				}
 
 				curr_packet_len += sizeof(struct bat_packet) + bat_packet->hna_len * 5;
 				curr_packet_num++;
@@ -345,16 +641,16 @@ void send_outstanding_packets(uint32_t curr_time)
 
 			if (send_udp_packet(forw_node->pack_buff, forw_node->pack_buff_len, &batman_if->broad, batman_if->udp_send_sock, batman_if) < 0)
 				deactivate_interface(batman_if);
+			else
+				prof_count(PROF_send_outstanding_packets, 1, forw_node->pack_buff_len);
 
 		}
 
-packet_free:	list_del((struct list_head *)&forw_list, forw_pos, &forw_list);
-
+packet_free:
 		if (forw_node->own)
 			schedule_own_packet(forw_node->if_incoming);
 
-		debugFree(forw_node->pack_buff, 1501);
-		debugFree(forw_node, 1502);
+		forw_node_put(forw_node);
 
 	}
 
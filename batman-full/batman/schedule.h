@@ -20,6 +20,11 @@
  */
 
 
+void schedule_init(void);
+void schedule_free(void);
+uint32_t get_forw_send_time(uint32_t curr_time);
+void debug_forw_list(void);
 void schedule_own_packet( struct batman_if *batman_if );
-void schedule_forward_packet(struct orig_node *orig_node, struct bat_packet *in, uint32_t neigh, uint8_t directlink, int16_t hna_buff_len, struct batman_if *if_outgoing, uint32_t curr_time);
+uint8_t prepare_forward_packet(struct orig_node *orig_node, struct bat_packet *in, uint32_t neigh, uint8_t directlink);
+void schedule_forward_packet(struct bat_packet *in, uint8_t directlink, int16_t hna_buff_len, struct batman_if *if_outgoing, uint32_t curr_time);
 void send_outstanding_packets(uint32_t curr_time);
@@ -24,11 +24,17 @@
 
 #include "packet.h"
 
+struct seq_window {               /* sliding window of received sequence numbers - see bitarray.c */
+	TYPE_OF_WORD bits[TQ_LOCAL_WINDOW_SIZE / WORD_BIT_SIZE];
+	uint8_t head;                 /* bit of the newest sequence number, the older ones follow downwards */
+	uint8_t count;                /* number of bits set in the window */
+};
+
 struct orig_node {                /* structure for orig_list maintaining nodes of mesh */
 	uint32_t orig;
 	struct neigh_node *router;
 	struct batman_if *batman_if;
-	TYPE_OF_WORD *bcast_own;
+	struct seq_window *bcast_own;
 	uint8_t *bcast_own_sum;
 	uint8_t tq_own;
 	int tq_asym_penalty;
@@ -50,16 +56,16 @@ struct neigh_node {
 	uint8_t tq_avg;
 	uint8_t last_ttl;
 	uint32_t last_valid;            /* when last packet via this neighbour was received */
-	TYPE_OF_WORD *real_bits;
+	struct seq_window real_bits;
 	struct orig_node *orig_node;
 	struct batman_if *if_incoming;
 };
 
-struct forw_node {                /* structure for forw_list maintaining packets to be send/forwarded */
+struct forw_node {                /* structure for the forward queue maintaining packets to be send/forwarded */
 	struct list_head list;
 	uint32_t send_time;
 	uint8_t  own;
-	unsigned char *pack_buff;
+	unsigned char pack_buff[MAX_AGGREGATION_BYTES];
 	uint16_t  pack_buff_len;
 	uint32_t direct_link_flags;
 	uint8_t num_packets;
@@ -93,6 +99,8 @@ struct batman_if {
 	uint8_t netmask;
 	uint8_t wifi_if;
 	struct bat_packet out;
+	struct forw_node *forw_own;   /* our next packet on this interface */
+	struct forw_node *forw_aggr;  /* last packet queued for this interface - may take more packets */
 };
 
 struct gw_client {
@@ -113,6 +121,13 @@ struct vis_if {
 	struct sockaddr_in addr;
 };
 
+struct recv_packet {              /* one received datagram - see receive_packets() */
+	unsigned char buff[RECV_PACKET_SIZE];
+	int16_t len;
+	uint32_t neigh;
+	struct batman_if *if_incoming;
+};
+
 struct unix_if {
 	int32_t unix_sock;
 	pthread_t listen_thread_id;